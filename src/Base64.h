@@ -27,13 +27,611 @@
 #include <tchar.h>
 #include <string>
 #include <vector>
+#include <stdexcept>
+#include <string.h>
 
 #define _JTI_NO_LINK_RECORD
 #include <JTIUtils.h>
 #undef _JTI_NO_LINK_RECORD
 
+// The SSSE3 kernels need the intrinsics shipped with VS2008 and later; 
+// earlier compilers (or JTI_BASE64_NO_SIMD) get the table-driven kernels.
+#if !defined(JTI_BASE64_NO_SIMD) && defined(_MSC_VER) && (_MSC_VER >= 1500) && (defined(_M_IX86) || defined(_M_X64))
+#define JTI_BASE64_SSSE3
+#endif
+
+#ifdef JTI_BASE64_SSSE3
+#include <intrin.h>
+#include <tmmintrin.h>
+#endif
+
 namespace JTI_Util
 {
+/******************************************************************************/
+// Base64Variant
+//
+// The encodings supported by the Base64 classes.
+//
+/******************************************************************************/
+namespace Base64Variant
+{
+	enum Types {
+		Standard = 0,	// RFC 4648 section 4, padded
+		UrlSafe = 1,	// RFC 4648 section 5 ('-' and '_'), unpadded
+		Mime = 2		// RFC 2045, padded with CRLF after every 76 characters
+	};
+}
+
+namespace JTI_Internal
+{
+/******************************************************************************/
+// Base64Kernels
+//
+// These are the block encoders/decoders used by the Base64 class.  The 
+// table-driven kernels handle any length; the SSSE3 kernels handle the
+// bulk of large buffers 16 characters at a time and are selected at 
+// runtime through CPUID.  The alphabet is passed in so the same kernels
+// serve every Base64 variant.
+//
+/******************************************************************************/
+struct Base64Kernels
+{
+	enum { INVALID = 0xff, MIME_LINE_LENGTH = 76 };
+
+	// Everything the kernels need to know about a variant.
+	struct Format
+	{
+		const char* Alphabet;
+		const unsigned char* DecodeTable;
+		bool Pad;
+		size_t LineLength;	// 0 = no line breaks; otherwise a multiple of 4
+	};
+
+	static Format GetFormat(Base64Variant::Types variant)
+	{
+		Format fmt = { StdAlphabet(), StdDecodeTable(), true, 0 };
+		if (variant == Base64Variant::UrlSafe)
+		{
+			fmt.Alphabet = UrlAlphabet();
+			fmt.DecodeTable = UrlDecodeTable();
+			fmt.Pad = false;
+		}
+		else if (variant == Base64Variant::Mime)
+			fmt.LineLength = MIME_LINE_LENGTH;
+		return fmt;
+	}
+
+	// Standard (RFC 4648 section 4) alphabet
+	static const char* StdAlphabet() 
+	{
+		return "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	}
+
+	// Reverse lookup table for the standard alphabet.  The tables are 
+	// constant initialized so no thread ever sees one partly built.
+	static const unsigned char* StdDecodeTable()
+	{
+		static const unsigned char table[256] = {
+			0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+			0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+			0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+			0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+			0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+			0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+			0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+			0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+			0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+			0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+			0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+			0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+			0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+			0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+			0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+			0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+		};
+		return table;
+	}
+
+	// URL and filename safe (RFC 4648 section 5) alphabet
+	static const char* UrlAlphabet() 
+	{
+		return "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+	}
+
+	// Reverse lookup table for the URL-safe alphabet.
+	static const unsigned char* UrlDecodeTable()
+	{
+		static const unsigned char table[256] = {
+			0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+			0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+			0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff,
+			0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+			0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+			0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0x3f,
+			0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+			0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+			0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+			0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+			0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+			0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+			0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+			0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+			0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+			0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+		};
+		return table;
+	}
+
+	// Characters skipped between groups (e.g. MIME line breaks).
+	static bool IsWhitespace(unsigned char ch)
+	{
+		return (ch == '\r' || ch == '\n' || ch == ' ' || ch == '\t');
+	}
+
+	// Returns true if the processor supports SSSE3; tested once.
+	static bool HasSsse3()
+	{
+#ifdef JTI_BASE64_SSSE3
+		static volatile long hasSsse3 = -1;
+		if (hasSsse3 < 0)
+		{
+			int cpuInfo[4];
+			__cpuid(cpuInfo, 1);
+			::InterlockedExchange(&hasSsse3, ((cpuInfo[2] & (1 << 9)) != 0) ? 1 : 0);
+		}
+		return (hasSsse3 != 0);
+#else
+		return false;
+#endif
+	}
+
+	// Encodes all the input; returns the count of characters written.
+	static size_t Encode(const unsigned char* in, size_t length, char* out, const char* alphabet, bool fPad)
+	{
+		char* o = out;
+#ifdef JTI_BASE64_SSSE3
+		if (length >= 16 && HasSsse3())
+		{
+			size_t nDone = EncodeSsse3(in, length, o, alphabet[62], alphabet[63]);
+			in += nDone; length -= nDone; o += (nDone / 3) * 4;
+		}
+#endif
+		// 3 bytes encode to 4 characters.
+		for (; length >= 3; length -= 3, in += 3, o += 4)
+		{
+			unsigned int val = (static_cast<unsigned int>(in[0]) << 16) | (static_cast<unsigned int>(in[1]) << 8) | in[2];
+			o[0] = alphabet[val >> 18];
+			o[1] = alphabet[(val >> 12) & 0x3f];
+			o[2] = alphabet[(val >> 6) & 0x3f];
+			o[3] = alphabet[val & 0x3f];
+		}
+
+		// The final 1 or 2 bytes
+		if (length > 0)
+		{
+			unsigned int val = static_cast<unsigned int>(in[0]) << 16;
+			if (length > 1)
+				val |= static_cast<unsigned int>(in[1]) << 8;
+			*o++ = alphabet[val >> 18];
+			*o++ = alphabet[(val >> 12) & 0x3f];
+			if (length > 1)
+				*o++ = alphabet[(val >> 6) & 0x3f];
+			else if (fPad)
+				*o++ = '=';
+			if (fPad)
+				*o++ = '=';
+		}
+		return static_cast<size_t>(o - out);
+	}
+
+	// Encodes all the input, inserting CRLF each time a line fills up.  The
+	// break is written before the next character rather than after the last
+	// so the output never ends with one; column carries the position across
+	// calls.  Returns the count of characters written.
+	static size_t EncodeLines(const unsigned char* in, size_t length, char* out, const Format& fmt, size_t& column)
+	{
+		if (fmt.LineLength == 0)
+			return Encode(in, length, out, fmt.Alphabet, fmt.Pad);
+
+		char* o = out;
+		while (length > 0)
+		{
+			if (column >= fmt.LineLength)
+			{
+				*o++ = '\r'; *o++ = '\n';
+				column = 0;
+			}
+
+			// Encode whatever fits on the rest of this line in one pass.
+			size_t nBytes = ((fmt.LineLength - column) / 4) * 3;
+			if (nBytes > length)
+				nBytes = length;
+			size_t nCount = Encode(in, nBytes, o, fmt.Alphabet, fmt.Pad);
+			o += nCount; column += nCount;
+			in += nBytes; length -= nBytes;
+		}
+		return static_cast<size_t>(o - out);
+	}
+
+	// Returns the number of characters produced by EncodeLines for the given
+	// number of bytes starting at column 0.
+	static size_t EncodedLength(size_t length, const Format& fmt)
+	{
+		size_t nChars = (fmt.Pad) ? ((length + 2) / 3) * 4 : (length / 3) * 4 + ((length % 3) ? (length % 3) + 1 : 0);
+		if (fmt.LineLength > 0 && nChars > 0)
+			nChars += ((nChars - 1) / fmt.LineLength) * 2;
+		return nChars;
+	}
+
+	// Decodes characters using the given format.  Unless the format pads, a 
+	// final group of 2 or 3 characters without padding is accepted.
+	static bool Decode(const unsigned char* in, size_t length, unsigned char* out, size_t& outLength, const Format& fmt)
+	{
+		const char ch62 = fmt.Alphabet[62], ch63 = fmt.Alphabet[63];
+		size_t nTail = length % 4;
+		if (nTail == 0)
+			return Decode(in, length, out, outLength, fmt.DecodeTable, ch62, ch63);
+
+		// An unpadded tail; the groups before it must not be padded either.
+		outLength = 0;
+		size_t nBody = length - nTail;
+		if (fmt.Pad || nTail == 1 || memchr(in + nBody, '=', nTail) != NULL || (nBody > 0 && in[nBody-1] == '='))
+			return false;
+		unsigned char last[4] = { '=', '=', '=', '=' };
+		memcpy(last, in + nBody, nTail);
+
+		size_t nBodyOut = 0, nTailOut = 0;
+		if (!Decode(in, nBody, out, nBodyOut, fmt.DecodeTable, ch62, ch63) ||
+			!Decode(last, 4, out + nBodyOut, nTailOut, fmt.DecodeTable, ch62, ch63))
+			return false;
+		outLength = nBodyOut + nTailOut;
+		return true;
+	}
+
+	// Decodes complete groups of four characters; the final group may be
+	// padded.  Returns false on any character outside the alphabet or
+	// misplaced padding.
+	static bool Decode(const unsigned char* in, size_t length, unsigned char* out, size_t& outLength, const unsigned char* table, char ch62, char ch63)
+	{
+		unsigned char* o = out;
+		outLength = 0;
+		if ((length % 4) != 0)
+			return false;
+		if (length == 0)
+			return true;
+
+		// Everything except the last group never contains padding.
+		size_t nBody = length - 4;
+#ifdef JTI_BASE64_SSSE3
+		if (nBody >= 16 && HasSsse3())
+		{
+			size_t nDone = DecodeSsse3(in, nBody, o, ch62, ch63);
+			in += nDone; nBody -= nDone; o += (nDone / 4) * 3;
+		}
+#else
+		ch62; ch63;
+#endif
+		for (; nBody > 0; nBody -= 4, in += 4, o += 3)
+		{
+			unsigned int a = table[in[0]], b = table[in[1]], c = table[in[2]], d = table[in[3]];
+			if (((a | b | c | d) & 0x80) != 0)
+				return false;
+			unsigned int val = (a << 18) | (b << 12) | (c << 6) | d;
+			o[0] = static_cast<unsigned char>(val >> 16);
+			o[1] = static_cast<unsigned char>(val >> 8);
+			o[2] = static_cast<unsigned char>(val);
+		}
+
+		// Final group with optional padding.
+		unsigned int a = table[in[0]], b = table[in[1]];
+		if (((a | b) & 0x80) != 0)
+			return false;
+		unsigned int val = (a << 18) | (b << 12);
+		*o++ = static_cast<unsigned char>(val >> 16);
+		if (in[3] == '=')
+		{
+			if (in[2] != '=')
+			{
+				unsigned int c = table[in[2]];
+				if ((c & 0x80) != 0)
+					return false;
+				val |= (c << 6);
+				*o++ = static_cast<unsigned char>(val >> 8);
+			}
+		}
+		else
+		{
+			unsigned int c = table[in[2]], d = table[in[3]];
+			if (((c | d) & 0x80) != 0)
+				return false;
+			val |= (c << 6) | d;
+			*o++ = static_cast<unsigned char>(val >> 8);
+			*o++ = static_cast<unsigned char>(val);
+		}
+
+		outLength = static_cast<size_t>(o - out);
+		return true;
+	}
+
+#ifdef JTI_BASE64_SSSE3
+	// Encodes 12 bytes to 16 characters per pass (reading 16 bytes); returns
+	// the count of input bytes consumed, always a multiple of 12.
+	static size_t EncodeSsse3(const unsigned char* in, size_t length, char* out, char ch62, char ch63)
+	{
+		const __m128i shuf = _mm_set_epi8(10,11,9,10, 7,8,6,7, 4,5,3,4, 1,2,0,1);
+		const __m128i maskAC = _mm_set1_epi32(0x0fc0fc00);
+		const __m128i multAC = _mm_set1_epi32(0x04000040);
+		const __m128i maskBD = _mm_set1_epi32(0x003f03f0);
+		const __m128i multBD = _mm_set1_epi32(0x01000010);
+		const __m128i lut = _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, 
+			static_cast<char>(ch62 - 62), static_cast<char>(ch63 - 63), 0, 0);
+		const __m128i n51 = _mm_set1_epi8(51);
+		const __m128i n25 = _mm_set1_epi8(25);
+
+		size_t nDone = 0;
+		for (; length - nDone >= 16; nDone += 12, out += 16)
+		{
+			// Split each 3 bytes into four 6-bit values, one per byte.
+			__m128i v = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + nDone)), shuf);
+			__m128i t0 = _mm_mulhi_epu16(_mm_and_si128(v, maskAC), multAC);
+			__m128i t1 = _mm_mullo_epi16(_mm_and_si128(v, maskBD), multBD);
+			v = _mm_or_si128(t0, t1);
+
+			// Map 0-63 onto the alphabet by range offsets.
+			__m128i idx = _mm_subs_epu8(v, n51);
+			idx = _mm_sub_epi8(idx, _mm_cmpgt_epi8(v, n25));
+			v = _mm_add_epi8(v, _mm_shuffle_epi8(lut, idx));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), v);
+		}
+		return nDone;
+	}
+
+	// Decodes 16 characters to 12 bytes per pass; returns the count of
+	// characters consumed (a multiple of 16).  Stops at the first block
+	// holding a character outside the alphabet so the table-driven decoder
+	// can report it.
+	static size_t DecodeSsse3(const unsigned char* in, size_t length, unsigned char* out, char ch62, char ch63)
+	{
+		const __m128i belowA = _mm_set1_epi8('A'-1), aboveZ = _mm_set1_epi8('Z'+1);
+		const __m128i belowa = _mm_set1_epi8('a'-1), abovez = _mm_set1_epi8('z'+1);
+		const __m128i below0 = _mm_set1_epi8('0'-1), above9 = _mm_set1_epi8('9'+1);
+		const __m128i c62 = _mm_set1_epi8(ch62), c63 = _mm_set1_epi8(ch63);
+		const __m128i offUpper = _mm_set1_epi8(-65), offLower = _mm_set1_epi8(-71), offDigit = _mm_set1_epi8(4);
+		const __m128i off62 = _mm_set1_epi8(static_cast<char>(62 - ch62)), off63 = _mm_set1_epi8(static_cast<char>(63 - ch63));
+		const __m128i mergeAB = _mm_set1_epi32(0x01400140);
+		const __m128i mergeABC = _mm_set1_epi32(0x00011000);
+		const __m128i pack = _mm_setr_epi8(2,1,0, 6,5,4, 10,9,8, 14,13,12, -1,-1,-1,-1);
+
+		size_t nDone = 0;
+		for (; length - nDone >= 16; nDone += 16, out += 12)
+		{
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + nDone));
+
+			// Classify each character; bytes >= 0x80 compare as negative and match nothing.
+			__m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, belowA), _mm_cmplt_epi8(v, aboveZ));
+			__m128i lower = _mm_and_si128(_mm_cmpgt_epi8(v, belowa), _mm_cmplt_epi8(v, abovez));
+			__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, below0), _mm_cmplt_epi8(v, above9));
+			__m128i is62 = _mm_cmpeq_epi8(v, c62);
+			__m128i is63 = _mm_cmpeq_epi8(v, c63);
+			__m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, _mm_or_si128(is62, is63)));
+			if (_mm_movemask_epi8(valid) != 0xffff)
+				break;
+
+			// Translate to 6-bit values.
+			__m128i delta = _mm_or_si128(
+				_mm_or_si128(_mm_and_si128(upper, offUpper), _mm_and_si128(lower, offLower)),
+				_mm_or_si128(_mm_and_si128(digit, offDigit), 
+					_mm_or_si128(_mm_and_si128(is62, off62), _mm_and_si128(is63, off63))));
+			v = _mm_add_epi8(v, delta);
+
+			// Pack four 6-bit values into each 3 bytes and store 12 bytes.
+			v = _mm_madd_epi16(_mm_maddubs_epi16(v, mergeAB), mergeABC);
+			v = _mm_shuffle_epi8(v, pack);
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(out), v);
+			*reinterpret_cast<int*>(out + 8) = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+		}
+		return nDone;
+	}
+#endif // JTI_BASE64_SSSE3
+};
+} // namespace JTI_Internal
+
+/******************************************************************************/
+// Base64Encoder
+//
+// This is an incremental encoder.  Data is pushed in arbitrary chunks and
+// the characters are written to caller-supplied storage; up to two bytes 
+// are held back between calls until Finish() completes the final group.
+//
+/******************************************************************************/
+class Base64Encoder
+{
+// Constructor
+public:
+	explicit Base64Encoder(Base64Variant::Types variant = Base64Variant::Standard) : 
+		format_(JTI_Internal::Base64Kernels::GetFormat(variant)), pendingCount_(0), column_(0) {/* */}
+
+// Properties
+public:
+	// MaxPushLength - Returns the storage required for a Push() of the given 
+	// number of bytes.
+	size_t MaxPushLength(size_t length) const 
+	{ 
+		size_t nChars = ((length + 2) / 3) * 4;
+		if (format_.LineLength > 0)
+			nChars += (nChars / format_.LineLength + 1) * 2;
+		return nChars;
+	}
+	// MaxFinishLength - Returns the storage required for Finish().
+	static size_t MaxFinishLength() { return 6; }
+
+// Methods
+public:
+	// Push - Encodes the next chunk of data into out, which must hold
+	// MaxPushLength(length) characters.  Returns the count written.
+	size_t Push(const void* inData, size_t length, char* out)
+	{
+		const unsigned char* in = static_cast<const unsigned char*>(inData);
+		char* o = out;
+
+		// Complete a group started by the previous call.
+		if (pendingCount_ > 0)
+		{
+			for (; pendingCount_ < 3 && length > 0; --length)
+				pending_[pendingCount_++] = *in++;
+			if (pendingCount_ < 3)
+				return 0;
+			o += JTI_Internal::Base64Kernels::EncodeLines(pending_, 3, o, format_, column_);
+			pendingCount_ = 0;
+		}
+
+		size_t nWhole = length - (length % 3);
+		o += JTI_Internal::Base64Kernels::EncodeLines(in, nWhole, o, format_, column_);
+		for (in += nWhole, length -= nWhole; length > 0; --length)
+			pending_[pendingCount_++] = *in++;
+		return static_cast<size_t>(o - out);
+	}
+
+	// Finish - Writes the final group into out, which must hold
+	// MaxFinishLength() characters, and resets the encoder.
+	size_t Finish(char* out)
+	{
+		size_t nCount = JTI_Internal::Base64Kernels::EncodeLines(pending_, pendingCount_, out, format_, column_);
+		Reset();
+		return nCount;
+	}
+
+	// Reset - Discards any pending data.
+	void Reset() { pendingCount_ = 0; column_ = 0; }
+
+// Class data
+private:
+	JTI_Internal::Base64Kernels::Format format_;
+	unsigned char pending_[3];
+	size_t pendingCount_;
+	size_t column_;
+};
+
+/******************************************************************************/
+// Base64Decoder
+//
+// This is an incremental decoder.  Characters are pushed in arbitrary 
+// chunks (groups may span calls, whitespace is skipped) and the bytes are 
+// written to caller-supplied storage.  Once a padded group is seen only 
+// whitespace may follow.
+//
+/******************************************************************************/
+class Base64Decoder
+{
+// Constructor
+public:
+	explicit Base64Decoder(Base64Variant::Types variant = Base64Variant::Standard) : 
+		format_(JTI_Internal::Base64Kernels::GetFormat(variant)), pendingCount_(0), fDone_(false), fError_(false) {/* */}
+
+// Properties
+public:
+	// MaxPushLength - Returns the storage required for a Push() of the given 
+	// number of characters.
+	static size_t MaxPushLength(size_t length) { return ((length + 3) / 4) * 3; }
+	// MaxFinishLength - Returns the storage required for Finish().
+	static size_t MaxFinishLength() { return 2; }
+	// IsFailed - Returns true once invalid data has been pushed.
+	bool IsFailed() const { return fError_; }
+
+// Methods
+public:
+	// Push - Decodes the next chunk of characters into out, which must hold
+	// MaxPushLength(length) bytes; outLength receives the count written.
+	// Returns false if the data is not valid Base64.
+	bool Push(const char* inData, size_t length, unsigned char* out, size_t& outLength)
+	{
+		const unsigned char* in = reinterpret_cast<const unsigned char*>(inData);
+		const unsigned char* end = in + length;
+		unsigned char* o = out;
+		outLength = 0;
+
+		while (in < end && !fError_)
+		{
+			if (JTI_Internal::Base64Kernels::IsWhitespace(*in))
+			{
+				++in;
+				continue;
+			}
+			if (fDone_)
+			{
+				fError_ = true;
+				break;
+			}
+
+			// Complete a group started by an earlier chunk or split by whitespace.
+			if (pendingCount_ > 0)
+			{
+				pending_[pendingCount_++] = *in++;
+				if (pendingCount_ == 4)
+				{
+					pendingCount_ = 0;
+					DecodeGroups(pending_, 4, o);
+				}
+				continue;
+			}
+
+			// Decode the whole groups of this run of characters in place.
+			const unsigned char* run = in;
+			while (in < end && !JTI_Internal::Base64Kernels::IsWhitespace(*in))
+				++in;
+			size_t nWhole = static_cast<size_t>(in - run) & ~static_cast<size_t>(3);
+			if (nWhole > 0)
+				DecodeGroups(run, nWhole, o);
+			if (fDone_ && run + nWhole < in)
+				fError_ = true;
+			for (run += nWhole; run < in && !fError_; )
+				pending_[pendingCount_++] = *run++;
+		}
+
+		outLength = static_cast<size_t>(o - out);
+		return !fError_;
+	}
+
+	// Finish - Returns true if everything pushed formed valid Base64 and 
+	// resets the decoder.  For unpadded variants the final partial group is
+	// decoded into out, which must hold MaxFinishLength() bytes.
+	bool Finish(unsigned char* out, size_t& outLength)
+	{
+		outLength = 0;
+		bool fValid = !fError_;
+		if (fValid && pendingCount_ > 0)
+			fValid = JTI_Internal::Base64Kernels::Decode(pending_, pendingCount_, out, outLength, format_);
+		Reset();
+		return fValid;
+	}
+
+	// Reset - Discards any pending data and error state.
+	void Reset() { pendingCount_ = 0; fDone_ = fError_ = false; }
+
+// Internal functions
+private:
+	void DecodeGroups(const unsigned char* in, size_t length, unsigned char*& o)
+	{
+		size_t nCount = 0;
+		if (!JTI_Internal::Base64Kernels::Decode(in, length, o, nCount, format_))
+		{
+			fError_ = true;
+			return;
+		}
+		o += nCount;
+		if (in[length-1] == '=')
+			fDone_ = true;
+	}
+
+// Class data
+private:
+	JTI_Internal::Base64Kernels::Format format_;
+	unsigned char pending_[4];
+	size_t pendingCount_;
+	bool fDone_;
+	bool fError_;
+};
+
 /******************************************************************************/
 // Base64
 //
@@ -48,135 +646,261 @@ public:
 
 // Implementation
 public:
+	// Constants
+	enum { STREAM_CHUNK = 0xc000 };	// 48K; a whole number of groups
+
 	// EncodeFile - This function takes a filename and returns a Base64 
-	// encoded buffer in a string.
-	static tstring EncodeFile(const TCHAR* pszFilename)
+	// encoded buffer in a string.  An empty string is returned if the file
+	// cannot be read or its encoding will not fit in memory.
+	static tstring EncodeFile(const TCHAR* pszFilename, Base64Variant::Types variant = Base64Variant::Standard)
 	{
-		// Open the file for read access.
+		tstring s;
 		HANDLE hFile = CreateFile(pszFilename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
-		if (hFile != INVALID_HANDLE_VALUE)
+		if (hFile == INVALID_HANDLE_VALUE)
+			return s;
+
+		LARGE_INTEGER liSize;
+		if (GetFileSizeEx(hFile, &liSize) && 
+			static_cast<ULONGLONG>(liSize.QuadPart) <= (static_cast<size_t>(-1) / 4) * 3 - 2)
 		{
-			// Get the file size, we assume the file is smaller than 4G
-			DWORD dwSize = GetFileSize(hFile, NULL);
+			size_t nSize = static_cast<size_t>(liSize.QuadPart);
+			s.reserve(EncodedLength(nSize, variant));
 
-			// Create a file mapping object; it increments the ref count on the original file so close
-			// it now to avoid resource leaks.
-			HANDLE hFileMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, dwSize, NULL);
-			CloseHandle(hFile);
-			if (hFileMap != NULL)
+			// Read the file in chunks, appending the characters as we go.
+			Base64Encoder encoder(variant);
+			std::vector<unsigned char> inBuff(STREAM_CHUNK);
+			std::vector<char> outBuff(encoder.MaxPushLength(STREAM_CHUNK));
+			DWORD dwRead = 0;
+			bool fOK = true;
+			while ((fOK = (ReadFile(hFile, &inBuff[0], STREAM_CHUNK, &dwRead, NULL) != FALSE)) && dwRead > 0)
 			{
-				// Map a view of the file; again close the handle we used.
-				LPVOID lpvFile = MapViewOfFile(hFileMap, FILE_MAP_READ, 0, 0, 0);
-				CloseHandle(hFileMap);
-				if (lpvFile != NULL)
-				{
-					// Encode and release the view on the file
-					tstring s = EncodeBuffer(lpvFile, dwSize);
-					UnmapViewOfFile(lpvFile);
-					return s;
-				}
+				size_t nCount = encoder.Push(&inBuff[0], dwRead, &outBuff[0]);
+				s.append(outBuff.begin(), outBuff.begin() + nCount);
 			}
+			if (fOK)
+			{
+				size_t nCount = encoder.Finish(&outBuff[0]);
+				s.append(outBuff.begin(), outBuff.begin() + nCount);
+			}
+			else
+				s.erase();
 		}
-		return tstring();
+		else
+			SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+
+		CloseHandle(hFile);
+		return s;
 	}
 
-	// EncodeBuffer - This function takes a buffer/length combination and returns
-	// a Base64 encoded buffer in a string.
-	static tstring EncodeBuffer(const void* in, size_t length)
-	{
-		const unsigned char* data = reinterpret_cast<const unsigned char*>(in);
-
-		// 3 unsigned chars encode to 4 chars.  Output is always an even
-		// multiple of 4 characters.
-		TCHAR* alphabet =	_T("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/=");
-		TCHAR out[5] = {0}; 
-		tstring s; 
-		
-		s.reserve(((length + 2) / 3) * 4);
-		for (size_t i = 0; i < length; i += 3)
-		{
-			bool quad = false, trip = false;
-			int val = (0xFF & (int) data[i]);
-			val <<= 8;
-			if ((i + 1) < length) 
-			{
-				val |= (0xFF & (int) data[i + 1]);
-				trip = true;
-			}
+	// EncodeFile - This encodes one file into another, holding only one 
+	// chunk of each in memory.  Returns false (with GetLastError() set) on 
+	// failure, in which case the target file is removed.
+	static bool EncodeFile(const TCHAR* pszSource, const TCHAR* pszTarget, Base64Variant::Types variant = Base64Variant::Standard)
+	{
+		return TransformFile(pszSource, pszTarget, &EncodeStream, variant);
+	}
 
-			val <<= 8;
-			if ((i + 2) < length) 
-			{
-				val |= (0xFF & (int) data[i + 2]);
-				quad = true;
-			}
-			
-			out[3] = alphabet[(quad ? (val & 0x3F) : 64)];
-			val >>= 6;
-			out[2] = alphabet[(trip ? (val & 0x3F) : 64)];
-			val >>= 6;
-			out[1] = alphabet[val & 0x3F];
-			val >>= 6;
-			out[0] = alphabet[val & 0x3F];
-			
-			s.append(out);
+	// DecodeFile - This decodes one file of Base64 characters into another,
+	// holding only one chunk of each in memory.  Invalid data fails with
+	// ERROR_INVALID_DATA and the target file is removed.
+	static bool DecodeFile(const TCHAR* pszSource, const TCHAR* pszTarget, Base64Variant::Types variant = Base64Variant::Standard)
+	{
+		return TransformFile(pszSource, pszTarget, &DecodeStream, variant);
+	}
+
+	// EncodeStream - This encodes from one open handle to another until the
+	// source reaches end of file.
+	static bool EncodeStream(HANDLE hSource, HANDLE hTarget, Base64Variant::Types variant = Base64Variant::Standard)
+	{
+		Base64Encoder encoder(variant);
+		std::vector<unsigned char> inBuff(STREAM_CHUNK);
+		std::vector<char> outBuff(encoder.MaxPushLength(STREAM_CHUNK));
+		DWORD dwRead = 0;
+		for (;;)
+		{
+			if (!ReadFile(hSource, &inBuff[0], STREAM_CHUNK, &dwRead, NULL))
+				return false;
+			size_t nCount = (dwRead > 0) ? encoder.Push(&inBuff[0], dwRead, &outBuff[0]) : encoder.Finish(&outBuff[0]);
+			if (!WriteAll(hTarget, &outBuff[0], nCount))
+				return false;
+			if (dwRead == 0)
+				return true;
 		}
-		return s;
 	}
 
-	static ByteArray DecodeString(const tstring& data)
+	// DecodeStream - This decodes from one open handle to another until the
+	// source reaches end of file.
+	static bool DecodeStream(HANDLE hSource, HANDLE hTarget, Base64Variant::Types variant = Base64Variant::Standard)
 	{
-		return DecodeBuffer(data.c_str(), data.size());
+		Base64Decoder decoder(variant);
+		std::vector<char> inBuff(STREAM_CHUNK);
+		std::vector<unsigned char> outBuff(Base64Decoder::MaxPushLength(STREAM_CHUNK));
+		DWORD dwRead = 0;
+		for (;;)
+		{
+			if (!ReadFile(hSource, &inBuff[0], STREAM_CHUNK, &dwRead, NULL))
+				return false;
+			if (dwRead == 0)
+				break;
+			size_t nCount = 0;
+			bool fValid = decoder.Push(&inBuff[0], dwRead, &outBuff[0], nCount);
+			if (!WriteAll(hTarget, &outBuff[0], nCount))
+				return false;
+			if (!fValid)
+				break;
+		}
+		size_t nCount = 0;
+		if (!decoder.Finish(&outBuff[0], nCount))
+		{
+			SetLastError(ERROR_INVALID_DATA);
+			return false;
+		}
+		return WriteAll(hTarget, &outBuff[0], nCount);
+	}
+
+	// EncodedLength - Returns the number of characters required to encode
+	// the given number of bytes.
+	static size_t EncodedLength(size_t length, Base64Variant::Types variant = Base64Variant::Standard)
+	{
+		return JTI_Internal::Base64Kernels::EncodedLength(length, JTI_Internal::Base64Kernels::GetFormat(variant));
+	}
+
+	// MaxDecodedLength - Returns the largest number of bytes the given number
+	// of characters may decode to.
+	static size_t MaxDecodedLength(size_t length)
+	{
+		return ((length + 3) / 4) * 3;
 	}
 
-	static ByteArray DecodeBuffer(const void* inData, size_t length)
+	// Encode - This encodes a buffer into caller-supplied storage of at least
+	// EncodedLength(length, variant) characters and returns the count written.
+	static size_t Encode(const void* in, size_t length, char* out, Base64Variant::Types variant = Base64Variant::Standard)
 	{
-		const unsigned char* data = static_cast<const unsigned char*>(inData);
-		unsigned char base64Decode_[256]; int i;
-		for (i = 0; i < 256; i++)
-			base64Decode_[i] = 0xff;
-		for (i = 'A'; i <= 'Z'; i++)
-			base64Decode_[i] = (unsigned char)(i - 'A');
-		for (i = 'a'; i <= 'z'; i++)
-			base64Decode_[i] = (unsigned char)(26 + i - 'a');
-		for (i = '0'; i <= '9'; i++)
-			base64Decode_[i] = (unsigned char)(52 + i - '0');
-		base64Decode_['+'] = 62;
-		base64Decode_['/'] = 63;
+		size_t column = 0;
+		return JTI_Internal::Base64Kernels::EncodeLines(reinterpret_cast<const unsigned char*>(in), 
+			length, out, JTI_Internal::Base64Kernels::GetFormat(variant), column);
+	}
 
-		size_t len = ((length + 3) / 4) * 3;
-		if (length > 0 && data[length - 1] == '=')
-			--len;
-		if (length > 1 && data[length - 2] == '=')
-			--len;
+	// Decode - This decodes characters into caller-supplied storage of at least
+	// MaxDecodedLength(length) bytes.  The input must not contain whitespace;
+	// false is returned for invalid input.
+	static bool Decode(const char* in, size_t length, unsigned char* out, size_t& outLength, Base64Variant::Types variant = Base64Variant::Standard)
+	{
+		return JTI_Internal::Base64Kernels::Decode(reinterpret_cast<const unsigned char*>(in), length, 
+			out, outLength, JTI_Internal::Base64Kernels::GetFormat(variant));
+	}
+
+	// EncodeBuffer - This function takes a buffer/length combination and returns
+	// a Base64 encoded buffer in a string.
+	static tstring EncodeBuffer(const void* in, size_t length, Base64Variant::Types variant = Base64Variant::Standard)
+	{
+		tstring s;
+		size_t nChars = EncodedLength(length, variant);
+		if (nChars > 0)
+		{
+#if defined(_UNICODE) || defined(UNICODE)
+			std::vector<char> buff(nChars);
+			Encode(in, length, &buff[0], variant);
+			s.assign(buff.begin(), buff.end());
+#else
+			s.resize(nChars);
+			Encode(in, length, &s[0], variant);
+#endif
+		}
+		return s;
+	}
 
-		ByteArray out; 
-		out.reserve(len);
+	static ByteArray DecodeString(const tstring& data, Base64Variant::Types variant = Base64Variant::Standard)
+	{
+#if defined(_UNICODE) || defined(UNICODE)
+		// Anything outside of 7-bit ASCII is invalid; map it to a non-code character.
+		std::string narrow(data.length(), '\x80');
+		for (size_t i = 0; i < data.length(); ++i)
+		{
+			if (data[i] < 0x80)
+				narrow[i] = static_cast<char>(data[i]);
+		}
+		return DecodeBuffer(narrow.c_str(), narrow.size(), variant);
+#else
+		return DecodeBuffer(data.c_str(), data.size(), variant);
+#endif
+	}
 
-		int shift = 0; // # of excess bits stored in accum
-		int accum = 0; // excess bits
+	// DecodeBuffer - This decodes a buffer of Base64 characters.  Line breaks
+	// and other whitespace are ignored; any other character outside of the
+	// alphabet throws a std::runtime_error.
+	static ByteArray DecodeBuffer(const void* inData, size_t length, Base64Variant::Types variant = Base64Variant::Standard)
+	{
+		const char* data = static_cast<const char*>(inData);
 
-		for (size_t ix = 0; ix < length; ++ix)
+		// Remove whitespace (e.g. MIME line breaks) only if there is any.
+		std::string compact;
+		for (size_t i = 0; i < length; ++i)
 		{
-			TCHAR ch = data[ix];
-			int value = base64Decode_[ch];	// ignore high byte of char
-			if (value >= 0)					// skip over non-code
+			if (IsWhitespace(data[i]))
 			{
-				accum <<= 6;				// bits shift up by 6 each time through
-				shift += 6;					// loop, with new bits being put in
-				accum |= value;				// at the bottom.
-				if (shift >= 8)				// whenever there are 8 or more shifted in,
-				{ 
-					shift -= 8;				// write them out (from the top, leaving any
-					unsigned char ch = static_cast<unsigned char>((accum >> shift) & 0xff);
-					out.push_back(ch);		// excess at the bottom for next iteration.
+				compact.reserve(length);
+				compact.assign(data, i);
+				for (++i; i < length; ++i)
+				{
+					if (!IsWhitespace(data[i]))
+						compact += data[i];
 				}
+				data = compact.c_str();
+				length = compact.length();
+				break;
 			}
 		}
+
+		ByteArray out(MaxDecodedLength(length));
+		size_t outLength = 0;
+		if (length > 0 && !Decode(data, length, &out[0], outLength, variant))
+			throw std::runtime_error("Invalid Base64 data");
+		out.resize(outLength);
 		return out;
 	}
+
+// Internal functions
+private:
+	static bool IsWhitespace(char ch)
+	{
+		return JTI_Internal::Base64Kernels::IsWhitespace(static_cast<unsigned char>(ch));
+	}
+
+	static bool WriteAll(HANDLE hFile, const void* pData, size_t length)
+	{
+		DWORD dwWritten = 0;
+		return (length == 0 || (WriteFile(hFile, pData, static_cast<DWORD>(length), &dwWritten, NULL) && dwWritten == length));
+	}
+
+	static bool TransformFile(const TCHAR* pszSource, const TCHAR* pszTarget, 
+		bool (*pfnTransform)(HANDLE, HANDLE, Base64Variant::Types), Base64Variant::Types variant)
+	{
+		HANDLE hSource = CreateFile(pszSource, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (hSource == INVALID_HANDLE_VALUE)
+			return false;
+		HANDLE hTarget = CreateFile(pszTarget, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (hTarget == INVALID_HANDLE_VALUE)
+		{
+			DWORD dwError = GetLastError();
+			CloseHandle(hSource);
+			SetLastError(dwError);
+			return false;
+		}
+
+		bool fOK = pfnTransform(hSource, hTarget, variant);
+		DWORD dwError = GetLastError();
+		CloseHandle(hSource);
+		CloseHandle(hTarget);
+		if (!fOK)
+		{
+			DeleteFile(pszTarget);
+			SetLastError(dwError);
+		}
+		return fOK;
+	}
 };
 
 } // namespace JTI_Util
 
-#endif // __JTI_BASE64_H_INCLUDED_
\ No newline at end of file
+#endif // __JTI_BASE64_H_INCLUDED_
\ No newline at end of file
@@ -8,7 +8,9 @@
 //
 // The logger will write to the file of basename_yyyymmdd.log until the
 // date changes.  Once that happens, the file is closed and the logger will
-// move to te next filename.
+// move to te next filename.  Files may also be rolled on size and on a
+// fixed interval; rolled files are compressed and pruned on a background
+// thread so the writer never waits on them.
 //
 // Copyright (C) 1997-2004 JulMar Technology, Inc.   All rights reserved
 // This is private property of JulMar Technology, Inc.  It may not be
@@ -29,8 +31,8 @@
 #include <io.h>
 #include <process.h>
 #include <direct.h>
-#undef max
-#include <limits>
+#include <winioctl.h>
+#include <algorithm>
 
 using namespace JTI_Util;
 
@@ -38,8 +40,9 @@ using namespace JTI_Util;
 	LINT OPTIONS
 -----------------------------------------------------------------------------*/
 //lint --e{1924}  allow C-style casts
-//lint -esym(534, CloseHandle, MoveFileA, SetEndOfFile, WaitForSingleObject)
+//lint -esym(534, CloseHandle, MoveFileA, SetEndOfFile, WaitForSingleObject, DeleteFileA)
 //lint -esym(1740, FileEventLogger::logFile_, FileEventLogger::threadHandle_, FileEventLogger::RenameFile)
+//lint -esym(1740, FileEventLogger::rollThreadHandle_)
 
 /*****************************************************************************
 ** Procedure:  FileEventLogger::FileEventLogger
@@ -52,10 +55,12 @@ using namespace JTI_Util;
 **
 /****************************************************************************/
 FileEventLogger::FileEventLogger() : LockableObject<MultiThreadModel>(),
-	isStopping_(false,true), hasData_(false,true),  qData_(), dayOfWeek_(99), 
-	logFile_(INVALID_HANDLE_VALUE), threadHandle_(INVALID_HANDLE_VALUE),
-	dirName_(""), baseName_(""), renName_(""), currName_(""), maxSize_(0), fileIndex_(0),
-	truncateExisting_(false)
+	isStopping_(false,true), hasData_(false,true), hasRolledFiles_(false,true), activeBuffer_(NULL), 
+	fullBuffers_(), freeBuffers_(), dayOfWeek_(99), logFile_(INVALID_HANDLE_VALUE), 
+	threadHandle_(INVALID_HANDLE_VALUE), rollThreadHandle_(INVALID_HANDLE_VALUE), rolledFiles_(), 
+	keptFiles_(), codec_(NULL), dirName_(""), baseName_(""), renName_(""), currName_(""), maxSize_(0), 
+	bufferSize_(DEFAULT_BUFFER_SIZE), fileOffset_(0), rollMinutes_(0), rollPeriod_(0), maxFiles_(0), 
+	fileIndex_(0), truncateExisting_(false)
 {
 }// FileEventLogger::FileEventLogger 
 
@@ -73,6 +78,19 @@ FileEventLogger::~FileEventLogger()
 { 
 	Stop();
 
+	// Release any buffers which were never written
+	DeleteBuffer(activeBuffer_);
+	activeBuffer_ = NULL;
+	for (LogBufferList::iterator it = fullBuffers_.begin(); it != fullBuffers_.end(); ++it)
+		DeleteBuffer(*it);
+	fullBuffers_.clear();
+	for (LogBufferList::iterator it = freeBuffers_.begin(); it != freeBuffers_.end(); ++it)
+		DeleteBuffer(*it);
+	freeBuffers_.clear();
+
+	delete codec_;
+	codec_ = NULL;
+
 }// FileEventLogger::~FileEventLogger
 
 /*****************************************************************************
@@ -88,13 +106,35 @@ FileEventLogger::~FileEventLogger()
 /****************************************************************************/
 bool FileEventLogger::Log(const char* pszData)
 {
-	std::string s; s.reserve(lstrlenA(pszData)+2);
-	s = ((pszData) ? pszData : "");
-	s += "\r\n";
+	DWORD dwLength = (pszData) ? static_cast<DWORD>(lstrlenA(pszData)) : 0;
+	DWORD dwNeeded = dwLength + 2;
 
 	CCSLock<FileEventLogger> lockGuard(this);
-	qData_.push_back(s);
-	JTI_VERIFY(hasData_.SetEvent());
+
+	// If the line will not fit, hand the current buffer to the writer.
+	if (activeBuffer_ != NULL && (activeBuffer_->Capacity - activeBuffer_->Length) < dwNeeded)
+	{
+		if (activeBuffer_->Length > 0)
+			fullBuffers_.push_back(activeBuffer_);
+		else
+			ReleaseBuffer(activeBuffer_);
+		activeBuffer_ = NULL;
+	}
+	if (activeBuffer_ == NULL)
+		activeBuffer_ = AllocBuffer(dwNeeded);
+
+	// The writer only needs waking when it has nothing pending already.
+	bool fSignal = (activeBuffer_->Length == 0);
+
+	char* pDest = activeBuffer_->Data + activeBuffer_->Length;
+	if (dwLength > 0)
+		memcpy(pDest, pszData, dwLength);
+	pDest[dwLength] = '\r';
+	pDest[dwLength+1] = '\n';
+	activeBuffer_->Length += dwNeeded;
+
+	if (fSignal)
+		JTI_VERIFY(hasData_.SetEvent());
 
 	return true;
 
@@ -148,8 +188,10 @@ void FileEventLogger::WorkerThread()
 		DWORD rc = WaitForMultipleObjects(2, arrHandles, FALSE, INFINITE);
 		CleanQueue();
 
-		if (qData_.empty())
+		CCSLock<FileEventLogger> lockGuard(this);
+		if (fullBuffers_.empty() && (activeBuffer_ == NULL || activeBuffer_->Length == 0))
 			hasData_.ResetEvent();	//lint !e534
+		lockGuard.Unlock();
 
 		// If we are exiting due to the signal, then do so now.
 		if (rc == WAIT_OBJECT_0 || rc == WAIT_ABANDONED_0)
@@ -168,8 +210,8 @@ void FileEventLogger::WorkerThread()
 ** 
 ** Returns: void
 ** 
-** Description: This removes all elements from the queue and writes them
-**              to our log.
+** Description: This takes all the filled buffers (including the partially
+**              filled active buffer) and writes them to our log.
 **
 /****************************************************************************/
 bool FileEventLogger::CleanQueue()
@@ -177,63 +219,157 @@ bool FileEventLogger::CleanQueue()
 	// Reopen our file if necessary
 	CheckFile();
 
-	// Write to the file if it's open
+	// Take the pending buffers; the next Log call will pick up a fresh one.
 	CCSLock<FileEventLogger> lockGuard(this);
-	if (logFile_ == INVALID_HANDLE_VALUE) {
-		qData_.clear();
-		return false;
+	LogBufferList buffers;
+	buffers.swap(fullBuffers_);
+	if (activeBuffer_ != NULL && activeBuffer_->Length > 0) {
+		buffers.push_back(activeBuffer_);
+		activeBuffer_ = NULL;
 	}
 
-    // Copy off the current data into a private queue and unlock.
-    std::deque<std::string> queue;
-	queue.swap(qData_);
-	lockGuard.Unlock();
-
-    // Get the file size of the current logfile.  If the hi file size is set then
-    // assume max size reached.
-    DWORD dwFileSize = 0;
-    if (maxSize_ > 0)
-    {
-        DWORD dwHiSize;
-        dwFileSize = GetFileSize(logFile_, &dwHiSize); 
-        if (dwHiSize > 0)
-            dwFileSize = std::numeric_limits<DWORD>::max();
-
-        // Reopen the file immediately if necessary.
-		if (dwFileSize >= maxSize_)
+	// Write to the file if it's open
+	bool fWritten = false;
+	if (logFile_ != INVALID_HANDLE_VALUE)
+	{
+		lockGuard.Unlock();
+
+		fWritten = true;
+		for (LogBufferList::const_iterator it = buffers.begin(); fWritten && it != buffers.end(); ++it)
+			fWritten = WriteBuffer(*it);
+
+		lockGuard.Lock();
+	}
+
+	// Recycle the buffers
+	for (LogBufferList::iterator it = buffers.begin(); it != buffers.end(); ++it)
+		ReleaseBuffer(*it);
+
+	return fWritten;
+
+}// FileEventLogger::CleanQueue
+
+/*****************************************************************************
+** Procedure:  FileEventLogger::WriteBuffer
+** 
+** Arguments:  pBuffer - Buffer of complete lines to write
+** 
+** Returns: true/false if the file is still open
+** 
+** Description: This writes a buffer to the log with a single write.  If
+**              the buffer crosses the maximum file size, it is split after
+**              the line which reaches the limit and the file is rolled.
+**
+/****************************************************************************/
+bool FileEventLogger::WriteBuffer(const LogBuffer* pBuffer)
+{
+	const char* pData = pBuffer->Data;
+	DWORD dwRemaining = pBuffer->Length;
+
+	while (dwRemaining > 0)
+	{
+		DWORD dwChunk = dwRemaining;
+		bool fRollFile = false;
+		if (maxSize_ > 0 && fileOffset_ + dwChunk >= maxSize_)
+		{
+			DWORD dwToLimit = (fileOffset_ >= maxSize_) ? 0 : static_cast<DWORD>(maxSize_ - fileOffset_ - 1);
+			const char* pEol = reinterpret_cast<const char*>(memchr(pData + dwToLimit, '\n', dwRemaining - dwToLimit));
+			if (pEol != NULL)
+				dwChunk = static_cast<DWORD>(pEol - pData) + 1;
+			fRollFile = true;
+		}
+
+		DWORD dwWritten = 0;
+		JTI_VERIFY(WriteFile(logFile_, pData, dwChunk, &dwWritten, NULL) != 0);
+		JTI_ASSERT(dwWritten == dwChunk);
+		fileOffset_ += dwWritten;
+
+		pData += dwChunk;
+		dwRemaining -= dwChunk;
+
+		if (fRollFile)
 		{
 			CheckFile();
 			if (logFile_ == INVALID_HANDLE_VALUE)
 				return false;
-            dwFileSize = 0;
 		}
-    }
+	}
+	return true;
+
+}// FileEventLogger::WriteBuffer
+
+/*****************************************************************************
+** Procedure:  FileEventLogger::AllocBuffer
+** 
+** Arguments:  dwMinSize - Minimum space required
+** 
+** Returns: Empty buffer
+** 
+** Description: This returns a recycled buffer if one is large enough, or
+**              allocates a new one.  The object lock must be held.
+**
+/****************************************************************************/
+FileEventLogger::LogBuffer* FileEventLogger::AllocBuffer(DWORD dwMinSize)
+{
+	if (!freeBuffers_.empty() && freeBuffers_.back()->Capacity >= dwMinSize)
+	{
+		LogBuffer* pBuffer = freeBuffers_.back();
+		freeBuffers_.pop_back();
+		return pBuffer;
+	}
+
+	LogBuffer* pBuffer = JTI_NEW LogBuffer;
+	pBuffer->Capacity = (dwMinSize > bufferSize_) ? dwMinSize : bufferSize_;
+	pBuffer->Length = 0;
+	pBuffer->Data = JTI_NEW char[pBuffer->Capacity];
+	return pBuffer;
+
+}// FileEventLogger::AllocBuffer
 
-    // Write out our entries.
-	while (!queue.empty())
+/*****************************************************************************
+** Procedure:  FileEventLogger::ReleaseBuffer
+** 
+** Arguments:  pBuffer - Buffer which is no longer in use
+** 
+** Returns: void
+** 
+** Description: This places a standard sized buffer back onto the free
+**              list.  Oversized buffers (for very long lines) and buffers
+**              beyond the free list limit are deleted.  The object lock
+**              must be held.
+**
+/****************************************************************************/
+void FileEventLogger::ReleaseBuffer(LogBuffer* pBuffer)
+{
+	if (pBuffer->Capacity == bufferSize_ && freeBuffers_.size() < MAX_FREE_BUFFERS)
 	{
-		const std::string& s = queue.front();
-		DWORD dwLength = static_cast<DWORD>(s.length()), dwWritten = 0;
-		JTI_VERIFY(WriteFile(logFile_, s.c_str(), dwLength, &dwWritten, NULL) != 0);
-		JTI_ASSERT(dwWritten == dwLength);
-
-		if (maxSize_ > 0)
-        {
-            if ((dwFileSize+dwWritten) < dwFileSize || (dwFileSize+dwWritten) >= maxSize_)
-		    {
-    			CheckFile();
-	    		if (logFile_ == INVALID_HANDLE_VALUE)
-		    		return false;
-                dwFileSize = 0;
-		    }
-            else
-          	    dwFileSize += dwWritten;
-        }
-		queue.pop_front();
+		pBuffer->Length = 0;
+		freeBuffers_.push_back(pBuffer);
 	}
-	return true;
+	else
+		DeleteBuffer(pBuffer);
 
-}// FileEventLogger::CleanQueue
+}// FileEventLogger::ReleaseBuffer
+
+/*****************************************************************************
+** Procedure:  FileEventLogger::DeleteBuffer
+** 
+** Arguments:  pBuffer - Buffer to delete
+** 
+** Returns: void
+** 
+** Description: This deletes a buffer and its data
+**
+/****************************************************************************/
+void FileEventLogger::DeleteBuffer(LogBuffer* pBuffer)
+{
+	if (pBuffer != NULL)
+	{
+		delete [] pBuffer->Data;
+		delete pBuffer;
+	}
+
+}// FileEventLogger::DeleteBuffer
 
 /*****************************************************************************
 ** Procedure:  FileEventLogger::CheckFile
@@ -259,7 +395,7 @@ void FileEventLogger::CheckFile()
 		fReopen = true;
 		fileIndex_ = 0;
 	}
-	else if (HitMaxSize())
+	else if (HitMaxSize() || GetRollPeriod(stNow) != rollPeriod_)
 	{
 		fReopen = true;
 	}
@@ -275,6 +411,7 @@ void FileEventLogger::CheckFile()
 			JTI_VERIFY(::CloseHandle(logFile_) != 0);
 			logFile_ = INVALID_HANDLE_VALUE;
 		}
+		fileOffset_ = 0;
 
 		// Get the directory to work with
 		std::string strDir = dirName_;
@@ -287,18 +424,31 @@ void FileEventLogger::CheckFile()
 		}
 
 		// Check to see if we are going to rename the file to a new name.
+		std::string strRolled = currName_;
 		if (!currName_.empty() && !renName_.empty())
 		{
-			MoveFileExA(currName_.c_str(), GetNextFileName(strDir, renName_, stNow).c_str(), 
-				MOVEFILE_REPLACE_EXISTING | MOVEFILE_COPY_ALLOWED);
+			strRolled = GetNextFileName(strDir, renName_, stNow);
+			if (!MoveFileExA(currName_.c_str(), strRolled.c_str(), 
+					MOVEFILE_REPLACE_EXISTING | MOVEFILE_COPY_ALLOWED))
+				strRolled = currName_;
 		}
 
-		// Set the new day of week
+		// Set the new day of week and roll period
 		dayOfWeek_ = stNow.wDay;
+		rollPeriod_ = GetRollPeriod(stNow);
 
 		// Get the next filename
 		currName_ = GetNextFileName(strDir, baseName_, stNow);
 
+		// Pass the rolled file to the background thread for compression
+		// and pruning, unless we are about to reopen it.
+		if (rollThreadHandle_ != INVALID_HANDLE_VALUE && 
+			!strRolled.empty() && strRolled != currName_)
+		{
+			rolledFiles_.push_back(strRolled);
+			hasRolledFiles_.SetEvent();	//lint !e534
+		}
+
 		// Open the file.
 		logFile_ = ::CreateFileA(currName_.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
 		if (logFile_ != INVALID_HANDLE_VALUE)
@@ -309,7 +459,13 @@ void FileEventLogger::CheckFile()
 				SetEndOfFile(logFile_);
 			}
 			else
+			{
+				// Track the file size from here on rather than asking the OS.
+				LARGE_INTEGER liSize;
+				if (GetFileSizeEx(logFile_, &liSize))
+					fileOffset_ = static_cast<ULONGLONG>(liSize.QuadPart);
 				SetFilePointer(logFile_, 0L, NULL, FILE_END);
+			}
 		}
 	}
 }//
@@ -355,17 +511,37 @@ std::string FileEventLogger::GetNextFileName(const std::string& strDir, const st
 ** 
 ** Returns: true/false
 ** 
-** Description: This checks the file size to see if we have hit our max size.
+** Description: This checks the tracked file size to see if we have hit our
+**              max size.
 **
 /****************************************************************************/
 bool FileEventLogger::HitMaxSize() const
 {
 	if (maxSize_ > 0 && logFile_ != INVALID_HANDLE_VALUE)
-		return (GetFileSize(logFile_, NULL) >= maxSize_);
+		return (fileOffset_ >= maxSize_);
 	return false;
 
 }// FileEventLogger::HitMaxSize
 
+/*****************************************************************************
+** Procedure:  FileEventLogger::GetRollPeriod
+** 
+** Arguments:  stNow - Current Time
+** 
+** Returns: Index of the roll interval within the day
+** 
+** Description: This returns which RollMinutes interval of the day the 
+**              given time falls into; a change means the file should roll.
+**
+/****************************************************************************/
+DWORD FileEventLogger::GetRollPeriod(const SYSTEMTIME& stNow) const
+{
+	if (rollMinutes_ == 0)
+		return 0;
+	return (static_cast<DWORD>(stNow.wHour) * 60 + stNow.wMinute) / rollMinutes_;
+
+}// FileEventLogger::GetRollPeriod
+
 /*****************************************************************************
 ** Procedure:  FileEventLogger::BuildFilename
 ** 
@@ -440,7 +616,10 @@ std::string FileEventLogger::BuildFilename(const std::string& strName, const SYS
 ** 
 ** Returns: void 
 ** 
-** Description: This starts the file logger
+** Description: This starts the file logger.  A logger which rolls every
+**              RollMinutes and has no RenameFile must have a %c counter in
+**              its name; otherwise each roll would reopen the same file and
+**              the logger is not started.
 **
 /****************************************************************************/
 bool FileEventLogger::Start(const char* pszDirectory, const char* pszBaseName)
@@ -450,13 +629,30 @@ bool FileEventLogger::Start(const char* pszDirectory, const char* pszBaseName)
 		dirName_ = pszDirectory;
 		baseName_ = pszBaseName;
 
-		// Start the thread
+		if (rollMinutes_ > 0 && renName_.empty() && baseName_.find("%c") == std::string::npos)
+			return true;
+
+		// Start the thread suspended; it reads the roll thread handle when it
+		// opens the first file, so that must be set before it runs.
 		UINT wThreadID = 0;
-		threadHandle_ = reinterpret_cast<HANDLE>(_beginthreadex(NULL, 0, FileEventLogger::StartThreadFunc, reinterpret_cast<void*>(this), 0, &wThreadID));
+		threadHandle_ = reinterpret_cast<HANDLE>(_beginthreadex(NULL, 0, FileEventLogger::StartThreadFunc, reinterpret_cast<void*>(this), CREATE_SUSPENDED, &wThreadID));
 		if (threadHandle_ != 0)
 			SetThreadPriority(threadHandle_, THREAD_PRIORITY_BELOW_NORMAL);
 		else
 			threadHandle_ = INVALID_HANDLE_VALUE;
+
+		// Start the thread which compresses and prunes rolled files.
+		if (threadHandle_ != INVALID_HANDLE_VALUE && (codec_ != NULL || maxFiles_ > 0))
+		{
+			rollThreadHandle_ = reinterpret_cast<HANDLE>(_beginthreadex(NULL, 0, FileEventLogger::StartRollThreadFunc, reinterpret_cast<void*>(this), 0, &wThreadID));
+			if (rollThreadHandle_ != 0)
+				SetThreadPriority(rollThreadHandle_, THREAD_PRIORITY_LOWEST);
+			else
+				rollThreadHandle_ = INVALID_HANDLE_VALUE;
+		}
+
+		if (threadHandle_ != INVALID_HANDLE_VALUE)
+			ResumeThread(threadHandle_);	//lint !e534
 	}
 	return (threadHandle_ == INVALID_HANDLE_VALUE);
 
@@ -482,5 +678,137 @@ void FileEventLogger::Stop() throw()
 		JTI_VERIFY(CloseHandle(threadHandle_) != 0);
 		threadHandle_ = INVALID_HANDLE_VALUE;
 	}
+	if (rollThreadHandle_ != INVALID_HANDLE_VALUE)
+	{
+		if (rollThreadHandle_ != GetCurrentThread())
+			WaitForSingleObject(rollThreadHandle_, INFINITE);
+		JTI_VERIFY(CloseHandle(rollThreadHandle_) != 0);
+		rollThreadHandle_ = INVALID_HANDLE_VALUE;
+	}
 
 }// FileEventLogger::Stop
+
+/*****************************************************************************
+** Procedure:  FileEventLogger::set_Codec
+** 
+** Arguments:  pCodec - Codec used to compress rolled files (may be NULL)
+** 
+** Returns: void 
+** 
+** Description: This replaces the codec for rolled files.  The logger takes
+**              ownership of the codec and deletes it.
+**
+/****************************************************************************/
+void FileEventLogger::set_Codec(LogFileCodec* pCodec)
+{
+	CCSLock<FileEventLogger> lockGuard(this);
+	if (codec_ != pCodec)
+	{
+		delete codec_;
+		codec_ = pCodec;
+	}
+
+}// FileEventLogger::set_Codec
+
+/*****************************************************************************
+** Procedure:  FileEventLogger::RollThread
+** 
+** Arguments:  void
+** 
+** Returns: void 
+** 
+** Description: This is the low-priority thread which compresses and prunes
+**              rolled files.  Files still queued when the logger stops are
+**              left as they are.
+**
+/****************************************************************************/
+void FileEventLogger::RollThread()
+{
+	HANDLE arrHandles[2] = {
+		isStopping_.get(),
+		hasRolledFiles_.get()
+	};
+
+	for (;;)
+	{
+		DWORD rc = WaitForMultipleObjects(2, arrHandles, FALSE, INFINITE);
+		if (rc == WAIT_OBJECT_0 || rc == WAIT_ABANDONED_0)
+			break;
+
+		// Take one file at a time so a stop request is seen between files.
+		CCSLock<FileEventLogger> lockGuard(this);
+		if (rolledFiles_.empty())
+		{
+			hasRolledFiles_.ResetEvent();	//lint !e534
+			continue;
+		}
+		std::string strFile = rolledFiles_.front();
+		rolledFiles_.pop_front();
+		lockGuard.Unlock();
+
+		ProcessRolledFile(strFile);
+	}
+
+}// FileEventLogger::RollThread
+
+/*****************************************************************************
+** Procedure:  FileEventLogger::ProcessRolledFile
+** 
+** Arguments:  strFile - Rolled log file
+** 
+** Returns: void 
+** 
+** Description: This compresses a rolled file using the codec and then
+**              deletes the oldest rolled files beyond the MaxFiles limit.
+**
+/****************************************************************************/
+void FileEventLogger::ProcessRolledFile(const std::string& strFile)
+{
+	std::string strKept = strFile;
+	if (codec_ != NULL)
+	{
+		std::string strResult;
+		if (codec_->Compress(strFile, strResult) && !strResult.empty())
+			strKept = strResult;
+	}
+
+	if (maxFiles_ > 0)
+	{
+		// A reused name replaces its older entry.
+		keptFiles_.erase(std::remove(keptFiles_.begin(), keptFiles_.end(), strKept), keptFiles_.end());
+		keptFiles_.push_back(strKept);
+		while (static_cast<int>(keptFiles_.size()) > maxFiles_)
+		{
+			DeleteFileA(keptFiles_.front().c_str());
+			keptFiles_.pop_front();
+		}
+	}
+
+}// FileEventLogger::ProcessRolledFile
+
+/*****************************************************************************
+** Procedure:  NtfsCompressionCodec::Compress
+** 
+** Arguments:  strSource - Rolled log file
+**             strResult - Returning file name (same as the source)
+** 
+** Returns: true/false success indicator
+** 
+** Description: This turns on NTFS compression for the file.
+**
+/****************************************************************************/
+bool NtfsCompressionCodec::Compress(const std::string& strSource, std::string& strResult)
+{
+	HANDLE hFile = ::CreateFileA(strSource.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	USHORT nFormat = COMPRESSION_FORMAT_DEFAULT;
+	DWORD dwReturned = 0;
+	BOOL fRC = ::DeviceIoControl(hFile, FSCTL_SET_COMPRESSION, &nFormat, sizeof(nFormat), NULL, 0, &dwReturned, NULL);
+	JTI_VERIFY(::CloseHandle(hFile) != 0);
+
+	strResult = strSource;
+	return (fRC != FALSE);
+
+}// NtfsCompressionCodec::Compress
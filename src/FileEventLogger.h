@@ -8,7 +8,9 @@
 //
 // The logger will write to the file of basename_yyyymmdd.log until the
 // date changes.  Once that happens, the file is closed and the logger will
-// move to te next filename.
+// move to te next filename.  Files may also be rolled on size and on a
+// fixed interval; rolled files are compressed and pruned on a background
+// thread so the writer never waits on them.
 //
 // Copyright (C) 1997-2004 JulMar Technology, Inc.
 // All rights reserved
@@ -27,6 +29,7 @@
 -----------------------------------------------------------------------------*/
 #pragma warning (disable:4702)
 #include <string>
+#include <vector>
 #include <deque>
 #pragma warning (default:4702)
 #include <Lock.h>
@@ -39,45 +42,105 @@
 //
 // Data not initialized in constructor
 //lint -esym(1927, FileEventLogger::MaxSize, FileEventLogger::TruncateExistingData)
-//lint -esym(1927, FileEventLogger::RenameFile)
+//lint -esym(1927, FileEventLogger::RenameFile, FileEventLogger::BufferSize)
+//lint -esym(1927, FileEventLogger::RollMinutes, FileEventLogger::MaxFiles)
 //
 // Data not initialized in constructor
 //lint -esym(1401, FileEventLogger::MaxSize, FileEventLogger::TruncateExistingData)
-//lint -esym(1401, FileEventLogger::RenameFile)
+//lint -esym(1401, FileEventLogger::RenameFile, FileEventLogger::BufferSize)
+//lint -esym(1401, FileEventLogger::RollMinutes, FileEventLogger::MaxFiles)
 //
 // Data not initialized by assignment operator
 //lint -esym(1539, FileEventLogger::MaxSize, FileEventLogger::TruncateExistingData)
-//lint -esym(1539, FileEventLogger::RenameFile)
+//lint -esym(1539, FileEventLogger::RenameFile, FileEventLogger::BufferSize)
+//lint -esym(1539, FileEventLogger::RollMinutes, FileEventLogger::MaxFiles)
 //
 // Public data member
 //lint -esym(1925, FileEventLogger::MaxSize, FileEventLogger::TruncateExistingData)
-//lint -esym(1925, FileEventLogger::RenameFile)
+//lint -esym(1925, FileEventLogger::RenameFile, FileEventLogger::BufferSize)
+//lint -esym(1925, FileEventLogger::RollMinutes, FileEventLogger::MaxFiles)
 //
 /*****************************************************************************/
 
 namespace JTI_Util
 {   
+/****************************************************************************/
+// LogFileCodec
+//
+// This interface is used by the FileEventLogger to compress a log file 
+// once it has been rolled.  It is called on a low-priority background 
+// thread.  The codec returns the name of the file which now holds the data
+// (e.g. "name.log.gz") and is responsible for removing the original.
+//
+/****************************************************************************/
+class LogFileCodec
+{
+public:
+	virtual ~LogFileCodec() {/* */}
+	virtual bool Compress(const std::string& strSource, std::string& strResult) = 0;
+};
+
+/****************************************************************************/
+// NtfsCompressionCodec
+//
+// This codec sets the NTFS compression attribute on the rolled file so it
+// is compressed in place by the file system; the filename does not change.
+//
+/****************************************************************************/
+class NtfsCompressionCodec : public LogFileCodec
+{
+public:
+	virtual bool Compress(const std::string& strSource, std::string& strResult);
+};
+
 /****************************************************************************/
 // FileEventLogger
 //
-// This class manages the event file logging.
+// This class manages the event file logging.  Callers copy their text 
+// directly into a large preallocated buffer; when it fills (or the writer
+// thread wakes up) the buffer is handed to the writer thread and replaced 
+// with a recycled one, so the file sees one large write per buffer rather 
+// than one per line.
 //
 /****************************************************************************/
 class FileEventLogger : public LockableObject<MultiThreadModel>
 {
+// Internal structures
+private:
+	struct LogBuffer
+	{
+		char* Data;
+		DWORD Length;
+		DWORD Capacity;
+	};
+	typedef std::vector<LogBuffer*> LogBufferList;
+	enum { DEFAULT_BUFFER_SIZE = 65536, MAX_FREE_BUFFERS = 4 };
+
 // Class data
 private:
 	EventSynch isStopping_;
 	EventSynch hasData_;
-	std::deque<std::string> qData_;
+	EventSynch hasRolledFiles_;
+	LogBuffer* activeBuffer_;
+	LogBufferList fullBuffers_;
+	LogBufferList freeBuffers_;
 	WORD dayOfWeek_;
 	HANDLE logFile_;
 	HANDLE threadHandle_;
+	HANDLE rollThreadHandle_;
+	std::deque<std::string> rolledFiles_;
+	std::deque<std::string> keptFiles_;
+	LogFileCodec* codec_;
 	std::string dirName_;
 	std::string baseName_;
 	std::string renName_;
 	std::string currName_;
 	DWORD maxSize_;
+	DWORD bufferSize_;
+	ULONGLONG fileOffset_;
+	DWORD rollMinutes_;
+	DWORD rollPeriod_;
+	int maxFiles_;
 	int fileIndex_;
 	bool truncateExisting_;
 
@@ -90,6 +153,9 @@ public:
 public:
 	__declspec(property(get=get_MaxSize, put=set_MaxSize)) DWORD MaxSize;
 	__declspec(property(get=get_Truncate, put=set_Truncate)) bool TruncateExistingData;
+	__declspec(property(get=get_BufferSize, put=set_BufferSize)) DWORD BufferSize;
+	__declspec(property(get=get_RollMinutes, put=set_RollMinutes)) DWORD RollMinutes;
+	__declspec(property(get=get_MaxFiles, put=set_MaxFiles)) int MaxFiles;
 	__declspec(property(get=get_RenameFilespec, put=set_RenameFilespec)) const char* RenameFile;
 	__declspec(property(get=get_LogDirectory, put=set_LogDirectory)) const char* LogDirectory;
 	__declspec(property(get=get_CurrentFileName)) const char* CurrentFilename;
@@ -107,6 +173,22 @@ public:
 	bool get_Truncate() const { return truncateExisting_; }
 	void set_Truncate(bool f) { truncateExisting_ = f; }
 
+	DWORD get_BufferSize() const { return bufferSize_; }
+	void set_BufferSize(DWORD bufferSize) { bufferSize_ = (bufferSize < 1024) ? 1024 : bufferSize; }
+
+	// Roll the file every N minutes (0 = only on date change or size).  Unless a
+	// RenameFile is set, the base name needs a %c counter or Start fails.
+	DWORD get_RollMinutes() const { return rollMinutes_; }
+	void set_RollMinutes(DWORD nMinutes) { rollMinutes_ = nMinutes; }
+
+	// Number of rolled files to keep (0 = keep all)
+	int get_MaxFiles() const { return maxFiles_; }
+	void set_MaxFiles(int nFiles) { maxFiles_ = (nFiles < 0) ? 0 : nFiles; }
+
+	// Compressor for rolled files; the logger owns the codec.  Set before Start.
+	LogFileCodec* get_Codec() const { return codec_; }
+	void set_Codec(LogFileCodec* pCodec);
+
 	const char* get_CurrentFileName() const { return currName_.c_str(); }
 	const char* get_RenameFilespec() const { return renName_.c_str(); }
 	void set_RenameFilespec(const char* pszName) { renName_ = (pszName) ? pszName : ""; }
@@ -120,12 +202,23 @@ private:
 	std::string GetNextFileName(const std::string& strDir, const std::string& fileSpec, const SYSTEMTIME& stNow);
 	void CheckFile();
 	bool CleanQueue();
+	bool WriteBuffer(const LogBuffer* pBuffer);
 	bool HitMaxSize() const;
+	DWORD GetRollPeriod(const SYSTEMTIME& stNow) const;
+	void RollThread();
+	void ProcessRolledFile(const std::string& strFile);
+	LogBuffer* AllocBuffer(DWORD dwMinSize);
+	void ReleaseBuffer(LogBuffer* pBuffer);
+	static void DeleteBuffer(LogBuffer* pBuffer);
 	void WorkerThread();
 	static UINT __stdcall StartThreadFunc(void* pParam) {
 		reinterpret_cast<FileEventLogger*>(pParam)->WorkerThread();
 		return 0;
 	}
+	static UINT __stdcall StartRollThreadFunc(void* pParam) {
+		reinterpret_cast<FileEventLogger*>(pParam)->RollThread();
+		return 0;
+	}
 };
 
 #ifdef __TRACE_DEBUG_H_INCL__
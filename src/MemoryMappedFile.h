@@ -11,7 +11,7 @@
 // JulMar Technology, Inc.
 //
 // You must not remove this notice, or any other, from this software.
-// 
+//
 /****************************************************************************/
 
 #ifndef __MEMORYMAP_INCL__
@@ -27,6 +27,7 @@
 // PC-Lint options
 //
 //lint -save
+//lint -esym(534, CloseHandle, UnmapViewOfFile, FlushViewOfFile, FlushFileBuffers)
 //
 /*****************************************************************************/
 
@@ -35,54 +36,76 @@ namespace JTI_Util
 /****************************************************************************/
 // MemoryMappedFile
 //
-// This class wraps a memory mapped file.
+// This class wraps a memory mapped file.  By default the whole file is
+// mapped; a window size limits the view to part of the file so files larger
+// than the address space can be used.  Map() moves the view to any range
+// and Access() slides it along as needed.  Sequential or random access hints
+// are given with FILE_FLAG_SEQUENTIAL_SCAN or FILE_FLAG_RANDOM_ACCESS when
+// the file is opened; Prefetch() faults a range in ahead of use.
 //
 /****************************************************************************/
 class MemoryMappedFile
 {
 // Class data
 private:
-	void* lpv_;
+	HANDLE hFile_;
+	HANDLE hFileMap_;
+	BYTE* view_;			// base of the view (allocation aligned)
+	void* lpv_;				// first byte of the requested range
 	__int64 size_;
+	__int64 offset_;		// file offset of lpv_
+	size_t length_;			// bytes mapped from lpv_
+	size_t windowSize_;		// 0 maps the whole file
+	DWORD granularity_;
+	DWORD pageSize_;
+	bool fWritable_;
 
 // Constructor
 public:
-	MemoryMappedFile(const char* pszFile, 
-			DWORD dwDesiredAccess = GENERIC_READ, 
-			DWORD dwShareMode = FILE_SHARE_READ, 
+	MemoryMappedFile(const char* pszFile,
+			DWORD dwDesiredAccess = GENERIC_READ,
+			DWORD dwShareMode = FILE_SHARE_READ,
 			LPSECURITY_ATTRIBUTES lpSecurityAttributes = NULL,
 			DWORD dwCreationDisposition = OPEN_EXISTING,
-			DWORD dwFlagsAndAttributes = FILE_ATTRIBUTE_NORMAL) : lpv_(0)
+			DWORD dwFlagsAndAttributes = FILE_ATTRIBUTE_NORMAL,
+			size_t nWindowSize = 0) :
+		hFile_(INVALID_HANDLE_VALUE), hFileMap_(NULL), view_(0), lpv_(0), size_(0), offset_(0), length_(0),
+		windowSize_(nWindowSize), granularity_(0), pageSize_(0), fWritable_(false)
 	{
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		granularity_ = si.dwAllocationGranularity;
+		pageSize_ = si.dwPageSize;
+		fWritable_ = ((dwDesiredAccess & (GENERIC_WRITE|GENERIC_ALL|FILE_WRITE_ATTRIBUTES|FILE_WRITE_DATA|FILE_WRITE_EA)) > 0);
+
 		USES_CONVERSION;
-		HANDLE hFile = CreateFile(A2T(const_cast<char*>(pszFile)), dwDesiredAccess, dwShareMode, lpSecurityAttributes, dwCreationDisposition, dwFlagsAndAttributes, NULL);
-		if (hFile != INVALID_HANDLE_VALUE)
+		hFile_ = CreateFile(A2T(const_cast<char*>(pszFile)), dwDesiredAccess, dwShareMode, lpSecurityAttributes, dwCreationDisposition, dwFlagsAndAttributes, NULL);
+		if (hFile_ != INVALID_HANDLE_VALUE)
 		{
 			// Get the total file size to map
-			DWORD dwSizeHigh = 0, dwSizeLow = GetFileSize(hFile, &dwSizeHigh);
+			DWORD dwSizeHigh = 0, dwSizeLow = GetFileSize(hFile_, &dwSizeHigh);
 
 			// Store off the file size
 			size_ = ((static_cast<__int64>(dwSizeHigh)) << 32) + dwSizeLow;
 
-			// Create a file mapping object; it increments the ref count on the original file so close
-			// it now to avoid resource leaks.
-			DWORD protectionType = ((dwDesiredAccess & (FILE_WRITE_ATTRIBUTES|FILE_WRITE_DATA|FILE_WRITE_EA)) > 0) ? PAGE_READWRITE : PAGE_READONLY;
-			HANDLE hFileMap = CreateFileMapping(hFile, lpSecurityAttributes, protectionType, dwSizeHigh, dwSizeLow, NULL);
-			CloseHandle(hFile);
-
-			// Map a view of the file; again close the handle we used.
-			if (hFileMap != NULL) {
-				protectionType = ((dwDesiredAccess & (FILE_WRITE_ATTRIBUTES|FILE_WRITE_DATA|FILE_WRITE_EA)) > 0) ? FILE_MAP_WRITE : FILE_MAP_READ;
-				lpv_ = MapViewOfFile(hFileMap, protectionType, 0, 0, 0);
-				CloseHandle(hFileMap);
+			// An empty file cannot be mapped until it is grown.  The handles
+			// stay open so the view can be moved or the file grown later.
+			if (size_ > 0)
+			{
+				hFileMap_ = CreateFileMapping(hFile_, lpSecurityAttributes, fWritable_ ? PAGE_READWRITE : PAGE_READONLY, dwSizeHigh, dwSizeLow, NULL);
+				if (hFileMap_ != NULL)
+					Map(0, windowSize_);
 			}
 		}
 	}
 
 	~MemoryMappedFile()
 	{
-		if (lpv_ != NULL)
-			UnmapViewOfFile(lpv_);
+		Unmap();
+		if (hFileMap_ != NULL)
+			CloseHandle(hFileMap_);
+		if (hFile_ != INVALID_HANDLE_VALUE)
+			CloseHandle(hFile_);
 	}
 
 // Properties
@@ -90,13 +113,142 @@ public:
 	__declspec(property(get=get_Pointer)) void* Buffer;
 	__declspec(property(get=get_IsValid)) bool IsValid;
 	__declspec(property(get=get_Size)) __int64 Size;
+	__declspec(property(get=get_Offset)) __int64 Offset;
+	__declspec(property(get=get_Length)) size_t Length;
 
 // Property helpers
 public:
 	bool get_IsValid() { return (lpv_ != NULL); }
 	void* get_Pointer() { return lpv_; }
 	__int64 get_Size() { return size_; }
+	__int64 get_Offset() { return offset_; }
+	size_t get_Length() { return length_; }
+
+// Methods
+public:
+	// Maps nLength bytes from nOffset (to the end of the file if zero),
+	// replacing the current view.  Pointers into the old view are invalid.
+	bool Map(__int64 nOffset, size_t nLength = 0)
+	{
+		Unmap();
+		if (hFileMap_ == NULL || nOffset < 0 || nOffset >= size_)
+			return false;
+
+		// Clip the range to the file; the view must start on an allocation boundary.
+		__int64 nRemain = size_ - nOffset;
+		if (nLength == 0 || static_cast<unsigned __int64>(nLength) > static_cast<unsigned __int64>(nRemain))
+		{
+			if (static_cast<unsigned __int64>(nRemain) > static_cast<size_t>(-1))
+				return false;
+			nLength = static_cast<size_t>(nRemain);
+		}
+		__int64 nBase = nOffset - (nOffset % granularity_);
+		size_t nSkip = static_cast<size_t>(nOffset - nBase);
+
+		view_ = reinterpret_cast<BYTE*>(MapViewOfFile(hFileMap_, fWritable_ ? FILE_MAP_WRITE : FILE_MAP_READ,
+						static_cast<DWORD>(nBase >> 32), static_cast<DWORD>(nBase & 0xffffffff), nSkip + nLength));
+		if (view_ == NULL)
+			return false;
+		lpv_ = view_ + nSkip;
+		offset_ = nOffset;
+		length_ = nLength;
+		return true;
+	}
+
+	// Returns a pointer to nLength bytes at nOffset, sliding the view to
+	// start there if they are not already mapped.  The pointer is valid
+	// until the view next moves.
+	void* Access(__int64 nOffset, size_t nLength)
+	{
+		if (lpv_ == NULL || nOffset < offset_ || static_cast<unsigned __int64>(nOffset - offset_) + nLength > length_)
+		{
+			if (!Map(nOffset, (windowSize_ > nLength || windowSize_ == 0) ? windowSize_ : nLength) || nLength > length_)
+				return NULL;
+		}
+		return reinterpret_cast<BYTE*>(lpv_) + (nOffset - offset_);
+	}
+
+	// Writes modified pages in the mapped part of the range back to the
+	// file, and to the disk as well if requested.
+	bool Flush(__int64 nOffset = 0, size_t nLength = 0, bool fToDisk = false)
+	{
+		if (lpv_ == NULL)
+			return false;
+		BYTE* pStart; size_t nCount;
+		if (!ClipToView(nOffset, nLength, pStart, nCount))
+			return true;
+		if (!FlushViewOfFile(pStart, nCount))
+			return false;
+		return !fToDisk || FlushFileBuffers(hFile_) != FALSE;
+	}
+
+	// Touches each page in the mapped part of the range so it is read in
+	// now rather than faulted in one page at a time later.
+	void Prefetch(__int64 nOffset = 0, size_t nLength = 0)
+	{
+		BYTE* pStart; size_t nCount;
+		if (lpv_ == NULL || !ClipToView(nOffset, nLength, pStart, nCount))
+			return;
+		volatile BYTE by = 0;
+		for (size_t i = 0; i < nCount; i += pageSize_)
+			by = static_cast<BYTE>(by ^ pStart[i]);
+		by = static_cast<BYTE>(by ^ pStart[nCount-1]);
+	}
+
+	// Extends a writable file to nNewSize bytes and maps the same range
+	// again (the whole file if no window size was given).  Pointers into
+	// the old view are invalid.
+	bool Grow(__int64 nNewSize)
+	{
+		if (!fWritable_ || hFile_ == INVALID_HANDLE_VALUE || nNewSize < size_)
+			return false;
+		if (nNewSize == size_)
+			return true;
+
+		__int64 nOffset = (lpv_ != NULL) ? offset_ : 0;
+		Unmap();
+		if (hFileMap_ != NULL)
+			CloseHandle(hFileMap_);
+
+		// Mapping beyond the end of the file extends it.
+		hFileMap_ = CreateFileMapping(hFile_, NULL, PAGE_READWRITE, static_cast<DWORD>(nNewSize >> 32), static_cast<DWORD>(nNewSize & 0xffffffff), NULL);
+		if (hFileMap_ == NULL)
+			return false;
+		size_ = nNewSize;
+		return Map(nOffset, windowSize_);
+	}
+
+// Internal methods
+private:
+	void Unmap()
+	{
+		if (view_ != NULL)
+			UnmapViewOfFile(view_);
+		view_ = 0;
+		lpv_ = 0;
+		length_ = 0;
+	}
+
+	// Returns the part of [nOffset, nOffset+nLength) inside the view; a zero
+	// length runs to the end of the view.
+	bool ClipToView(__int64 nOffset, size_t nLength, BYTE*& pStart, size_t& nCount)
+	{
+		__int64 nEnd = (nLength == 0) ? offset_ + static_cast<__int64>(length_) : nOffset + static_cast<__int64>(nLength);
+		if (nOffset < offset_)
+			nOffset = offset_;
+		if (nEnd > offset_ + static_cast<__int64>(length_))
+			nEnd = offset_ + static_cast<__int64>(length_);
+		if (nEnd <= nOffset)
+			return false;
+		pStart = reinterpret_cast<BYTE*>(lpv_) + (nOffset - offset_);
+		nCount = static_cast<size_t>(nEnd - nOffset);
+		return true;
+	}
+
+// Unavailable methods
+private:
+	MemoryMappedFile(const MemoryMappedFile&);
+	MemoryMappedFile& operator=(const MemoryMappedFile&);
 };
 }// namespace JTI_Util
 #endif // __MEMORYMAP_INCL__
-
@@ -48,7 +48,8 @@ using namespace JTI_Util;
 /****************************************************************************/
 TraceLogger_Base::TraceLogger_Base() : 
 	trcLevel_(0), listHandlers_(), listElements_(), Stopping_(false,true), HasData_(false,true),
-	threadHandle_(INVALID_HANDLE_VALUE), lockElements_(), lockHandlers_(), stopOnAssert_(false), mapPrefix_()
+	threadHandle_(INVALID_HANDLE_VALUE), lockElements_(), lockHandlers_(), stopOnAssert_(false), mapPrefix_(),
+	sitesHead_(NULL), siteRules_(), lockSites_(), throttleGen_(0)
 {
 }// TraceLogger_Base::TraceLogger_Base
 
@@ -162,6 +163,15 @@ unsigned int __stdcall TraceLogger_Base::LogEventHandler(void* lp)
 /****************************************************************************/
 void TraceLogger_Base::Stop() 
 {
+	// Report any sites which were throttled and have not emitted since.
+	CCSLock<CriticalSectionLock> lockGuard(&lockSites_);
+	for (TraceSite* pSite = sitesHead_; pSite != NULL; pSite = pSite->Next)
+	{
+		if (pSite->Suppressed != 0)
+			ReportSuppressed(*pSite);
+	}
+	lockGuard.Unlock();
+
 	Stopping_.SetEvent();	//lint !e534
 	if (threadHandle_ != INVALID_HANDLE_VALUE)	{
 		WaitForSingleObject(threadHandle_,INFINITE); 	//lint !e534
@@ -186,6 +196,9 @@ void TraceLogger_Base::Runner()
 	HANDLE arrHandles[] = { Stopping_.get(), HasData_.get() };
 	CCSLock<CriticalSectionLock> lockGuard(&lockElements_, false);
 
+	// The two lists are swapped back and forth so each keeps its capacity.
+	LogElementList lstElems;
+
 	for (;;)
 	{
 		// Wait on either the STOP event, or data arriving.
@@ -198,13 +211,12 @@ void TraceLogger_Base::Runner()
 		if (!listElements_.empty())
 		{
 			// Copy the elements off.
-			LogElementList lstElems;
 			lstElems.swap(listElements_);
 
 			// Unlock and dispatch
 			lockGuard.Unlock();
-			std::for_each(lstElems.begin(), lstElems.end(), 
-				std::bind1st(std::mem_fun(&TraceLogger_Base::DispatchSingle),this));
+			DispatchBatch(&lstElems[0], lstElems.size());
+			lstElems.clear();
 
 			// Now test the size again; if we have added one while processing, allow the thread
 			// to continue working on new data.
@@ -217,8 +229,8 @@ void TraceLogger_Base::Runner()
 
 	// Dispatch all the remaining elements.
 	lockGuard.Lock();
-	std::for_each(listElements_.begin(), listElements_.end(), 
-		std::bind1st(std::mem_fun(&TraceLogger_Base::DispatchSingle),this));
+	if (!listElements_.empty())
+		DispatchBatch(&listElements_[0], listElements_.size());
 	listElements_.clear();
 
 }// TraceLogger_Base::Runner
@@ -235,62 +247,59 @@ void TraceLogger_Base::Runner()
 /****************************************************************************/
 void TraceLogger_Base::DispatchSingle(InternalLogElement* pile)
 {
-	const LogElement* ple = dynamic_cast<const LogElement*>(pile);
-	if (ple != NULL)
-		BroadcastLogEvent(ple);
-	else
-	{
-		const AssertElement* pae = dynamic_cast<const AssertElement*>(pile);
-		if (pae)
-			BroadcastAssert(pae);
-	}
-	delete pile;
+	DispatchBatch(&pile, 1);
 
 }// TraceLogger_Base::DispatchSingle
 
 /*****************************************************************************
-** Procedure:  TraceLogger_Base::BroadcastLogEvent
+** Procedure:  TraceLogger_Base::DispatchBatch
 ** 
-** Arguments:  le - Log element
+** Arguments:  ppElements - Log elements to dispatch
+**             nCount - Count of elements
 ** 
 ** Returns: void 
 ** 
-** Description: This is called to send the log element to all the handlers
+** Description: This sends a set of log elements to each handler in a 
+**              single call and then deletes them.  Handlers only see the
+**              elements which match their log level; if a handler takes
+**              everything the original array is passed without copying.
 **
 /****************************************************************************/
-void TraceLogger_Base::BroadcastLogEvent(const LogElement* le)
+void TraceLogger_Base::DispatchBatch(InternalLogElement* const* ppElements, size_t nCount)
 {
-	unsigned long nType = le->TraceLevel;
+	std::vector<const InternalLogElement*> arrFiltered;
 
 	CCSRLock lockGuard(&lockHandlers_);
 	LogHandlerList::iterator itEnd = listHandlers_.end();
 	for (LogHandlerList::iterator it = listHandlers_.begin(); it != itEnd; ++it)
 	{
-		unsigned long nType2 = (*it)->LogLevel;
-		if ((nType == 0 && nType2 > 0) || (nType & nType2) > 0)
-			(*it)->OnLog(*le);
-	}
+		unsigned long nType = (*it)->LogLevel;
 
-}// TraceLogger_Base::BroadcastLogEvent
+		// Find the first element this handler does not want.
+		size_t nFirst = 0;
+		while (nFirst < nCount && ppElements[nFirst]->IsForLevel(nType))
+			++nFirst;
 
-/*****************************************************************************
-** Procedure:  TraceLogger_Base::BroadcastAssert
-** 
-** Arguments:  ae - Assert element
-** 
-** Returns: void 
-** 
-** Description: This broadcasts failed assertions
-**
-/****************************************************************************/
-void TraceLogger_Base::BroadcastAssert(const AssertElement* ae)
-{
-	CCSRLock lockGuard(&lockHandlers_);
-	LogHandlerList::iterator itEnd = listHandlers_.end();
-	for (LogHandlerList::iterator it = listHandlers_.begin(); it != itEnd; ++it)
-		(*it)->OnAssert(*ae);
+		if (nFirst == nCount)
+			(*it)->OnLogBatch(ppElements, nCount);
+		else
+		{
+			arrFiltered.assign(ppElements, ppElements + nFirst);
+			for (size_t i = nFirst+1; i < nCount; ++i)
+			{
+				if (ppElements[i]->IsForLevel(nType))
+					arrFiltered.push_back(ppElements[i]);
+			}
+			if (!arrFiltered.empty())
+				(*it)->OnLogBatch(&arrFiltered[0], arrFiltered.size());
+		}
+	}
+	lockGuard.Unlock();
+
+	for (size_t i = 0; i < nCount; ++i)
+		delete ppElements[i];
 
-}// TraceLogger_Base::BroadcastAssert
+}// TraceLogger_Base::DispatchBatch
 
 /*****************************************************************************
 ** Procedure:  TraceLogger_Base::DumpFile
@@ -361,8 +370,13 @@ bool TraceLogger_Base::DumpFile(unsigned long nLevel, const char* fileName, bool
 /****************************************************************************/
 bool TraceLogger_Base::addType(unsigned long nLevel, const std::string& textType, const std::string& textPrefix) 
 { 
-	return (mapPrefix_.insert(std::make_pair(nLevel,
-			TraceLogType(nLevel,textType,textPrefix))).second);	
+	CCSLock<CriticalSectionLock> lockGuard(&lockSites_);
+	if (!mapPrefix_.insert(std::make_pair(nLevel, TraceLogType(nLevel,textType,textPrefix))).second)
+		return false;
+
+	// Sites of this level may have been using another type's throttle.
+	::InterlockedIncrement(&throttleGen_);
+	return true;
 
 }// TraceLogger_Base::addType
 
@@ -378,10 +392,50 @@ bool TraceLogger_Base::addType(unsigned long nLevel, const std::string& textType
 /****************************************************************************/
 void TraceLogger_Base::removeType(unsigned long nLevel) 
 { 
-	mapPrefix_.erase(nLevel); /*lint !e534*/ 
+	CCSLock<CriticalSectionLock> lockGuard(&lockSites_);
+	if (mapPrefix_.erase(nLevel) > 0)
+		::InterlockedIncrement(&throttleGen_);
 
 }// TraceLogger_Base::removeType
 
+/*****************************************************************************
+** Procedure:  TraceLogger_Base::set_Throttle
+** 
+** Arguments:  nLevel - Trace Level
+**             nRatePerSec - Maximum sustained traces per second for each
+**                           call site of this level (0 = unlimited)
+**             nBurst - Number of traces a site may emit at once before the
+**                      rate applies (0 = same as the rate)
+**             nSampleEvery - Only emit 1 in N traces from each site 
+**                            (0 or 1 = every trace)
+** 
+** Returns: false if the trace level has not been added
+** 
+** Description: This configures storm protection for a tracing type.
+**              Call sites which exceed the limits drop their traces and
+**              emit a single summary record when they next get through.
+**              A site traced with several level bits uses the type of
+**              its exact level if there is one, otherwise the lowest type
+**              sharing a bit with it.
+**
+/****************************************************************************/
+bool TraceLogger_Base::set_Throttle(unsigned long nLevel, long nRatePerSec, long nBurst, long nSampleEvery)
+{
+	CCSLock<CriticalSectionLock> lockGuard(&lockSites_);
+	std::map<unsigned long, TraceLogType>::iterator it = mapPrefix_.find(nLevel);
+	if (it == mapPrefix_.end())
+		return false;
+
+	it->second.rateLimit_ = (nRatePerSec > 0) ? nRatePerSec : 0;
+	it->second.burst_ = (nBurst > 0) ? nBurst : it->second.rateLimit_;
+	it->second.sampleEvery_ = (nSampleEvery > 1) ? nSampleEvery : 0;
+
+	// Force each site to pick up the new settings on its next trace.
+	::InterlockedIncrement(&throttleGen_);
+	return true;
+
+}// TraceLogger_Base::set_Throttle
+
 /*****************************************************************************
 ** Procedure:  TraceLogger_Base::get_TypeInfo
 ** 
@@ -394,6 +448,7 @@ void TraceLogger_Base::removeType(unsigned long nLevel)
 /****************************************************************************/
 TraceLogType TraceLogger_Base::get_TypeInfo(unsigned long nLevel) const 
 {
+	CCSLock<CriticalSectionLock> lockGuard(&lockSites_);
 	std::map<unsigned long, TraceLogType>::const_iterator it = mapPrefix_.find(nLevel);
 	return (it != mapPrefix_.end()) ? it->second : TraceLogType();
 
@@ -411,6 +466,7 @@ TraceLogType TraceLogger_Base::get_TypeInfo(unsigned long nLevel) const
 /****************************************************************************/
 std::string TraceLogger_Base::get_Prefix(unsigned long nLevel) const 
 {
+	CCSLock<CriticalSectionLock> lockGuard(&lockSites_);
 	std::map<unsigned long, TraceLogType>::const_iterator it = mapPrefix_.find(nLevel);
 	return (it != mapPrefix_.end()) ? it->second.get_Prefix() : std::string();
 
@@ -559,6 +615,315 @@ void TraceLogger_Base::AssertFailed(const char* pszFile, int nLine, const std::s
 
 }// TraceLogger_Base::AssertFailed
 
+/*****************************************************************************
+** Procedure:  TraceLogger_Base::RegisterSite
+** 
+** Arguments:  pSite - Call site reached for the first time
+** 
+** Returns: void 
+** 
+** Description: This links a call site into the site registry and applies
+**              any enable/disable rules which were set before it was hit.
+**
+/****************************************************************************/
+void TraceLogger_Base::RegisterSite(TraceSite* pSite)
+{
+	CCSLock<CriticalSectionLock> lockGuard(&lockSites_);
+	if (pSite->Registered == 0)
+	{
+		ApplySiteRules(pSite);
+		pSite->Next = sitesHead_;
+		sitesHead_ = pSite;
+		::InterlockedExchange(&pSite->Registered, 1);
+	}
+
+}// TraceLogger_Base::RegisterSite
+
+/*****************************************************************************
+** Procedure:  TraceLogger_Base::ApplySiteRules
+** 
+** Arguments:  pSite - Call site to evaluate
+** 
+** Returns: void 
+** 
+** Description: This runs the site rules in the order they were added
+**              and sets the enabled state of the site.  The caller must
+**              hold the site lock.
+**
+/****************************************************************************/
+void TraceLogger_Base::ApplySiteRules(TraceSite* pSite) const
+{
+	long fEnabled = 1;
+	SiteRuleList::const_iterator itEnd = siteRules_.end();
+	for (SiteRuleList::const_iterator it = siteRules_.begin(); it != itEnd; ++it)
+	{
+		if (it->Matches(pSite))
+			fEnabled = (it->Enable) ? 1 : 0;
+	}
+	::InterlockedExchange(&pSite->Enabled, fEnabled);
+
+}// TraceLogger_Base::ApplySiteRules
+
+/*****************************************************************************
+** Procedure:  TraceLogger_Base::EnableSites
+** 
+** Arguments:  nLevel - Trace level (category) to change
+**             fEnable - true to turn the sites on, false to turn them off
+** 
+** Returns: Count of registered sites affected
+** 
+** Description: This turns all call sites for a trace level on or off 
+**              without changing the global trace level.  Level zero 
+**              refers to the JTI_TRACE/JTI_DUMP sites.  The rule is kept
+**              so sites which have not been reached yet pick it up.
+**
+/****************************************************************************/
+int TraceLogger_Base::EnableSites(unsigned long nLevel, bool fEnable)
+{
+	SiteRule rule;
+	rule.ByLevel = true;
+	rule.Level = nLevel;
+	rule.Line = 0;
+	rule.Enable = fEnable;
+
+	int nCount = 0;
+	CCSLock<CriticalSectionLock> lockGuard(&lockSites_);
+	siteRules_.push_back(rule);
+	for (TraceSite* pSite = sitesHead_; pSite != NULL; pSite = pSite->Next)
+	{
+		if (rule.Matches(pSite))
+		{
+			::InterlockedExchange(&pSite->Enabled, (fEnable) ? 1 : 0);
+			++nCount;
+		}
+	}
+	return nCount;
+
+}// TraceLogger_Base::EnableSites
+
+/*****************************************************************************
+** Procedure:  TraceLogger_Base::EnableSites
+** 
+** Arguments:  filePattern - Source file pattern (may include * and ?)
+**             nLine - Line number, zero for all lines in the file
+**             fEnable - true to turn the sites on, false to turn them off
+** 
+** Returns: Count of registered sites affected
+** 
+** Description: This turns specific call sites on or off.  The pattern is
+**              matched against both the full path and the filename.
+**
+/****************************************************************************/
+int TraceLogger_Base::EnableSites(const char* filePattern, int nLine, bool fEnable)
+{
+	if (filePattern == NULL)
+		return 0;
+
+	SiteRule rule;
+	rule.ByLevel = false;
+	rule.Level = 0;
+	rule.FilePattern = filePattern;
+	rule.Line = nLine;
+	rule.Enable = fEnable;
+
+	int nCount = 0;
+	CCSLock<CriticalSectionLock> lockGuard(&lockSites_);
+	siteRules_.push_back(rule);
+	for (TraceSite* pSite = sitesHead_; pSite != NULL; pSite = pSite->Next)
+	{
+		if (rule.Matches(pSite))
+		{
+			::InterlockedExchange(&pSite->Enabled, (fEnable) ? 1 : 0);
+			++nCount;
+		}
+	}
+	return nCount;
+
+}// TraceLogger_Base::EnableSites
+
+/*****************************************************************************
+** Procedure:  TraceLogger_Base::ResetSites
+** 
+** Arguments:  void
+** 
+** Returns: void 
+** 
+** Description: This removes all the site rules and turns every call
+**              site back on.
+**
+/****************************************************************************/
+void TraceLogger_Base::ResetSites()
+{
+	CCSLock<CriticalSectionLock> lockGuard(&lockSites_);
+	siteRules_.clear();
+	for (TraceSite* pSite = sitesHead_; pSite != NULL; pSite = pSite->Next)
+		::InterlockedExchange(&pSite->Enabled, 1);
+
+}// TraceLogger_Base::ResetSites
+
+/*****************************************************************************
+** Procedure:  TraceLogger_Base::RefreshThrottle
+** 
+** Arguments:  pSite - Call site to update
+** 
+** Returns: void 
+** 
+** Description: This copies the throttle settings for the site's trace
+**              level into the site and refills its token bucket.  A site
+**              with several level bits and no type of its own takes the
+**              lowest type sharing a bit with it.
+**
+/****************************************************************************/
+void TraceLogger_Base::RefreshThrottle(TraceSite* pSite)
+{
+	CCSLock<CriticalSectionLock> lockGuard(&lockSites_);
+	long nGen = throttleGen_;
+	if (pSite->ThrottleGen == nGen)
+		return;
+
+	std::map<unsigned long, TraceLogType>::const_iterator it = mapPrefix_.find(pSite->Level);
+	if (it == mapPrefix_.end() && pSite->Level != 0)
+	{
+		for (it = mapPrefix_.begin(); it != mapPrefix_.end(); ++it)
+		{
+			if ((it->first & pSite->Level) != 0)
+				break;
+		}
+	}
+	if (it != mapPrefix_.end())
+	{
+		pSite->RateLimit = it->second.get_RateLimit();
+		pSite->Burst = it->second.get_Burst();
+		pSite->SampleEvery = it->second.get_SampleEvery();
+	}
+	else
+	{
+		pSite->RateLimit = 0;
+		pSite->Burst = 0;
+		pSite->SampleEvery = 0;
+	}
+
+	::InterlockedExchange(&pSite->Tokens, pSite->Burst);
+	::InterlockedExchange(&pSite->LastRefill, static_cast<long>(::GetTickCount()));
+	::InterlockedExchange(&pSite->ThrottleGen, nGen);
+
+}// TraceLogger_Base::RefreshThrottle
+
+/*****************************************************************************
+** Procedure:  TraceLogger_Base::AdmitSite
+** 
+** Arguments:  site - Call site about to trace
+** 
+** Returns: true if the trace should be generated
+** 
+** Description: This applies 1-in-N sampling and the token bucket for a
+**              throttled call site.  Dropped traces are counted so a 
+**              summary can be emitted later.  No locks are taken.
+**
+/****************************************************************************/
+bool TraceLogger_Base::AdmitSite(TraceSite& site)
+{
+	// Sampling - let the first of every N through.
+	if (site.SampleEvery > 1 && 
+		(static_cast<unsigned long>(::InterlockedIncrement(&site.SampleCount)) % static_cast<unsigned long>(site.SampleEvery)) != 1)
+	{
+		::InterlockedIncrement(&site.Suppressed);
+		return false;
+	}
+
+	if (site.RateLimit > 0)
+	{
+		// Refill the bucket based on the time elapsed since the last refill.
+		DWORD dwLast = static_cast<DWORD>(site.LastRefill);
+		DWORD dwNow = ::GetTickCount();
+		ULONGLONG nAdd = (static_cast<ULONGLONG>(dwNow - dwLast) * site.RateLimit) / 1000;
+		if (nAdd > 0)
+		{
+			// Only advance the clock by the time the new tokens account for 
+			// so partial tokens are not lost, unless the bucket overflowed.
+			DWORD dwNext = (nAdd >= static_cast<ULONGLONG>(site.Burst)) ? dwNow :
+				dwLast + static_cast<DWORD>((nAdd * 1000) / site.RateLimit);
+			if (::InterlockedCompareExchange(&site.LastRefill, static_cast<long>(dwNext), 
+					static_cast<long>(dwLast)) == static_cast<long>(dwLast))
+			{
+				for (;;)
+				{
+					long nTokens = site.Tokens;
+					long nNew = (nAdd >= static_cast<ULONGLONG>(site.Burst - nTokens)) ? 
+						site.Burst : nTokens + static_cast<long>(nAdd);
+					if (::InterlockedCompareExchange(&site.Tokens, nNew, nTokens) == nTokens)
+						break;
+				}
+			}
+		}
+
+		// Take a token if one is available.
+		for (;;)
+		{
+			long nTokens = site.Tokens;
+			if (nTokens <= 0)
+			{
+				::InterlockedIncrement(&site.Suppressed);
+				return false;
+			}
+			if (::InterlockedCompareExchange(&site.Tokens, nTokens-1, nTokens) == nTokens)
+				break;
+		}
+	}
+
+	return true;
+
+}// TraceLogger_Base::AdmitSite
+
+/*****************************************************************************
+** Procedure:  TraceLogger_Base::ReportSuppressed
+** 
+** Arguments:  site - Call site which dropped traces
+** 
+** Returns: void 
+** 
+** Description: This emits a single summary record for all the traces a
+**              site has dropped since it last emitted.
+**
+/****************************************************************************/
+void TraceLogger_Base::ReportSuppressed(TraceSite& site)
+{
+	long nCount = ::InterlockedExchange(&site.Suppressed, 0);
+	if (nCount <= 0)
+		return;
+
+	const char* pFile = strrchr(site.File, '\\');
+	std::ostringstream ostm;
+	ostm << "Suppressed " << nCount << " duplicate trace(s) from " 
+		 << ((pFile != NULL) ? pFile+1 : site.File) << " (" << site.Line << ")";
+	InternalTrace(site.Level, ostm.str());
+
+}// TraceLogger_Base::ReportSuppressed
+
+/*****************************************************************************
+** Procedure:  TraceLogger_Base::SiteRule::Matches
+** 
+** Arguments:  pSite - Call site to test
+** 
+** Returns: true if this rule applies to the site
+** 
+** Description: This tests a single site rule against a call site.
+**
+/****************************************************************************/
+bool TraceLogger_Base::SiteRule::Matches(const TraceSite* pSite) const
+{
+	if (ByLevel)
+		return (Level == 0) ? (pSite->Level == 0) : ((pSite->Level & Level) != 0);
+
+	if (Line != 0 && Line != pSite->Line)
+		return false;
+
+	const char* pFile = strrchr(pSite->File, '\\');
+	return (patchk(FilePattern.c_str(), pSite->File) || 
+		(pFile != NULL && patchk(FilePattern.c_str(), pFile+1)));
+
+}// TraceLogger_Base::SiteRule::Matches
+
 /*****************************************************************************
 ** Procedure:  LogHandler::~LogHandler
 ** 
@@ -573,6 +938,54 @@ LogHandler::~LogHandler()
 {
 }// LogHandler::~LogHandler
 
+/*****************************************************************************
+** Procedure:  LogHandler::OnLogBatch
+** 
+** Arguments:  ppElements - Log elements for this handler
+**             nCount - Count of elements
+** 
+** Returns: void 
+** 
+** Description: Default batch handler; this passes each element to the
+**              OnLog or OnAssert override.
+**
+/****************************************************************************/
+void LogHandler::OnLogBatch(const InternalLogElement* const* ppElements, size_t nCount)
+{
+	for (size_t i = 0; i < nCount; ++i)
+		ppElements[i]->Dispatch(*this);
+
+}// LogHandler::OnLogBatch
+
+/*****************************************************************************
+** Procedure:  LogHandler::JoinBatch
+** 
+** Arguments:  ppElements - Log elements to join
+**             nCount - Count of elements
+**             pszEol - Line terminator to place after each element
+**             strOut - Returning string
+** 
+** Returns: void 
+** 
+** Description: This builds a single buffer from a batch of log elements
+**              so a handler can write the batch with one call.
+**
+/****************************************************************************/
+void LogHandler::JoinBatch(const InternalLogElement* const* ppElements, size_t nCount, const char* pszEol, std::string& strOut)
+{
+	size_t nEol = strlen(pszEol), nTotal = 0;
+	for (size_t i = 0; i < nCount; ++i)
+		nTotal += ppElements[i]->ToString().length() + nEol;
+
+	strOut.reserve(strOut.length() + nTotal);
+	for (size_t i = 0; i < nCount; ++i)
+	{
+		strOut += ppElements[i]->ToString();
+		strOut.append(pszEol, nEol);
+	}
+
+}// LogHandler::JoinBatch
+
 /*****************************************************************************
 ** Procedure:  LogHandler::set_LogLevel
 ** 
@@ -615,10 +1028,29 @@ void LogElement::BuildString()
 	BuiltString_.reserve(Text.length() + 75);
 	BuiltString_ = ostm.str();
 	BuiltString_ += TraceLogger::Instance().get_Prefix(TraceLevel);
-	BuiltString_ += Text;
+
+	// Callers which still end their text with std::ends pass a trailing
+	// NUL; it must not reach the joined batches.
+	BuiltString_.append(Text.c_str());
 
 }// LogElement::BuildString
 
+/*****************************************************************************
+** Procedure:  LogElement::Dispatch
+** 
+** Arguments:  handler - Handler to receive the element
+** 
+** Returns: void 
+** 
+** Description: This passes the element to the handler's OnLog
+**
+/****************************************************************************/
+void LogElement::Dispatch(LogHandler& handler) const
+{
+	handler.OnLog(*this);
+
+}// LogElement::Dispatch
+
 /*****************************************************************************
 ** Procedure:  AssertElement::BuildString
 ** 
@@ -644,7 +1076,23 @@ void AssertElement::BuildString()
 
 	BuiltString_.reserve(255 + Text.length());
 	BuiltString_ = ostm.str();
-	BuiltString_ += Text;
+	BuiltString_.append(Text.c_str());
 
 }// AssertElement::BuildString
 
+/*****************************************************************************
+** Procedure:  AssertElement::Dispatch
+** 
+** Arguments:  handler - Handler to receive the element
+** 
+** Returns: void 
+** 
+** Description: This passes the element to the handler's OnAssert
+**
+/****************************************************************************/
+void AssertElement::Dispatch(LogHandler& handler) const
+{
+	handler.OnAssert(*this);
+
+}// AssertElement::Dispatch
+
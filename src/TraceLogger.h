@@ -85,6 +85,8 @@
 
 namespace JTI_Util
 {
+class LogHandler;
+
 /****************************************************************************/
 // InternalLogElement
 //
@@ -116,6 +118,8 @@ public:
 	}
 	virtual ~InternalLogElement() {/* */}
 	virtual const std::string& ToString() const = 0;
+	virtual bool IsForLevel(unsigned long nLogLevel) const = 0;
+	virtual void Dispatch(LogHandler& handler) const = 0;
 };
 
 /****************************************************************************/
@@ -149,6 +153,11 @@ public:
 			const_cast<LogElement*>(this)->BuildString();
 		return BuiltString_;
 	}
+	virtual bool IsForLevel(unsigned long nLogLevel) const
+	{
+		return ((TraceLevel == 0 && nLogLevel > 0) || (TraceLevel & nLogLevel) > 0);
+	}
+	virtual void Dispatch(LogHandler& handler) const;
 private:
 	void BuildString();
 };
@@ -191,6 +200,8 @@ public:
 			const_cast<AssertElement*>(this)->BuildString();
 		return BuiltString_;
 	}
+	virtual bool IsForLevel(unsigned long) const { return true; }
+	virtual void Dispatch(LogHandler& handler) const;
 private:
 	void BuildString();
 };
@@ -199,7 +210,10 @@ private:
 // LogHandler
 //
 // This interface represents the contract which log entry notifications
-// are performed through.
+// are performed through.  The trace runner delivers everything it has 
+// queued as a single batch (already filtered by the handler's log level); 
+// the default OnLogBatch forwards each element to OnLog/OnAssert so 
+// handlers which can write a batch at once should override it.
 //
 *****************************************************************************/
 class LogHandler
@@ -213,6 +227,11 @@ public:
 public:
 	virtual void OnLog(const LogElement&) = 0;
 	virtual void OnAssert(const AssertElement&) = 0;
+	virtual void OnLogBatch(const InternalLogElement* const* ppElements, size_t nCount);
+
+// Helper functions
+protected:
+	static void JoinBatch(const InternalLogElement* const* ppElements, size_t nCount, const char* pszEol, std::string& strOut);
 
 // Properties
 public:
@@ -247,6 +266,13 @@ struct ConsoleLogHandler : public LogHandler
 	{
 		std::cout << ae.ToString().c_str() << std::endl << std::flush;
 	}
+	virtual void OnLogBatch(const InternalLogElement* const* ppElements, size_t nCount)
+	{
+		std::string strBatch;
+		JoinBatch(ppElements, nCount, "\n", strBatch);
+		std::cout.write(strBatch.data(), static_cast<std::streamsize>(strBatch.length()));
+		std::cout << std::flush;
+	}
 };
 #endif
 
@@ -269,6 +295,24 @@ struct ODSLogHandler : public LogHandler
 		::OutputDebugStringA(ae.ToString().c_str()); 
 		::OutputDebugStringA("\r\n");
 	}
+	virtual void OnLogBatch(const InternalLogElement* const* ppElements, size_t nCount)
+	{
+		// Debug monitors only take 4K per call; combine lines up to that.
+		enum { MAX_ODS = 4000 };
+		std::string strBatch;
+		for (size_t i = 0; i < nCount; ++i)
+		{
+			const std::string& strLine = ppElements[i]->ToString();
+			if (!strBatch.empty() && strBatch.length() + strLine.length() + 2 > MAX_ODS) {
+				::OutputDebugStringA(strBatch.c_str());
+				strBatch.resize(0);
+			}
+			strBatch += strLine;
+			strBatch += "\r\n";
+		}
+		if (!strBatch.empty())
+			::OutputDebugStringA(strBatch.c_str());
+	}
 };
 
 /*****************************************************************************
@@ -285,21 +329,28 @@ private:
 	unsigned long traceLevel_;
 	std::string textType_;
 	std::string textPrefix_;
+	long rateLimit_;
+	long burst_;
+	long sampleEvery_;
 
 // Constructor
 private:
 	friend class TraceLogger_Base;
-	TraceLogType() : traceLevel_(0), textType_(""), textPrefix_("") {/* */}
+	TraceLogType() : traceLevel_(0), textType_(""), textPrefix_(""), rateLimit_(0), burst_(0), sampleEvery_(0) {/* */}
 	TraceLogType(unsigned long nLevel, const std::string& textType, const std::string& textPrefix) :
-		traceLevel_(nLevel), textType_(textType), textPrefix_(textPrefix) {/* */}
+		traceLevel_(nLevel), textType_(textType), textPrefix_(textPrefix), rateLimit_(0), burst_(0), sampleEvery_(0) {/* */}
 public:
 	TraceLogType(const TraceLogType& rhs) : 
-		traceLevel_(rhs.traceLevel_), textType_(rhs.textType_), textPrefix_(rhs.textPrefix_) {/* */}
+		traceLevel_(rhs.traceLevel_), textType_(rhs.textType_), textPrefix_(rhs.textPrefix_),
+		rateLimit_(rhs.rateLimit_), burst_(rhs.burst_), sampleEvery_(rhs.sampleEvery_) {/* */}
 	TraceLogType& operator=(const TraceLogType& rhs) {
 		if (this != &rhs) {
 			traceLevel_ = rhs.traceLevel_;
 			textType_ = rhs.textType_;
 			textPrefix_ = rhs.textPrefix_;
+			rateLimit_ = rhs.rateLimit_;
+			burst_ = rhs.burst_;
+			sampleEvery_ = rhs.sampleEvery_;
 		}
 		return *this;
 	}
@@ -309,6 +360,42 @@ public:
 	unsigned long get_TraceLevel() const { return traceLevel_; }
 	const std::string& get_Type() const { return textType_; }
 	const std::string& get_Prefix() const { return textPrefix_; }
+	long get_RateLimit() const { return rateLimit_; }
+	long get_Burst() const { return burst_; }
+	long get_SampleEvery() const { return sampleEvery_; }
+};
+
+/*****************************************************************************
+// TraceSite
+//
+// This structure describes a single trace macro call site.  It is kept
+// as a POD so each macro expansion can declare a statically-initialized
+// instance (no runtime construction); the site is linked into the trace
+// logger's site registry the first time it is reached and from then on
+// may be switched on and off individually or by trace level.
+//
+// The trailing throttle fields are zero-initialized by the macros and
+// filled in from the TraceLogType of the site's level; they hold the
+// per-site token bucket, the 1-in-N sample counter and the count of
+// traces dropped since the site last emitted.
+//
+*****************************************************************************/
+struct TraceSite
+{
+	const char* File;
+	int Line;
+	unsigned long Level;
+	volatile long Enabled;
+	volatile long Registered;
+	TraceSite* Next;
+	volatile long ThrottleGen;
+	long RateLimit;
+	long Burst;
+	long SampleEvery;
+	volatile long Tokens;
+	volatile long LastRefill;
+	volatile long SampleCount;		// read as unsigned so it wraps cleanly
+	volatile long Suppressed;
 };
 
 /*****************************************************************************
@@ -334,11 +421,13 @@ public:
 	// Trace type information
 	bool addType(unsigned long nLevel, const std::string& textType, const std::string& textPrefix = "");
 	void removeType(unsigned long nLevel);
+	bool set_Throttle(unsigned long nLevel, long nRatePerSec, long nBurst = 0, long nSampleEvery = 0);
 	TraceLogType get_TypeInfo(unsigned long nLevel) const;
 	std::string get_Prefix(unsigned long nLevel) const;
 
 	template <class _Ty>
 	void get_Types(_Ty& c) const {
+		CCSLock<CriticalSectionLock> lockGuard(&lockSites_);
 		std::transform(mapPrefix_.begin(), mapPrefix_.end(),
 			std::inserter(c, c.begin()), 
 			stdx::map_adapter_2<unsigned long, TraceLogType>());
@@ -353,6 +442,13 @@ public:
 			InternalTrace(nLevel, stmInfo);
 	}
 
+	// Outputs a trace element for an admitted call site
+	inline void Trace(TraceSite& site, const std::string& stmInfo) {
+		if (site.Suppressed != 0)
+			ReportSuppressed(site);
+		InternalTrace(site.Level, stmInfo);
+	}
+
 	// Dumps the contents of a file to the trace logger.
 	bool DumpFile(unsigned long nLevel, const char* fileName, bool isBinary);
 
@@ -363,9 +459,43 @@ public:
 		InternalHexDump(nLevel,pBuffer,nSize);
 	}
 
+	// Output a hex dump for an admitted call site
+	inline void HexDump(TraceSite& site, const void* pBuffer, int nSize) {
+		if (pBuffer == 0 || nSize == 0)
+			return;
+		if (site.Suppressed != 0)
+			ReportSuppressed(site);
+		InternalHexDump(site.Level,pBuffer,nSize);
+	}
+
 	// Outputs an assert failure
 	void AssertFailed(const char* pszFile, int nLine, const std::string& stmInfo);
 
+	// Tests a call site; registers it on first use and applies any
+	// rate limit or sampling configured for its level.
+	inline bool IsSiteEnabled(TraceSite& site) {
+		if (site.Registered == 0)
+			RegisterSite(&site);
+		if (site.Enabled == 0 ||
+			((site.Level == 0) ? (trcLevel_ == 0) : ((site.Level & trcLevel_) == 0)))
+			return false;
+		if (site.ThrottleGen != throttleGen_)
+			RefreshThrottle(&site);
+		return (site.RateLimit == 0 && site.SampleEvery <= 1) ? true : AdmitSite(site);
+	}
+
+	// Turn call sites on/off by trace level or by file (and line)
+	int EnableSites(unsigned long nLevel, bool fEnable);
+	int EnableSites(const char* filePattern, int nLine, bool fEnable);
+	void ResetSites();
+
+	template <class _Ty>
+	void get_Sites(_Ty& c) const {
+		CCSLock<CriticalSectionLock> lockGuard(&lockSites_);
+		for (const TraceSite* pSite = sitesHead_; pSite != NULL; pSite = pSite->Next)
+			c.push_back(pSite);
+	}
+
 // Property access methods
 public:
 	inline unsigned long get_TraceLevel() const { return trcLevel_; }
@@ -389,10 +519,27 @@ private:
 	static unsigned int __stdcall LogEventHandler(void* lpParameter);
 	void Runner();
 	void DispatchSingle(InternalLogElement* pile);
-	void BroadcastLogEvent(const LogElement* le);
-	void BroadcastAssert(const AssertElement* ae);
+	void DispatchBatch(InternalLogElement* const* ppElements, size_t nCount);
 	void InternalHexDump(unsigned long nLevel, const void* pBuffer, int nSize);
 	void InternalTrace(unsigned long nLevel, const std::string& stmInfo);
+	void RegisterSite(TraceSite* pSite);
+	void ApplySiteRules(TraceSite* pSite) const;
+	void RefreshThrottle(TraceSite* pSite);
+	bool AdmitSite(TraceSite& site);
+	void ReportSuppressed(TraceSite& site);
+
+// Site rules
+private:
+	struct SiteRule
+	{
+		bool ByLevel;
+		unsigned long Level;
+		std::string FilePattern;
+		int Line;
+		bool Enable;
+		bool Matches(const TraceSite* pSite) const;
+	};
+	typedef std::vector<SiteRule> SiteRuleList;
 
 // Unavailable methods
 private:
@@ -403,7 +550,7 @@ private:
 private:
 	unsigned long trcLevel_;
 	typedef std::vector<LogHandler*> LogHandlerList;
-	typedef std::deque<InternalLogElement*> LogElementList;
+	typedef std::vector<InternalLogElement*> LogElementList;
 	LogHandlerList listHandlers_;
 	LogElementList listElements_;
 	EventSynch Stopping_;
@@ -413,6 +560,10 @@ private:
 	MRSWLock lockHandlers_;
 	bool stopOnAssert_;
 	std::map<unsigned long, TraceLogType> mapPrefix_;
+	TraceSite* sitesHead_;
+	SiteRuleList siteRules_;
+	CriticalSectionLock lockSites_;
+	volatile long throttleGen_;
 };
 
 /*****************************************************************************
@@ -425,67 +576,97 @@ typedef Singleton<TraceLogger_Base, 9999, MultiThreadModel> TraceLogger;
 
 } // namespace JTI_Util   
 
-#if defined(DEBUG) || defined(_DEBUG)
-
-#define JTI_TRACE(x) \
-	if (JTI_Util::TraceLogger::Instance().get_TraceLevel()>0) {\
-		std::ostringstream ostm(std::ios::out);\
-		ostm << ##x << std::ends;\
-		JTI_Util::TraceLogger::Instance().Trace(0, ostm.str());\
-	}
-
-#define JTI_TRACEX(l, x) \
-	if ((JTI_Util::TraceLogger::Instance().get_TraceLevel()&l)>0) {\
-		std::ostringstream ostm(std::ios::out);\
-		ostm << ##x << std::ends;\
-		JTI_Util::TraceLogger::Instance().Trace(##l, ostm.str());\
-	}
+/*****************************************************************************
+** JTI_TRACE_COMPILED_LEVELS
+**
+** Trace level bits to compile into the tracing macros; a level with none
+** of these bits is removed entirely (including the stream formatting).
+** The default keeps every level.  JTI_TRACE/JTI_DUMP use level zero and
+** are kept only while every level is.
+**
+/****************************************************************************/
+#ifndef JTI_TRACE_COMPILED_LEVELS
+#define JTI_TRACE_COMPILED_LEVELS 0xffffffff
+#endif
 
-#define JTI_DUMP(p,s) \
-	JTI_Util::TraceLogger::Instance().HexDump(0, p, s);
-   
-#define JTI_DUMPX(l, p, s) \
-	JTI_Util::TraceLogger::Instance().HexDump(l, p, s);
+#define JTI_TRACE_COMPILED(l) ((static_cast<unsigned long>(l) == 0) ? \
+	(static_cast<unsigned long>(JTI_TRACE_COMPILED_LEVELS) == 0xffffffff) : \
+	((static_cast<unsigned long>(l) & static_cast<unsigned long>(JTI_TRACE_COMPILED_LEVELS)) != 0))
+#define JTI_TRACE_SITE(l) { __FILE__, __LINE__, static_cast<unsigned long>(l), 1, 0, NULL }
 
+#if defined(DEBUG) || defined(_DEBUG)
+#define JTI_TRACE_ENABLED
 #else
-
 #ifdef _lint
 #define RELEASE_TRACE
 #endif
-
 #ifdef RELEASE_TRACE
+#define JTI_TRACE_ENABLED
+#endif
+#endif // DEBUG
+
+#ifdef JTI_TRACE_ENABLED
+
+// The level test is a constant expression, so warning C4127 is turned off
+// around each use of the macros rather than for the including file.
+#ifdef _lint
+#define JTI_TRACE_PUSH_WARNINGS
+#define JTI_TRACE_POP_WARNINGS
+#else
+#define JTI_TRACE_PUSH_WARNINGS __pragma(warning(push)) __pragma(warning(disable:4127))
+#define JTI_TRACE_POP_WARNINGS __pragma(warning(pop))
+#endif
 
 #define JTI_TRACE(x) \
-	if (JTI_Util::TraceLogger::Instance().get_TraceLevel()>0) {\
-		std::ostringstream ostm(std::ios::out);\
-		ostm << ##x << std::ends;\
-		JTI_Util::TraceLogger::Instance().Trace(0, ostm.str());\
-	}
+	JTI_TRACE_PUSH_WARNINGS \
+	if (JTI_TRACE_COMPILED(0)) {\
+		static JTI_Util::TraceSite _jtiSite = JTI_TRACE_SITE(0);\
+		if (JTI_Util::TraceLogger::Instance().IsSiteEnabled(_jtiSite)) {\
+			std::ostringstream ostm(std::ios::out);\
+			ostm << ##x;\
+			JTI_Util::TraceLogger::Instance().Trace(_jtiSite, ostm.str());\
+		}\
+	}\
+	JTI_TRACE_POP_WARNINGS
 
 #define JTI_TRACEX(l, x) \
-	if ((JTI_Util::TraceLogger::Instance().get_TraceLevel()&l)>0) {\
-		std::ostringstream ostm(std::ios::out);\
-		ostm << ##x << std::ends;\
-		JTI_Util::TraceLogger::Instance().Trace(##l, ostm.str());\
-	}
+	JTI_TRACE_PUSH_WARNINGS \
+	if (JTI_TRACE_COMPILED(l)) {\
+		static JTI_Util::TraceSite _jtiSite = JTI_TRACE_SITE(l);\
+		if (JTI_Util::TraceLogger::Instance().IsSiteEnabled(_jtiSite)) {\
+			std::ostringstream ostm(std::ios::out);\
+			ostm << ##x;\
+			JTI_Util::TraceLogger::Instance().Trace(_jtiSite, ostm.str());\
+		}\
+	}\
+	JTI_TRACE_POP_WARNINGS
 
 #define JTI_DUMP(p,s) \
-	if (JTI_Util::TraceLogger::Instance().TraceLevel>0) \
-		JTI_Util::TraceLogger::Instance().HexDump(0, p, s);
+	JTI_TRACE_PUSH_WARNINGS \
+	if (JTI_TRACE_COMPILED(0)) {\
+		static JTI_Util::TraceSite _jtiSite = JTI_TRACE_SITE(0);\
+		if (JTI_Util::TraceLogger::Instance().IsSiteEnabled(_jtiSite)) \
+			JTI_Util::TraceLogger::Instance().HexDump(_jtiSite, p, s);\
+	}\
+	JTI_TRACE_POP_WARNINGS
    
 #define JTI_DUMPX(l, p, s) \
-	if ((JTI_Util::TraceLogger::Instance().TraceLevel&l)>0) \
-		JTI_Util::TraceLogger::Instance().HexDump(l, p, s);
+	JTI_TRACE_PUSH_WARNINGS \
+	if (JTI_TRACE_COMPILED(l)) {\
+		static JTI_Util::TraceSite _jtiSite = JTI_TRACE_SITE(l);\
+		if (JTI_Util::TraceLogger::Instance().IsSiteEnabled(_jtiSite)) \
+			JTI_Util::TraceLogger::Instance().HexDump(_jtiSite, p, s);\
+	}\
+	JTI_TRACE_POP_WARNINGS
 
-#else // _TRACE or DEBUG not defined
+#else // JTI_TRACE_ENABLED not defined
 
 #define JTI_TRACE(x)		(__noop)
 #define JTI_TRACEX(l, x)	(__noop)
 #define JTI_DUMP(p,s)		(__noop)
 #define JTI_DUMPX(l,p,s)	(__noop)
 
-#endif // TRACE
-#endif // DEBUG
+#endif // JTI_TRACE_ENABLED
 
 #if defined(DEBUG) || defined(_DEBUG)
 
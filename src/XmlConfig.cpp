@@ -0,0 +1,346 @@
+/****************************************************************************/
+//
+// XmlConfig.cpp
+//
+// This file implements the watching of XML configuration files.
+//
+// Copyright (C) 1998-2003 JulMar Technology, Inc.   All rights reserved
+// This is private property of JulMar Technology, Inc.  It may not be
+// distributed or released without express written permission of
+// JulMar Technology, Inc.
+//
+// You must not remove this notice, or any other, from this software.
+// 
+/****************************************************************************/
+
+/*----------------------------------------------------------------------------
+    INCLUDE FILES
+-----------------------------------------------------------------------------*/
+#include "stdafx.h"
+#include <JTIUtils.h>
+#include "XmlConfig.h"
+#include "FileSystemWatcher.h"
+
+using namespace JTI_Util;
+
+/*----------------------------------------------------------------------------
+	LINT OPTIONS
+-----------------------------------------------------------------------------*/
+//lint -esym(1551, XmlConfigWatch::~XmlConfigWatch) Cannot throw exception
+
+/*****************************************************************************
+** Procedure:  XmlConfigWatch::Create
+** 
+** Arguments:  'pszFile' - Configuration file to watch
+**             'pszSnapshot' - Binary snapshot of the file or NULL
+** 
+** Returns: New watch with a reference count of one, or NULL if the file
+**          could not be read
+** 
+** Description: Loads the file and starts watching it for changes.
+**
+/****************************************************************************/
+XmlConfigWatch* XmlConfigWatch::Create(const char* pszFile, const char* pszSnapshot)
+{
+	XmlNodeStore* pStore = LoadVersion(pszFile, pszSnapshot);
+	if (pStore == NULL)
+		return NULL;
+
+	XmlConfigWatch* pWatch = NULL;
+	try
+	{
+		pWatch = JTI_NEW XmlConfigWatch(pszFile, pszSnapshot, pStore);
+	}
+	catch (...)
+	{
+		pStore->Release();
+		throw;
+	}
+
+	try
+	{
+		// Watch the directory for the file being written or replaced.
+		USES_CONVERSION;
+		char chPath[MAX_PATH]; char* pszName = NULL;
+		if (GetFullPathNameA(pszFile, sizeofarray(chPath), chPath, &pszName) == 0 || pszName == NULL)
+			throw std::runtime_error("Unable to locate XmlConfig file to watch.");
+		std::string sName = pszName; *pszName = '\0';
+
+		pWatch->pWatcher_ = JTI_NEW FileSystemWatcher;
+		pWatch->pWatcher_->Path = A2T(chPath);
+		pWatch->pWatcher_->Filter = A2T(const_cast<char*>(sName.c_str()));
+		pWatch->pWatcher_->NotifyFilter = FileSystemWatcher::LastWrite | FileSystemWatcher::FileName | FileSystemWatcher::FileSize;
+		pWatch->pWatcher_->add_OnChanged(*pWatch, &XmlConfigWatch::OnFileEvent);
+		pWatch->pWatcher_->add_OnCreated(*pWatch, &XmlConfigWatch::OnFileEvent);
+		pWatch->pWatcher_->add_OnRenamed(*pWatch, &XmlConfigWatch::OnFileEvent);
+		pWatch->pWatcher_->EnableRaisingEvents = true;
+	}
+	catch (...)
+	{
+		pWatch->Release();
+		throw;
+	}
+	return pWatch;
+
+}// XmlConfigWatch::Create
+
+/*****************************************************************************
+** Procedure:  XmlConfigWatch::XmlConfigWatch
+** 
+** Arguments:  'pszFile' - Configuration file
+**             'pszSnapshot' - Binary snapshot of the file or NULL
+**             'pStore' - First version of the file
+** 
+** Returns: void
+** 
+** Description: Constructor; takes over the reference to the store.
+**
+/****************************************************************************/
+XmlConfigWatch::XmlConfigWatch(const char* pszFile, const char* pszSnapshot, XmlNodeStore* pStore) :
+	xmlFile_(pszFile), snapshotFile_((pszSnapshot != NULL) ? pszSnapshot : ""), pWatcher_(NULL), pStore_(pStore), 
+	generation_(1), epoch_(0)
+{
+	readers_[0] = readers_[1] = 0;
+	if (pStore->Count > 0)
+		Flatten(*pStore, pStore->Root(), "", values_);
+
+}// XmlConfigWatch::XmlConfigWatch
+
+/*****************************************************************************
+** Procedure:  XmlConfigWatch::~XmlConfigWatch
+** 
+** Arguments:  void
+** 
+** Returns: void
+** 
+** Description: Destructor; stops the watcher thread before the published
+**              version is released.
+**
+/****************************************************************************/
+XmlConfigWatch::~XmlConfigWatch()
+{
+	delete pWatcher_;
+	pStore_->Release();
+
+}// XmlConfigWatch::~XmlConfigWatch
+
+/*****************************************************************************
+** Procedure:  XmlConfigWatch::AcquireStore
+** 
+** Arguments:  void
+** 
+** Returns: Published version with a reference added for the caller
+** 
+** Description: Returns the latest version for use beyond a Reader.
+**
+/****************************************************************************/
+XmlNodeStore* XmlConfigWatch::AcquireStore() const
+{
+	Reader reader(this);
+	reader.Store->AddRef();
+	return const_cast<XmlNodeStore*>(reader.Store);
+
+}// XmlConfigWatch::AcquireStore
+
+/*****************************************************************************
+** Procedure:  XmlConfigWatch::Reload
+** 
+** Arguments:  void
+** 
+** Returns: true if a new version was published
+** 
+** Description: Reads the file again and publishes it if any node differs
+**              from the current version, then tells the listeners which
+**              paths changed.  A file which does not parse, as when it is
+**              still being written, leaves the current version in place;
+**              the next change reads it again.
+**
+/****************************************************************************/
+bool XmlConfigWatch::Reload()
+{
+	std::vector<std::string> changed;
+	{
+		CCSLock<XmlConfigWatch> _lockGuard(this);
+		XmlNodeStore* pStore = NULL;
+		try
+		{
+			pStore = LoadVersion(xmlFile_.c_str(), snapshotFile_.empty() ? NULL : snapshotFile_.c_str());
+		}
+		catch (const std::runtime_error&)
+		{
+			return false;
+		}
+		if (pStore == NULL)
+			return false;
+		if (pStore->Count == 0)
+		{
+			pStore->Release();
+			return false;
+		}
+
+		ValueMap values;
+		Flatten(*pStore, pStore->Root(), "", values);
+
+		// Both maps are ordered by path so one pass finds the differences.
+		ValueMap::const_iterator itThen = values_.begin(), itNow = values.begin();
+		while (itThen != values_.end() || itNow != values.end())
+		{
+			if (itNow == values.end() || (itThen != values_.end() && itThen->first < itNow->first))
+				changed.push_back((itThen++)->first);
+			else if (itThen == values_.end() || itNow->first < itThen->first)
+				changed.push_back((itNow++)->first);
+			else
+			{
+				if (itThen->second != itNow->second)
+					changed.push_back(itNow->first);
+				++itThen; ++itNow;
+			}
+		}
+
+		if (changed.empty())
+		{
+			pStore->Release();
+			return false;
+		}
+		values_.swap(values);
+		Publish(pStore);
+	}
+
+	changedEvent_(XmlConfigChangeEvent(xmlFile_, changed));
+	return true;
+
+}// XmlConfigWatch::Reload
+
+/*****************************************************************************
+** Procedure:  XmlConfigWatch::OnFileEvent
+** 
+** Arguments:  'evt' - File system change
+** 
+** Returns: void
+** 
+** Description: Called on the watcher thread when the file is written,
+**              created or renamed into place.
+**
+/****************************************************************************/
+void XmlConfigWatch::OnFileEvent(FileSystemWatcherEvent /*evt*/)
+{
+	try
+	{
+		Reload();
+	}
+	catch (...)
+	{
+		// Nothing can be reported on the watcher thread; the current
+		// version stays published.
+	}
+
+}// XmlConfigWatch::OnFileEvent
+
+/*****************************************************************************
+** Procedure:  XmlConfigWatch::Publish
+** 
+** Arguments:  'pStore' - New version
+** 
+** Returns: void
+** 
+** Description: Swaps the new version in and releases the old one once no
+**              reader can be using it.  A reader which started before the
+**              swap is counted in the slot the epoch named then; the epoch
+**              is moved on and that slot drained, twice, so readers
+**              counted late in either slot are also done before the release.
+**              New readers are never held up.
+**
+/****************************************************************************/
+void XmlConfigWatch::Publish(XmlNodeStore* pStore)
+{
+	XmlNodeStore* pOld = reinterpret_cast<XmlNodeStore*>(InterlockedExchangePointer(reinterpret_cast<PVOID volatile*>(&pStore_), pStore));
+	InterlockedIncrement(&generation_);
+
+	for (int i = 0; i < 2; ++i)
+	{
+		long nSlot = (epoch_ & 1);
+		InterlockedExchange(&epoch_, nSlot ^ 1);
+		while (readers_[nSlot] != 0)
+			Sleep(0);
+	}
+	pOld->Release();
+
+}// XmlConfigWatch::Publish
+
+/*****************************************************************************
+** Procedure:  XmlConfigWatch::LoadVersion
+** 
+** Arguments:  'pszFile' - Configuration file
+**             'pszSnapshot' - Binary snapshot of the file or NULL
+** 
+** Returns: New store with a reference count of one, or NULL if the file
+**          could not be read
+** 
+** Description: Loads a version of the file which does not keep the file
+**              or its snapshot open, so either can be saved or replaced
+**              while the version is published.  The parse is strict, so a
+**              file cut off part way through an element is refused.
+**
+/****************************************************************************/
+XmlNodeStore* XmlConfigWatch::LoadVersion(const char* pszFile, const char* pszSnapshot)
+{
+	XmlNodeStore* pStore = (pszSnapshot != NULL) ? XmlNodeStore::LoadCached(pszFile, pszSnapshot, 1, true) : XmlNodeStore::Load(pszFile, 1, true);
+	if (pStore != NULL)
+	{
+		try
+		{
+			pStore->Detach();
+		}
+		catch (...)
+		{
+			pStore->Release();
+			throw;
+		}
+	}
+	return pStore;
+
+}// XmlConfigWatch::LoadVersion
+
+/*****************************************************************************
+** Procedure:  XmlConfigWatch::Flatten
+** 
+** Arguments:  'store' - Version of the file
+**             'node' - Node to add with its descendants
+**             'path' - Path of the node's parent
+**             'values' - Returned contents by path
+** 
+** Returns: void
+** 
+** Description: Records the value and attributes of each node by its path.
+**              Only the first of several siblings with one name can be
+**              found by path, so the others are left out.
+**
+/****************************************************************************/
+void XmlConfigWatch::Flatten(const XmlNodeStore& store, XmlNodeStore::Index node, const std::string& path, ValueMap& values)
+{
+	std::string nodePath = path;
+	if (!nodePath.empty())
+		nodePath += '/';
+	nodePath += store.GetName(node);
+
+	std::pair<ValueMap::iterator, bool> result = values.insert(std::make_pair(nodePath, std::string()));
+	if (!result.second)
+		return;
+
+	size_t nLength;
+	const char* pValue = store.GetValue(node, nLength);
+	std::string& contents = result.first->second;
+	contents.assign(pValue, nLength);
+	for (XmlNodeStore::Index attr = 0; attr < store.AttributeCount(node); ++attr)
+	{
+		contents += '\0';
+		contents += store.GetAttributeName(node, attr);
+		contents += '=';
+		pValue = store.GetAttributeValue(node, attr, nLength);
+		contents.append(pValue, nLength);
+	}
+
+	for (XmlNodeStore::Index child = store.FirstChild(node); child != XmlNodeStore::NIL; child = store.NextSibling(child))
+		Flatten(store, child, nodePath, values);
+
+}// XmlConfigWatch::Flatten
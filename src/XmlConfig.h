@@ -15,6 +15,7 @@
 // --------------------------------------------------------------
 // 09/12/2002  MCS   Updated to use new XmlParser class to
 //                   remove the dependancy on MSXML.
+//             Added watching of the file with lock-free readers.
 // 
 /****************************************************************************/
 
@@ -27,15 +28,169 @@
 #include <wtypes.h>
 #include <string>
 #include <sstream>
+#include <vector>
+#include <map>
 #include <JTIUtils.h>
 #include <xmlParser.h>
+#include <Delegates.h>
 
 namespace JTI_Util
 {
+class FileSystemWatcher;
+class FileSystemWatcherEvent;
+
+/****************************************************************************/
+// XmlConfigChangeEvent
+//
+// This class defines the event passed to the listening delegates when a
+// watched configuration file is reloaded.  It holds the paths of the nodes
+// which were added, removed or given a new value or attributes.
+//
+/*****************************************************************************/
+class XmlConfigChangeEvent
+{
+// Constructor
+public:
+	XmlConfigChangeEvent(const std::string& fileName, const std::vector<std::string>& paths) : 
+		fileName_(fileName), paths_(paths) {/* */}
+
+// Properties
+public:
+	__declspec(property(get=get_FileName)) const char* FileName;
+	__declspec(property(get=get_Count)) int Count;
+
+// Accessors
+public:
+	const char* get_FileName() const { return fileName_.c_str(); }
+	int get_Count() const { return static_cast<int>(paths_.size()); }
+	const std::string& operator[](int index) const { return paths_[index]; }
+
+// Internal data
+private:
+	std::string fileName_;
+	std::vector<std::string> paths_;
+};
+
+/****************************************************************************/
+// XmlConfigWatch
+//
+// This class watches a configuration file and parses it again on the
+// watcher's thread when it changes.  Each version is published as a 
+// read-only XmlNodeStore by swapping a pointer, so readers never wait on a
+// reload or on each other.  A replaced version is released once every 
+// reader which might have seen it is done.  Listeners are told which
+// paths changed.  A listener must not destroy the last XmlConfig sharing
+// the watch, since that stops the thread it is called on.
+//
+/*****************************************************************************/
+class XmlConfigWatch : 
+	public RefCountedObject<>,
+	public LockableObject<>
+{
+// Class data
+private:
+	typedef std::map<std::string, std::string> ValueMap;
+	std::string xmlFile_;
+	std::string snapshotFile_;
+	FileSystemWatcher* pWatcher_;
+	XmlNodeStore* volatile pStore_;		// published version
+	ValueMap values_;					// node contents of pStore_ by path
+	volatile long generation_;			// versions published
+	mutable volatile long epoch_;		// slot of readers_ new readers use
+	mutable volatile long readers_[2];	// readers in progress by slot
+	Delegate_1<MultiThreadModel, XmlConfigChangeEvent> changedEvent_;
+
+// Constructor
+public:
+	static XmlConfigWatch* Create(const char* pszFile, const char* pszSnapshot = NULL);
+private:
+	XmlConfigWatch(const char* pszFile, const char* pszSnapshot, XmlNodeStore* pStore);
+	~XmlConfigWatch();
+
+// Reader
+public:
+	// Holds the published version while in scope.  Readers count themselves
+	// in the slot the epoch names; a publish moves the epoch to the other
+	// slot and waits only for those already counted.
+	class Reader
+	{
+	public:
+		Reader(const XmlConfigWatch* pWatch) : pWatch_(pWatch), slot_(pWatch->epoch_ & 1)
+		{
+			InterlockedIncrement(&pWatch_->readers_[slot_]);
+			pStore_ = pWatch_->pStore_;
+		}
+		~Reader() { InterlockedDecrement(&pWatch_->readers_[slot_]); }
+
+		__declspec(property(get=get_Store)) const XmlNodeStore* Store;
+		const XmlNodeStore* get_Store() const { return pStore_; }
+
+	private:
+		const XmlConfigWatch* pWatch_;
+		long slot_;
+		const XmlNodeStore* pStore_;
+		Reader(const Reader&);
+		Reader& operator=(const Reader&);
+	};
+
+// Properties
+public:
+	__declspec(property(get=get_FileName)) const char* FileName;
+	__declspec(property(get=get_Generation)) long Generation;
+
+// Accessors
+public:
+	const char* get_FileName() const { return xmlFile_.c_str(); }
+	long get_Generation() const { return generation_; }
+
+// Delegates
+public:
+	template<class _Object, class _Class>
+	void add_OnChanged(const _Object& object, void (_Class::* fnc)(XmlConfigChangeEvent))
+	{
+		changedEvent_.add(object,fnc);
+	}
+
+	void add_OnChanged(void (*fnc)(XmlConfigChangeEvent))
+	{
+		changedEvent_.add(fnc);
+	}
+
+	template<class _Object, class _Class>
+	void remove_OnChanged(const _Object& object, void (_Class::* fnc)(XmlConfigChangeEvent))
+	{
+		changedEvent_.remove(object,fnc);
+	}
+
+	void remove_OnChanged(void (*fnc)(XmlConfigChangeEvent))
+	{
+		changedEvent_.remove(fnc);
+	}
+
+// Methods
+public:
+	XmlNodeStore* AcquireStore() const;
+	bool Reload();
+
+// Internal methods
+private:
+	void OnFileEvent(FileSystemWatcherEvent evt);
+	void Publish(XmlNodeStore* pStore);
+	static XmlNodeStore* LoadVersion(const char* pszFile, const char* pszSnapshot);
+	static void Flatten(const XmlNodeStore& store, XmlNodeStore::Index node, const std::string& path, ValueMap& values);
+
+// Unavailable methods
+private:
+	XmlConfigWatch(const XmlConfigWatch&);
+	XmlConfigWatch& operator=(const XmlConfigWatch&);
+};
+
 /****************************************************************************/
 // XmlConfig
 //
 // Class used to read and write XML configuration files (ala .INI).
+// A watched configuration reads values from the latest version of its
+// file without locking; copies share the watch.
 //
 /*****************************************************************************/
 class XmlConfig
@@ -43,15 +198,27 @@ class XmlConfig
 // Constructor
 public:
 	XmlConfig(const char* pszSection="") : 
-		isDirty_(false), hasData_(false), xmlSection_(pszSection) {/* */}
-	XmlConfig(const XmlConfig& rhs) : xmlFile_(rhs.xmlFile_), isDirty_(rhs.isDirty_), hasData_(rhs.hasData_), xmlSection_(rhs.xmlSection_), xmlDoc_(rhs.xmlDoc_) {/* */}
+		isDirty_(false), hasData_(false), xmlSection_(pszSection), pWatch_(NULL), watchGeneration_(0) {/* */}
+	XmlConfig(const XmlConfig& rhs) : xmlFile_(rhs.xmlFile_), snapshotFile_(rhs.snapshotFile_), isDirty_(rhs.isDirty_), hasData_(rhs.hasData_), 
+		xmlSection_(rhs.xmlSection_), xmlDoc_(rhs.xmlDoc_), pWatch_(rhs.pWatch_), watchGeneration_(rhs.watchGeneration_) 
+	{
+		if (pWatch_ != NULL)
+			pWatch_->AddRef();
+	}
+	~XmlConfig() { unwatch(); }
 	XmlConfig& operator=(const XmlConfig& rhs) {
 		if (this != &rhs) {
+			if (rhs.pWatch_ != NULL)
+				rhs.pWatch_->AddRef();
+			unwatch();
 			xmlFile_ = rhs.xmlFile_;
+			snapshotFile_ = rhs.snapshotFile_;
 			xmlSection_ = rhs.xmlSection_;
 			isDirty_ = rhs.isDirty_;
 			hasData_ = rhs.hasData_;
 			xmlDoc_ = rhs.xmlDoc_;
+			pWatch_ = rhs.pWatch_;
+			watchGeneration_ = rhs.watchGeneration_;
 		}
 		return *this;
 	}
@@ -63,17 +230,19 @@ public:
 	__declspec(property(get=get_hasData)) bool HasData;
 	__declspec(property(get=get_Text,put=set_Text)) std::string XmlText;
 	__declspec(property(get=get_Filename)) const char* FileName;
+	__declspec(property(get=get_IsWatching)) bool IsWatching;
 
 // Access methods
 public:
-	const std::string& get_Root() const { return xmlDoc_.RootNode.Name; }
-	void set_Root(const char* pszRoot) { xmlDoc_.RootNode.Name = pszRoot; }
+	const std::string& get_Root() const { SyncDocument(); return xmlDoc_.RootNode.Name; }
+	void set_Root(const char* pszRoot) { SyncDocument(); xmlDoc_.RootNode.Name = pszRoot; KeepChanges(); }
 
 	const std::string& get_AppName() const { return xmlSection_; }
 	void set_AppName(const char* pszRoot) { xmlSection_ = pszRoot; }
 
 	bool get_hasData() const { return hasData_; }
-	std::string get_Text() const { return (hasData_) ? xmlDoc_.XmlText : ""; }
+	bool get_IsWatching() const { return pWatch_ != NULL; }
+	std::string get_Text() const { SyncDocument(); return (hasData_) ? xmlDoc_.XmlText : ""; }
 	bool set_Text(const char* pszXML) 
 	{ 
 		try
@@ -84,6 +253,7 @@ public:
 		{
 			return false;
 		}
+		KeepChanges();
 		return true;
 	}
 
@@ -91,7 +261,14 @@ public:
 	{
 		try
 		{
-			return (xmlDoc_.find(BuildNodeName(pszSection, pszKey).c_str()).IsValid);
+			if (pWatch_ != NULL && !isDirty_)
+			{
+				bool fFound;
+				GetValue(pszSection, pszKey, fFound);
+				return fFound;
+			}
+			SyncDocument();
+			return (xmlDoc_.find(BuildNodePath(pszSection, pszKey)).IsValid);
 		}
 		catch(const std::runtime_error&)
 		{
@@ -210,58 +387,166 @@ public:
 	{ 
 		if (pszXmlFile)
 			xmlFile_ = pszXmlFile;
-		return (isDirty_) ? xmlDoc_.save(xmlFile_.c_str()) : false; 
+		bool fSaved = (isDirty_) ? xmlDoc_.save(xmlFile_.c_str()) : false; 
+
+		// A watched document follows the file again once it is saved.
+		if (fSaved && pWatch_ != NULL)
+			isDirty_ = false;
+		return fSaved;
 	}
 
-	bool load(const char* pszXmlFile) 
+	// A snapshot file, if given, is loaded in place of the XML while the
+	// XML is unchanged and rebuilt when it is not.
+	bool load(const char* pszXmlFile, const char* pszSnapshot = NULL) 
 	{ 
+		unwatch();
 		xmlFile_ = pszXmlFile; 
-		hasData_ = (xmlDoc_.load(xmlFile_.c_str()) && xmlDoc_.RootNode.IsValid);
+		snapshotFile_ = (pszSnapshot != NULL) ? pszSnapshot : "";
+		bool fLoaded = (pszSnapshot != NULL) ? xmlDoc_.load(xmlFile_.c_str(), pszSnapshot) : xmlDoc_.load(xmlFile_.c_str());
+		hasData_ = (fLoaded && xmlDoc_.RootNode.IsValid);
         return hasData_;
 	}
 
+	// Watches the loaded file and rereads it whenever it changes.  Values
+	// are then read from the latest version.  Once changes are made here,
+	// values are read from this document and it is not refreshed until
+	// it is saved; other readers see the changes once saved.
+	bool watch()
+	{
+		if (pWatch_ != NULL)
+			return true;
+		if (xmlFile_.empty())
+			return false;
+		pWatch_ = XmlConfigWatch::Create(xmlFile_.c_str(), snapshotFile_.empty() ? NULL : snapshotFile_.c_str());
+		watchGeneration_ = (pWatch_ != NULL) ? pWatch_->Generation : 0;
+		return (pWatch_ != NULL);
+	}
+
+	void unwatch()
+	{
+		if (pWatch_ != NULL)
+		{
+			pWatch_->Release();
+			pWatch_ = NULL;
+		}
+	}
+
+// Delegates
+public:
+	template<class _Object, class _Class>
+	void add_OnChanged(const _Object& object, void (_Class::* fnc)(XmlConfigChangeEvent))
+	{
+		GetWatch().add_OnChanged(object, fnc);
+	}
+
+	void add_OnChanged(void (*fnc)(XmlConfigChangeEvent))
+	{
+		GetWatch().add_OnChanged(fnc);
+	}
+
+	template<class _Object, class _Class>
+	void remove_OnChanged(const _Object& object, void (_Class::* fnc)(XmlConfigChangeEvent))
+	{
+		GetWatch().remove_OnChanged(object, fnc);
+	}
+
+	void remove_OnChanged(void (*fnc)(XmlConfigChangeEvent))
+	{
+		GetWatch().remove_OnChanged(fnc);
+	}
+
 // Internal methods
 private:
-	std::string BuildNodeName(const char* pszSection, const char* pszKey) const
+	XmlPath BuildNodePath(const char* pszSection, const char* pszKey) const
+	{
+		return BuildNodePath(xmlDoc_.RootNode.IsValid ? xmlDoc_.RootNode.Name.c_str() : NULL, pszSection, pszKey);
+	}
+
+	XmlPath BuildNodePath(const char* pszRoot, const char* pszSection, const char* pszKey) const
 	{
-		if (!xmlDoc_.RootNode.IsValid)
+		if (pszRoot == NULL)
 		{
 			std::string s = "Configuration Root node not assigned (";
 			s += + pszSection; s += "/"; s += pszKey; s += ")";
 			throw std::runtime_error(s);
 		}
 
-		std::ostringstream ostm;
-		ostm << "/" << xmlDoc_.RootNode.Name << "/";
+		XmlPath path(pszRoot);
 		if (!xmlSection_.empty())
-			ostm << xmlSection_ << "/";
+			path.Append(xmlSection_.c_str());
 		if (pszSection != NULL)
-			ostm << pszSection << "/";
-		ostm << pszKey;
-		return ostm.str();
+			path.Append(pszSection);
+		path.Append(pszKey);
+		return path;
 	}
 
+	// A watched file is read without locking unless this document holds
+	// unsaved changes.
 	std::string GetValue(const char* pszSection, const char* pszKey, bool& fFound) const
 	{
-		XmlNode node = xmlDoc_.find(BuildNodeName(pszSection, pszKey).c_str());
+		if (pWatch_ != NULL && !isDirty_)
+		{
+			XmlConfigWatch::Reader reader(pWatch_);
+			const XmlNodeStore* pStore = reader.Store;
+			XmlNodeStore::Index found = pStore->FindPath(BuildNodePath((pStore->Count > 0) ? pStore->GetName(pStore->Root()) : NULL, pszSection, pszKey));
+			fFound = (found != XmlNodeStore::NIL);
+			if (!fFound)
+				return "";
+			size_t nLength;
+			const char* pValue = pStore->GetValue(found, nLength);
+			return std::string(pValue, nLength);
+		}
+
+		SyncDocument();
+		XmlNode node = xmlDoc_.find(BuildNodePath(pszSection, pszKey));
 		fFound = (node.IsValid);
 		return node.Value;
 	}
 
 	bool SetValue(const char* pszSection, const char* pszKey, const char* pszValue)
 	{
-		XmlNode node = xmlDoc_.create(BuildNodeName(pszSection, pszKey).c_str());
+		SyncDocument();
+		XmlNode node = xmlDoc_.create(BuildNodePath(pszSection, pszKey));
 		node.Value = pszValue;
 		isDirty_ = true;
 		return true;
 	}
 
+	// Keeps a change to a watched document in place of the file's later
+	// versions until it is saved.
+	void KeepChanges()
+	{
+		if (pWatch_ != NULL)
+			isDirty_ = true;
+	}
+
+	// Brings the document up to the latest version of a watched file
+	// unless it has unsaved changes.
+	void SyncDocument() const
+	{
+		if (pWatch_ != NULL && !isDirty_ && watchGeneration_ != pWatch_->Generation)
+		{
+			watchGeneration_ = pWatch_->Generation;
+			xmlDoc_ = XmlDocument(pWatch_->AcquireStore());
+		}
+	}
+
+	XmlConfigWatch& GetWatch() const
+	{
+		if (pWatch_ == NULL)
+			throw std::runtime_error("XmlConfig is not watching a file.");
+		return *pWatch_;
+	}
+
 // Class data
 private:
 	mutable XmlDocument xmlDoc_;
 	std::string xmlFile_;
+	std::string snapshotFile_;
 	std::string xmlSection_;
 	bool isDirty_, hasData_;
+	XmlConfigWatch* pWatch_;
+	mutable long watchGeneration_;		// version of the watched file in xmlDoc_
 };
 
 }// namespace JTI_Util
@@ -30,902 +30,3899 @@
 #include <sstream>
 #include "stlx.h"
 #include "XmlParser.h"
+#include "binstream.h"
+#include "filestream.h"
+#include "MemoryMappedFile.h"
+#include "WorkerThreadPool.h"
 
 using namespace JTI_Util;
 
 /*----------------------------------------------------------------------------
 	CONSTANTS
 -----------------------------------------------------------------------------*/
-enum XmlTagType
-{
-	TT_ANY,
-	TT_INVALID,
-	TT_OPEN_TAG,
-	TT_OPEN_ENDTAG,
-	TT_CLOSE_TAG,
-	TT_CLOSE_ENDTAG,
-	TT_PI_TAG,
-	TT_PI_ENDTAG,
-	TT_COMMENT_TAG,
-	TT_COMMENT_ENDTAG,
-	TT_MARKUP_TAG,
-	TT_EQUAL_SIGN,
-	TT_QUOTE,
-	TT_SINGLEQUOTE,
-	TT_TEXT
+// The SSE2 scanner needs the intrinsics shipped with VS2005 and later;
+// other compilers (or JTI_XML_NO_SIMD) use the scalar loop.
+#if !defined(JTI_XML_NO_SIMD) && defined(_MSC_VER) && (_MSC_VER >= 1400) && (defined(_M_IX86) || defined(_M_X64))
+#define JTI_XML_SSE2
+#include <intrin.h>
+#include <emmintrin.h>
+#endif
+
+// Character classes used by the scanner
+enum
+{
+	CC_SPACE	= 0x01,		// whitespace
+	CC_NAMEEND	= 0x02,		// ends a name or unquoted value ('/' and '?' only before '>')
+	CC_ESCAPE	= 0x04		// must be escaped when rendered
 };
 
 /*----------------------------------------------------------------------------
 	GLOBALS
 -----------------------------------------------------------------------------*/
-static struct {
-	const char* pszTag;
-	int size;
-	XmlTagType id;
-} gTags[] = 
-{
-	{ "</",	2, TT_CLOSE_TAG },
-	{ "/>", 2, TT_CLOSE_ENDTAG },
-	{ "<?", 2, TT_PI_TAG },
-	{ "?>", 2, TT_PI_ENDTAG },
-	{ "-->", 3, TT_COMMENT_ENDTAG },
-	{ "<!--", 3, TT_COMMENT_TAG },
-	{ "<!", 2, TT_MARKUP_TAG },
-	{ "<",	1, TT_OPEN_TAG },
-	{ ">",	1, TT_OPEN_ENDTAG },
-	{ "=",	1, TT_EQUAL_SIGN },
-	{ "\"",	1, TT_QUOTE },
-	{ "'",	1, TT_SINGLEQUOTE }
+static struct CharClassTable
+{
+	unsigned char cls[256];
+	CharClassTable()
+	{
+		memset(cls, 0, sizeof(cls));
+		const char* pszSpace = " \t\r\n\v\f";
+		for (const char* p = pszSpace; *p; ++p)
+			cls[static_cast<unsigned char>(*p)] |= CC_SPACE | CC_NAMEEND;
+		const char* pszNameEnd = "<>=\"'/?";
+		for (const char* p = pszNameEnd; *p; ++p)
+			cls[static_cast<unsigned char>(*p)] |= CC_NAMEEND;
+		cls['&'] |= CC_ESCAPE; cls['<'] |= CC_ESCAPE; cls['>'] |= CC_ESCAPE;
+	}
+} gCharClass;
+
+/*****************************************************************************
+** Procedure:  HasSse2
+**
+** Arguments:  void
+**
+** Returns: true if the SSE2 scanner may be used
+**
+** Description: Tests the processor once; every x64 processor has SSE2.
+**
+/****************************************************************************/
+static bool HasSse2()
+{
+#if defined(JTI_XML_SSE2) && defined(_M_X64)
+	return true;
+#elif defined(JTI_XML_SSE2)
+	static volatile long hasSse2 = -1;
+	if (hasSse2 < 0)
+	{
+		int cpuInfo[4];
+		__cpuid(cpuInfo, 1);
+		::InterlockedExchange(&hasSse2, ((cpuInfo[3] & (1 << 26)) != 0) ? 1 : 0);
+	}
+	return (hasSse2 != 0);
+#else
+	return false;
+#endif
+
+}// HasSse2
+
+/*****************************************************************************
+** Procedure:  FindEither
+**
+** Arguments:  'p' - Start of the range to search
+**             'pEnd' - End of the range
+**             'ch1', 'ch2' - Characters to look for
+**
+** Returns: First position holding either character, or pEnd
+**
+** Description: Scans for the characters which end a run of text or a
+**              quoted value, sixteen bytes at a time where possible.
+**
+/****************************************************************************/
+static const char* FindEither(const char* p, const char* pEnd, char ch1, char ch2)
+{
+#ifdef JTI_XML_SSE2
+	if (pEnd - p >= 16 && HasSse2())
+	{
+		const __m128i v1 = _mm_set1_epi8(ch1), v2 = _mm_set1_epi8(ch2);
+		for (; pEnd - p >= 16; p += 16)
+		{
+			__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, v1), _mm_cmpeq_epi8(chunk, v2)));
+			if (mask != 0)
+			{
+				unsigned long nIndex;
+				_BitScanForward(&nIndex, static_cast<unsigned long>(mask));
+				return p + nIndex;
+			}
+		}
+	}
+#endif
+	while (p < pEnd && *p != ch1 && *p != ch2)
+		++p;
+	return p;
+
+}// FindEither
+
+/*****************************************************************************
+** Procedure:  FindSequence
+**
+** Arguments:  'p' - Start of the range to search
+**             'pEnd' - End of the range
+**             'pszSeq' - Characters to look for
+**
+** Returns: Position of the sequence, or NULL
+**
+** Description: Locates the terminator of a comment, PI or CDATA section.
+**
+/****************************************************************************/
+static const char* FindSequence(const char* p, const char* pEnd, const char* pszSeq)
+{
+	size_t nLen = strlen(pszSeq);
+	while (static_cast<size_t>(pEnd - p) >= nLen)
+	{
+		p = static_cast<const char*>(memchr(p, pszSeq[0], (pEnd - p) - nLen + 1));
+		if (p == NULL)
+			break;
+		if (!memcmp(p, pszSeq, nLen))
+			return p;
+		++p;
+	}
+	return NULL;
+
+}// FindSequence
+
+/*****************************************************************************
+** Procedure:  FindEscape
+**
+** Arguments:  'p' - Start of the range to search
+**             'pEnd' - End of the range
+**             'chQuote' - Quote around an attribute value, or '\0' for text
+**
+** Returns: First character which must be escaped, or pEnd
+**
+** Description: Scans text being written for '&', '<', '>' or the quote,
+**              sixteen bytes at a time where possible.
+**
+/****************************************************************************/
+static const char* FindEscape(const char* p, const char* pEnd, char chQuote)
+{
+#ifdef JTI_XML_SSE2
+	if (pEnd - p >= 16 && HasSse2())
+	{
+		const __m128i vAmp = _mm_set1_epi8('&'), vLess = _mm_set1_epi8('<'), vGreater = _mm_set1_epi8('>');
+		const __m128i vQuote = _mm_set1_epi8((chQuote != '\0') ? chQuote : '&');
+		for (; pEnd - p >= 16; p += 16)
+		{
+			__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			__m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, vAmp), _mm_cmpeq_epi8(chunk, vLess)),
+										_mm_or_si128(_mm_cmpeq_epi8(chunk, vGreater), _mm_cmpeq_epi8(chunk, vQuote)));
+			int mask = _mm_movemask_epi8(hits);
+			if (mask != 0)
+			{
+				unsigned long nIndex;
+				_BitScanForward(&nIndex, static_cast<unsigned long>(mask));
+				return p + nIndex;
+			}
+		}
+	}
+#endif
+	while (p < pEnd && (gCharClass.cls[static_cast<unsigned char>(*p)] & CC_ESCAPE) == 0 && (*p != chQuote || chQuote == '\0'))
+		++p;
+	return p;
+
+}// FindEscape
+
+/*****************************************************************************
+** Procedure:  IsSpace
+**
+** Arguments:  'p' - Start of the range to test
+**             'pEnd' - End of the range
+**
+** Returns: true if the range holds only whitespace
+**
+/****************************************************************************/
+static bool IsSpace(const char* p, const char* pEnd)
+{
+	for (; p < pEnd; ++p)
+	{
+		if ((gCharClass.cls[static_cast<unsigned char>(*p)] & CC_SPACE) == 0)
+			return false;
+	}
+	return true;
+
+}// IsSpace
+
+/*****************************************************************************
+** Procedure:  SplitElements
+**
+** Arguments:  'p' - Start of the document
+**             'pEnd' - End of the document
+**             'nParts' - Number of parts wanted
+**             'splits' - Returned start tags the parts begin at
+**
+** Returns: End tag of the root element, or NULL if the document cannot be
+**          split
+**
+** Description: A quick structural pass which follows only the nesting of
+**              elements.  Comments, processing instructions, CDATA, quoted
+**              attribute values and text are skipped the way the parser
+**              reads them.  A part begins at the first element of the root
+**              found after each nLength/nParts bytes.  The parts are checked
+**              when they are parsed, so a document this pass misreads is
+**              only parsed again on one thread.
+**
+/****************************************************************************/
+static const char* SplitElements(const char* p, const char* pEnd, size_t nParts, std::vector<const char*>& splits)
+{
+	const size_t nPartSize = (pEnd - p) / nParts;
+	const char* pNext = p + nPartSize;
+	size_t depth = 0;
+	bool fTextAllowed = false;
+
+	while (p < pEnd)
+	{
+		if (gCharClass.cls[static_cast<unsigned char>(*p)] & CC_SPACE)
+		{
+			++p;
+			continue;
+		}
+
+		// Text runs to the next end tag.
+		if (*p != '<')
+		{
+			if (!fTextAllowed)
+				return NULL;
+			for (;;)
+			{
+				p = FindEither(p, pEnd, '<', '<');
+				if (pEnd - p < 2)
+					return NULL;
+				if (p[1] == '/')
+					break;
+				++p;
+			}
+			fTextAllowed = false;
+			continue;
+		}
+
+		if (pEnd - p < 2)
+			return NULL;
+		const char* pStop = NULL;
+		size_t nStop = 1;		// length of the terminator
+		if (p[1] == '/')
+		{
+			if (depth == 0)
+				return NULL;
+			if (--depth == 0)
+				return (splits.empty()) ? NULL : p;
+			pStop = static_cast<const char*>(memchr(p, '>', pEnd - p));
+		}
+		else if (p[1] == '?')
+		{
+			pStop = FindSequence(p + 2, pEnd, "?>");
+			nStop = 2;
+		}
+		else if (pEnd - p >= 4 && !memcmp(p, "<!--", 4))
+		{
+			pStop = FindSequence(p + 4, pEnd, "-->");
+			nStop = 3;
+		}
+		else if (pEnd - p >= 9 && !memcmp(p, "<![CDATA[", 9))
+		{
+			pStop = FindSequence(p + 9, pEnd, "]]>");
+			nStop = 3;
+		}
+		else if (p[1] == '!')
+			pStop = static_cast<const char*>(memchr(p, '>', pEnd - p));
+		else
+		{
+			// Start tag
+			if (depth == 1 && p >= pNext && splits.size() + 1 < nParts)
+			{
+				splits.push_back(p);
+				pNext = p + nPartSize;
+			}
+			for (pStop = p + 1; pStop < pEnd && *pStop != '>'; ++pStop)
+			{
+				if (*pStop == '"' || *pStop == '\'')
+				{
+					pStop = static_cast<const char*>(memchr(pStop + 1, *pStop, pEnd - pStop - 1));
+					if (pStop == NULL)
+						return NULL;
+				}
+			}
+			if (pStop == pEnd)
+				return NULL;
+			fTextAllowed = (pStop[-1] != '/');
+			if (fTextAllowed)
+				++depth;
+			p = pStop + 1;
+			continue;
+		}
+
+		if (pStop == NULL)
+			return NULL;
+		p = pStop + nStop;
+		fTextAllowed = false;
+	}
+	return NULL;
+
+}// SplitElements
+
+/*****************************************************************************
+** Procedure:  AppendUtf8
+**
+** Arguments:  'out' - String or vector to append to
+**             'ch' - Code point
+**
+** Returns: void
+**
+** Description: Appends a code point encoded as UTF-8.
+**
+/****************************************************************************/
+template <class _Out>
+static void AppendUtf8(_Out& out, unsigned long ch)
+{
+	if (ch < 0x80)
+		out.push_back(static_cast<char>(ch));
+	else if (ch < 0x800)
+	{
+		out.push_back(static_cast<char>(0xc0 | (ch >> 6)));
+		out.push_back(static_cast<char>(0x80 | (ch & 0x3f)));
+	}
+	else if (ch < 0x10000)
+	{
+		out.push_back(static_cast<char>(0xe0 | (ch >> 12)));
+		out.push_back(static_cast<char>(0x80 | ((ch >> 6) & 0x3f)));
+		out.push_back(static_cast<char>(0x80 | (ch & 0x3f)));
+	}
+	else
+	{
+		out.push_back(static_cast<char>(0xf0 | (ch >> 18)));
+		out.push_back(static_cast<char>(0x80 | ((ch >> 12) & 0x3f)));
+		out.push_back(static_cast<char>(0x80 | ((ch >> 6) & 0x3f)));
+		out.push_back(static_cast<char>(0x80 | (ch & 0x3f)));
+	}
+
+}// AppendUtf8
+
+/*****************************************************************************
+** Procedure:  ConvertToUtf8
+**
+** Arguments:  'p' - UTF-16 or UTF-32 text without its byte order mark
+**             'nLength' - Length in bytes
+**             'nUnit' - 2 or 4 bytes per code unit
+**             'fBigEndian' - Byte order of the code units
+**             'out' - Returned UTF-8 text
+**
+** Returns: void
+**
+** Description: Converts a document stored in a wide encoding.  Unpaired
+**              surrogates and invalid code points become U+FFFD.
+**
+/****************************************************************************/
+static void ConvertToUtf8(const unsigned char* p, size_t nLength, size_t nUnit, bool fBigEndian, std::vector<char>& out)
+{
+	out.clear();
+	out.reserve(nLength);
+	const unsigned char* pEnd = p + (nLength - nLength % nUnit);
+	while (p < pEnd)
+	{
+		unsigned long ch = 0;
+		for (size_t i = 0; i < nUnit; ++i)
+			ch |= static_cast<unsigned long>(p[i]) << (fBigEndian ? 8 * (nUnit - 1 - i) : 8 * i);
+		p += nUnit;
+
+		if (nUnit == 2 && ch >= 0xd800 && ch < 0xdc00 && p < pEnd)
+		{
+			unsigned long chLow = fBigEndian ? ((p[0] << 8) | p[1]) : ((p[1] << 8) | p[0]);
+			if (chLow >= 0xdc00 && chLow < 0xe000)
+			{
+				ch = 0x10000 + ((ch - 0xd800) << 10) + (chLow - 0xdc00);
+				p += 2;
+			}
+		}
+		if ((ch >= 0xd800 && ch < 0xe000) || ch > 0x10ffff)
+			ch = 0xfffd;
+		AppendUtf8(out, ch);
+	}
+
+}// ConvertToUtf8
+
+/*****************************************************************************
+** Procedure:  GetFileStamp
+**
+** Arguments: 'pszFile' - File to examine
+**            'nSize' - Returned size of the file
+**            'nTime' - Returned last write time
+**
+** Returns: true if the file exists
+**
+** Description: Reads the size and time of a file without opening it.
+**
+/****************************************************************************/
+static bool GetFileStamp(const char* pszFile, unsigned __int64& nSize, unsigned __int64& nTime)
+{
+	USES_CONVERSION;
+	WIN32_FILE_ATTRIBUTE_DATA fad;
+	if (!GetFileAttributesEx(A2T(const_cast<char*>(pszFile)), GetFileExInfoStandard, &fad))
+		return false;
+	nSize = (static_cast<unsigned __int64>(fad.nFileSizeHigh) << 32) | fad.nFileSizeLow;
+	nTime = (static_cast<unsigned __int64>(fad.ftLastWriteTime.dwHighDateTime) << 32) | fad.ftLastWriteTime.dwLowDateTime;
+	return true;
+
+}// GetFileStamp
+
+/*****************************************************************************
+** Procedure:  HashFile
+**
+** Arguments: 'pszFile' - File to hash
+**            'nHash' - Returned hash
+**
+** Returns: true if the file could be mapped
+**
+** Description: Hashes the contents of a file with XmlPath::HashText.
+**
+/****************************************************************************/
+static bool HashFile(const char* pszFile, unsigned long& nHash)
+{
+	MemoryMappedFile mmf(pszFile, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN);
+	if (!mmf.IsValid)
+		return false;
+	nHash = XmlPath::HashText(static_cast<const char*>(mmf.Buffer), mmf.Length);
+	return true;
+
+}// HashFile
+
+/*****************************************************************************
+** Procedure:  WriteArray
+**
+** Arguments: 'stm' - Stream to write to
+**            'arr' - Records to write
+**
+** Returns: true if written
+**
+** Description: Writes the records of a vector as a block.
+**
+/****************************************************************************/
+template <class _T>
+static bool WriteArray(binstream& stm, const std::vector<_T>& arr)
+{
+	return arr.empty() || stm.write(&arr[0], static_cast<unsigned int>(arr.size() * sizeof(_T)));
+
+}// WriteArray
+
+namespace JTI_Util
+{
+/******************************************************************************/
+// DocumentSplit
+//
+// A document divided at elements of its root so the parts can be parsed on
+// worker threads.  The calling thread reads everything before the first
+// part and from the root's end tag on, and joins the parts to the root in
+// between.  Destroying the split waits for any part still being parsed.
+//
+/******************************************************************************/
+class DocumentSplit;
+struct DocumentPart
+{
+	const char* pStart;
+	const char* pEnd;
+	XmlNodeStore* pStore;				// elements and comments of the part
+	XmlNodeStore::Index firstComment;	// comments outside those elements
+	bool fFailed;
+	DocumentSplit* pSplit;
+};
+
+class DocumentSplit
+{
+// Class data
+public:
+	const XmlNodeStore* pOwner_;		// store the parts are joined into
+	std::vector<DocumentPart> parts_;
+	const char* pRootEnd_;				// end tag of the root
+	const char* pEnd_;
+private:
+	volatile long remaining_;
+	EventSynch evtDone_;
+
+// Constructor
+public:
+	DocumentSplit(const XmlNodeStore* pOwner) : pOwner_(pOwner), pRootEnd_(NULL), pEnd_(NULL), remaining_(0), evtDone_(true, true) {/* */}
+	~DocumentSplit()
+	{
+		Wait();
+		for (std::vector<DocumentPart>::iterator it = parts_.begin(); it != parts_.end(); ++it)
+		{
+			if (it->pStore != NULL)
+				it->pStore->Release();
+		}
+	}
+
+// Methods
+public:
+	bool Prepare(const char* pData, size_t nLength, size_t nParts)
+	{
+		std::vector<const char*> splits;
+		pEnd_ = pData + nLength;
+		pRootEnd_ = SplitElements(pData, pEnd_, nParts, splits);
+		if (pRootEnd_ == NULL)
+			return false;
+
+		parts_.resize(splits.size());
+		for (size_t i = 0; i < splits.size(); ++i)
+		{
+			DocumentPart part = { splits[i], (i + 1 < splits.size()) ? splits[i+1] : pRootEnd_, NULL, XmlNodeStore::NIL, false, this };
+			parts_[i] = part;
+		}
+		return true;
+	}
+	// Hands each part to the pool; those it will not take are marked failed.
+	void Start(WorkerThreadPool<>& pool, void (*fnc)(ULONG_PTR))
+	{
+		remaining_ = static_cast<long>(parts_.size());
+		evtDone_.ResetEvent();
+		for (std::vector<DocumentPart>::iterator it = parts_.begin(); it != parts_.end(); ++it)
+		{
+			if (!pool.QueueUserWorkItem(fnc, reinterpret_cast<ULONG_PTR>(&*it)))
+			{
+				it->fFailed = true;
+				PartDone();
+			}
+		}
+	}
+	const char* get_HeadEnd() const { return parts_.front().pStart; }
+	void PartDone() { if (InterlockedDecrement(&remaining_) == 0) evtDone_.SetEvent(); }
+	void Wait() const { evtDone_.Wait(); }
+
+// Unavailable methods
+private:
+	DocumentSplit(const DocumentSplit&);
+	DocumentSplit& operator=(const DocumentSplit&);
 };
-const int TAG_COUNT = sizeofarray(gTags);
 
 /******************************************************************************/
 // InternalParser
 //
-// This class provides the parser support to read an XML document.
+// This class provides the parser support to read an XML document.  It is a
+// pull scanner: each call to Next() returns the next start tag, attribute,
+// text, comment or end tag as slices of the source buffer, which is never
+// modified or copied.  Strings are only built when the caller materializes
+// a slice.  Only the root element is read; anything after it is ignored.
+//
+// The buffer may hold just part of the document.  Unless it is marked as
+// the final part, an item cut off by the end of the buffer is returned as
+// EV_MORE with the position left at its start; the caller then supplies
+// that remainder followed by more data through Refill().  A fragment is a
+// run of sibling elements cut from inside a document rather than a whole
+// document.
 //
 /******************************************************************************/
 class InternalParser
 {
-// Class data
-private:
-	LPCSTR xmlData_;
+// Class data
+public:
+	enum EventType { EV_NONE, EV_START, EV_ATTRIBUTE, EV_TEXT, EV_END, EV_COMMENT, EV_MORE };
+
+	// A run of characters within the source buffer
+	struct Slice
+	{
+		const char* data;
+		size_t length;
+		bool fEntities;		// contains references which must be decoded
+	};
+
+	struct Event
+	{
+		EventType type;
+		Slice name;			// element or attribute name
+		Slice value;		// attribute value, text or comment
+	};
+
+private:
+	const char* pCurr_;
+	const char* pEnd_;
+	bool fFinal_;			// the buffer runs to the end of the document
+	bool fInTag_;			// reading the attributes of a start tag
+	bool fTextAllowed_;		// directly after a start tag
+	bool fDone_;			// the root element has ended
+	bool fFragment_;		// any number of elements may follow each other
+	std::vector<std::string> openNames_;
+	size_t depth_;
+
+	// Parts of a document smaller than this are not worth a thread.
+	enum { MIN_PART_SIZE = 0x100000 };
+
+// Constructor
+public:
+	InternalParser(const char* pData, size_t nLength, bool fFinal = true, bool fFragment = false) :
+		pCurr_(pData), pEnd_(pData + nLength), fFinal_(fFinal), fInTag_(false), fTextAllowed_(false), fDone_(false), 
+		fFragment_(fFragment), depth_(0) {/* */}
+
+// Access methods
+public:
+	EventType Next(Event& ev);
+	const char* get_Position() const { return pCurr_; }
+	size_t get_Remaining() const { return pEnd_ - pCurr_; }
+	void Refill(const char* pData, size_t nLength, bool fFinal) { pCurr_ = pData; pEnd_ = pData + nLength; fFinal_ = fFinal; }
+	XmlNodeStore::Index Parse(XmlNodeStore& store, DocumentSplit* pSplit = NULL);
+	static void ParseDocument(XmlNodeStore& store, const char* pData, size_t nLength, int nThreads, bool fStrict = false);
+	static void Materialize(const Slice& slice, std::string& text);
+
+// Internal methods
+private:
+	struct NeedMore {};		// thrown to unwind a scan cut off by the buffer end
+	struct SplitFailed {};	// thrown when a split document must be parsed whole
+	static void ParsePart(ULONG_PTR arg);
+	void NeedData() const { if (!fFinal_) throw NeedMore(); }
+	EventType Scan(Event& ev);
+	bool SkipWhitespace();
+	const char* ScanName(const char* p) const;
+	EventType ReadAttribute(Event& ev);
+	EventType ReadEndTag(Event& ev);
+	EventType CloseElement(Event& ev);
+	EventType SetEvent(Event& ev, EventType type, const char* pName, size_t nName, const char* pValue, size_t nValue, bool fEntities) const;
+	static XmlNodeStore::TextRef StoreText(XmlNodeStore& store, const Slice& slice, std::string& scratch);
+	std::string Preview(const char* p) const { return std::string(p, std::min<size_t>(20, pEnd_ - p)); }
+	void Throw(const char* pszFmt, ...) const;
+	void CheckClosed() const { if (depth_ != 0) Throw("Element %s is not closed", openNames_[depth_-1].c_str()); }
+};
+}// namespace JTI_Util
+
+/*****************************************************************************
+** Procedure:  InternalParser::Throw
+**
+** Arguments:  'pszFormat' - Format string
+**
+** Returns: void
+**
+** Description: Throws an exception
+**
+/****************************************************************************/
+void InternalParser::Throw(const char* pszFormat, ...) const
+{
+	va_list args;
+	va_start(args, pszFormat);
+	char chBuff[255];
+	if (_vsnprintf(chBuff, sizeof(chBuff), pszFormat, args) == -1)
+		chBuff[sizeof(chBuff)-1] = '\0';
+	va_end(args);
+
+	throw std::runtime_error(chBuff);
+
+}// InternalParser::Throw
+
+/*****************************************************************************
+** Procedure:  InternalParser::SetEvent
+**
+** Arguments:  'ev' - Event to fill in
+**             'type' - Event type
+**             'pName', 'nName' - Name slice
+**             'pValue', 'nValue' - Value slice
+**             'fEntities' - true if the value holds references
+**
+** Returns: Event type
+**
+** Description: Fills in the returned event.
+**
+/****************************************************************************/
+InternalParser::EventType InternalParser::SetEvent(Event& ev, EventType type, const char* pName, size_t nName,
+												   const char* pValue, size_t nValue, bool fEntities) const
+{
+	ev.type = type;
+	ev.name.data = pName;
+	ev.name.length = nName;
+	ev.name.fEntities = false;
+	ev.value.data = pValue;
+	ev.value.length = nValue;
+	ev.value.fEntities = fEntities;
+	return type;
+
+}// InternalParser::SetEvent
+
+/*****************************************************************************
+** Procedure:  InternalParser::SkipWhitespace
+**
+** Arguments: void
+**
+** Returns: false if the end of the buffer was reached
+**
+** Description: This skips any whitespace characters
+**
+/****************************************************************************/
+bool InternalParser::SkipWhitespace()
+{
+	while (pCurr_ < pEnd_ && (gCharClass.cls[static_cast<unsigned char>(*pCurr_)] & CC_SPACE))
+		++pCurr_;
+	return (pCurr_ < pEnd_);
+
+}// InternalParser::SkipWhitespace
+
+/*****************************************************************************
+** Procedure:  InternalParser::ScanName
+**
+** Arguments: 'p' - Start of the name
+**
+** Returns: End of the name
+**
+** Description: Names (and unquoted values) run to whitespace or markup;
+**              '/' and '?' only end a name when followed by '>'.  A name
+**              running to the end of a partial buffer may be incomplete.
+**
+/****************************************************************************/
+const char* InternalParser::ScanName(const char* p) const
+{
+	for (; p < pEnd_; ++p)
+	{
+		if (gCharClass.cls[static_cast<unsigned char>(*p)] & CC_NAMEEND)
+		{
+			if ((*p == '/' || *p == '?') && (p + 1 >= pEnd_ || p[1] != '>'))
+				continue;
+			break;
+		}
+	}
+	if (p == pEnd_)
+		NeedData();
+	return p;
+
+}// InternalParser::ScanName
+
+/*****************************************************************************
+** Procedure:  InternalParser::Next
+**
+** Arguments: 'ev' - Returned event
+**
+** Returns: Type of the event, EV_NONE at the end of the document
+**
+** Description: Reads the next item from the buffer.  If the buffer is
+**              not the final part of the document and the item does not
+**              fit in it, the scan is undone and EV_MORE is returned.
+**
+/****************************************************************************/
+InternalParser::EventType InternalParser::Next(Event& ev)
+{
+	if (fFinal_)
+		return Scan(ev);
+
+	const char* pItem = pCurr_;
+	bool fInTag = fInTag_, fTextAllowed = fTextAllowed_;
+	try
+	{
+		return Scan(ev);
+	}
+	catch (const NeedMore&)
+	{
+		pCurr_ = pItem;
+		fInTag_ = fInTag;
+		fTextAllowed_ = fTextAllowed;
+	}
+	return SetEvent(ev, EV_MORE, 0, 0, 0, 0, false);
+
+}// InternalParser::Next
+
+/*****************************************************************************
+** Procedure:  InternalParser::Scan
+**
+** Arguments: 'ev' - Returned event
+**
+** Returns: Type of the event, EV_NONE at the end of the document
+**
+** Description: Scans the next item.  Text is only allowed directly after a
+**              start tag and runs to the next end tag; leading whitespace is
+**              dropped.  Processing instructions and declarations are
+**              skipped.
+**
+/****************************************************************************/
+InternalParser::EventType InternalParser::Scan(Event& ev)
+{
+	for (;;)
+	{
+		if (fDone_)
+			return SetEvent(ev, EV_NONE, 0, 0, 0, 0, false);
+
+		if (fInTag_)
+		{
+			if (!SkipWhitespace())
+			{
+				NeedData();
+				Throw("Hit end of stream while searching for tag >");
+			}
+			if (*pCurr_ == '>')
+			{
+				++pCurr_;
+				fInTag_ = false;
+				fTextAllowed_ = true;
+				continue;
+			}
+			if (*pCurr_ == '/' && pCurr_ + 1 == pEnd_)
+				NeedData();
+			if (*pCurr_ == '/' && pCurr_ + 1 < pEnd_ && pCurr_[1] == '>')
+			{
+				pCurr_ += 2;
+				fInTag_ = false;
+				return CloseElement(ev);
+			}
+			return ReadAttribute(ev);
+		}
+
+		// An unclosed element at the end of the document is accepted here;
+		// a strict parse refuses it once the scan is done.
+		if (!SkipWhitespace())
+		{
+			NeedData();
+			return SetEvent(ev, EV_NONE, 0, 0, 0, 0, false);
+		}
+
+		if (*pCurr_ != '<')
+		{
+			if (!fTextAllowed_)
+				Throw("Invalid text found (%s...), malformed document.", Preview(pCurr_).c_str());
+			fTextAllowed_ = false;
+
+			// Text runs to the end tag; a '<' which does not start one is kept.
+			const char* pStart = pCurr_;
+			bool fEntities = false;
+			for (;;)
+			{
+				const char* p = FindEither(pCurr_, pEnd_, '<', '&');
+				if (p + 1 >= pEnd_)
+				{
+					NeedData();
+					Throw("Hit end of stream while searching for tag </");
+				}
+				pCurr_ = p + 1;
+				if (*p == '&')
+					fEntities = true;
+				else if (*pCurr_ == '/')
+				{
+					pCurr_ = p;
+					break;
+				}
+			}
+			return SetEvent(ev, EV_TEXT, 0, 0, pStart, pCurr_ - pStart, fEntities);
+		}
+
+		if (pCurr_ + 1 >= pEnd_)
+			NeedData();
+		char chNext = (pCurr_ + 1 < pEnd_) ? pCurr_[1] : '\0';
+		if (chNext == '/')
+			return ReadEndTag(ev);
+
+		if (chNext == '?')
+		{
+			const char* p = FindSequence(pCurr_ + 2, pEnd_, "?>");
+			if (p == NULL)
+			{
+				NeedData();
+				Throw("Hit end of stream while searching for tag ?>");
+			}
+			pCurr_ = p + 2;
+			fTextAllowed_ = false;
+			continue;
+		}
+
+		if (chNext == '!')
+		{
+			if (pEnd_ - pCurr_ < 9)
+				NeedData();
+			if (pEnd_ - pCurr_ >= 4 && !memcmp(pCurr_, "<!--", 4))
+			{
+				const char* pStart = pCurr_ + 4;
+				const char* p = FindSequence(pStart, pEnd_, "-->");
+				if (p == NULL)
+				{
+					NeedData();
+					Throw("Hit end of stream while searching for tag -->");
+				}
+				pCurr_ = p + 3;
+				fTextAllowed_ = false;
+				return SetEvent(ev, EV_COMMENT, 0, 0, pStart, p - pStart, false);
+			}
+
+			// CDATA is the element's text if it comes where text may.
+			if (pEnd_ - pCurr_ >= 9 && !memcmp(pCurr_, "<![CDATA[", 9))
+			{
+				const char* pStart = pCurr_ + 9;
+				const char* p = FindSequence(pStart, pEnd_, "]]>");
+				if (p == NULL)
+				{
+					NeedData();
+					Throw("Hit end of stream while searching for tag ]]>");
+				}
+				pCurr_ = p + 3;
+				if (fTextAllowed_)
+				{
+					fTextAllowed_ = false;
+					return SetEvent(ev, EV_TEXT, 0, 0, pStart, p - pStart, false);
+				}
+				continue;
+			}
+
+			// Declarations (DOCTYPE etc.) are skipped.
+			const char* p = static_cast<const char*>(memchr(pCurr_, '>', pEnd_ - pCurr_));
+			if (p == NULL)
+			{
+				NeedData();
+				Throw("Hit end of stream while searching for tag >");
+			}
+			pCurr_ = p + 1;
+			fTextAllowed_ = false;
+			continue;
+		}
+
+		// Start tag
+		const char* pName = ++pCurr_;
+		pCurr_ = ScanName(pCurr_);
+		if (pCurr_ == pName)
+			Throw("Error parsing element %s", Preview(pName).c_str());
+		if (depth_ == openNames_.size())
+			openNames_.push_back(std::string());
+		openNames_[depth_++].assign(pName, pCurr_ - pName);
+		fInTag_ = true;
+		fTextAllowed_ = false;
+		return SetEvent(ev, EV_START, pName, pCurr_ - pName, 0, 0, false);
+	}
+
+}// InternalParser::Scan
+
+/*****************************************************************************
+** Procedure:  InternalParser::ReadAttribute
+**
+** Arguments: 'ev' - Returned event
+**
+** Returns: EV_ATTRIBUTE
+**
+** Description: This parses out a single attribute of the current start tag;
+**              the value may be quoted with either quote or unquoted.
+**
+/****************************************************************************/
+InternalParser::EventType InternalParser::ReadAttribute(Event& ev)
+{
+	const std::string& element = openNames_[depth_-1];
+	const char* pName = pCurr_;
+	pCurr_ = ScanName(pCurr_);
+	if (pCurr_ == pName)
+		Throw("Error parsing element %s", element.c_str());
+	size_t nName = pCurr_ - pName;
+
+	// Make sure the next token is an equal sign!
+	if (!SkipWhitespace())
+		NeedData();
+	if (pCurr_ == pEnd_ || *pCurr_ != '=')
+		Throw("Missing '=' on attribute for element %s.", element.c_str());
+	++pCurr_;
+	if (!SkipWhitespace())
+	{
+		NeedData();
+		Throw("Hit end of stream while searching for tag >");
+	}
+
+	const char* pValue = pCurr_;
+	bool fEntities = false;
+	if (*pCurr_ == '"' || *pCurr_ == '\'')
+	{
+		char chQuote = *pCurr_;
+		pValue = ++pCurr_;
+		for (;;)
+		{
+			pCurr_ = FindEither(pCurr_, pEnd_, chQuote, '&');
+			if (pCurr_ == pEnd_)
+			{
+				NeedData();
+				Throw("Missing closing quote on attribute %s for element %s.", std::string(pName, nName).c_str(), element.c_str());
+			}
+			if (*pCurr_ == chQuote)
+				break;
+			fEntities = true;
+			++pCurr_;
+		}
+		++pCurr_;
+		return SetEvent(ev, EV_ATTRIBUTE, pName, nName, pValue, pCurr_ - pValue - 1, fEntities);
+	}
+
+	pCurr_ = ScanName(pCurr_);
+	if (pCurr_ == pValue)
+		Throw("Missing value on attribute %s for element %s.", std::string(pName, nName).c_str(), element.c_str());
+	fEntities = (memchr(pValue, '&', pCurr_ - pValue) != NULL);
+	return SetEvent(ev, EV_ATTRIBUTE, pName, nName, pValue, pCurr_ - pValue, fEntities);
+
+}// InternalParser::ReadAttribute
+
+/*****************************************************************************
+** Procedure:  InternalParser::ReadEndTag
+**
+** Arguments: 'ev' - Returned event
+**
+** Returns: EV_END
+**
+** Description: Reads an end tag and checks it matches the open element.
+**
+/****************************************************************************/
+InternalParser::EventType InternalParser::ReadEndTag(Event& ev)
+{
+	if (depth_ == 0)
+		Throw("Hit end-tag without fully formed element (%s...)", Preview(pCurr_).c_str());
+
+	pCurr_ += 2;
+	if (!SkipWhitespace())
+	{
+		NeedData();
+		Throw("Hit end of stream while searching for tag >");
+	}
+	const char* pName = pCurr_;
+	pCurr_ = ScanName(pCurr_);
+
+	const std::string& element = openNames_[depth_-1];
+	if (element.length() != static_cast<size_t>(pCurr_ - pName) || memcmp(element.data(), pName, element.length()) != 0)
+		Throw("Name on end tag (%s) does not match start tag (%s).", std::string(pName, pCurr_ - pName).c_str(), element.c_str());
+	if (!SkipWhitespace())
+		NeedData();
+	if (pCurr_ == pEnd_ || *pCurr_ != '>')
+		Throw("Missing end-tag on element %s", element.c_str());
+	++pCurr_;
+	return CloseElement(ev);
+
+}// InternalParser::ReadEndTag
+
+/*****************************************************************************
+** Procedure:  InternalParser::CloseElement
+**
+** Arguments: 'ev' - Returned event
+**
+** Returns: EV_END
+**
+** Description: Ends the open element; the name remains valid until the
+**              next call to Next().
+**
+/****************************************************************************/
+InternalParser::EventType InternalParser::CloseElement(Event& ev)
+{
+	const std::string& element = openNames_[--depth_];
+	fTextAllowed_ = false;
+	fDone_ = (depth_ == 0 && !fFragment_);
+	return SetEvent(ev, EV_END, element.data(), element.length(), 0, 0, false);
+
+}// InternalParser::CloseElement
+
+/*****************************************************************************
+** Procedure:  InternalParser::Materialize
+**
+** Arguments: 'slice' - Characters from the buffer
+**            'text' - Returned string
+**
+** Returns: void
+**
+** Description: Copies a slice into a string, decoding the predefined
+**              entities and character references.  Unknown references
+**              are kept as they are.
+**
+/****************************************************************************/
+void InternalParser::Materialize(const Slice& slice, std::string& text)
+{
+	if (!slice.fEntities)
+	{
+		text.assign(slice.data, slice.length);
+		return;
+	}
+
+	static const struct { const char* pszName; size_t nLen; char ch; } gEntities[] = {
+		{ "lt;", 3, '<' }, { "gt;", 3, '>' }, { "amp;", 4, '&' }, { "quot;", 5, '"' }, { "apos;", 5, '\'' }
+	};
+
+	text.erase();
+	text.reserve(slice.length);
+	const char* p = slice.data;
+	const char* pEnd = slice.data + slice.length;
+	while (p < pEnd)
+	{
+		const char* pAmp = static_cast<const char*>(memchr(p, '&', pEnd - p));
+		if (pAmp == NULL)
+			pAmp = pEnd;
+		text.append(p, pAmp - p);
+		if (pAmp == pEnd)
+			break;
+
+		p = pAmp + 1;
+		size_t nLeft = pEnd - p;
+		bool fFound = false;
+		for (size_t i = 0; i < sizeofarray(gEntities) && !fFound; ++i)
+		{
+			if (nLeft >= gEntities[i].nLen && !memcmp(p, gEntities[i].pszName, gEntities[i].nLen))
+			{
+				text += gEntities[i].ch;
+				p += gEntities[i].nLen;
+				fFound = true;
+			}
+		}
+
+		// Character references are stored as UTF-8.
+		if (!fFound && nLeft > 2 && *p == '#')
+		{
+			bool fHex = (p[1] == 'x' || p[1] == 'X');
+			const char* pDigits = p + (fHex ? 2 : 1);
+			const char* pStop = pDigits;
+			unsigned long ch = 0;
+			for (; pStop < pEnd && ch <= 0x10ffff; ++pStop)
+			{
+				int nDigit = (*pStop >= '0' && *pStop <= '9') ? *pStop - '0' :
+							 (fHex && *pStop >= 'a' && *pStop <= 'f') ? *pStop - 'a' + 10 :
+							 (fHex && *pStop >= 'A' && *pStop <= 'F') ? *pStop - 'A' + 10 : -1;
+				if (nDigit < 0)
+					break;
+				ch = ch * (fHex ? 16 : 10) + nDigit;
+			}
+			if (pStop < pEnd && *pStop == ';' && pStop > pDigits && ch > 0 && ch <= 0x10ffff)
+			{
+				AppendUtf8(text, ch);
+				p = pStop + 1;
+				fFound = true;
+			}
+		}
+		if (!fFound)
+			text += '&';
+	}
+
+}// InternalParser::Materialize
+
+/*****************************************************************************
+** Procedure:  InternalParser::StoreText
+**
+** Arguments: 'store' - Store being built
+**            'slice' - Characters from the buffer
+**            'scratch' - Work string used to decode references
+**
+** Returns: Reference to the text within the store
+**
+** Description: Adds a slice to the store.  Slices without references are
+**              left in the source when the store keeps it, and copied
+**              straight from the buffer otherwise.
+**
+/****************************************************************************/
+XmlNodeStore::TextRef InternalParser::StoreText(XmlNodeStore& store, const Slice& slice, std::string& scratch)
+{
+	if (!slice.fEntities)
+		return store.AddSourceText(slice.data, slice.length);
+	Materialize(slice, scratch);
+	return store.AddText(scratch.data(), scratch.length());
+
+}// InternalParser::StoreText
+
+/*****************************************************************************
+** Procedure:  InternalParser::Parse
+**
+** Arguments:  'store' - Store to fill in
+**
+** Returns: void
+**
+** Description: Builds the element tree into the node store.  Comments are
+**              kept with the element they appear in; those before the root
+**              element belong to the root.  The elements of a fragment are
+**              linked as siblings.  When reading the head of a split
+**              document, the parts are joined to the root where the head
+**              ends.
+**
+/****************************************************************************/
+XmlNodeStore::Index InternalParser::Parse(XmlNodeStore& store, DocumentSplit* pSplit)
+{
+	typedef XmlNodeStore::Index Index;
+	const Index NIL = XmlNodeStore::NIL;
+
+	// Elements still open, with the last child and comment added to each
+	// so siblings can be linked without walking the list.
+	struct OpenNode
+	{
+		Index node;
+		Index lastChild;
+		Index lastComment;
+	};
+	std::vector<OpenNode> stack;
+	Index firstComment = NIL, lastComment = NIL;
+	Index lastElement = NIL;	// last element of a fragment outside any other
+	std::string scratch;
+
+	if (store.source_ == NULL)
+		store.text_.reserve(store.text_.size() + (pEnd_ - pCurr_) / 2);
+
+	Event ev;
+	while (Next(ev) != EV_NONE)
+	{
+		switch (ev.type)
+		{
+			case EV_START:
+			{
+				Index node = static_cast<Index>(store.nodes_.size());
+				XmlNodeStore::NodeRecord rec = { store.AddName(ev.name.data, ev.name.length), { 0, 0 }, 0, 0, NIL, NIL, NIL };
+				OpenNode open = { node, NIL, NIL };
+				if (stack.empty() && fFragment_)
+				{
+					if (lastElement != NIL)
+						store.nodes_[lastElement].nextSibling = node;
+					lastElement = node;
+				}
+				else if (stack.empty())
+				{
+					rec.firstComment = firstComment;
+					open.lastComment = lastComment;
+				}
+				else
+				{
+					OpenNode& parent = stack.back();
+					if (parent.lastChild == NIL)
+						store.nodes_[parent.node].firstChild = node;
+					else
+						store.nodes_[parent.lastChild].nextSibling = node;
+					parent.lastChild = node;
+				}
+				store.nodes_.push_back(rec);
+				stack.push_back(open);
+				break;
+			}
+			case EV_ATTRIBUTE:
+			{
+				XmlNodeStore::AttributeRecord attr = { store.AddName(ev.name.data, ev.name.length), StoreText(store, ev.value, scratch) };
+				XmlNodeStore::NodeRecord& rec = store.nodes_[stack.back().node];
+				if (rec.attributeCount++ == 0)
+					rec.firstAttribute = static_cast<Index>(store.attributes_.size());
+				store.attributes_.push_back(attr);
+				break;
+			}
+			case EV_TEXT:
+				store.nodes_[stack.back().node].value = StoreText(store, ev.value, scratch);
+				break;
+			case EV_END:
+				stack.pop_back();
+				break;
+			case EV_COMMENT:
+			{
+				Index comment = static_cast<Index>(store.comments_.size());
+				XmlNodeStore::CommentRecord rec = { store.AddSourceText(ev.value.data, ev.value.length), NIL };
+				store.comments_.push_back(rec);
+
+				Index& first = stack.empty() ? firstComment : store.nodes_[stack.back().node].firstComment;
+				Index& last = stack.empty() ? lastComment : stack.back().lastComment;
+				if (last == NIL)
+					first = comment;
+				else
+					store.comments_[last].next = comment;
+				last = comment;
+				break;
+			}
+			case EV_MORE:
+			{
+				// The head of a split document has been read.  It must end
+				// between two elements of the root.
+				if (pSplit == NULL || stack.size() != 1 || fInTag_ || !IsSpace(pCurr_, pEnd_))
+					throw SplitFailed();
+				pSplit->Wait();
+
+				OpenNode& root = stack.back();
+				for (std::vector<DocumentPart>::iterator it = pSplit->parts_.begin(); it != pSplit->parts_.end(); ++it)
+				{
+					if (it->fFailed || it->pStore->nodes_.empty())
+						throw SplitFailed();
+					Index nodeBase = static_cast<Index>(store.nodes_.size());
+					Index commentBase = static_cast<Index>(store.comments_.size());
+					store.Append(*it->pStore);
+					it->pStore->Release();
+					it->pStore = NULL;
+
+					if (root.lastChild == NIL)
+						store.nodes_[root.node].firstChild = nodeBase;
+					else
+						store.nodes_[root.lastChild].nextSibling = nodeBase;
+					for (root.lastChild = nodeBase; store.nodes_[root.lastChild].nextSibling != NIL; )
+						root.lastChild = store.nodes_[root.lastChild].nextSibling;
+
+					if (it->firstComment != NIL)
+					{
+						Index comment = commentBase + it->firstComment;
+						if (root.lastComment == NIL)
+							store.nodes_[root.node].firstComment = comment;
+						else
+							store.comments_[root.lastComment].next = comment;
+						for (root.lastComment = comment; store.comments_[root.lastComment].next != NIL; )
+							root.lastComment = store.comments_[root.lastComment].next;
+					}
+				}
+				Refill(pSplit->pRootEnd_, pSplit->pEnd_ - pSplit->pRootEnd_, true);
+				break;
+			}
+			default:
+				break;
+		}
+	}
+
+	if (fFragment_ && !stack.empty())
+		Throw("Element %s is not closed", openNames_[depth_-1].c_str());
+	return firstComment;
+
+}// InternalParser::Parse
+
+/*****************************************************************************
+** Procedure:  InternalParser::ParsePart
+**
+** Arguments: 'arg' - Part of a split document
+**
+** Returns: void
+**
+** Description: Worker thread entry; parses one part of a split document
+**              into a store of its own.  Errors only mark the part as
+**              failed so the document is parsed again whole.
+**
+/****************************************************************************/
+void InternalParser::ParsePart(ULONG_PTR arg)
+{
+	DocumentPart* pPart = reinterpret_cast<DocumentPart*>(arg);
+	try
+	{
+		pPart->pStore = JTI_NEW XmlNodeStore;
+		pPart->pStore->source_ = pPart->pSplit->pOwner_->source_;
+		pPart->pStore->sourceLength_ = pPart->pSplit->pOwner_->sourceLength_;
+		InternalParser parser(pPart->pStart, pPart->pEnd - pPart->pStart, true, true);
+		pPart->firstComment = parser.Parse(*pPart->pStore);
+	}
+	catch (...)
+	{
+		pPart->fFailed = true;
+	}
+	pPart->pSplit->PartDone();
+
+}// InternalParser::ParsePart
+
+/*****************************************************************************
+** Procedure:  InternalParser::ParseDocument
+**
+** Arguments: 'store' - Empty store to fill in
+**            'pData' - Document text
+**            'nLength' - Length of the text
+**            'nThreads' - Threads which may be used
+**            'fStrict' - true to refuse a document whose root is not closed
+**
+** Returns: void
+**
+** Description: Parses a document, on several threads if it is large
+**              enough.  The elements of the root are split into parts
+**              which a WorkerThreadPool parses while this thread reads the
+**              head of the document.  If a part does not parse cleanly the
+**              document is parsed again on this thread alone, so errors are
+**              reported as they would be otherwise.  An element left open
+**              at the end of the text is accepted unless strict, as a file
+**              still being written would otherwise be read as complete.
+**
+/****************************************************************************/
+void InternalParser::ParseDocument(XmlNodeStore& store, const char* pData, size_t nLength, int nThreads, bool fStrict)
+{
+	size_t nParts = (nThreads > 1) ? std::min<size_t>(nThreads, nLength / MIN_PART_SIZE) : 1;
+	if (nParts > 1)
+	{
+		// The split is destroyed first so it can wait for the pool to
+		// finish with its parts.
+		WorkerThreadPool<> pool;
+		DocumentSplit split(&store);
+		if (split.Prepare(pData, nLength, nParts + 1) && pool.Start(static_cast<int>(nParts), static_cast<int>(nParts), static_cast<int>(nParts)))
+		{
+			split.Start(pool, &InternalParser::ParsePart);
+			try
+			{
+				InternalParser parser(pData, split.get_HeadEnd() - pData, false);
+				parser.Parse(store, &split);
+				if (fStrict)
+					parser.CheckClosed();
+				return;
+			}
+			catch (const SplitFailed&)
+			{
+				store.Reset();
+			}
+		}
+	}
+
+	InternalParser parser(pData, nLength);
+	parser.Parse(store);
+	if (fStrict)
+		parser.CheckClosed();
+
+}// InternalParser::ParseDocument
+
+/*****************************************************************************
+** Procedure:  XmlNodeStore::XmlNodeStore
+**
+** Arguments:  void
+**
+** Returns: void
+**
+** Description: Constructor for an empty store.  The text pool starts with
+**              a single NUL so empty text needs no space of its own.
+**
+/****************************************************************************/
+XmlNodeStore::XmlNodeStore() : 
+	pMapping_(NULL), source_(NULL), sourceLength_(0), pSharedNames_(NULL)
+{
+	text_.push_back('\0');
+
+}// XmlNodeStore::XmlNodeStore
+
+/*****************************************************************************
+** Procedure:  XmlNodeStore::~XmlNodeStore
+**
+** Arguments:  void
+**
+** Returns: void
+**
+** Description: Destructor for the store; unmaps the source file and
+**              drops its references to the shared attribute names.
+**
+/****************************************************************************/
+XmlNodeStore::~XmlNodeStore()
+{
+	ReleaseSharedNames();
+	delete pMapping_;
+
+}// XmlNodeStore::~XmlNodeStore
+
+/*****************************************************************************
+** Procedure:  XmlNodeStore::Create
+**
+** Arguments: 'pData' - XML text
+**            'nLength' - Length of the text
+**            'nThreads' - Threads the parse may use
+**
+** Returns: New store with a reference count of one
+**
+** Description: Parses a document into a new node store.  The caller
+**              releases the store when done with it.
+**
+/****************************************************************************/
+XmlNodeStore* XmlNodeStore::Create(const char* pData, size_t nLength, int nThreads)
+{
+	XmlNodeStore* pStore = JTI_NEW XmlNodeStore;
+	try
+	{
+		InternalParser::ParseDocument(*pStore, pData, nLength, nThreads);
+	}
+	catch (...)
+	{
+		pStore->Release();
+		throw;
+	}
+	return pStore;
+
+}// XmlNodeStore::Create
+
+/*****************************************************************************
+** Procedure:  XmlNodeStore::Load
+**
+** Arguments: 'pszFile' - File to load
+**            'nThreads' - Threads the parse may use
+**            'fStrict' - true to refuse a document whose root is not closed
+**
+** Returns: New store with a reference count of one, or NULL if the file
+**          could not be mapped
+**
+** Description: Maps a file and parses it in place.  A UTF-8 byte order
+**              mark is skipped; UTF-16 and UTF-32 documents are converted
+**              to UTF-8 first and the file is then unmapped.  Otherwise
+**              the file stays mapped until the store is released or
+**              detached, and text without references is not copied out
+**              of it.  An empty file, which cannot be mapped, loads as an
+**              empty store.
+**
+/****************************************************************************/
+XmlNodeStore* XmlNodeStore::Load(const char* pszFile, int nThreads, bool fStrict)
+{
+	static const struct { unsigned char bom[4]; size_t nLength; size_t nUnit; bool fBigEndian; } gEncodings[] = {
+		{ { 0xEF, 0xBB, 0xBF }, 3, 1, false },			// UTF-8
+		{ { 0xFF, 0xFE, 0x00, 0x00 }, 4, 4, false },	// UTF-32 little endian
+		{ { 0x00, 0x00, 0xFE, 0xFF }, 4, 4, true },		// UTF-32 big endian
+		{ { 0xFF, 0xFE }, 2, 2, false },				// UTF-16 little endian
+		{ { 0xFE, 0xFF }, 2, 2, true }					// UTF-16 big endian
+	};
+
+	XmlNodeStore* pStore = JTI_NEW XmlNodeStore;
+	try
+	{
+		const unsigned char* pData = NULL;
+		size_t nLength = 0;
+		unsigned __int64 nSize = 0, nTime = 0;
+		if (!GetFileStamp(pszFile, nSize, nTime) || nSize > 0)
+		{
+			pStore->pMapping_ = JTI_NEW MemoryMappedFile(pszFile, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, 
+								NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN);
+			if (!pStore->pMapping_->IsValid)
+			{
+				pStore->Release();
+				return NULL;
+			}
+			pData = static_cast<const unsigned char*>(pStore->pMapping_->Buffer);
+			nLength = pStore->pMapping_->Length;
+		}
+
+		for (size_t i = 0; i < sizeofarray(gEncodings); ++i)
+		{
+			if (nLength < gEncodings[i].nLength || memcmp(pData, gEncodings[i].bom, gEncodings[i].nLength) != 0)
+				continue;
+			pData += gEncodings[i].nLength;
+			nLength -= gEncodings[i].nLength;
+			if (gEncodings[i].nUnit > 1)
+			{
+				ConvertToUtf8(pData, nLength, gEncodings[i].nUnit, gEncodings[i].fBigEndian, pStore->converted_);
+				delete pStore->pMapping_;
+				pStore->pMapping_ = NULL;
+				nLength = pStore->converted_.size();
+				pData = (nLength > 0) ? reinterpret_cast<const unsigned char*>(&pStore->converted_[0]) : NULL;
+			}
+			break;
+		}
+
+		pStore->source_ = reinterpret_cast<const char*>(pData);
+		pStore->sourceLength_ = nLength;
+		InternalParser::ParseDocument(*pStore, pStore->source_, pStore->sourceLength_, nThreads, fStrict);
+	}
+	catch (...)
+	{
+		pStore->Release();
+		throw;
+	}
+	return pStore;
+
+}// XmlNodeStore::Load
+
+/*****************************************************************************
+** Procedure:  XmlNodeStore::AddText
+**
+** Arguments: 'pText' - Characters to add
+**            'nLength' - Number of characters
+**
+** Returns: Reference to the text within the pool
+**
+** Description: Appends text to the pool followed by a NUL.
+**
+/****************************************************************************/
+XmlNodeStore::TextRef XmlNodeStore::AddText(const char* pText, size_t nLength)
+{
+	TextRef text = { 0, 0 };
+	if (nLength == 0)
+		return text;
+	if (nLength >= NIL - text_.size())
+		throw std::runtime_error("XML document is too large for the node store.");
+
+	text.offset = static_cast<Index>(text_.size());
+	text.length = static_cast<Index>(nLength);
+	text_.insert(text_.end(), pText, pText + nLength);
+	text_.push_back('\0');
+	return text;
+
+}// XmlNodeStore::AddText
+
+/*****************************************************************************
+** Procedure:  XmlNodeStore::AddSourceText
+**
+** Arguments: 'pText' - Characters within the source
+**            'nLength' - Number of characters
+**
+** Returns: Reference to the text
+**
+** Description: Refers to text in the source when the store keeps one and
+**              the offset and length fit a reference; it is copied into
+**              the pool otherwise.
+**
+/****************************************************************************/
+XmlNodeStore::TextRef XmlNodeStore::AddSourceText(const char* pText, size_t nLength)
+{
+	if (source_ == NULL || nLength == 0 || nLength >= IN_SOURCE || static_cast<size_t>(pText - source_) > NIL - nLength)
+		return AddText(pText, nLength);
+
+	TextRef text = { static_cast<Index>(pText - source_), static_cast<Index>(nLength) | IN_SOURCE };
+	return text;
+
+}// XmlNodeStore::AddSourceText
+
+/*****************************************************************************
+** Procedure:  XmlNodeStore::AddName
+**
+** Arguments: 'pszName' - Name characters
+**            'nLength' - Length of the name
+**
+** Returns: Index of the interned name
+**
+** Description: Returns the existing index for a name or adds it.  The
+**              hash table is kept at most half full.
+**
+/****************************************************************************/
+XmlNodeStore::Index XmlNodeStore::AddName(const char* pszName, size_t nLength)
+{
+	if ((names_.size() + 1) * 2 > nameTable_.size())
+		HashNames(nameTable_.empty() ? 64 : nameTable_.size() * 2);
+
+	size_t nMask = nameTable_.size() - 1;
+	for (size_t nSlot = XmlPath::HashText(pszName, nLength) & nMask; ; nSlot = (nSlot + 1) & nMask)
+	{
+		Index name = nameTable_[nSlot];
+		if (name == NIL)
+		{
+			name = static_cast<Index>(names_.size());
+			names_.push_back(AddText(pszName, nLength));
+			nameTable_[nSlot] = name;
+			return name;
+		}
+		if (names_[name].length == nLength && !memcmp(&text_[names_[name].offset], pszName, nLength))
+			return name;
+	}
+
+}// XmlNodeStore::AddName
+
+/*****************************************************************************
+** Procedure:  XmlNodeStore::HashNames
+**
+** Arguments: 'nSize' - Slots in the table; a power of two more than twice
+**                      the number of names
+**
+** Returns: void
+**
+** Description: Builds the name hash table from the names.
+**
+/****************************************************************************/
+void XmlNodeStore::HashNames(size_t nSize)
+{
+	std::vector<Index> table(nSize, static_cast<Index>(NIL));
+	size_t nMask = table.size() - 1;
+	for (size_t i = 0; i < names_.size(); ++i)
+	{
+		size_t nSlot = XmlPath::HashText(&text_[names_[i].offset], names_[i].length) & nMask;
+		while (table[nSlot] != NIL)
+			nSlot = (nSlot + 1) & nMask;
+		table[nSlot] = static_cast<Index>(i);
+	}
+	nameTable_.swap(table);
+
+}// XmlNodeStore::HashNames
+
+/*****************************************************************************
+** Procedure:  XmlNodeStore::Append
+**
+** Arguments: 'part' - Store holding part of the same document
+**
+** Returns: void
+**
+** Description: Copies the records of another store onto the end of this
+**              one, renumbering them and interning their names here.  Both
+**              stores must refer to the same source.  Nothing is linked to
+**              the copied nodes; the caller does that.
+**
+/****************************************************************************/
+void XmlNodeStore::Append(const XmlNodeStore& part)
+{
+	if (part.text_.size() >= NIL - text_.size())
+		throw std::runtime_error("XML document is too large for the node store.");
+
+	const Index textBase = static_cast<Index>(text_.size());
+	const Index nodeBase = static_cast<Index>(nodes_.size());
+	const Index attributeBase = static_cast<Index>(attributes_.size());
+	const Index commentBase = static_cast<Index>(comments_.size());
+	text_.insert(text_.end(), part.text_.begin(), part.text_.end());
+
+	std::vector<Index> names(part.names_.size());
+	for (size_t i = 0; i < names.size(); ++i)
+		names[i] = AddName(&part.text_[part.names_[i].offset], part.names_[i].length);
+
+	// Text in the source is shared; empty text stays at the pool's NUL.
+	#define SHIFT_TEXT(t) if (((t).length & ~IN_SOURCE) != 0 && ((t).length & IN_SOURCE) == 0) (t).offset += textBase
+	#define SHIFT_INDEX(i, base) if ((i) != NIL) (i) += (base)
+
+	nodes_.reserve(nodes_.size() + part.nodes_.size());
+	for (std::vector<NodeRecord>::const_iterator it = part.nodes_.begin(); it != part.nodes_.end(); ++it)
+	{
+		NodeRecord rec = *it;
+		rec.name = names[rec.name];
+		SHIFT_TEXT(rec.value);
+		rec.firstAttribute += attributeBase;
+		SHIFT_INDEX(rec.firstChild, nodeBase);
+		SHIFT_INDEX(rec.nextSibling, nodeBase);
+		SHIFT_INDEX(rec.firstComment, commentBase);
+		nodes_.push_back(rec);
+	}
+
+	attributes_.reserve(attributes_.size() + part.attributes_.size());
+	for (std::vector<AttributeRecord>::const_iterator it = part.attributes_.begin(); it != part.attributes_.end(); ++it)
+	{
+		AttributeRecord attr = *it;
+		attr.name = names[attr.name];
+		SHIFT_TEXT(attr.value);
+		attributes_.push_back(attr);
+	}
+
+	comments_.reserve(comments_.size() + part.comments_.size());
+	for (std::vector<CommentRecord>::const_iterator it = part.comments_.begin(); it != part.comments_.end(); ++it)
+	{
+		CommentRecord rec = *it;
+		SHIFT_TEXT(rec.text);
+		SHIFT_INDEX(rec.next, commentBase);
+		comments_.push_back(rec);
+	}
+
+	#undef SHIFT_TEXT
+	#undef SHIFT_INDEX
+
+}// XmlNodeStore::Append
+
+/*****************************************************************************
+** Procedure:  XmlNodeStore::Reset
+**
+** Arguments: void
+**
+** Returns: void
+**
+** Description: Empties the store so it can be filled again; the source is
+**              kept.
+**
+/****************************************************************************/
+void XmlNodeStore::Reset()
+{
+	ReleaseSharedNames();
+	nodes_.clear();
+	attributes_.clear();
+	comments_.clear();
+	names_.clear();
+	nameTable_.clear();
+	text_.assign(1, '\0');
+
+}// XmlNodeStore::Reset
+
+/*****************************************************************************
+** Procedure:  XmlNodeStore::ReleaseSharedNames
+**
+** Arguments: void
+**
+** Returns: void
+**
+** Description: Drops the references the store holds to the attribute
+**              names it has handed out.  Nodes still using a name keep it.
+**
+/****************************************************************************/
+void XmlNodeStore::ReleaseSharedNames()
+{
+	if (pSharedNames_ == NULL)
+		return;
+
+	for (size_t i = 0; i < names_.size(); ++i)
+	{
+		if (pSharedNames_[i] != NULL)
+			pSharedNames_[i]->Release(); //lint !e534
+	}
+	delete [] pSharedNames_;
+	pSharedNames_ = NULL;
+
+}// XmlNodeStore::ReleaseSharedNames
+
+/*****************************************************************************
+** Procedure:  XmlNodeStore::ShareAttributeName
+**
+** Arguments: 'node' - Node record
+**            'attr' - Attribute of the node
+**
+** Returns: Shared copy of the attribute name
+**
+** Description: Returns the one copy of the name handed out by this store,
+**              creating it on first use.  Nodes may be expanded on several
+**              threads, so entries are filled without a lock and the loser
+**              of a race drops its copy.  The caller adds its own reference.
+**
+/****************************************************************************/
+const XmlName* XmlNodeStore::ShareAttributeName(Index node, Index attr) const
+{
+	if (pSharedNames_ == NULL)
+	{
+		XmlName** pNames = JTI_NEW XmlName*[names_.size()];
+		std::fill(pNames, pNames + names_.size(), static_cast<XmlName*>(NULL));
+		if (InterlockedCompareExchangePointer(reinterpret_cast<PVOID volatile*>(&pSharedNames_), pNames, NULL) != NULL)
+			delete [] pNames;
+	}
+
+	Index name = attributes_[nodes_[node].firstAttribute + attr].name;
+	XmlName* pName = pSharedNames_[name];
+	if (pName == NULL)
+	{
+		pName = JTI_NEW XmlName(&text_[names_[name].offset], names_[name].length);
+		XmlName* pOther = static_cast<XmlName*>(InterlockedCompareExchangePointer(reinterpret_cast<PVOID volatile*>(&pSharedNames_[name]), pName, NULL));
+		if (pOther != NULL)
+		{
+			pName->Release(); //lint !e534
+			pName = pOther;
+		}
+	}
+	return pName;
+
+}// XmlNodeStore::ShareAttributeName
+
+/******************************************************************************/
+// SnapshotHeader
+//
+// Start of a snapshot file.  The node, attribute, comment and name arrays
+// follow in that order, then the text pool and finally the source text the
+// records refer to.  The name hash table is not stored; it is built again
+// from the names when the snapshot is loaded.
+//
+/******************************************************************************/
+namespace {
+	struct SnapshotHeader
+	{
+		unsigned long magic;
+		unsigned long version;
+		unsigned __int64 sourceSize;
+		unsigned __int64 sourceTime;
+		unsigned long sourceHash;
+		XmlNodeStore::Index nodeCount;
+		XmlNodeStore::Index attributeCount;
+		XmlNodeStore::Index commentCount;
+		XmlNodeStore::Index nameCount;
+		XmlNodeStore::Index textLength;
+		XmlNodeStore::Index sourceLength;
+	};
+	const unsigned long SNAPSHOT_MAGIC = 0x4E53584A;	// "JXSN"
+	const unsigned long SNAPSHOT_VERSION = 2;
+}
+
+/*****************************************************************************
+** Procedure:  StampSnapshot
+**
+** Arguments: 'pszSnapshot' - Snapshot file
+**            'nTime' - Last write time of the source
+**
+** Returns: true if the snapshot was updated
+**
+** Description: Records a new source time in a snapshot whose source was
+**              touched but not changed, so later loads match it by time
+**              and do not hash the source again.
+**
+/****************************************************************************/
+static bool StampSnapshot(const char* pszSnapshot, unsigned __int64 nTime)
+{
+	USES_CONVERSION;
+	HANDLE hFile = CreateFile(A2T(const_cast<char*>(pszSnapshot)), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 
+							  NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	DWORD dwWritten = 0;
+	bool fStamped = (SetFilePointer(hFile, offsetof(SnapshotHeader, sourceTime), NULL, FILE_BEGIN) != INVALID_SET_FILE_POINTER &&
+					 WriteFile(hFile, &nTime, sizeof(nTime), &dwWritten, NULL) && dwWritten == sizeof(nTime));
+	CloseHandle(hFile);
+	return fStamped;
+
+}// StampSnapshot
+
+/*****************************************************************************
+** Procedure:  XmlNodeStore::GetSnapshotKey
+**
+** Arguments: 'pszSource' - Source XML file
+**            'key' - Returned key
+**
+** Returns: true if the key was read
+**
+** Description: Reads the size, time and hash of a source file.  This is
+**              done before the file is parsed, so a snapshot is never
+**              keyed to a newer file than the one it holds.  It fails if
+**              the file changes while it is hashed.
+**
+/****************************************************************************/
+bool XmlNodeStore::GetSnapshotKey(const char* pszSource, SnapshotKey& key)
+{
+	unsigned __int64 nSize, nTime;
+	return GetFileStamp(pszSource, key.size, key.time) && HashFile(pszSource, key.hash) &&
+		   GetFileStamp(pszSource, nSize, nTime) && nSize == key.size && nTime == key.time;
+
+}// XmlNodeStore::GetSnapshotKey
+
+/*****************************************************************************
+** Procedure:  XmlNodeStore::LoadSnapshot
+**
+** Arguments: 'pszSnapshot' - Snapshot file
+**            'pszSource' - XML file the snapshot was built from
+**
+** Returns: New store with a reference count of one, or NULL if there is
+**          no usable snapshot
+**
+** Description: Maps a snapshot and copies its arrays into a new store;
+**              the source text stays in the mapping.  A snapshot is used
+**              when the source has the size and time it was built from,
+**              or failing that the same hash; the snapshot then takes the
+**              new time so the next load need not hash the source.  The
+**              records are checked so a damaged snapshot is refused
+**              rather than read.
+**
+/****************************************************************************/
+XmlNodeStore* XmlNodeStore::LoadSnapshot(const char* pszSnapshot, const char* pszSource)
+{
+	SnapshotKey key;
+	if (!GetFileStamp(pszSource, key.size, key.time))
+		return NULL;
+
+	XmlNodeStore* pStore = JTI_NEW XmlNodeStore;
+	try
+	{
+		pStore->pMapping_ = JTI_NEW MemoryMappedFile(pszSnapshot, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 
+							NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN);
+		const char* pData = static_cast<const char*>(pStore->pMapping_->Buffer);
+		size_t nLength = pStore->pMapping_->Length;
+		if (pData == NULL || nLength < sizeof(SnapshotHeader))
+		{
+			pStore->Release();
+			return NULL;
+		}
+
+		SnapshotHeader header;
+		memcpy(&header, pData, sizeof(header));
+		unsigned __int64 nExpected = sizeof(header) +
+			static_cast<unsigned __int64>(header.nodeCount) * sizeof(NodeRecord) +
+			static_cast<unsigned __int64>(header.attributeCount) * sizeof(AttributeRecord) +
+			static_cast<unsigned __int64>(header.commentCount) * sizeof(CommentRecord) +
+			static_cast<unsigned __int64>(header.nameCount) * sizeof(TextRef) +
+			header.textLength + header.sourceLength;
+		if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION || nExpected != nLength || 
+			header.sourceSize != key.size || header.textLength == 0 ||
+			(header.sourceTime != key.time && (!HashFile(pszSource, key.hash) || header.sourceHash != key.hash)))
+		{
+			pStore->Release();
+			return NULL;
+		}
+
+		const char* p = pData + sizeof(header);
+		const NodeRecord* pNodes = reinterpret_cast<const NodeRecord*>(p);
+		pStore->nodes_.assign(pNodes, pNodes + header.nodeCount);
+		p += header.nodeCount * sizeof(NodeRecord);
+		const AttributeRecord* pAttributes = reinterpret_cast<const AttributeRecord*>(p);
+		pStore->attributes_.assign(pAttributes, pAttributes + header.attributeCount);
+		p += header.attributeCount * sizeof(AttributeRecord);
+		const CommentRecord* pComments = reinterpret_cast<const CommentRecord*>(p);
+		pStore->comments_.assign(pComments, pComments + header.commentCount);
+		p += header.commentCount * sizeof(CommentRecord);
+		const TextRef* pNames = reinterpret_cast<const TextRef*>(p);
+		pStore->names_.assign(pNames, pNames + header.nameCount);
+		p += header.nameCount * sizeof(TextRef);
+		pStore->text_.assign(p, p + header.textLength);
+		p += header.textLength;
+		pStore->source_ = p;
+		pStore->sourceLength_ = header.sourceLength;
+
+		if (!pStore->Validate())
+		{
+			pStore->Release();
+			return NULL;
+		}
+
+		size_t nTableSize = 64;
+		while (nTableSize < pStore->names_.size() * 2)
+			nTableSize *= 2;
+		pStore->HashNames(nTableSize);
+
+		if (header.sourceTime != key.time)
+			StampSnapshot(pszSnapshot, key.time); //lint !e534
+	}
+	catch (...)
+	{
+		pStore->Release();
+		throw;
+	}
+	return pStore;
+
+}// XmlNodeStore::LoadSnapshot
+
+/*****************************************************************************
+** Procedure:  XmlNodeStore::LoadCached
+**
+** Arguments: 'pszFile' - XML file to load
+**            'pszSnapshot' - Snapshot of the file
+**            'nThreads' - Threads a parse may use
+**            'fStrict' - true to refuse a document whose root is not closed
+**
+** Returns: New store with a reference count of one, or NULL if the file
+**          could not be mapped
+**
+** Description: Loads a file from its snapshot if the snapshot was built
+**              from the file as it is now.  Otherwise the file is parsed
+**              and the snapshot written again; failing to write it does
+**              not fail the load.
+**
+/****************************************************************************/
+XmlNodeStore* XmlNodeStore::LoadCached(const char* pszFile, const char* pszSnapshot, int nThreads, bool fStrict)
+{
+	XmlNodeStore* pStore = LoadSnapshot(pszSnapshot, pszFile);
+	if (pStore == NULL)
+	{
+		SnapshotKey key;
+		bool fKey = GetSnapshotKey(pszFile, key);
+		pStore = Load(pszFile, nThreads, fStrict);
+		if (pStore != NULL && fKey)
+			pStore->SaveSnapshot(pszSnapshot, key);
+	}
+	return pStore;
+
+}// XmlNodeStore::LoadCached
+
+/*****************************************************************************
+** Procedure:  XmlNodeStore::SaveSnapshot
+**
+** Arguments: 'pszSnapshot' - Snapshot file to write
+**            'key' - Key of the source the store was parsed from
+**
+** Returns: true if the snapshot was written
+**
+** Description: Writes the store as a snapshot.  Only the source text the
+**              records refer to is kept, packed together.  The snapshot
+**              is written to a temporary file and then moved into place
+**              so a reader never maps a partial one.
+**
+/****************************************************************************/
+bool XmlNodeStore::SaveSnapshot(const char* pszSnapshot, const SnapshotKey& key) const
+{
+	// Pack the source text and point the records at the packed copy.
+	std::vector<NodeRecord> nodes(nodes_);
+	std::vector<AttributeRecord> attributes(attributes_);
+	std::vector<CommentRecord> comments(comments_);
+	std::vector<char> source;
+	#define PACK_TEXT(t) if ((t).length & IN_SOURCE) { const char* pText = source_ + (t).offset; (t).offset = static_cast<Index>(source.size()); source.insert(source.end(), pText, pText + ((t).length & ~IN_SOURCE)); }
+	for (std::vector<NodeRecord>::iterator itNode = nodes.begin(); itNode != nodes.end(); ++itNode)
+		PACK_TEXT(itNode->value);
+	for (std::vector<AttributeRecord>::iterator itAttr = attributes.begin(); itAttr != attributes.end(); ++itAttr)
+		PACK_TEXT(itAttr->value);
+	for (std::vector<CommentRecord>::iterator itComment = comments.begin(); itComment != comments.end(); ++itComment)
+		PACK_TEXT(itComment->text);
+	#undef PACK_TEXT
+
+	SnapshotHeader header = { SNAPSHOT_MAGIC, SNAPSHOT_VERSION, key.size, key.time, key.hash,
+		static_cast<Index>(nodes.size()), static_cast<Index>(attributes.size()), static_cast<Index>(comments.size()),
+		static_cast<Index>(names_.size()), static_cast<Index>(text_.size()), static_cast<Index>(source.size()) };
+
+	USES_CONVERSION;
+	std::string sTemp(pszSnapshot); sTemp += ".tmp";
+	{
+		filestream stm(A2T(const_cast<char*>(sTemp.c_str())), filestream::out);
+		if (stm.fail() || !stm.write(&header, sizeof(header)) || !WriteArray(stm, nodes) || !WriteArray(stm, attributes) ||
+			!WriteArray(stm, comments) || !WriteArray(stm, names_) || 
+			!WriteArray(stm, text_) || !WriteArray(stm, source) || (stm.close(), !stm.good()))
+		{
+			stm.close();
+			DeleteFile(A2T(const_cast<char*>(sTemp.c_str())));
+			return false;
+		}
+	}
+
+	if (!MoveFileEx(A2T(const_cast<char*>(sTemp.c_str())), A2T(const_cast<char*>(pszSnapshot)), MOVEFILE_REPLACE_EXISTING))
+	{
+		DeleteFile(A2T(const_cast<char*>(sTemp.c_str())));
+		return false;
+	}
+	return true;
+
+}// XmlNodeStore::SaveSnapshot
+
+/*****************************************************************************
+** Procedure:  XmlNodeStore::Detach
+**
+** Arguments: void
+**
+** Returns: void
+**
+** Description: Copies the text still in a mapped file into the pool and
+**              closes the file, so the file can be written or replaced
+**              while the store is in use.
+**
+/****************************************************************************/
+void XmlNodeStore::Detach()
+{
+	if (pMapping_ == NULL)
+		return;
+
+	#define COPY_TEXT(t) if ((t).length & IN_SOURCE) (t) = AddText(source_ + (t).offset, (t).length & ~IN_SOURCE)
+	for (std::vector<NodeRecord>::iterator itNode = nodes_.begin(); itNode != nodes_.end(); ++itNode)
+		COPY_TEXT(itNode->value);
+	for (std::vector<AttributeRecord>::iterator itAttr = attributes_.begin(); itAttr != attributes_.end(); ++itAttr)
+		COPY_TEXT(itAttr->value);
+	for (std::vector<CommentRecord>::iterator itComment = comments_.begin(); itComment != comments_.end(); ++itComment)
+		COPY_TEXT(itComment->text);
+	#undef COPY_TEXT
+
+	source_ = NULL;
+	sourceLength_ = 0;
+	delete pMapping_;
+	pMapping_ = NULL;
+
+}// XmlNodeStore::Detach
+
+/*****************************************************************************
+** Procedure:  XmlNodeStore::IsValidText
+**
+** Arguments: 'text' - Reference to check
+**
+** Returns: true if the text lies within the pool or the source
+**
+** Description: Checks a text reference read from a snapshot.  Text in
+**              the pool must be followed by its NUL.
+**
+/****************************************************************************/
+bool XmlNodeStore::IsValidText(const TextRef& text) const
+{
+	Index nLength = (text.length & ~IN_SOURCE);
+	if (text.length & IN_SOURCE)
+		return text.offset <= sourceLength_ && nLength <= sourceLength_ - text.offset;
+	return text.offset < text_.size() && nLength < text_.size() - text.offset && text_[text.offset + nLength] == '\0';
+
+}// XmlNodeStore::IsValidText
+
+/*****************************************************************************
+** Procedure:  XmlNodeStore::Validate
+**
+** Arguments: void
+**
+** Returns: true if the store is well formed
+**
+** Description: Checks a store read from a snapshot.  Every index must be
+**              in range, and links must lead forward as the parser makes
+**              them so no walk of the tree can loop.
+**
+/****************************************************************************/
+bool XmlNodeStore::Validate() const
+{
+	if (text_.empty() || text_.back() != '\0')
+		return false;
+
+	for (std::vector<TextRef>::const_iterator it = names_.begin(); it != names_.end(); ++it)
+	{
+		if ((it->length & IN_SOURCE) || !IsValidText(*it))
+			return false;
+	}
+
+	for (size_t i = 0; i < nodes_.size(); ++i)
+	{
+		const NodeRecord& rec = nodes_[i];
+		if (rec.name >= names_.size() || !IsValidText(rec.value) ||
+			rec.firstAttribute > attributes_.size() || rec.attributeCount > attributes_.size() - rec.firstAttribute ||
+			(rec.firstChild != NIL && (rec.firstChild <= i || rec.firstChild >= nodes_.size())) ||
+			(rec.nextSibling != NIL && (rec.nextSibling <= i || rec.nextSibling >= nodes_.size())) ||
+			(rec.firstComment != NIL && rec.firstComment >= comments_.size()))
+			return false;
+	}
+	for (std::vector<AttributeRecord>::const_iterator it = attributes_.begin(); it != attributes_.end(); ++it)
+	{
+		if (it->name >= names_.size() || !IsValidText(it->value))
+			return false;
+	}
+	for (size_t i = 0; i < comments_.size(); ++i)
+	{
+		if (!IsValidText(comments_[i].text) || (comments_[i].next != NIL && (comments_[i].next <= i || comments_[i].next >= comments_.size())))
+			return false;
+	}
+	return true;
+
+}// XmlNodeStore::Validate
+
+/*****************************************************************************
+** Procedure:  XmlNodeStore::FindName
+**
+** Arguments: 'pszName' - Name characters
+**            'nLength' - Length of the name
+**
+** Returns: Index of the interned name or NIL if no node uses it
+**
+/****************************************************************************/
+XmlNodeStore::Index XmlNodeStore::FindName(const char* pszName, size_t nLength) const
+{
+	return FindName(pszName, nLength, XmlPath::HashText(pszName, nLength));
+
+}// XmlNodeStore::FindName
+
+/*****************************************************************************
+** Procedure:  XmlNodeStore::FindName
+**
+** Arguments: 'pszName' - Name characters
+**            'nLength' - Length of the name
+**            'nHash' - XmlPath::HashText of the name
+**
+** Returns: Index of the interned name or NIL if no node uses it
+**
+/****************************************************************************/
+XmlNodeStore::Index XmlNodeStore::FindName(const char* pszName, size_t nLength, unsigned long nHash) const
+{
+	if (nameTable_.empty())
+		return NIL;
+
+	size_t nMask = nameTable_.size() - 1;
+	for (size_t nSlot = nHash & nMask; ; nSlot = (nSlot + 1) & nMask)
+	{
+		Index name = nameTable_[nSlot];
+		if (name == NIL || (names_[name].length == nLength && !memcmp(&text_[names_[name].offset], pszName, nLength)))
+			return name;
+	}
+
+}// XmlNodeStore::FindName
+
+/*****************************************************************************
+** Procedure:  XmlNodeStore::FindChild
+**
+** Arguments: 'node' - Parent node
+**            'pszName' - Name of the child
+**
+** Returns: Index of the first child with the name or NIL
+**
+** Description: The name is looked up once and children are then matched
+**              by name index.
+**
+/****************************************************************************/
+XmlNodeStore::Index XmlNodeStore::FindChild(Index node, const char* pszName) const
+{
+	Index name = FindName(pszName, strlen(pszName));
+	if (name == NIL)
+		return NIL;
+
+	Index child = nodes_[node].firstChild;
+	while (child != NIL && nodes_[child].name != name)
+		child = nodes_[child].nextSibling;
+	return child;
+
+}// XmlNodeStore::FindChild
+
+/*****************************************************************************
+** Procedure:  XmlNodeStore::FindPath
+**
+** Arguments: 'path' - Path of names starting with the root's
+**
+** Returns: Index of the node or NIL
+**
+** Description: Follows a path from the root, taking the first child with
+**              each name as XmlDocument::find does.  Each name is looked
+**              up by the hash the path already holds and children are then
+**              matched by name index.
+**
+/****************************************************************************/
+XmlNodeStore::Index XmlNodeStore::FindPath(const XmlPath& path) const
+{
+	if (nodes_.empty() || path.IsEmpty)
+		return NIL;
+
+	Index node = Root();
+	for (int i = 0; i < path.Count && node != NIL; ++i)
+	{
+		size_t nLength = 0; unsigned long nHash = 0;
+		const char* pszName = path.GetSegment(i, nLength, nHash);
+		Index name = FindName(pszName, nLength, nHash);
+		if (name == NIL)
+			return NIL;
+
+		if (i == 0)
+		{
+			if (nodes_[node].name != name)
+				node = NIL;
+			continue;
+		}
+		node = nodes_[node].firstChild;
+		while (node != NIL && nodes_[node].name != name)
+			node = nodes_[node].nextSibling;
+	}
+	return node;
+
+}// XmlNodeStore::FindPath
+
+/*****************************************************************************
+** Procedure:  XmlNodeStore::FindAttribute
+**
+** Arguments: 'node' - Element
+**            'pszName' - Name of the attribute
+**
+** Returns: Value of the first attribute with the name or NULL
+**
+/****************************************************************************/
+const char* XmlNodeStore::FindAttribute(Index node, const char* pszName, size_t& nLength) const
+{
+	nLength = 0;
+	Index name = FindName(pszName, strlen(pszName));
+	if (name == NIL)
+		return NULL;
+
+	const NodeRecord& rec = nodes_[node];
+	for (Index i = 0; i < rec.attributeCount; ++i)
+	{
+		if (attributes_[rec.firstAttribute + i].name == name)
+			return GetText(attributes_[rec.firstAttribute + i].value, nLength);
+	}
+	return NULL;
+
+}// XmlNodeStore::FindAttribute
+
+/*****************************************************************************
+** Procedure:  XmlPath::HashText
+**
+** Arguments: 'pszText' - Characters to hash
+**            'nLength' - Number of characters
+**
+** Returns: 32-bit FNV-1a hash of the text
+**
+/****************************************************************************/
+unsigned long XmlPath::HashText(const char* pszText, size_t nLength)
+{
+	unsigned long nHash = 2166136261UL;
+	for (size_t i = 0; i < nLength; ++i)
+	{
+		nHash ^= static_cast<unsigned char>(pszText[i]);
+		nHash *= 16777619UL;
+	}
+	return nHash & 0xffffffff;
+
+}// XmlPath::HashText
+
+/*****************************************************************************
+** Procedure:  XmlPath::Append
+** 
+** Arguments:  'pszPath' - Names to add, separated by '/' or '\'
+** 
+** Returns: This path
+** 
+** Description: Adds one or more names to the end of the path.
+**
+/****************************************************************************/
+XmlPath& XmlPath::Append(const char* pszPath)
+{
+	if (pszPath == NULL)
+		return *this;
+
+	while (*pszPath != '\0')
+	{
+		size_t nLength = strcspn(pszPath, "/\\");
+		if (nLength == 0)
+		{
+			++pszPath;
+			continue;
+		}
+
+		if (!text_.empty())
+			text_ += '/';
+		Segment seg;
+		seg.offset = text_.length();
+		seg.length = nLength;
+		seg.hash = HashText(pszPath, nLength);
+		text_.append(pszPath, nLength);
+		segments_.push_back(seg);
+		pszPath += nLength;
+	}
+	hash_ = HashText(text_.data(), text_.length());
+	return *this;
+
+}// XmlPath::Append
+
+/*****************************************************************************
+** Procedure:  XmlAttributeList::XmlAttributeList
+** 
+** Arguments:  'rhs' - List to copy
+** 
+** Returns: void
+** 
+** Description: Copy constructor; the copy shares the attribute names.
+**
+/****************************************************************************/
+XmlAttributeList::XmlAttributeList(const XmlAttributeList& rhs) : 
+	attribs_(rhs.attribs_)
+{
+	for (const_iterator it = attribs_.begin(); it != attribs_.end(); ++it)
+		it->name->AddRef();
+
+}// XmlAttributeList::XmlAttributeList
+
+/*****************************************************************************
+** Procedure:  XmlAttributeList::~XmlAttributeList
+** 
+** Arguments:  void
+** 
+** Returns: void
+** 
+** Description: Destructor; drops the references to the attribute names.
+**
+/****************************************************************************/
+XmlAttributeList::~XmlAttributeList()
+{
+	for (const_iterator it = attribs_.begin(); it != attribs_.end(); ++it)
+		it->name->Release(); //lint !e534
+
+}// XmlAttributeList::~XmlAttributeList
+
+/*****************************************************************************
+** Procedure:  XmlAttributeList::operator=
+** 
+** Arguments:  'rhs' - List to copy
+** 
+** Returns: This list
+** 
+** Description: Replaces the attributes with a copy of another list.
+**
+/****************************************************************************/
+XmlAttributeList& XmlAttributeList::operator=(const XmlAttributeList& rhs)
+{
+	if (this != &rhs)
+	{
+		XmlAttributeList copy(rhs);
+		swap(copy);
+	}
+	return *this;
+
+}// XmlAttributeList::operator=
+
+/*****************************************************************************
+** Procedure:  XmlAttributeList::Search
+** 
+** Arguments:  'pszName' - Attribute name
+**             'fFound' - Returned true if the name is present
+** 
+** Returns: Position of the name, or where it would be inserted
+** 
+** Description: Binary search of the sorted attributes.
+**
+/****************************************************************************/
+size_t XmlAttributeList::Search(const char* pszName, bool& fFound) const
+{
+	size_t nLow = 0, nHigh = attribs_.size();
+	while (nLow < nHigh)
+	{
+		size_t nMid = (nLow + nHigh) / 2;
+		int nCompare = attribs_[nMid].name->text.compare(pszName);
+		if (nCompare == 0)
+		{
+			fFound = true;
+			return nMid;
+		}
+		if (nCompare < 0)
+			nLow = nMid + 1;
+		else
+			nHigh = nMid;
+	}
+	fFound = false;
+	return nLow;
+
+}// XmlAttributeList::Search
+
+/*****************************************************************************
+** Procedure:  XmlAttributeList::find
+** 
+** Arguments:  'pszName' - Attribute name
+** 
+** Returns: Value of the attribute or NULL if it is not present
+** 
+** Description: Looks up an attribute by name.
+**
+/****************************************************************************/
+const std::string* XmlAttributeList::find(const char* pszName) const
+{
+	bool fFound;
+	size_t nPos = Search(pszName, fFound);
+	return (fFound) ? &attribs_[nPos].value : NULL;
+
+}// XmlAttributeList::find
+
+/*****************************************************************************
+** Procedure:  XmlAttributeList::insert
+** 
+** Arguments:  'pszName' - Attribute name
+**             'pValue' - Value characters
+**             'nLength' - Length of the value
+** 
+** Returns: Value of the attribute
+** 
+** Description: Adds an attribute in name order.  An attribute already
+**              present keeps its value.
+**
+/****************************************************************************/
+std::string& XmlAttributeList::insert(const char* pszName, const char* pValue, size_t nLength)
+{
+	bool fFound;
+	size_t nPos = Search(pszName, fFound);
+	if (!fFound)
+	{
+		XmlName* pName = JTI_NEW XmlName(pszName, strlen(pszName));
+		try
+		{
+			Attribute attr;
+			attr.name = pName;
+			attribs_.insert(attribs_.begin() + nPos, attr)->value.assign(pValue, nLength);
+		}
+		catch (...)
+		{
+			pName->Release(); //lint !e534
+			throw;
+		}
+	}
+	return attribs_[nPos].value;
+
+}// XmlAttributeList::insert
+
+/*****************************************************************************
+** Procedure:  XmlAttributeList::insert
+** 
+** Arguments:  'pName' - Shared attribute name
+**             'pValue' - Value characters
+**             'nLength' - Length of the value
+** 
+** Returns: Value of the attribute
+** 
+** Description: Adds an attribute in name order, adding a reference to the
+**              shared name.  An attribute already present keeps its value.
+**
+/****************************************************************************/
+std::string& XmlAttributeList::insert(const XmlName* pName, const char* pValue, size_t nLength)
+{
+	bool fFound;
+	size_t nPos = Search(pName->text.c_str(), fFound);
+	if (!fFound)
+	{
+		Attribute attr;
+		attr.name = pName;
+		attribs_.insert(attribs_.begin() + nPos, attr)->value.assign(pValue, nLength);
+		pName->AddRef();
+	}
+	return attribs_[nPos].value;
+
+}// XmlAttributeList::insert
+
+/*****************************************************************************
+** Procedure:  XmlAttributeList::erase
+** 
+** Arguments:  'pszName' - Attribute name
+** 
+** Returns: void
+** 
+** Description: Removes an attribute if it is present.
+**
+/****************************************************************************/
+void XmlAttributeList::erase(const char* pszName)
+{
+	bool fFound;
+	size_t nPos = Search(pszName, fFound);
+	if (fFound)
+	{
+		const XmlName* pName = attribs_[nPos].name;
+		attribs_.erase(attribs_.begin() + nPos);
+		pName->Release(); //lint !e534
+	}
+
+}// XmlAttributeList::erase
+
+/*****************************************************************************
+** Procedure:  XmlNodeImpl::XmlNodeImpl
+** 
+** Arguments:  'name' - Name of the node
+**             'value' - Value of the node
+** 
+** Returns: void
+** 
+** Description: This creates a new XML node
+**
+/****************************************************************************/
+XmlNodeImpl::XmlNodeImpl(const char* pszName, const char* pszValue) : 
+	name_((pszName) ? pszName : ""), value_((pszValue) ? pszValue : ""), pStore_(NULL), record_(0), nameHash_(0), pTree_(NULL)
+{
+	// Strip any spaces from the name.
+	if (name_.find(' ') != string::npos)
+	{
+		std::string::size_type pos; 
+		while ((pos = name_.find_first_of(' ')) != std::string::npos)
+			name_.replace(pos, 1, "_");		
+	}
+	nameHash_ = XmlPath::HashText(name_.data(), name_.length());
+
+}// XmlNodeImpl::XmlNodeImpl
+
+/*****************************************************************************
+** Procedure:  XmlNodeImpl::XmlNodeImpl
+** 
+** Arguments:  'pStore' - Store holding the node
+**             'record' - Index of the node within the store
+** 
+** Returns: void
+** 
+** Description: Creates a node from a store record.  Only the name and value
+**              are copied; the rest is read when the node is expanded.
+**
+/****************************************************************************/
+XmlNodeImpl::XmlNodeImpl(XmlNodeStore* pStore, XmlNodeStore::Index record) : 
+	name_(pStore->GetName(record)), pStore_(pStore), record_(record), nameHash_(0), pTree_(NULL)
+{
+	size_t nLength;
+	const char* pszValue = pStore->GetValue(record, nLength);
+	value_.assign(pszValue, nLength);
+	nameHash_ = XmlPath::HashText(name_.data(), name_.length());
+	pStore_->AddRef();
+
+}// XmlNodeImpl::XmlNodeImpl
+
+/*****************************************************************************
+** Procedure:  XmlNodeImpl::~XmlNodeImpl
+** 
+** Arguments:  void
+** 
+** Returns: void
+** 
+** Description: Destructor for the node
+**
+/****************************************************************************/
+XmlNodeImpl::~XmlNodeImpl()
+{
+	std::for_each(children_.begin(), children_.end(), stdx::rel_obj<XmlNodeImpl*>());
+	if (pStore_ != NULL)
+		pStore_->Release();
+	if (pTree_ != NULL)
+		pTree_->Release();
+
+}// XmlNodeImpl::~XmlNodeImpl
+
+/*****************************************************************************
+** Procedure:  XmlNodeImpl::ExpandRecord
+** 
+** Arguments:  void
+** 
+** Returns: void
+** 
+** Description: Copies the attributes and comments of the store record into
+**              the node and creates unexpanded nodes for its children,
+**              which count their changes with this node's tree.  The node
+**              then drops its reference to the store.
+**
+/****************************************************************************/
+void XmlNodeImpl::ExpandRecord()
+{
+	CCSLock<XmlNodeImpl> aLock(this);
+	XmlNodeStore* pStore = pStore_;
+	if (pStore == NULL)
+		return;
+
+	XmlTreeGeneration* pTree = Tree();
+	XmlAttributeList attribs;
+	std::vector<std::string> comments;
+	std::vector<XmlNodeImpl*> children;
+	try
+	{
+		size_t nLength;
+		XmlNodeStore::Index nCount = pStore->AttributeCount(record_);
+		attribs.reserve(nCount);
+		for (XmlNodeStore::Index i = 0; i < nCount; ++i)
+		{
+			const char* pszValue = pStore->GetAttributeValue(record_, i, nLength);
+			attribs.insert(pStore->ShareAttributeName(record_, i), pszValue, nLength);
+		}
+		for (XmlNodeStore::Index comment = pStore->FirstComment(record_); comment != XmlNodeStore::NIL; comment = pStore->NextComment(comment))
+		{
+			const char* pszComment = pStore->GetComment(comment, nLength);
+			comments.push_back(std::string(pszComment, nLength));
+		}
+		for (XmlNodeStore::Index child = pStore->FirstChild(record_); child != XmlNodeStore::NIL; child = pStore->NextSibling(child))
+		{
+			children.push_back(JTI_NEW XmlNodeImpl(pStore, child));
+			pTree->AddRef();
+			children.back()->pTree_ = pTree;
+		}
+	}
+	catch (...)
+	{
+		std::for_each(children.begin(), children.end(), stdx::rel_obj<XmlNodeImpl*>());
+		throw;
+	}
+
+	attribs_.swap(attribs);
+	comments_.swap(comments);
+	children_.swap(children);
+	pStore_ = NULL;
+	pStore->Release();
+
+}// XmlNodeImpl::ExpandRecord
+
+/*****************************************************************************
+** Procedure:  XmlNodeImpl::ExpandAll
+** 
+** Arguments:  void
+** 
+** Returns: void
+** 
+** Description: Expands this node and every node below it, so none of them
+**              refer to the store any longer.
+**
+/****************************************************************************/
+void XmlNodeImpl::ExpandAll()
+{
+	Expand();
+	CCSLock<XmlNodeImpl> aLock(this);
+	for (std::vector<XmlNodeImpl*>::iterator it = children_.begin(); it != children_.end(); ++it)
+		(*it)->ExpandAll();
+
+}// XmlNodeImpl::ExpandAll
+
+/*****************************************************************************
+** Procedure:  XmlNodeImpl::RenderXml
+** 
+** Arguments:  'level' - Indent of the node; 0 adds the XML declaration
+** 
+** Returns: string representation of the node.
+** 
+** Description: This renders the XML for a given node.
+**
+/****************************************************************************/
+std::string XmlNodeImpl::RenderXml(int level) const
+{
+	std::string xml;
+	XmlWriter writer(xml);
+	writer.indent_ = level;
+	if (level == 0)
+		writer.WriteDeclaration();
+	writer.WriteNode(const_cast<XmlNodeImpl*>(this));
+	writer.Flush();
+	return xml;
+
+}// XmlNodeImpl::RenderXml
+
+/*****************************************************************************
+** Procedure:  XmlNode::get_Attributes
+** 
+** Arguments:  void
+** 
+** Returns: Wrapped attribute map
+** 
+** Description: Returns the attribute map for the XmlNode list.
+**
+/****************************************************************************/
+XmlAttributeMap XmlNode::get_Attributes() const 
+{ 
+	pImpl_->Expand();
+	return XmlAttributeMap(*this, pImpl_->attribs_); 
+
+}// XmlNode::get_Attributes
+
+/*****************************************************************************
+** Procedure:  XmlNode::get_Children
+** 
+** Arguments:  void
+** 
+** Returns: Wrapped child node array
+** 
+** Description: Returns the node array for the XmlNode list.
+**
+/****************************************************************************/
+XmlNodeArray XmlNode::get_Children() const 
+{ 
+	pImpl_->Expand();
+	return XmlNodeArray(*this, pImpl_->children_); 
+
+}// XmlNode::get_Children
+
+/*****************************************************************************
+** Procedure:  XmlNode::get_Comments
+** 
+** Arguments:  void
+** 
+** Returns: Returns the array of comments.
+** 
+** Description: Returns the string array for the comment list
+**
+/****************************************************************************/
+XmlCommentArray XmlNode::get_Comments() const
+{
+	pImpl_->Expand();
+	return XmlCommentArray(*this, pImpl_->comments_);
+
+}// XmlNode::get_Comments
+
+/*****************************************************************************
+** Procedure:  XmlNodeImpl::SetName
+** 
+** Arguments:  'pszName' - New name of the node
+** 
+** Returns: void
+** 
+** Description: Renames the node; paths remembered by documents may no
+**              longer refer to the same nodes.
+**
+/****************************************************************************/
+void XmlNodeImpl::SetName(const char* pszName)
+{
+	name_ = pszName;
+	nameHash_ = XmlPath::HashText(name_.data(), name_.length());
+	Changed();
+
+}// XmlNodeImpl::SetName
+
+/*****************************************************************************
+** Procedure:  XmlNodeImpl::FindPath
+** 
+** Arguments:  'path' - Path of the node to locate
+**             'nFirst' - First name in the path to look for below this node
+** 
+** Returns: Located node or NULL
+** 
+** Description: Walks down from this node matching each remaining name of
+**              the path against the children, comparing hashes first.
+**
+/****************************************************************************/
+XmlNodeImpl* XmlNodeImpl::FindPath(const XmlPath& path, int nFirst)
+{
+	XmlNodeImpl* pNode = this;
+	for (int i = nFirst; i < path.Count && pNode != NULL; ++i)
+	{
+		pNode->Expand();
+		CCSLock<XmlNodeImpl> _lockGuard(pNode);
+		XmlNodeImpl* pChild = NULL;
+		for (std::vector<XmlNodeImpl*>::iterator it = pNode->children_.begin(); it != pNode->children_.end(); ++it)
+		{
+			if (path.Matches(i, (*it)->name_, (*it)->nameHash_))
+			{
+				pChild = *it;
+				break;
+			}
+		}
+		pNode = pChild;
+	}
+	return pNode;
+
+}// XmlNodeImpl::FindPath
+
+/*****************************************************************************
+** Procedure:  XmlNode::Find
+** 
+** Arguments:  'pszPath' - Path of the node to locate
+** 
+** Returns: Located node
+** 
+** Description: Locates a subnode from this point
+**
+/****************************************************************************/
+XmlNode XmlNode::find(const char* pszPath) const
+{
+	if (pszPath == NULL || *pszPath == '\0')
+		return XmlNode();
+	return find(XmlPath(pszPath));
+
+}// XmlNode::find
+
+/*****************************************************************************
+** Procedure:  XmlNode::Find
+** 
+** Arguments:  'path' - Path of the node to locate
+** 
+** Returns: Located node
+** 
+** Description: Locates a subnode from this point
+**
+/****************************************************************************/
+XmlNode XmlNode::find(const XmlPath& path) const
+{
+	if (path.IsEmpty || !HasChildren)
+		return XmlNode();
+
+	XmlNodeImpl* pNode = pImpl_->FindPath(path, 0);
+	return (pNode != NULL) ? XmlNode(pNode) : XmlNode();
+
+}// XmlNode::find
+
+/*****************************************************************************
+** Procedure:  XmlTreeGeneration::Join
+** 
+** Arguments:  'pFirst' - Count of one tree
+**             'pSecond' - Count of the other
+** 
+** Returns: void
+** 
+** Description: Makes the two trees share one count.  The count at the
+**              higher address is always joined to the lower, so joins
+**              racing on other threads cannot link the counts in a loop.
+**
+/****************************************************************************/
+void XmlTreeGeneration::Join(XmlTreeGeneration* pFirst, XmlTreeGeneration* pSecond)
+{
+	for (;;)
+	{
+		XmlTreeGeneration* pFrom = pFirst->Find();
+		XmlTreeGeneration* pTo = pSecond->Find();
+		if (pFrom == pTo)
+			return;
+		if (pFrom < pTo)
+			std::swap(pFrom, pTo);
+
+		pTo->AddRef();
+		if (InterlockedCompareExchangePointer(reinterpret_cast<PVOID volatile*>(&pFrom->pJoined_), pTo, NULL) == NULL)
+			return;
+		pTo->Release();
+	}
+
+}// XmlTreeGeneration::Join
+
+/*****************************************************************************
+** Procedure:  XmlNodeImpl::Tree
+** 
+** Arguments:  void
+** 
+** Returns: Change count of the tree holding this node
+** 
+** Description: Returns the count, creating one for a node which has not
+**              been added to another or asked for its count before.
+**
+/****************************************************************************/
+XmlTreeGeneration* XmlNodeImpl::Tree() const
+{
+	if (pTree_ == NULL)
+	{
+		XmlTreeGeneration* pTree = JTI_NEW XmlTreeGeneration;
+		if (InterlockedCompareExchangePointer(reinterpret_cast<PVOID volatile*>(&const_cast<XmlNodeImpl*>(this)->pTree_), pTree, NULL) != NULL)
+			pTree->Release();	//lint !e534
+	}
+	return pTree_;
+
+}// XmlNodeImpl::Tree
+
+/*****************************************************************************
+** Procedure:  XmlNodeImpl::Adopt
+** 
+** Arguments:  'pChild' - Node just added as a child of this one
+** 
+** Returns: void
+** 
+** Description: Counts the changes to the child with this node's tree.  A
+**              child already in a tree joins the two counts.
+**
+/****************************************************************************/
+void XmlNodeImpl::Adopt(XmlNodeImpl* pChild) const
+{
+	XmlTreeGeneration* pTree = Tree();
+	pTree->AddRef();
+	if (InterlockedCompareExchangePointer(reinterpret_cast<PVOID volatile*>(&pChild->pTree_), pTree, NULL) != NULL)
+	{
+		pTree->Release();	//lint !e534
+		XmlTreeGeneration::Join(pChild->pTree_, pTree);
+	}
 
-// Constructor
-public:
-	InternalParser(LPCSTR pszData) : xmlData_(pszData) {/* */}
+}// XmlNodeImpl::Adopt
 
-// Access methods
-public:
-	void Parse(XmlNode& node) { 
-		LPCSTR pszCurrent = xmlData_;
-		node = ReadElement(pszCurrent, 0);
-	}
+/*****************************************************************************
+** Procedure:  XmlDocument::XmlDocument
+** 
+** Arguments:  void
+** 
+** Returns: void
+** 
+** Description: Constructor for the Xml parser object
+**
+/****************************************************************************/
+XmlDocument::XmlDocument(const char* pszRootName) : root_(pszRootName), pPathTree_(NULL), pathGeneration_(0)
+{ 
+}// XmlDocument::XmlDocument
 
-// Internal methods
-private:
-	XmlNode ReadElement(LPCSTR& pszCurrent, int level) const;
-	bool ParseElementData(XmlNode& node, LPCSTR& pszCurrent) const;
-	bool ParseAttribute(XmlNode& node, LPCSTR& pszCurrent) const;
-	bool ParseText(XmlNode& node, LPCSTR& pszCurrent, XmlTagType lastTag) const;
-	XmlTagType NextToken(LPCSTR& pszCurr, int& size) const;
-	XmlTagType IdentifyToken(LPCSTR pszCurr, int* psize=NULL) const;
-	bool SkipWhitespace(LPCSTR& pszCurrent) const;
-	std::string CollectToTag(LPCSTR& pszCurrent, XmlTagType tagToEnd) const;
-	std::string CollectToWhitespaceOrTag(LPCSTR& pszCurrent, XmlTagType tagToEnd = TT_ANY) const;
-	void Throw(const char* pszFmt, ...) const;
+/*****************************************************************************
+** Procedure:  XmlDocument::XmlDocument
+** 
+** Arguments:  'rhs' - Document to share the root node of
+** 
+** Returns: void
+** 
+** Description: Copy constructor; remembered paths are not copied.
+**
+/****************************************************************************/
+XmlDocument::XmlDocument(const XmlDocument& rhs) : root_(rhs.root_), pPathTree_(NULL), pathGeneration_(0)
+{ 
+}// XmlDocument::XmlDocument
 
-public:
-	static LPCSTR InternalParser::GetTagText(XmlTagType tag);
-};
+/*****************************************************************************
+** Procedure:  XmlDocument::XmlDocument
+** 
+** Arguments:  'pStore' - Parsed document
+** 
+** Returns: void
+** 
+** Description: Constructor for a document read from a node store.  The
+**              document takes over the caller's reference to the store.
+**
+/****************************************************************************/
+XmlDocument::XmlDocument(XmlNodeStore* pStore) : pPathTree_(NULL), pathGeneration_(0)
+{ 
+	Attach(pStore);
+
+}// XmlDocument::XmlDocument
 
 /*****************************************************************************
-** Procedure:  InternalParser::Throw
+** Procedure:  XmlDocument::~XmlDocument
 ** 
-** Arguments:  'pszFormat' - Format string
+** Arguments:  void
 ** 
 ** Returns: void
 ** 
-** Description: Throws an exception
+** Description: Destructor for the Xml parser object
 **
 /****************************************************************************/
-void InternalParser::Throw(const char* pszFormat, ...) const
+XmlDocument::~XmlDocument()
+{ 
+	ClearPaths();
+
+}// XmlDocument::~XmlDocument
+
+/*****************************************************************************
+** Procedure:  XmlDocument::operator=
+** 
+** Arguments:  'rhs' - Document to share the root node of
+** 
+** Returns: This document
+** 
+** Description: Assignment operator
+**
+/****************************************************************************/
+XmlDocument& XmlDocument::operator=(const XmlDocument& rhs)
 {
-	va_list args;
-	va_start(args, pszFormat);
-	char chBuff[255];
-	if (_vsnprintf(chBuff, sizeof(chBuff), pszFormat, args) == -1)
-		chBuff[sizeof(chBuff)-1] = '\0';
-	va_end(args);
-	
-	throw std::runtime_error(chBuff);
+	if (this != &rhs)
+	{
+		ClearPaths();
+		root_ = rhs.root_;
+	}
+	return *this;
 
-}// InternalParser::Throw
+}// XmlDocument::operator=
 
 /*****************************************************************************
-** Procedure:  InternalParser::GetTagText
+** Procedure:  XmlDocument::ClearPaths
 ** 
-** Arguments:  'tag' - Tag to search for
+** Arguments:  void
 ** 
-** Returns: Text for tag
+** Returns: void
 ** 
-** Description: This looks up a tag and returns the appropriate text
+** Description: Forgets all remembered paths.
 **
 /****************************************************************************/
-LPCSTR InternalParser::GetTagText(XmlTagType tag)
+void XmlDocument::ClearPaths() const
 {
-	// Walk all the tags looking for a match.
-	for (int i = 0; i < TAG_COUNT; ++i)
+	for (PathCache::iterator it = paths_.begin(); it != paths_.end(); ++it)
 	{
-		if (gTags[i].id == tag)
-			return gTags[i].pszTag;
+		if (it->second.pNode != NULL)
+			it->second.pNode->Release();
 	}
-	return "";
+	paths_.clear();
+	pPathTree_ = NULL;
+
+}// XmlDocument::ClearPaths
+
+/*****************************************************************************
+** Procedure:  XmlDocument::find
+** 
+** Arguments:  'pszPath' - Path of the node to locate
+** 
+** Returns: Located node
+** 
+** Description: Locates a node by its full path from the root
+**
+/****************************************************************************/
+XmlNode XmlDocument::find(const char* pszPath) const
+{
+	if (pszPath == NULL || *pszPath == '\0')
+		return XmlNode();
+	return find(XmlPath(pszPath));
 
-}// InternalParser::GetTagText
+}// XmlDocument::find
 
 /*****************************************************************************
-** Procedure:  InternalParser::NextToken
+** Procedure:  XmlDocument::find
 ** 
-** Arguments:  'pszCurrent' - Current position in the buffer.
-**             'size' - Reference to returning size
+** Arguments:  'path' - Path of the node to locate
 ** 
-** Returns: Tag type found in buffer.
+** Returns: Located node
 ** 
-** Description: This reads the next tag and returns
+** Description: Locates a node by its full path from the root.  The result
+**              is remembered so the same path is found again with a single
+**              hash lookup until a node of this document's tree is added,
+**              removed or renamed.
 **
 /****************************************************************************/
-XmlTagType InternalParser::NextToken(LPCSTR& pszCurr, int& size) const
+XmlNode XmlDocument::find(const XmlPath& path) const
 {
-	// Skip any whitespace
-	if (!SkipWhitespace(pszCurr))
-		return TT_INVALID;
+	XmlNodeImpl* pRoot = root_.pImpl_;
+	if (path.IsEmpty || !path.Matches(0, pRoot->name_, pRoot->nameHash_))
+		return XmlNode();
+
+	CCSLock<XmlNodeImpl> _lockGuard(pRoot);
+	XmlTreeGeneration* pTree = pRoot->Tree()->Find();
+	long generation = pTree->get_Count();
+	if (pTree != pPathTree_ || generation != pathGeneration_)
+	{
+		ClearPaths();
+		pPathTree_ = pTree;
+		pathGeneration_ = generation;
+	}
+
+	std::pair<PathCache::iterator, PathCache::iterator> range = paths_.equal_range(path.Hash);
+	for (PathCache::iterator it = range.first; it != range.second; ++it)
+	{
+		if (it->second.path == path.Text)
+			return (it->second.pNode != NULL) ? XmlNode(it->second.pNode) : XmlNode();
+	}
 
-	// Identify the next token and adjust our buffer position.
-	XmlTagType tag = IdentifyToken(pszCurr, &size);
-	pszCurr += size;
-	return tag;
+	XmlNodeImpl* pNode = pRoot->FindPath(path, 1);
+	if (paths_.size() >= MaxCachedPaths)
+		ClearPaths();
 
-}// InternalParser::NextToken
+	CachedPath entry;
+	entry.path = path.Text;
+	entry.pNode = pNode;
+	paths_.insert(std::make_pair(path.Hash, entry));
+	if (pNode == NULL)
+		return XmlNode();
+	pNode->AddRef();
+	return XmlNode(pNode);
+
+}// XmlDocument::find
 
 /*****************************************************************************
-** Procedure:  InternalParser::IdentifyToken
+** Procedure:  DetachStore
 ** 
-** Arguments: 'pszCurr' - Current position in buffer to identify
+** Arguments:  'pStore' - Store just loaded, or NULL
 ** 
-** Returns: Token type
+** Returns: The store, or NULL if none was loaded
 ** 
-** Description: This checks the current position for a valid token
+** Description: Closes the file a loaded store was mapped from, so the
+**              file can be saved or replaced while the document is held.
+**              The store is released if this fails.
 **
 /****************************************************************************/
-XmlTagType InternalParser::IdentifyToken(LPCSTR pszCurr, int* psize) const
+static XmlNodeStore* DetachStore(XmlNodeStore* pStore)
 {
-	// Walk all the tags looking for a match.
-	for (int i = 0; i < TAG_COUNT; ++i)
+	if (pStore != NULL)
 	{
-		if (!strncmp(gTags[i].pszTag, pszCurr, gTags[i].size))
+		try
+		{
+			pStore->Detach();
+		}
+		catch (...)
 		{
-			if (psize) *psize = gTags[i].size;
-			return gTags[i].id;
+			pStore->Release();
+			throw;
 		}
 	}
+	return pStore;
+
+}// DetachStore
 
-	if (psize) *psize = 0;
-	return TT_TEXT;
+/*****************************************************************************
+** Procedure:  XmlDocument::load
+** 
+** Arguments:  'pszFile' - Filename to load
+**             'nThreads' - Threads the parse may use
+** 
+** Returns: true/false whether load was successful.
+** 
+** Description: This maps an XML file into memory and parses it in place,
+**              then copies the text still in the file out and closes it.
+**
+/****************************************************************************/
+bool XmlDocument::load(const char* pszFile, int nThreads)
+{
+	XmlNodeStore* pStore = DetachStore(XmlNodeStore::Load(pszFile, nThreads));
+	if (pStore == NULL)
+		return false;
+	Attach(pStore);
+	return true;
 
-}// InternalParser::IdentifyToken
+}// XmlDocument::load
 
 /*****************************************************************************
-** Procedure:  InternalParser::SkipWhitespace
+** Procedure:  XmlDocument::load
 ** 
-** Arguments: 'pszCurrent' - Current position in buffer (adjusted)
+** Arguments:  'pszFile' - Filename to load
+**             'pszSnapshot' - Binary snapshot of the file
+**             'nThreads' - Threads the parse may use
 ** 
-** Returns: String read
+** Returns: true/false whether load was successful.
 ** 
-** Description: This skips any whitespace characters
+** Description: This loads a document from its snapshot if the snapshot
+**              is current, or else parses the file and writes the snapshot
+**              again (see XmlNodeStore::LoadCached).  Neither file is
+**              held open once the document is loaded.
 **
 /****************************************************************************/
-bool InternalParser::SkipWhitespace(LPCSTR& pszCurrent) const
+bool XmlDocument::load(const char* pszFile, const char* pszSnapshot, int nThreads)
 {
-	// Skip whitespace
-	while (*pszCurrent && isspace(*pszCurrent))
-		++pszCurrent;
+	XmlNodeStore* pStore = DetachStore(XmlNodeStore::LoadCached(pszFile, pszSnapshot, nThreads));
+	if (pStore == NULL)
+		return false;
+	Attach(pStore);
+	return true;
 
-	return (*pszCurrent != '\0');
+}// XmlDocument::load
 
-}// InternalParser::SkipWhitespace
+/*****************************************************************************
+** Procedure:  XmlDocument::save
+** 
+** Arguments:  'pszFile' - Filename to save to
+** 
+** Returns: true/false whether save was successful.
+** 
+** Description: This writes the document to disk through an XmlWriter.
+**              Lines end with CR/LF as they did when the file was written
+**              in text mode; line breaks inside values are written as
+**              they are held.
+**
+/****************************************************************************/
+bool XmlDocument::save(const char* pszFile)
+{
+	// A document built from a mapped store refers to its file until every
+	// node has been read; read them all before the file is replaced.
+	root_.pImpl_->ExpandAll();
+
+	USES_CONVERSION;
+	filestream stm(A2T(const_cast<char*>(pszFile)), filestream::out);
+	if (stm.fail() || !stm.write("\xEF\xBB\xBF", 3))	 // UTF-8 byte order marker
+		return false;
+
+	try
+	{
+		XmlWriter writer(stm);
+		writer.NewLine = "\r\n";
+		writer.WriteDeclaration();
+		writer.WriteNode(root_);
+		writer.Flush();
+	}
+	catch (const std::runtime_error&)
+	{
+		return false;
+	}
+
+	stm.close();
+	return stm.good();
+
+}// XmlDocument::save
+
+/*****************************************************************************
+** Procedure:  XmlDocument::parse
+** 
+** Arguments:  'xmlBuffer' - XML data to load
+**             'nThreads' - Threads the parse may use
+** 
+** Returns: true/false whether parse was successful.
+** 
+** Description: This parses out an XML file
+**
+/****************************************************************************/
+void XmlDocument::parse(const std::string& xmlBuffer, int nThreads)
+{
+	// No data? ignore.
+	if (xmlBuffer.empty())
+		return;
+
+	Attach(XmlNodeStore::Create(xmlBuffer.data(), xmlBuffer.length(), nThreads));
+
+}// XmlDocument::parse
 
 /*****************************************************************************
-** Procedure:  InternalParser CollectToWhitespace
+** Procedure:  XmlDocument::Attach
 ** 
-** Arguments: 'pszData' - Current position in buffer (adjusted)
+** Arguments:  'pStore' - Parsed document; the caller's reference is taken
 ** 
-** Returns: String read
+** Returns: void
 ** 
-** Description: This reads up to the next whitespace character
+** Description: Makes the root of the store the document root.  Nodes are
+**              read from the store as they are used and the store is freed
+**              once every node has been expanded or released.
 **
 /****************************************************************************/
-std::string InternalParser::CollectToWhitespaceOrTag(LPCSTR& pszCurrent, XmlTagType tagToEnd) const
+void XmlDocument::Attach(XmlNodeStore* pStore)
 {
-	std::string text;
-	while (*pszCurrent && !isspace(*pszCurrent))
+	XmlNodeImpl* pRoot = NULL;
+	try
 	{
-		XmlTagType tagThis = IdentifyToken(pszCurrent);
-		if (tagThis == tagToEnd || (tagToEnd == TT_ANY && tagThis != TT_TEXT))
-			break;
-		text += *pszCurrent++;
+		pRoot = (pStore->Count > 0) ? JTI_NEW XmlNodeImpl(pStore, pStore->Root()) : JTI_NEW XmlNodeImpl;
+	}
+	catch (...)
+	{
+		pStore->Release();
+		throw;
 	}
+	pStore->Release();
+	ClearPaths();
+	root_ = XmlNode(pRoot);
+	pRoot->Release();
 
-	if (*pszCurrent == '\0' && tagToEnd != TT_ANY)
-		Throw("Hit end of stream while searching for tag %s", GetTagText(tagToEnd));
+}// XmlDocument::Attach
 
-	return text;
+/*****************************************************************************
+** Procedure:  XmlDocument::create
+** 
+** Arguments:  'pszPath' - Path of the node to create
+** 
+** Returns: Located or created node
+** 
+** Description: Locates a node by its full path, creating any missing nodes
+**
+/****************************************************************************/
+XmlNode XmlDocument::create(const char* pszPath, bool* pfCreated)
+{
+	// Init entry
+	if (pfCreated)
+		*pfCreated = false;
+
+	if (pszPath == NULL || *pszPath == '\0')
+		throw std::runtime_error("Invalid path passed into XmlDocument::Create");
+
+	return create(XmlPath(pszPath), pfCreated);
+
+}// XmlDocument::create
+
+/*****************************************************************************
+** Procedure:  XmlDocument::create
+** 
+** Arguments:  'path' - Path of the node to create
+** 
+** Returns: Located or created node
+** 
+** Description: Locates a node by its full path, creating any missing nodes
+**
+/****************************************************************************/
+XmlNode XmlDocument::create(const XmlPath& path, bool* pfCreated)
+{
+	// Init entry
+	if (pfCreated)
+		*pfCreated = false;
+
+	// Existing nodes are found through the remembered paths; this also
+	// rejects paths which do not start at the root.
+	XmlNode currNode = find(path);
+	if (currNode.IsValid || path.IsEmpty || !path.Matches(0, root_.pImpl_->name_, root_.pImpl_->nameHash_))
+		return currNode;
+
+	currNode = root_;
+	for (int i = 1; i < path.Count; ++i)
+	{
+		std::string name = path[i];
+		XmlNode foundNode = currNode.Children.find(name.c_str());
+		if (!foundNode.IsValid)
+		{
+			foundNode = XmlNode(name.c_str());
+			currNode.Children.add(foundNode);
+			if (pfCreated) *pfCreated = true;
+		}
+		currNode = foundNode;
+	}
+	return currNode;
+
+}// XmlDocument::create
+
+/*****************************************************************************
+** Procedure:  XmlWriter::XmlWriter
+** 
+** Arguments:  'stm' - Stream to write to
+**             'nBufferSize' - Bytes gathered before each write to the stream
+** 
+** Returns: void
+** 
+** Description: Creates a writer which writes to a binstream.
+**
+/****************************************************************************/
+XmlWriter::XmlWriter(binstream& stm, size_t nBufferSize) : 
+	pStream_(&stm), pText_(NULL), buffer_((nBufferSize > 0) ? nBufferSize : 1), used_(0),
+	newLine_("\n"), indent_(0), fOpenTag_(false), fHasText_(false)
+{
+}// XmlWriter::XmlWriter
 
-}// InternalParser CollectToWhitespace
+/*****************************************************************************
+** Procedure:  XmlWriter::XmlWriter
+** 
+** Arguments:  'text' - String to append to
+**             'nBufferSize' - Bytes gathered before each append
+** 
+** Returns: void
+** 
+** Description: Creates a writer which appends to a string.
+**
+/****************************************************************************/
+XmlWriter::XmlWriter(std::string& text, size_t nBufferSize) : 
+	pStream_(NULL), pText_(&text), buffer_((nBufferSize > 0) ? nBufferSize : 1), used_(0),
+	newLine_("\n"), indent_(0), fOpenTag_(false), fHasText_(false)
+{
+}// XmlWriter::XmlWriter
 
 /*****************************************************************************
-** Procedure:  InternalParser::CollectToTag
+** Procedure:  XmlWriter::~XmlWriter
 ** 
-** Arguments: 'pszData' - Current position in buffer (adjusted)
+** Arguments:  void
 ** 
-** Returns: String read
+** Returns: void
 ** 
-** Description: This reads up to the given tag.  This is similar to the
-**              above function but ignores whitespace.
+** Description: Passes any buffered output to the sink.  Call Flush() first
+**              to find out whether the final write succeeded.
 **
 /****************************************************************************/
-std::string InternalParser::CollectToTag(LPCSTR& pszCurrent, XmlTagType tagToEnd) const
+XmlWriter::~XmlWriter()
 {
-	std::string text;
-	while (*pszCurrent)
+	try
+	{
+		Drain();
+	}
+	catch (...)
 	{
-		XmlTagType tagThis = IdentifyToken(pszCurrent);
-		if (tagThis == tagToEnd)
-			break;
-		text += *pszCurrent++;
 	}
 
-	if (*pszCurrent == '\0')
-		Throw("Hit end of stream while searching for tag %s", GetTagText(tagToEnd));
+}// XmlWriter::~XmlWriter
 
-	return text;
+/*****************************************************************************
+** Procedure:  XmlWriter::WriteDeclaration
+** 
+** Arguments:  void
+** 
+** Returns: void
+** 
+** Description: Writes the XML declaration.
+**
+/****************************************************************************/
+void XmlWriter::WriteDeclaration()
+{
+	PutLine("<?xml version=\"1.0\" encoding=\"UTF-8\" ?>");
+
+}// XmlWriter::WriteDeclaration
 
-}// InternalParser::CollectToTag
+/*****************************************************************************
+** Procedure:  XmlWriter::WriteStartElement
+** 
+** Arguments:  'pszName' - Name of the element
+** 
+** Returns: void
+** 
+** Description: Opens an element within the current one.  The start tag is
+**              left open for attributes until something else is written.
+**
+/****************************************************************************/
+void XmlWriter::WriteStartElement(const char* pszName)
+{
+	if (fHasText_)
+		throw std::runtime_error("XmlWriter: element cannot follow text");
+	if (fOpenTag_)
+		PutLine(">");
+	PutIndent(elements_.size());
+	Put("<");
+	Put(pszName);
+	elements_.push_back(pszName);
+	fOpenTag_ = true;
+
+}// XmlWriter::WriteStartElement
 
 /*****************************************************************************
-** Procedure:  InternalParser::ParseAttribute
+** Procedure:  XmlWriter::PutAttribute
 ** 
-** Arguments: 'node' - Node to fill in 
-**            'pszCurrent' - Current position in the buffer.
+** Arguments:  'pszName' - Name of the attribute
+**             'pValue' - Value of the attribute
+**             'nLength' - Length of the value
 ** 
-** Returns: True/False success
+** Returns: void
 ** 
-** Description: This parses out a single attribute from the buffer and
-**              adds it to the given node.
+** Description: Adds an attribute to the open start tag.  The value is
+**              quoted with '"' unless it holds one.
 **
 /****************************************************************************/
-bool InternalParser::ParseAttribute(XmlNode& node, LPCSTR& pszCurrent) const
+void XmlWriter::PutAttribute(const char* pszName, const char* pValue, size_t nLength)
 {
-	// Current position is at beginning of text.  Read until we hit a space
-	// or an equal sign indicating the start of the value.
-	std::string attValue, attName = CollectToWhitespaceOrTag(pszCurrent, TT_EQUAL_SIGN);
-
-	// Make sure the next token is an equal sign!
-	int size = 0;
-	if (NextToken(pszCurrent, size) != TT_EQUAL_SIGN)
-		Throw("Missing '=' on attribute for element %s.", node.Name.c_str());
-
-	// Now, move until we hit a text tag.  Note whether we hit a quote/doublequote
-	// tag so we can search for the end marker.
-	XmlTagType tagNext = NextToken(pszCurrent, size);
-	if (tagNext == TT_QUOTE || tagNext == TT_SINGLEQUOTE)
-	{
-		attValue = CollectToTag(pszCurrent, tagNext);
-		if (NextToken(pszCurrent, size) != tagNext)
-			Throw("Missing closing quote on attribute %s for element %s.", attName.c_str(), node.Name.c_str());
-	}
-	else if (tagNext == TT_TEXT)
-		attValue = CollectToWhitespaceOrTag(pszCurrent, TT_ANY);
-	else
-	{
-		// Invalid tag hit
-		return false;
-	}
-
-	node.Attributes.add(attName.c_str(), attValue.c_str());
-	return true;
-
-}// InternalParser::ParseAttribute
+	if (!fOpenTag_)
+		throw std::runtime_error("XmlWriter: attribute written outside a start tag");
+	char chQuote = (memchr(pValue, '"', nLength) == NULL) ? '"' : '\'';
+	Put(" ");
+	Put(pszName);
+	Put("=");
+	Put(&chQuote, 1);
+	PutEscaped(pValue, nLength, chQuote);
+	Put(&chQuote, 1);
+
+}// XmlWriter::PutAttribute
 
 /*****************************************************************************
-** Procedure:  InternalParser::ParseElementData
+** Procedure:  XmlWriter::WriteText
 ** 
-** Arguments: 'node' - Node to fill in 
-**            'pszCurrent' - Current position in the buffer.
+** Arguments:  'pText' - Text of the element
+**             'nLength' - Length of the text
 ** 
-** Returns: Node which was read in.
+** Returns: void
 ** 
-** Description: This parses out a single element from the XML file.
+** Description: Writes text into the current element, escaping as needed.
 **
 /****************************************************************************/
-bool InternalParser::ParseElementData(XmlNode& node, LPCSTR& pszCurrent) const
+void XmlWriter::WriteText(const char* pText, size_t nLength)
 {
-	// Current position is at beginning of text.  Read until we hit a space
-	// or any known tag.  Element names are not allowed to contain spaces or
-	// reserved keyword (tag) characters.
-	node.Name = CollectToWhitespaceOrTag(pszCurrent).c_str();
-
-	// Now parse the remaining tokens until we hit an end marker.
-	while (*pszCurrent)
+	if (!fHasText_)
 	{
-		int size = 0;
-		XmlTagType tag = NextToken(pszCurrent, size);
-		switch (tag)
-		{
-			// Hit more text?  must be an attribute.
-			case TT_TEXT:
-				ParseAttribute(node, pszCurrent);
-				break;
-
-			// Got the end-tag or empty tag, backup and end.
-			case TT_OPEN_ENDTAG:
-			case TT_CLOSE_ENDTAG:
-				pszCurrent -= size;
-				return true;
-
-			// Some unknown tag.
-			default:
-				return false;
-		}
+		if (!fOpenTag_)
+			throw std::runtime_error("XmlWriter: text must directly follow a start tag");
+		Put(">");
+		fOpenTag_ = false;
+		fHasText_ = true;
 	}
-	return false;
+	PutEscaped(pText, nLength, '\0');
 
-}// InternalParser::ParseElementData
+}// XmlWriter::WriteText
 
 /*****************************************************************************
-** Procedure:  InternalParser::ParseText
+** Procedure:  XmlWriter::WriteComment
 ** 
-** Arguments: 'node' - Node to fill in 
-**            'pszCurrent' - Current position in the buffer.
-**            'lastTag' - Last tag we hit in the stream before the text.
+** Arguments:  'pszText' - Text of the comment
 ** 
 ** Returns: void
 ** 
-** Description: This parses out text from the XML stream.
+** Description: Writes a comment on its own line within the current element.
 **
 /****************************************************************************/
-bool InternalParser::ParseText(XmlNode& node, LPCSTR& pszCurrent, XmlTagType lastTag) const
+void XmlWriter::WriteComment(const char* pszText)
 {
-	if (lastTag == TT_OPEN_ENDTAG)
-	{
-		// Collect to the next close tag.
-		node.Value = CollectToTag(pszCurrent, TT_CLOSE_TAG).c_str();
-	}
-	else if (lastTag == TT_CLOSE_TAG)
+	if (fHasText_)
+		throw std::runtime_error("XmlWriter: comment cannot follow text");
+	if (fOpenTag_)
 	{
-		std::string name = CollectToWhitespaceOrTag(pszCurrent, TT_OPEN_ENDTAG);
-		if (name != node.Name)
-			Throw("Name on end tag (%s) does not match start tag (%s).", name.c_str(), node.Name.c_str());
-		return true;
-	}
-	else
-	{
-		Throw("Invalid text found (%s...), malformed document.", std::string(pszCurrent, 20).c_str());
+		PutLine(">");
+		fOpenTag_ = false;
 	}
+	PutIndent(elements_.size());
+	Put("<!--");
+	Put(pszText);
+	PutLine("-->");
 
-	return false;
-
-}// InternalParser::ParseText
+}// XmlWriter::WriteComment
 
 /*****************************************************************************
-** Procedure:  InternalParser::ReadElement
+** Procedure:  XmlWriter::WriteEndElement
 ** 
-** Arguments:  'pszCurrent' - Current position in the buffer.
-**             'level' - Current element level
+** Arguments:  void
 ** 
-** Returns: Node which was read in.
+** Returns: void
 ** 
-** Description: This parses out a single element from the XML file.
+** Description: Closes the current element; an element with no content is
+**              closed with "/>".
 **
 /****************************************************************************/
-XmlNode InternalParser::ReadElement(LPCSTR& pszCurrent, int level) const
+void XmlWriter::WriteEndElement()
 {
-	XmlNode node;
-	XmlTagType lastTag = TT_ANY;
+	if (elements_.empty())
+		throw std::runtime_error("XmlWriter: no element is open");
 
-	// If not a valid buffer..
-	if (pszCurrent == NULL || *pszCurrent == '\0')
-		Throw("Hit end of stream reading an incomplete element.");
-
-	// Keep walking until we hit the end.
-	while (*pszCurrent)
+	if (fOpenTag_)
+		PutLine("/>");
+	else
 	{
-		int size = 0;
-		XmlTagType tag = NextToken(pszCurrent, size);
-		switch (tag)
-		{
-			case TT_OPEN_TAG:
-				if (!node.IsValid)
-				{
-					if (!ParseElementData(node, pszCurrent))
-						Throw("Error parsing element %s", std::string(pszCurrent,20).c_str());
-				}
-				else
-				{
-					pszCurrent -= size;
-					node.Children.add(ReadElement(pszCurrent, level+1));
-				}
-				break;
-
-			case TT_OPEN_ENDTAG:
-				if (!node.IsValid)
-					Throw("Hit end-tag without fully formed element (%s...)", std::string(pszCurrent, 20).c_str());
-				break;
-
-			case TT_CLOSE_TAG:
-				if (!node.IsValid)
-					Throw("Hit end-tag without fully formed element (%s...)", std::string(pszCurrent, 20).c_str());
-				break;
-
-			
-			case TT_QUOTE:
-			case TT_SINGLEQUOTE:
-				if (!node.IsValid) {
-					Throw("Hit end-tag without fully formed element (%s...)", std::string(pszCurrent, 20).c_str());
-					break;
-				}
-				pszCurrent -= size;
-
-				// Fall through intentional.
-
-			case TT_TEXT:
-				if (ParseText(node, pszCurrent, lastTag))
-				{
-					// Parse indicated end tag found for this element; make sure
-					// and then exit.
-					if (NextToken(pszCurrent, size) != TT_OPEN_ENDTAG)
-						Throw("Missing end-tag on element %s", node.Name.c_str());
-					return node;
-				}
-				break;
-
-			case TT_CLOSE_ENDTAG:
-				return node;
-
-			case TT_PI_TAG:
-				CollectToTag(pszCurrent, TT_PI_ENDTAG);
-				break;
-			case TT_COMMENT_TAG:
-				node.Comments.add(CollectToTag(pszCurrent, TT_COMMENT_ENDTAG).c_str());
-				break;
-			case TT_MARKUP_TAG:
-				CollectToTag(pszCurrent, TT_OPEN_ENDTAG);
-				break;
-
-			// Ignore
-			case TT_PI_ENDTAG:
-			case TT_COMMENT_ENDTAG:
-				break;
-
-			default:
-				return node;
-		}
-
-		// Save off the last tag we hit.
-		lastTag = tag;
+		if (!fHasText_)
+			PutIndent(elements_.size() - 1);
+		Put("</");
+		Put(elements_.back());
+		PutLine(">");
 	}
+	elements_.pop_back();
+	fOpenTag_ = false;
+	fHasText_ = false;
 
-	return node;
-
-}// InternalParser::ReadElement
+}// XmlWriter::WriteEndElement
 
 /*****************************************************************************
-** Procedure:  XmlNodeImpl::XmlNodeImpl
+** Procedure:  XmlWriter::WriteNode
 ** 
-** Arguments:  'name' - Name of the node
-**             'value' - Value of the node
+** Arguments:  'pNode' - Node to write
 ** 
 ** Returns: void
 ** 
-** Description: This creates a new XML node
+** Description: Writes a node and everything below it.  Comments come before
+**              the start tag; a node with a value is written without its
+**              children.
 **
 /****************************************************************************/
-XmlNodeImpl::XmlNodeImpl(const char* pszName, const char* pszValue) : 
-	name_((pszName) ? pszName : ""), value_((pszValue) ? pszValue : "") 
+void XmlWriter::WriteNode(XmlNodeImpl* pNode)
 {
-	// Strip any spaces from the name.
-	if (name_.find(' ') != string::npos)
+	pNode->Expand();
+	CCSLock<XmlNodeImpl> aLock(pNode);
+
+	for (std::vector<std::string>::const_iterator it = pNode->comments_.begin(); it != pNode->comments_.end(); ++it)
+		WriteComment(it->c_str());
+
+	WriteStartElement(pNode->name_.c_str());
+	for (XmlAttributeList::const_iterator it = pNode->attribs_.begin(); it != pNode->attribs_.end(); ++it)
+		WriteAttribute(it->name->text.c_str(), it->value);
+
+	if (!pNode->value_.empty())
+		WriteText(pNode->value_.data(), pNode->value_.length());
+	else
 	{
-		std::string::size_type pos; 
-		while ((pos = name_.find_first_of(' ')) != std::string::npos)
-			name_.replace(pos, 1, "_");		
+		for (std::vector<XmlNodeImpl*>::const_iterator it = pNode->children_.begin(); it != pNode->children_.end(); ++it)
+			WriteNode(*it);
 	}
+	WriteEndElement();
 
-}// XmlNodeImpl::XmlNodeImpl
+}// XmlWriter::WriteNode
 
 /*****************************************************************************
-** Procedure:  XmlNodeImpl::~XmlNodeImpl
+** Procedure:  XmlWriter::Flush
 ** 
 ** Arguments:  void
 ** 
 ** Returns: void
 ** 
-** Description: Destructor for the node
+** Description: Passes buffered output to the sink; throws if the stream
+**              refuses it.
 **
 /****************************************************************************/
-XmlNodeImpl::~XmlNodeImpl()
+void XmlWriter::Flush()
 {
-	std::for_each(children_.begin(), children_.end(), stdx::delptr<XmlNodeImpl*>());
+	Drain();
 
-}// XmlNodeImpl::~XmlNodeImpl
+}// XmlWriter::Flush
 
 /*****************************************************************************
-** Procedure:  XmlNodeImpl::RenderXml
+** Procedure:  XmlWriter::PutEscaped
 ** 
-** Arguments:  void
+** Arguments:  'pText' - Text to write
+**             'nLength' - Length of the text
+**             'chQuote' - Quote around an attribute value, or '\0' for text
 ** 
-** Returns: string representation of the node.
+** Returns: void
 ** 
-** Description: This renders the XML for a given node.
+** Description: Writes text with '&', '<', '>' and the quote escaped; runs
+**              of plain characters are copied in one piece.
 **
 /****************************************************************************/
-std::string XmlNodeImpl::RenderXml(int level) const
+void XmlWriter::PutEscaped(const char* pText, size_t nLength, char chQuote)
 {
-	std::stringstream stm;
-
-	// Spit out the default PI header
-	if (level == 0)
-		stm << "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>" << endl;
-
-	// Add the comments above the tag itself.
-	if (!comments_.empty())
+	const char* pEnd = pText + nLength;
+	for (;;)
 	{
-		for (std::vector<std::string>::const_iterator it = comments_.begin(); 
-				it != comments_.end(); ++it)
+		const char* pStop = FindEscape(pText, pEnd, chQuote);
+		Put(pText, pStop - pText);
+		if (pStop == pEnd)
+			break;
+		switch (*pStop)
 		{
-			stm << std::string(level,'\t')
-				<< InternalParser::GetTagText(TT_COMMENT_TAG)
-				<< *it
-				<< InternalParser::GetTagText(TT_COMMENT_ENDTAG)
-				<< endl;
+			case '&':	Put("&amp;"); break;
+			case '<':	Put("&lt;"); break;
+			case '>':	Put("&gt;"); break;
+			case '"':	Put("&quot;"); break;
+			default:	Put("&apos;"); break;
 		}
+		pText = pStop + 1;
 	}
 
-	// Add the opening tag
-	stm << std::string(level,'\t') << InternalParser::GetTagText(TT_OPEN_TAG) << name_;
-	if (!attribs_.empty())
-	{
-		CCSLock<XmlNodeImpl> aLock(this);
-		for (std::map<std::string, std::string>::const_iterator it = attribs_.begin(); 
-			 it != attribs_.end(); ++it)
-		{
-			stm << " " << it->first << InternalParser::GetTagText(TT_EQUAL_SIGN);
-			std::string sQuote = (it->second.find("\"") == std::string::npos) ?
-				InternalParser::GetTagText(TT_QUOTE) : 
-				InternalParser::GetTagText(TT_SINGLEQUOTE);
-			stm << sQuote << it->second << sQuote;
-		}
-	}
-	
-	if (!value_.empty())
-	{
-		stm << InternalParser::GetTagText(TT_OPEN_ENDTAG) << value_ 
-			<< InternalParser::GetTagText(TT_CLOSE_TAG) << name_ 
-			<< InternalParser::GetTagText(TT_OPEN_ENDTAG) << std::endl;
-	}
-	else
+}// XmlWriter::PutEscaped
+
+/*****************************************************************************
+** Procedure:  XmlWriter::PutIndent
+** 
+** Arguments:  'nDepth' - Depth of the line being started
+** 
+** Returns: void
+** 
+** Description: Writes the tabs which start a line.
+**
+/****************************************************************************/
+void XmlWriter::PutIndent(size_t nDepth)
+{
+	static const char szTabs[] = "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t";
+	for (size_t nTabs = nDepth + indent_; nTabs > 0; )
 	{
-		if (!children_.empty())
-		{
-			stm << InternalParser::GetTagText(TT_OPEN_ENDTAG) << endl;
-			CCSLock<XmlNodeImpl> aLock(this);
-			for (std::vector<XmlNodeImpl*>::const_iterator it = children_.begin(); 
-				 it != children_.end(); ++it)
-				stm << (*it)->RenderXml(level+1);
-			stm << std::string(level,'\t') << InternalParser::GetTagText(TT_CLOSE_TAG) 
-				<< name_ << InternalParser::GetTagText(TT_OPEN_ENDTAG) << std::endl;
-		}
-		else
-			stm << InternalParser::GetTagText(TT_CLOSE_ENDTAG) << std::endl;
+		size_t nPart = (nTabs < sizeof(szTabs) - 1) ? nTabs : sizeof(szTabs) - 1;
+		Put(szTabs, nPart);
+		nTabs -= nPart;
 	}
 
-	return stm.str();
-
-}// XmlNodeImpl::RenderXml
+}// XmlWriter::PutIndent
 
 /*****************************************************************************
-** Procedure:  XmlNode::get_Attributes
+** Procedure:  XmlWriter::Put
 ** 
-** Arguments:  void
+** Arguments:  'pData' - Characters to write
+**             'nLength' - Number of characters
 ** 
-** Returns: Wrapped attribute map
+** Returns: void
 ** 
-** Description: Returns the attribute map for the XmlNode list.
+** Description: Adds output to the buffer, draining it as it fills.
 **
 /****************************************************************************/
-XmlAttributeMap XmlNode::get_Attributes() const 
-{ 
-	return XmlAttributeMap(*this, pImpl_->attribs_); 
+void XmlWriter::Put(const char* pData, size_t nLength)
+{
+	while (nLength > 0)
+	{
+		if (used_ == buffer_.size())
+			Drain();
+		size_t nPart = buffer_.size() - used_;
+		if (nPart > nLength)
+			nPart = nLength;
+		memcpy(&buffer_[used_], pData, nPart);
+		used_ += nPart;
+		pData += nPart;
+		nLength -= nPart;
+	}
 
-}// XmlNode::get_Attributes
+}// XmlWriter::Put
 
 /*****************************************************************************
-** Procedure:  XmlNode::get_Children
+** Procedure:  XmlWriter::Drain
 ** 
 ** Arguments:  void
 ** 
-** Returns: Wrapped child node array
+** Returns: void
 ** 
-** Description: Returns the node array for the XmlNode list.
+** Description: Passes the buffered output to the stream or string.
 **
 /****************************************************************************/
-XmlNodeArray XmlNode::get_Children() const 
-{ 
-	return XmlNodeArray(*this, pImpl_->children_); 
+void XmlWriter::Drain()
+{
+	if (used_ == 0)
+		return;
+	size_t nLength = used_;
+	used_ = 0;
+	if (pText_ != NULL)
+		pText_->append(&buffer_[0], nLength);
+	else if (!pStream_->write(&buffer_[0], static_cast<unsigned int>(nLength)))
+		throw std::runtime_error("XmlWriter: write to stream failed");
 
-}// XmlNode::get_Children
+}// XmlWriter::Drain
 
 /*****************************************************************************
-** Procedure:  XmlNode::get_Comments
+** Procedure:  XmlReader::XmlReader
 ** 
-** Arguments:  void
+** Arguments:  'pData' - XML text
+**             'nLength' - Length of the text
 ** 
-** Returns: Returns the array of comments.
+** Returns: void
 ** 
-** Description: Returns the string array for the comment list
+** Description: Creates a reader over a buffer holding the whole document.
+**              The buffer is not copied and must outlive the reader.
 **
 /****************************************************************************/
-XmlCommentArray XmlNode::get_Comments() const
+XmlReader::XmlReader(const char* pData, size_t nLength) : 
+	pParser_(NULL), pStream_(NULL), chunkSize_(0), type_(None), pName_(NULL), nName_(0), 
+	pValue_(NULL), nValue_(0), fEntities_(false), depth_(0), level_(0)
 {
-	return XmlCommentArray(*this, pImpl_->comments_);
+	pParser_ = JTI_NEW InternalParser(pData, nLength);
 
-}// XmlNode::get_Comments
+}// XmlReader::XmlReader
 
 /*****************************************************************************
-** Procedure:  XmlNode::Find
+** Procedure:  XmlReader::XmlReader
 ** 
-** Arguments:  'pszPath' - Path of the node to locate
+** Arguments:  'stm' - Stream positioned at the document
+**             'nChunkSize' - Bytes to read from the stream at a time
 ** 
-** Returns: Located node
+** Returns: void
 ** 
-** Description: Locates a subnode from this point
+** Description: Creates a reader which pulls the document from a stream as
+**              it is read.
 **
 /****************************************************************************/
-XmlNode XmlNode::find(const char* pszPath) const
+XmlReader::XmlReader(binstream& stm, size_t nChunkSize) : 
+	pParser_(NULL), pStream_(&stm), chunkSize_((nChunkSize > 0) ? nChunkSize : 0x10000), type_(None), 
+	pName_(NULL), nName_(0), pValue_(NULL), nValue_(0), fEntities_(false), depth_(0), level_(0)
 {
-	if (pszPath == NULL || *pszPath == '\0' || !HasChildren)
-		return XmlNode();
-
-	std::vector<std::string> arrPath;
-	stdx::split(pszPath, "/\\", std::back_inserter(arrPath));
-	if (arrPath.empty())
-		return XmlNode();
-
-	XmlNodeImpl* pcurrNode = pImpl_;
-	for (std::vector<std::string>::iterator it = arrPath.begin(); it != arrPath.end(); ++it)
-	{
-		// If the current node has no children then we are done.
-		if (pcurrNode->children_.empty())
-			return XmlNode();
-
-		// Search the array.
-		std::vector<XmlNodeImpl*>::iterator itNode = pcurrNode->children_.begin();
-		for (; itNode != pcurrNode->children_.end(); ++itNode)
-		{
-			if ((*itNode)->name_ == (*it)) {
-				pcurrNode = (*itNode);
-				break;
-			}
-		}
-
-		if (itNode == pcurrNode->children_.end())
-			return XmlNode();
-	}
+	pParser_ = JTI_NEW InternalParser(NULL, 0, false);
 
-	// Return the found node
-	return XmlNode(pcurrNode);
-
-}// XmlNode::find
+}// XmlReader::XmlReader
 
 /*****************************************************************************
-** Procedure:  XmlDocument::XmlDocument
+** Procedure:  XmlReader::~XmlReader
 ** 
 ** Arguments:  void
 ** 
 ** Returns: void
 ** 
-** Description: Constructor for the Xml parser object
+** Description: Destructor for the reader
 **
 /****************************************************************************/
-XmlDocument::XmlDocument(const char* pszRootName) : root_(pszRootName)
-{ 
-}// XmlDocument::XmlDocument
+XmlReader::~XmlReader()
+{
+	delete pParser_;
+
+}// XmlReader::~XmlReader
 
 /*****************************************************************************
-** Procedure:  XmlDocument::find
+** Procedure:  XmlReader::Read
 ** 
-** Arguments:  'pszPath' - Path of the node to locate
+** Arguments:  void
 ** 
-** Returns: Located node
+** Returns: Type of the next item, None at the end of the document
 ** 
-** Description: Constructor for the Xml parser object
+** Description: Moves to the next start tag, attribute, text, comment or
+**              end tag.  Attributes follow their start tag; the depth of
+**              an element is the number of elements around it and its
+**              attributes, text and comments are one deeper.
 **
 /****************************************************************************/
-XmlNode XmlDocument::find(const char* pszPath) const
+XmlReader::NodeType XmlReader::Read()
 {
-	if (pszPath == NULL || *pszPath == '\0')
-		return XmlNode();
-
-	// Skip any leading seperator.  Standard XML syntax allows for
-	// root node to be identified this way.
-	if (*pszPath == '/' || *pszPath == '\\')
-		++pszPath;
-
-	std::vector<std::string> arrPath;
-	stdx::split(pszPath, "/\\", std::back_inserter(arrPath));
-
-	if (arrPath.empty() || arrPath[0] != root_.Name)
-		return XmlNode();
-
-	XmlNode currNode = root_;
-	if (arrPath.size() > 1)
+	InternalParser::Event ev;
+	InternalParser::EventType type;
+	while ((type = pParser_->Next(ev)) == InternalParser::EV_MORE)
+		Fill();
+
+	pName_ = ev.name.data;
+	nName_ = ev.name.length;
+	pValue_ = ev.value.data;
+	nValue_ = ev.value.length;
+	fEntities_ = ev.value.fEntities;
+
+	switch (type)
 	{
-		for (std::vector<std::string>::iterator it = arrPath.begin()+1; it != arrPath.end(); ++it)
-		{
-			if (it->empty())
-				continue;
-			if (!currNode.IsValid)
-				break;
-			if (!currNode.HasChildren)
-				return XmlNode();
-			currNode = currNode.Children.find(it->c_str());
-		}
+		case InternalParser::EV_START:		type_ = StartElement; depth_ = level_++; break;
+		case InternalParser::EV_END:		type_ = EndElement; depth_ = --level_; break;
+		case InternalParser::EV_ATTRIBUTE:	type_ = Attribute; depth_ = level_; break;
+		case InternalParser::EV_TEXT:		type_ = Text; depth_ = level_; break;
+		case InternalParser::EV_COMMENT:	type_ = Comment; depth_ = level_; break;
+		default:							type_ = None; depth_ = 0; break;
 	}
-	return currNode;
+	return type_;
 
-}// XmlDocument::find
+}// XmlReader::Read
 
 /*****************************************************************************
-** Procedure:  XmlDocument::load
+** Procedure:  XmlReader::Skip
 ** 
-** Arguments:  'pszFile' - Filename to load
+** Arguments:  void
 ** 
-** Returns: true/false whether load was successful.
+** Returns: void
 ** 
-** Description: This loads an XML file into memory.
+** Description: On a start tag, reads past the whole element so the reader
+**              is left on its end tag.  Nothing within it is decoded.
 **
 /****************************************************************************/
-bool XmlDocument::load(const char* pszFile)
+void XmlReader::Skip()
 {
-	const int PATTERN_COUNT = 4;
-	static unsigned char gszPatterns[PATTERN_COUNT][5] = {
-		{ 3, 0xEF, 0xBB, 0xBF },			// UTF-8
-		{ 2, 0xFE, 0xFF },					// UTF-16 UCS-2 little endian
-		{ 4, 0xFF, 0xFE, 0x00, 0x00 },		// UTF-16/32 UCS-2/4 
-		{ 4, 0x00, 0x00, 0xFE, 0xFF }		// UTF-32 UCS-4 big endian
-	};
-
-	// Read the file into a string.
-	std::string xmlBuffer;
-	std::ifstream ifs(pszFile);
-	std::istreambuf_iterator<char> itBegin(ifs), itEnd;
-
-	// Skip any XML byte ordering marker
-	if (itBegin != itEnd)
-	{
-		unsigned char ch = static_cast<unsigned char>(*itBegin);
-		for (int i = 0; i < PATTERN_COUNT; ++i)
-		{
-			if (ch == gszPatterns[i][1])
-			{
-				for (int x = 1; x <= gszPatterns[i][0]; ++x && itBegin != itEnd, ++itBegin)
-				{
-					ch = static_cast<unsigned char>(*itBegin);
-					if (ch != gszPatterns[i][x])
-						break;
-				}
-				break;
-			}
-		}
-	}
-
-	// Load the full XML text.
-	xmlBuffer = std::string(itBegin, itEnd);
+	if (type_ != StartElement)
+		return;
 
-	// Now parse out the buffer
-	parse(xmlBuffer);
-	return true;
+	int depth = depth_;
+	while (Read() != None && (type_ != EndElement || depth_ != depth))
+		;
 
-}// XmlDocument::load
+}// XmlReader::Skip
 
 /*****************************************************************************
-** Procedure:  XmlDocument::save
+** Procedure:  XmlReader::IsName
 ** 
-** Arguments:  'pszFile' - Filename to save to
+** Arguments:  'pszName' - Name to compare
 ** 
-** Returns: true/false whether save was successful.
+** Returns: true if the current item has the name
 ** 
-** Description: This saves an XML file onto disk.
+** Description: Compares the name in place without copying it.
 **
 /****************************************************************************/
-bool XmlDocument::save(const char* pszFile)
+bool XmlReader::IsName(const char* pszName) const
 {
-	std::ofstream ofs(pszFile);
-	ofs << 0xEF << 0xBB << 0xBF;	 // UTF-8 byte order marker
-	ofs << root_.RenderXml();
+	return (pszName != NULL && strlen(pszName) == nName_ && !memcmp(pszName, pName_, nName_));
 
-	return true;
-
-}// XmlDocument::save
+}// XmlReader::IsName
 
 /*****************************************************************************
-** Procedure:  XmlDocument::parse
+** Procedure:  XmlReader::GetValue
 ** 
-** Arguments:  'xmlBuffer' - XML data to load
+** Arguments:  'value' - Returned value
 ** 
-** Returns: true/false whether parse was successful.
+** Returns: void
 ** 
-** Description: This parses out an XML file
+** Description: Returns the decoded value of the current attribute, text or
+**              comment; passing the same string each time reuses its space.
 **
 /****************************************************************************/
-void XmlDocument::parse(const std::string& xmlBuffer)
+void XmlReader::GetValue(std::string& value) const
 {
-	// No data? ignore.
-	if (xmlBuffer.empty())
-		return;
-
-	InternalParser parser(xmlBuffer.c_str());
-	parser.Parse(root_);
+	InternalParser::Slice slice = { pValue_, nValue_, fEntities_ };
+	InternalParser::Materialize(slice, value);
 
-}// XmlDocument::parse
+}// XmlReader::GetValue
 
 /*****************************************************************************
-** Procedure:  XmlDocument::create
+** Procedure:  XmlReader::Fill
 ** 
-** Arguments:  'pszPath' - Path of the node to create
+** Arguments:  void
 ** 
-** Returns: Located or created node
+** Returns: void
 ** 
-** Description: Constructor for the Xml parser object
+** Description: Moves the unread part of the buffer to the front and reads
+**              the next chunk after it.  The buffer only grows when one
+**              item is larger than a chunk.
 **
 /****************************************************************************/
-XmlNode XmlDocument::create(const char* pszPath, bool* pfCreated)
+void XmlReader::Fill()
 {
-	// Init entry
-	if (pfCreated)
-		*pfCreated = false;
-
-	if (pszPath == NULL || *pszPath == '\0')
-		throw std::runtime_error("Invalid path passed into XmlDocument::Create");
-
-	// Skip any leading seperator.  Standard XML syntax allows for
-	// root node to be identified this way.
-	if (*pszPath == '/' || *pszPath == '\\')
-		++pszPath;
-
-	std::vector<std::string> arrPath;
-	stdx::split(pszPath, "/\\", std::back_inserter(arrPath));
-
-	if (arrPath.empty() || arrPath[0] != root_.Name)
-		return XmlNode();
-
-	XmlNode currNode = root_;
-	if (arrPath.size() > 1)
-	{
-		for (std::vector<std::string>::iterator it = arrPath.begin()+1; it != arrPath.end(); ++it)
-		{
-			XmlNode foundNode = XmlNode();
-			if (currNode.HasChildren)
-				foundNode = currNode.Children.find(it->c_str());
-			if (foundNode == XmlNode())
-			{
-				foundNode = XmlNode(it->c_str());
-				currNode.Children.add(foundNode);
-				if (pfCreated) *pfCreated = true;
-			}
-			currNode = foundNode;
-		}
-	}
-	return currNode;
-
-}// XmlDocument::create
+	size_t nKeep = pParser_->get_Remaining();
+	size_t nOffset = (nKeep > 0) ? pParser_->get_Position() - &buffer_[0] : 0;
+	if (buffer_.size() < nKeep + chunkSize_)
+		buffer_.resize(nKeep + chunkSize_);
+	if (nKeep > 0 && nOffset > 0)
+		memmove(&buffer_[0], &buffer_[nOffset], nKeep);
+
+	// Stream reads are all or nothing, so the request is halved until it
+	// fits in what is left of the stream.
+	unsigned int nCount = static_cast<unsigned int>(chunkSize_);
+	while (nCount > 0 && !pStream_->read(&buffer_[nKeep], nCount))
+		nCount /= 2;
+	pParser_->Refill(&buffer_[0], nKeep + nCount, (nCount == 0 || pStream_->eof()));
+
+}// XmlReader::Fill
@@ -43,6 +43,330 @@ namespace JTI_Util
 class XmlCommentArray;
 class XmlNodeArray;
 class XmlAttributeMap;
+class InternalParser;
+class XmlPath;
+class binstream;
+class MemoryMappedFile;
+
+/******************************************************************************/
+// XmlName
+//
+// This internal class holds one copy of an attribute name shared by
+// reference count.  A store hands out one per distinct name, so the nodes
+// expanded from it share their names and each copy is freed with the last
+// node that uses it.
+//
+/******************************************************************************/
+class XmlName : 
+	public RefCountedObject<>
+{
+// Class data
+public:
+	const std::string text;
+
+// Constructor
+public:
+	XmlName(const char* pszName, size_t nLength) : text(pszName, nLength) {/* */}
+private:
+	~XmlName() {/* */}
+
+// Unavailable methods
+private:
+	XmlName(const XmlName&);
+	XmlName& operator=(const XmlName&);
+};
+
+/******************************************************************************/
+// XmlNodeStore
+//
+// This class holds a parsed document as flat arrays of fixed-size records
+// instead of one heap object per node.  Nodes are linked by first child and
+// next sibling indices, element and attribute names are interned so each is
+// stored once, and other text lives in a single pool.  A store loaded from
+// a file keeps the file mapped and refers to text in it directly instead of
+// copying it, until it is detached; XmlDocument detaches the stores it
+// loads so it never holds its file open.  The store is read-only once built
+// and is shared by reference count, so it may be read from any thread;
+// releasing it frees the whole document at once.  Large documents may be
+// parsed on several threads; the elements of the root are split between
+// them and the results joined.
+//
+// A store may be saved as a binary snapshot holding its arrays and the text
+// they refer to.  Loading a snapshot maps it and copies the arrays out
+// rather than parsing; it is used only while the source file is unchanged.
+//
+/******************************************************************************/
+class XmlNodeStore : 
+	public RefCountedObject<>
+{
+// Class data
+public:
+	typedef unsigned long Index;
+	static const Index NIL = 0xffffffff;
+
+	// Text in the pool is NUL terminated; text in the source is not.
+	static const Index IN_SOURCE = 0x80000000;
+	struct TextRef
+	{
+		Index offset;		// into the text pool, or the source if flagged
+		Index length;		// IN_SOURCE is set for text in the source
+	};
+
+	struct NodeRecord
+	{
+		Index name;			// interned name
+		TextRef value;
+		Index firstAttribute;
+		Index attributeCount;
+		Index firstChild;
+		Index nextSibling;
+		Index firstComment;
+	};
+
+	struct AttributeRecord
+	{
+		Index name;			// interned name
+		TextRef value;
+	};
+
+	struct CommentRecord
+	{
+		TextRef text;
+		Index next;
+	};
+
+	// Identifies the version of a source file a snapshot was built from.
+	struct SnapshotKey
+	{
+		unsigned __int64 size;
+		unsigned __int64 time;		// last write time
+		unsigned long hash;			// XmlPath::HashText of the file
+	};
+
+private:
+	std::vector<NodeRecord> nodes_;
+	std::vector<AttributeRecord> attributes_;
+	std::vector<CommentRecord> comments_;
+	std::vector<TextRef> names_;
+	std::vector<Index> nameTable_;	// open addressed hash of name indices
+	std::vector<char> text_;
+	MemoryMappedFile* pMapping_;	// file the source is mapped from
+	std::vector<char> converted_;	// source converted to UTF-8
+	const char* source_;			// document text referred to by the store
+	size_t sourceLength_;
+	mutable XmlName** volatile pSharedNames_;	// shared attribute names by name index
+
+// Constructor
+public:
+	static XmlNodeStore* Create(const char* pData, size_t nLength, int nThreads = 1);
+	static XmlNodeStore* Load(const char* pszFile, int nThreads = 1, bool fStrict = false);
+	static XmlNodeStore* LoadSnapshot(const char* pszSnapshot, const char* pszSource);
+	static XmlNodeStore* LoadCached(const char* pszFile, const char* pszSnapshot, int nThreads = 1, bool fStrict = false);
+	static bool GetSnapshotKey(const char* pszSource, SnapshotKey& key);
+	bool SaveSnapshot(const char* pszSnapshot, const SnapshotKey& key) const;
+	void Detach();
+private:
+	friend class InternalParser;
+	XmlNodeStore();
+	~XmlNodeStore();
+
+// Properties
+public:
+	__declspec(property(get=get_Count)) size_t Count;
+
+// Access methods
+public:
+	size_t get_Count() const { return nodes_.size(); }
+	Index Root() const { return nodes_.empty() ? static_cast<Index>(NIL) : 0; }
+	Index FirstChild(Index node) const { return nodes_[node].firstChild; }
+	Index NextSibling(Index node) const { return nodes_[node].nextSibling; }
+	Index FirstComment(Index node) const { return nodes_[node].firstComment; }
+	Index NextComment(Index comment) const { return comments_[comment].next; }
+	Index AttributeCount(Index node) const { return nodes_[node].attributeCount; }
+	Index NameId(Index node) const { return nodes_[node].name; }
+
+	// Names are NUL terminated.  Values and comments may refer to the
+	// source and are only valid for the returned length.
+	const char* GetName(Index node) const { return &text_[names_[nodes_[node].name].offset]; }
+	const char* GetAttributeName(Index node, Index attr) const { return &text_[names_[attributes_[nodes_[node].firstAttribute + attr].name].offset]; }
+	const char* GetValue(Index node, size_t& nLength) const { return GetText(nodes_[node].value, nLength); }
+	const char* GetComment(Index comment, size_t& nLength) const { return GetText(comments_[comment].text, nLength); }
+	const char* GetAttributeValue(Index node, Index attr, size_t& nLength) const { return GetText(attributes_[nodes_[node].firstAttribute + attr].value, nLength); }
+	const XmlName* ShareAttributeName(Index node, Index attr) const;
+
+	Index FindName(const char* pszName, size_t nLength) const;
+	Index FindName(const char* pszName, size_t nLength, unsigned long nHash) const;
+	Index FindChild(Index node, const char* pszName) const;
+	Index FindPath(const XmlPath& path) const;
+	const char* FindAttribute(Index node, const char* pszName, size_t& nLength) const;
+
+// Internal methods
+private:
+	const char* GetText(const TextRef& text, size_t& nLength) const
+	{
+		nLength = (text.length & ~IN_SOURCE);
+		return (text.length & IN_SOURCE) ? source_ + text.offset : &text_[text.offset];
+	}
+	Index AddName(const char* pszName, size_t nLength);
+	void HashNames(size_t nSize);
+	TextRef AddText(const char* pText, size_t nLength);
+	TextRef AddSourceText(const char* pText, size_t nLength);
+	void Append(const XmlNodeStore& part);
+	void Reset();
+	void ReleaseSharedNames();
+	bool IsValidText(const TextRef& text) const;
+	bool Validate() const;
+
+// Unavailable methods
+private:
+	XmlNodeStore(const XmlNodeStore&);
+	XmlNodeStore& operator=(const XmlNodeStore&);
+};
+
+/******************************************************************************/
+// XmlPath
+//
+// This class holds a node path split into its names with each name hashed
+// once, so a path used repeatedly is not parsed again on every lookup.
+// Names are separated by '/' or '\'; empty names are ignored.
+//
+/******************************************************************************/
+class XmlPath
+{
+// Class data
+private:
+	struct Segment
+	{
+		std::string::size_type offset;	// position in text_
+		std::string::size_type length;
+		unsigned long hash;
+	};
+	std::string text_;					// names joined by '/'
+	std::vector<Segment> segments_;
+	unsigned long hash_;				// hash of text_
+
+// Constructor
+public:
+	XmlPath() : hash_(HashText("", 0)) {/* */}
+	XmlPath(const char* pszPath) : hash_(HashText("", 0)) { Append(pszPath); }
+
+// Properties
+public:
+	__declspec(property(get=empty)) bool IsEmpty;
+	__declspec(property(get=size)) int Count;
+	__declspec(property(get=get_Text)) const std::string& Text;
+	__declspec(property(get=get_Hash)) unsigned long Hash;
+
+// Accessors
+public:
+	bool empty() const { return segments_.empty(); }
+	int size() const { return static_cast<int>(segments_.size()); }
+	const std::string& get_Text() const { return text_; }
+	unsigned long get_Hash() const { return hash_; }
+	std::string operator[](int index) const { return text_.substr(segments_[index].offset, segments_[index].length); }
+	// Returns a name without copying it; the text is not NUL terminated.
+	const char* GetSegment(int index, size_t& nLength, unsigned long& nHash) const {
+		const Segment& seg = segments_[index];
+		nLength = seg.length; nHash = seg.hash;
+		return text_.data() + seg.offset;
+	}
+
+// Methods
+public:
+	XmlPath& Append(const char* pszPath);
+	bool Matches(int index, const std::string& name, unsigned long nNameHash) const
+	{
+		const Segment& seg = segments_[index];
+		return (seg.hash == nNameHash && seg.length == name.length() && text_.compare(seg.offset, seg.length, name) == 0);
+	}
+	static unsigned long HashText(const char* pszText, size_t nLength);
+};
+
+/******************************************************************************/
+// XmlAttributeList
+//
+// This internal class holds the attributes of a node in one array sorted
+// by name.  Each attribute holds a reference to its name, so nodes expanded
+// from the same store share one copy of each name.
+//
+/******************************************************************************/
+class XmlAttributeList
+{
+// Class data
+public:
+	struct Attribute
+	{
+		const XmlName* name;		// shared name
+		std::string value;
+	};
+	typedef std::vector<Attribute>::const_iterator const_iterator;
+private:
+	std::vector<Attribute> attribs_;
+
+// Constructor
+public:
+	XmlAttributeList() {/* */}
+	XmlAttributeList(const XmlAttributeList& rhs);
+	~XmlAttributeList();
+	XmlAttributeList& operator=(const XmlAttributeList& rhs);
+
+// Accessors
+public:
+	bool empty() const { return attribs_.empty(); }
+	size_t size() const { return attribs_.size(); }
+	const_iterator begin() const { return attribs_.begin(); }
+	const_iterator end() const { return attribs_.end(); }
+
+// Methods
+public:
+	void reserve(size_t nCount) { attribs_.reserve(nCount); }
+	void swap(XmlAttributeList& rhs) { attribs_.swap(rhs.attribs_); }
+	const std::string* find(const char* pszName) const;
+	std::string& insert(const char* pszName, const char* pValue, size_t nLength);
+	std::string& insert(const XmlName* pName, const char* pValue, size_t nLength);
+	void erase(const char* pszName);
+
+// Internal methods
+private:
+	size_t Search(const char* pszName, bool& fFound) const;
+};
+
+/******************************************************************************/
+// XmlTreeGeneration
+//
+// This internal class counts the changes made to one tree of nodes, so a
+// document drops its remembered paths only when its own tree changes.
+// Adding a node to another joins their counts for good; a node may be in
+// several trees at once, and a tree split again only sees extra changes.
+//
+/******************************************************************************/
+class XmlTreeGeneration : 
+	public RefCountedObject<>
+{
+// Class data
+private:
+	volatile long count_;
+	XmlTreeGeneration* volatile pJoined_;	// count this one was joined to
+
+// Constructor
+public:
+	XmlTreeGeneration() : count_(0), pJoined_(NULL) {/* */}
+private:
+	~XmlTreeGeneration() { if (pJoined_ != NULL) pJoined_->Release(); }
+
+// Methods
+public:
+	// Returns the count the tree currently shares.
+	XmlTreeGeneration* Find() { XmlTreeGeneration* p = this; while (p->pJoined_ != NULL) p = p->pJoined_; return p; }
+	long get_Count() { return Find()->count_; }
+	void Changed() { InterlockedIncrement(&Find()->count_); }
+	static void Join(XmlTreeGeneration* pFirst, XmlTreeGeneration* pSecond);
+
+// Unavailable methods
+private:
+	XmlTreeGeneration(const XmlTreeGeneration&);
+	XmlTreeGeneration& operator=(const XmlTreeGeneration&);
+};
 
 /******************************************************************************/
 // XmlNodeImpl
@@ -59,16 +383,23 @@ class XmlNodeImpl :
 private:
 	std::string name_;			// Name of the node
 	std::string value_;			// Value of the node
-	std::map<std::string, std::string> attribs_;// Attributes
+	XmlAttributeList attribs_;					// Attributes
 	std::vector<XmlNodeImpl*> children_;		// Children
 	std::vector<std::string> comments_;			// Comments
+	XmlNodeStore* volatile pStore_;				// Store record not yet expanded
+	XmlNodeStore::Index record_;
+	unsigned long nameHash_;					// XmlPath::HashText of the name
+	XmlTreeGeneration* volatile pTree_;			// Changes counted for the tree, made on first use
 
 // Constructor
 private:
 	friend class XmlNode;
 	friend class XmlNodeArray;
 	friend class XmlCommentArray;
+	friend class XmlDocument;
+	friend class XmlWriter;
 	XmlNodeImpl(const char* pszName="", const char* pszValue = "");
+	XmlNodeImpl(XmlNodeStore* pStore, XmlNodeStore::Index record);
 public:
 	~XmlNodeImpl();
 
@@ -76,6 +407,22 @@ public:
 private:
 	std::string RenderXml(int level) const;
 
+	// Nodes read from a store hold only their name and value until the
+	// attributes, comments or children are first needed.
+	void Expand() const { if (pStore_ != NULL) const_cast<XmlNodeImpl*>(this)->ExpandRecord(); }
+	void ExpandRecord();
+
+	void ExpandAll();
+
+	void SetName(const char* pszName);
+	XmlNodeImpl* FindPath(const XmlPath& path, int nFirst);
+
+	// A node whose tree has not been asked for has no document relying on
+	// its count, so changing it need not be counted.
+	XmlTreeGeneration* Tree() const;
+	void Changed() const { if (pTree_ != NULL) pTree_->Changed(); }
+	void Adopt(XmlNodeImpl* pChild) const;
+
 // Unavailable methods
 private:
 	XmlNodeImpl(const XmlNodeImpl&);
@@ -133,13 +480,13 @@ public:
 public:
 	bool get_IsValid() const { return !pImpl_->name_.empty(); }
 	const std::string& get_Name() const { return pImpl_->name_; }
-	void set_Name(const char* pszName) { pImpl_->name_ = pszName; }
+	void set_Name(const char* pszName) { pImpl_->SetName(pszName); }
 	void set_Value(const char* pszValue) { pImpl_->value_ = pszValue; }
 	const std::string& get_Value() const { return pImpl_->value_; }
 	bool get_hasValue() const { return !pImpl_->value_.empty(); }
-	bool get_hasChildren() const { return !pImpl_->children_.empty(); }
-	bool get_hasComments() const { return !pImpl_->comments_.empty(); }
-	bool get_hasAttributes() const { return !pImpl_->attribs_.empty(); }
+	bool get_hasChildren() const { pImpl_->Expand(); return !pImpl_->children_.empty(); }
+	bool get_hasComments() const { pImpl_->Expand(); return !pImpl_->comments_.empty(); }
+	bool get_hasAttributes() const { pImpl_->Expand(); return !pImpl_->attribs_.empty(); }
 	XmlCommentArray get_Comments() const;
 	XmlAttributeMap get_Attributes() const;
 	XmlNodeArray get_Children() const;
@@ -147,6 +494,7 @@ public:
 // Methods
 public:
 	XmlNode find(const char* pszPath) const;
+	XmlNode find(const XmlPath& path) const;
 	std::string RenderXml(int level=0) const { return pImpl_->RenderXml(level); }
 
 // Private methods
@@ -155,6 +503,8 @@ private:
 	friend class XmlAttributeMap;
 	friend class XmlNodeArrayIterator;
 	friend class XmlCommentArray;
+	friend class XmlDocument;
+	friend class XmlWriter;
 	XmlNode(XmlNodeImpl* pNode) : pImpl_(pNode) { pImpl_->AddRef(); }
 };
 
@@ -168,32 +518,38 @@ class XmlAttributeMapIterator
 {
 	// Class data
 private:
-	typedef std::map<std::string, std::string> AttributeMap;
-	AttributeMap map_;
+	typedef std::vector<std::pair<std::string, std::string> > AttributeArray;
+	AttributeArray arrAttribs_;
 public:
-	typedef AttributeMap::iterator iterator ;
-	typedef AttributeMap::const_iterator const_iterator;
+	typedef AttributeArray::iterator iterator;
+	typedef AttributeArray::const_iterator const_iterator;
 
 // Constructor
 private:
 	friend class XmlAttributeMap;
-	XmlAttributeMapIterator(const AttributeMap& mapIn) : map_(mapIn) {/* */}
+	XmlAttributeMapIterator(const XmlAttributeList& listIn) {
+		arrAttribs_.reserve(listIn.size());
+		for (XmlAttributeList::const_iterator it = listIn.begin(); it != listIn.end(); ++it)
+			arrAttribs_.push_back(std::make_pair(it->name->text, it->value));
+	}
 
 // Methods
 public:
-	bool empty() const { return map_.empty(); }
-	int size() const { return static_cast<int>(map_.size()); }
+	bool empty() const { return arrAttribs_.empty(); }
+	int size() const { return static_cast<int>(arrAttribs_.size()); }
 	std::string operator[](const char* pszKey) const { 
-		const_iterator it = map_.find(pszKey);
-		if (it == map_.end())
-			return "";
-		return it->second;
+		for (const_iterator it = arrAttribs_.begin(); it != arrAttribs_.end(); ++it)
+		{
+			if (it->first == pszKey)
+				return it->second;
+		}
+		return "";
 	}
 
-	iterator begin() { return map_.begin(); }
-	iterator end() { return map_.end(); }
-	const_iterator begin() const { return map_.begin(); }
-	const_iterator end() const { return map_.end(); }
+	iterator begin() { return arrAttribs_.begin(); }
+	iterator end() { return arrAttribs_.end(); }
+	const_iterator begin() const { return arrAttribs_.begin(); }
+	const_iterator end() const { return arrAttribs_.end(); }
 };
 
 /******************************************************************************/
@@ -206,16 +562,15 @@ class XmlAttributeMap
 {
 // Class data
 private:
-	typedef std::map<std::string, std::string> AttributeMap;
 	XmlNode node_;
-	AttributeMap& mapRef_;
+	XmlAttributeList& listRef_;
 
 // Constructor
 private:
 	friend class XmlNode;
-	XmlAttributeMap(const XmlNode& node, AttributeMap& mapIn) : node_(node), mapRef_(mapIn) {/* */}
+	XmlAttributeMap(const XmlNode& node, XmlAttributeList& listIn) : node_(node), listRef_(listIn) {/* */}
 public:
-	XmlAttributeMap(const XmlAttributeMap& rhs) : node_(rhs.node_), mapRef_(rhs.mapRef_) {/* */}
+	XmlAttributeMap(const XmlAttributeMap& rhs) : node_(rhs.node_), listRef_(rhs.listRef_) {/* */}
 	~XmlAttributeMap() {/* */}
 
 // Operators
@@ -223,7 +578,7 @@ public:
 	XmlAttributeMap& operator=(const XmlAttributeMap& rhs) {
 		if (this != &rhs) {
 			node_ = rhs.node_;
-			mapRef_ = rhs.mapRef_;
+			listRef_ = rhs.listRef_;
 		}
 		return *this;
 	}
@@ -236,19 +591,19 @@ public:
 
 	// Accessors
 public:
-	bool empty() const { return mapRef_.empty(); }
-	int size() const { return  static_cast<int>(mapRef_.size()); }
-	XmlAttributeMapIterator get_Iterator() const { return XmlAttributeMapIterator(mapRef_); }
+	bool empty() const { return listRef_.empty(); }
+	int size() const { return  static_cast<int>(listRef_.size()); }
+	XmlAttributeMapIterator get_Iterator() const { return XmlAttributeMapIterator(listRef_); }
 
 	std::string operator[](const char* pszKey) const { 
 		CCSLock<XmlNodeImpl> _lockGuard(node_.pImpl_);
-		return mapRef_[pszKey]; 
+		return listRef_.insert(pszKey, "", 0); 
 	}
 
 	void add(const char* pszKey, const char* pszValue)
 	{
 		CCSLock<XmlNodeImpl> _lockGuard(node_.pImpl_);
-		mapRef_.insert(std::make_pair(pszKey, pszValue));
+		listRef_.insert(pszKey, pszValue, strlen(pszValue));
 	}
 
 	void add(const char* pszKey, int value)
@@ -256,7 +611,7 @@ public:
 		char chBuff[50];
 		itoa(value, chBuff, 10);
 		CCSLock<XmlNodeImpl> _lockGuard(node_.pImpl_);
-		mapRef_.insert(std::make_pair(pszKey, chBuff));
+		listRef_.insert(pszKey, chBuff, strlen(chBuff));
 	}
 
 	void add(const char* pszKey, long value)
@@ -264,22 +619,22 @@ public:
 		char chBuff[50];
 		ltoa(value, chBuff, 10);
 		CCSLock<XmlNodeImpl> _lockGuard(node_.pImpl_);
-		mapRef_.insert(std::make_pair(pszKey, chBuff));
+		listRef_.insert(pszKey, chBuff, strlen(chBuff));
 	}
 
 	void remove(const char* pszKey)
 	{
 		CCSLock<XmlNodeImpl> _lockGuard(node_.pImpl_);
-		mapRef_.erase(pszKey);
+		listRef_.erase(pszKey);
 	}
 
 	std::string find(const char* pszKey) const
 	{
 		CCSLock<XmlNodeImpl> _lockGuard(node_.pImpl_);
-		AttributeMap::const_iterator it = mapRef_.find(pszKey);
-		if (it == mapRef_.end())
+		const std::string* pValue = listRef_.find(pszKey);
+		if (pValue == NULL)
 			return std::string("");
-		return it->second;
+		return *pValue;
 	}
 };
 
@@ -469,8 +824,10 @@ public:
 		NodeArray::iterator it = std::find(arrNodes_.begin(), arrNodes_.end(), pImpl);
 		if (it != arrNodes_.end())
 			throw(std::runtime_error("Multiple insertion of same node within array not allowed!"));
+		node_.pImpl_->Adopt(pImpl);
 		pImpl->AddRef();
 		arrNodes_.push_back(pImpl);
+		node_.pImpl_->Changed();
 	}
 
 	bool remove(const XmlNode& xmlNode)
@@ -482,6 +839,7 @@ public:
 		{
 			(*it)->Release();
 			arrNodes_.erase(it);
+			node_.pImpl_->Changed();
 			return true;
 		}
 		return false;
@@ -518,18 +876,38 @@ public:
 // XmlDocument
 //
 // This class provides the document owner which holds the root node.
+// Paths found through the document are remembered, including paths which
+// were not found, until a node of the document is next added, removed or
+// renamed.
 //
 /******************************************************************************/
 class XmlDocument
 {
 // Class data
 private:
-	XmlNode root_;	// Root node of the document.
+	struct CachedPath
+	{
+		std::string path;
+		XmlNodeImpl* pNode;			// NULL if the path was not found
+	};
+	typedef std::multimap<unsigned long, CachedPath> PathCache;
+	enum { MaxCachedPaths = 4096 };
+
+	XmlNode root_;					// Root node of the document.
+	mutable PathCache paths_;		// find() results keyed by path hash
+	mutable const XmlTreeGeneration* pPathTree_;	// tree count paths_ was filled at
+	mutable long pathGeneration_;
 
 // Constructor
 public:
 	XmlDocument(const char* pszRootName=NULL);
-	~XmlDocument() {/* */}
+	XmlDocument(const XmlDocument& rhs);
+	explicit XmlDocument(XmlNodeStore* pStore);
+	~XmlDocument();
+
+// Operators
+public:
+	XmlDocument& operator=(const XmlDocument& rhs);
 
 // Properties
 public:
@@ -543,11 +921,161 @@ public:
 
 // Methods
 public:
-	bool load(const char* pszFile);
+	bool load(const char* pszFile, int nThreads = 1);
+	bool load(const char* pszFile, const char* pszSnapshot, int nThreads = 1);
 	bool save(const char* pszFile);
-	void parse(const std::string& xmlBuffer);
+	void parse(const std::string& xmlBuffer, int nThreads = 1);
 	XmlNode find(const char* pszPath) const;
+	XmlNode find(const XmlPath& path) const;
 	XmlNode create(const char* pszPath, bool* pfCreated=NULL);
+	XmlNode create(const XmlPath& path, bool* pfCreated=NULL);
+
+// Internal methods
+private:
+	void Attach(XmlNodeStore* pStore);
+	void ClearPaths() const;
+};
+
+/******************************************************************************/
+// XmlWriter
+//
+// This class writes XML to a binstream, or appends it to a string, as it
+// is produced.  Output is gathered in a fixed size buffer which is passed
+// to the sink each time it fills, so a node tree is written without first
+// building its text.  Elements are indented with tabs, one per line; an
+// element holding text is written on one line and may not also hold
+// elements or comments.  Lines end with NewLine, "\n" unless changed.
+//
+/******************************************************************************/
+class XmlWriter
+{
+// Class data
+private:
+	binstream* pStream_;		// NULL when appending to a string
+	std::string* pText_;
+	std::vector<char> buffer_;
+	size_t used_;
+	std::string newLine_;		// written at the end of each line
+	std::vector<std::string> elements_;	// names of the open elements
+	int indent_;				// tabs before the outermost element
+	bool fOpenTag_;				// start tag not yet closed with '>'
+	bool fHasText_;				// current element holds text
+
+// Constructor
+public:
+	XmlWriter(binstream& stm, size_t nBufferSize = 0x4000);
+	XmlWriter(std::string& text, size_t nBufferSize = 0x4000);
+	~XmlWriter();
+
+// Properties
+public:
+	__declspec(property(get=get_Depth)) int Depth;
+	__declspec(property(get=get_NewLine, put=set_NewLine)) const char* NewLine;
+
+// Accessors
+public:
+	int get_Depth() const { return static_cast<int>(elements_.size()); }
+	const char* get_NewLine() const { return newLine_.c_str(); }
+	void set_NewLine(const char* pszNewLine) { newLine_ = (pszNewLine) ? pszNewLine : ""; }
+
+// Methods
+public:
+	void WriteDeclaration();
+	void WriteStartElement(const char* pszName);
+	void WriteAttribute(const char* pszName, const char* pszValue) { PutAttribute(pszName, pszValue, strlen(pszValue)); }
+	void WriteAttribute(const char* pszName, const std::string& value) { PutAttribute(pszName, value.data(), value.length()); }
+	void WriteText(const char* pszText) { WriteText(pszText, strlen(pszText)); }
+	void WriteText(const char* pText, size_t nLength);
+	void WriteComment(const char* pszText);
+	void WriteEndElement();
+	void WriteNode(const XmlNode& node) { WriteNode(node.pImpl_); }
+	void Flush();
+
+// Internal methods
+private:
+	friend class XmlNodeImpl;
+	void WriteNode(XmlNodeImpl* pNode);
+	void PutAttribute(const char* pszName, const char* pValue, size_t nLength);
+	void PutEscaped(const char* pText, size_t nLength, char chQuote);
+	void PutIndent(size_t nDepth);
+	void Put(const char* pszText) { Put(pszText, strlen(pszText)); }
+	void Put(const char* pData, size_t nLength);
+	void Put(const std::string& text) { Put(text.data(), text.length()); }
+	void PutLine(const char* pszText) { Put(pszText); Put(newLine_); }
+	void Drain();
+
+// Unavailable methods
+private:
+	XmlWriter(const XmlWriter&);
+	XmlWriter& operator=(const XmlWriter&);
+};
+
+/******************************************************************************/
+// XmlReader
+//
+// This class reads a document one item at a time without building any
+// nodes.  It reads either from a buffer in memory, such as a mapped file,
+// or from a binstream in fixed size chunks, so memory use is bounded by the
+// chunk size and the largest single item rather than the document.  Names
+// and values point into the reader's buffer and are only valid until the
+// next call to Read().
+//
+/******************************************************************************/
+class XmlReader
+{
+// Class data
+public:
+	enum NodeType { None, StartElement, Attribute, Text, EndElement, Comment };
+private:
+	InternalParser* pParser_;
+	binstream* pStream_;		// NULL when reading from memory
+	std::vector<char> buffer_;
+	size_t chunkSize_;
+	NodeType type_;
+	const char* pName_;
+	size_t nName_;
+	const char* pValue_;
+	size_t nValue_;
+	bool fEntities_;
+	int depth_;					// depth of the current item
+	int level_;					// elements open
+
+// Constructor
+public:
+	XmlReader(const char* pData, size_t nLength);
+	XmlReader(binstream& stm, size_t nChunkSize = 0x10000);
+	~XmlReader();
+
+// Properties
+public:
+	__declspec(property(get=get_NodeType)) NodeType Type;
+	__declspec(property(get=get_Name)) std::string Name;
+	__declspec(property(get=get_Value)) std::string Value;
+	__declspec(property(get=get_Depth)) int Depth;
+
+// Accessors
+public:
+	NodeType get_NodeType() const { return type_; }
+	std::string get_Name() const { return std::string(pName_, nName_); }
+	std::string get_Value() const { std::string value; GetValue(value); return value; }
+	int get_Depth() const { return depth_; }
+
+// Methods
+public:
+	NodeType Read();
+	void Skip();
+	bool IsName(const char* pszName) const;
+	const char* GetName(size_t& nLength) const { nLength = nName_; return pName_; }
+	void GetValue(std::string& value) const;
+
+// Internal methods
+private:
+	void Fill();
+
+// Unavailable methods
+private:
+	XmlReader(const XmlReader&);
+	XmlReader& operator=(const XmlReader&);
 };
 
 }// namespace JTI_Util
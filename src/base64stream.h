@@ -0,0 +1,226 @@
+/******************************************************************************/
+//
+// base64stream.h
+//
+// This header implements binary stream adapters which Base64 encode data
+// written to them into another stream, or decode data read from them out
+// of another stream.
+//
+// Copyright (C) 1994-2003 JulMar Technology, Inc.   All rights reserved
+// This is private property of JulMar Technology, Inc.  It may not be
+// distributed or released without express written permission of
+// JulMar Technology, Inc.
+//
+// You must not remove this notice, or any other, from this software.
+//
+/******************************************************************************/
+
+#ifndef _BASE64STREAM_INC_
+#define _BASE64STREAM_INC_
+
+/*----------------------------------------------------------------------------
+    INCLUDE FILES
+-----------------------------------------------------------------------------*/
+#include <Base64.h>
+#include <binstream.h>
+
+namespace JTI_Util
+{
+/******************************************************************************/
+// base64_encodestream
+//
+// Write-only stream which encodes everything written to it and writes the
+// characters to the target stream as it goes.  The final group is written
+// by close() (or the destructor).
+//
+/******************************************************************************/
+class base64_encodestream : public binstream
+{
+// Class data
+private:
+	enum { CHUNK_SIZE = 0xc000 };
+	binstream& target_;
+	Base64Encoder encoder_;
+	std::vector<char> buff_;
+	bool fClosed_;
+
+// Constructor/Destructor
+public:
+	explicit base64_encodestream(binstream& target, Base64Variant::Types variant = Base64Variant::Standard) :
+		target_(target), encoder_(variant), fClosed_(false) {
+		buff_.resize(encoder_.MaxPushLength(CHUNK_SIZE));
+	}
+	virtual ~base64_encodestream() { close(); }
+
+// Overridable operations required in the derived classes
+public:
+	// Only a zero skip is supported; it allows version information to be written.
+	virtual bool skip(int sz) { return (sz == 0); }
+	virtual bool peek(void*, unsigned int) const { return false; }
+	virtual bool read(void*, unsigned int) { return false; }
+
+	virtual bool write(const void* pBuff, unsigned int size) {
+		if (fClosed_ || fail())
+			return false;
+		const unsigned char* in = static_cast<const unsigned char*>(pBuff);
+		while (size > 0)
+		{
+			unsigned int nChunk = (size > CHUNK_SIZE) ? static_cast<unsigned int>(CHUNK_SIZE) : size;
+			unsigned int nCount = static_cast<unsigned int>(encoder_.Push(in, nChunk, &buff_[0]));
+			if (nCount > 0 && !target_.write(&buff_[0], nCount))
+			{
+				setbit(binstream::failbit);
+				return false;
+			}
+			in += nChunk;
+			size -= nChunk;
+		}
+		return true;
+	}
+
+	virtual void close() {
+		if (!fClosed_)
+		{
+			fClosed_ = true;
+			unsigned int nCount = static_cast<unsigned int>(encoder_.Finish(&buff_[0]));
+			if (!fail() && nCount > 0 && !target_.write(&buff_[0], nCount))
+				setbit(binstream::failbit);
+		}
+	}
+};
+
+/******************************************************************************/
+// base64_decodestream
+//
+// Read-only stream which pulls Base64 characters from the source stream as
+// they are needed and returns the decoded data.  Invalid data sets the fail
+// bit.  The source is read in chunks; a read past its end must fail without
+// consuming anything, as memstream does.
+//
+/******************************************************************************/
+class base64_decodestream : public binstream
+{
+// Class data
+private:
+	enum { CHUNK_SIZE = 0x4000 };
+	binstream& source_;
+	Base64Decoder decoder_;
+	std::vector<char> inBuff_;
+	std::vector<unsigned char> outBuff_;
+	size_t outPos_, outLen_;
+	bool fEnd_;
+
+// Constructor
+public:
+	explicit base64_decodestream(binstream& source, Base64Variant::Types variant = Base64Variant::Standard) :
+		source_(source), decoder_(variant), inBuff_(CHUNK_SIZE), outPos_(0), outLen_(0), fEnd_(false) {/* */}
+
+// Overridable operations required in the derived classes
+public:
+	// Skips forward, or back over data already returned by the last read.
+	virtual bool skip(int sz) {
+		if (sz < 0)
+		{
+			if (static_cast<size_t>(-sz) > outPos_)
+				return false;
+			outPos_ -= static_cast<size_t>(-sz);
+			clrbit(binstream::eofbit);
+			return true;
+		}
+		while (sz > 0)
+		{
+			if (outPos_ == outLen_ && !Fill())
+				return false;
+			size_t nCount = outLen_ - outPos_;
+			if (nCount > static_cast<size_t>(sz))
+				nCount = static_cast<size_t>(sz);
+			outPos_ += nCount;
+			sz -= static_cast<int>(nCount);
+		}
+		return true;
+	}
+
+	virtual bool peek(void* pBuff, unsigned int sz) const {
+		// outBuff_ is empty until the first Fill, so it may not be indexed.
+		if (sz == 0)
+			return true;
+		base64_decodestream* pThis = const_cast<base64_decodestream*>(this);
+		while (outLen_ - outPos_ < sz)
+		{
+			if (!pThis->Fill())
+				return false;
+		}
+		memcpy(pBuff, &outBuff_[outPos_], sz);
+		return true;
+	}
+
+	virtual bool read(void* pBuff, unsigned int sz) {
+		if (!peek(pBuff, sz))
+			return false;
+		outPos_ += sz;
+		if (outPos_ == outLen_ && fEnd_)
+			setbit(binstream::eofbit);
+		return true;
+	}
+
+	virtual bool write(const void*, unsigned int) { return false; }
+
+// Internal methods
+private:
+	// Decodes the next chunk of the source; returns false at the end of the data.
+	bool Fill() {
+		if (fEnd_)
+		{
+			setbit(binstream::eofbit);
+			return false;
+		}
+
+		// Drop everything before the last read.
+		if (outPos_ > 0)
+		{
+			if (outLen_ > outPos_)
+				memmove(&outBuff_[0], &outBuff_[outPos_], outLen_ - outPos_);
+			outLen_ -= outPos_;
+			outPos_ = 0;
+		}
+
+		// Take the largest chunk the source can supply.
+		unsigned int nRead = 0;
+		if (!source_.eof())
+		{
+			for (unsigned int nSize = CHUNK_SIZE; nSize > 0 && nRead == 0; nSize /= 2)
+			{
+				if (source_.read(&inBuff_[0], nSize))
+					nRead = nSize;
+			}
+		}
+
+		outBuff_.resize(outLen_ + Base64Decoder::MaxPushLength(nRead) + Base64Decoder::MaxFinishLength());
+		size_t nCount = 0;
+		bool fValid;
+		if (nRead > 0)
+			fValid = decoder_.Push(&inBuff_[0], nRead, &outBuff_[outLen_], nCount);
+		else
+		{
+			fValid = decoder_.Finish(&outBuff_[outLen_], nCount);
+			fEnd_ = true;
+		}
+		outLen_ += nCount;
+
+		if (!fValid)
+		{
+			fEnd_ = true;
+			setbit(binstream::failbit);
+		}
+		if (nCount == 0 && fEnd_)
+		{
+			setbit(binstream::eofbit);
+			return false;
+		}
+		return true;
+	}
+};
+
+} // namespace JTI_Util
+
+#endif // _BASE64STREAM_INC_
@@ -22,9 +22,12 @@
 -----------------------------------------------------------------------------*/
 #pragma warning(disable:4702)
 #include <string>
+#include <vector>
+#include <bitset>
 #include <stdexcept>
 #include <iterator>
 #include <cstdlib>
+#include <cstring>
 #include <malloc.h>
 #pragma warning (default:4702)
 
@@ -63,12 +66,20 @@ public:
 		eofbit 	= 0x1,
 		failbit = 0x2
 	};
+	// Wire formats used by the insertion/extraction operators
+	enum {
+		nativefmt	= 0,	// host-sized integers, UTF-16 strings (original layout)
+		portablefmt	= 1,	// fixed-width little-endian integers, UTF-8 strings
+		compactfmt	= 2		// portable, but integers and lengths are LEB128 varints
+							// (zigzag-encoded if signed) and bit vectors are RLE packed
+	};
 private:
 	unsigned char bitFlags_;
+	unsigned char format_;
 
 // Destructor
 public:
-	binstream() : bitFlags_(0) {/* */}
+	binstream() : bitFlags_(0), format_(nativefmt) {/* */}
 	virtual ~binstream() {/* */}
 
 // Overridable operations required in the derived classes
@@ -79,6 +90,9 @@ public:
 	virtual bool peek(void*, unsigned int) const = 0;
 	virtual bool read(void*, unsigned int) = 0;
 	virtual bool write(const void*, unsigned int) = 0;
+	// Returns a pointer to the next sz bytes held by the stream and moves past
+	// them, or NULL if the stream cannot expose its storage.
+	virtual const void* view(unsigned int) { return 0; }
 
 // Other methods
 public:
@@ -86,9 +100,13 @@ public:
 	bool good() const { return (bitFlags_ & failbit) == 0; }
 	bool eof() const { return (bitFlags_ & (eofbit|failbit)) != 0; }
 	bool fail() const { return !good(); }
+	void setstate(int bit) { setbit(bit); }
 	
 	unsigned char peek() const { char ch = 0; peek(&ch,1); return ch; }
 
+	int format() const { return format_; }
+	void setformat(int fmt) { format_ = static_cast<unsigned char>(fmt); }
+
 	operator void*() { return (!fail()) ? (void*)1 : (void*)0; }
 	bool operator !() { return fail(); }
 
@@ -98,27 +116,450 @@ protected:
 	void clrbit(int bit=0xff) { bitFlags_ &= ~(bit&0xff); }
 };
 
+/******************************************************************************/
+// string_ref
+//
+// Refers to UTF-8 characters held elsewhere; extracting one from a stream 
+// which supports view() points it at the stream's own storage rather than 
+// copying.  memstream, chainstream and filestream support it; the Base64 
+// adapters do not.  The data is valid until the stream is next read, 
+// written or destroyed.
+// Always stored as a length then the bytes; the length is 32 bits unless 
+// the stream uses the compact format.
+//
+/******************************************************************************/
+struct string_ref
+{
+	const char* data;
+	unsigned long length;
+
+	string_ref() : data(0), length(0) {/* */}
+	string_ref(const char* p, unsigned long len) : data(p), length(len) {/* */}
+	explicit string_ref(const std::string& s) : data(s.data()), length(static_cast<unsigned long>(s.length())) {/* */}
+	std::string str() const { return std::string(data, length); }
+};
+
+/******************************************************************************/
+// array_ref
+//
+// Refers to a fixed number of elements held elsewhere, so a C array or part
+// of a container can be written or read as a unit.  No count is stored; the
+// reader must know it.  Arrays of numeric types are moved with a single 
+// stream call where the wire layout matches memory.
+//
+/******************************************************************************/
+template <typename _Ty>
+struct array_ref
+{
+	_Ty* data;
+	size_t count;
+
+	array_ref(_Ty* p, size_t n) : data(p), count(n) {/* */}
+};
+
+template <typename _Ty>
+inline array_ref<_Ty> make_array_ref(_Ty* p, size_t n) { return array_ref<_Ty>(p, n); }
+
+namespace JTI_Internal
+{
+// Marks the stream failed when the data being read is damaged.
+inline void throw_damaged(binstream& stm, const char* pszOp)
+{
+	stm.setstate(binstream::failbit);
+	throw schema_exception(std::string(pszOp));
+}
+
+// Writes the low nBytes of the value least significant byte first.
+inline void write_le(binstream& stm, unsigned __int64 val, unsigned int nBytes, const char* pszOp)
+{
+	unsigned char buff[8];
+	for (unsigned int i = 0; i < nBytes; ++i, val >>= 8)
+		buff[i] = static_cast<unsigned char>(val & 0xff);
+	if (!stm.write(buff, nBytes))
+		throw schema_exception(std::string(pszOp));
+}
+
+// Reads an nBytes little-endian value, sign-extending it if requested.
+inline unsigned __int64 read_le(binstream& stm, unsigned int nBytes, bool fSigned, const char* pszOp)
+{
+	unsigned char buff[8];
+	if (!stm.read(buff, nBytes))
+		throw schema_exception(std::string(pszOp));
+	unsigned __int64 val = 0;
+	for (unsigned int i = nBytes; i > 0; --i)
+		val = (val << 8) | buff[i-1];
+	if (fSigned && nBytes < 8 && (buff[nBytes-1] & 0x80) != 0)
+		val |= ~static_cast<unsigned __int64>(0) << (nBytes * 8);
+	return val;
+}
+
+// Writes a LEB128 varint: 7 bits per byte, low bits first, high bit set on 
+// all but the last byte.
+inline void write_varint(binstream& stm, unsigned __int64 val, const char* pszOp)
+{
+	unsigned char buff[10];
+	unsigned int nBytes = 0;
+	for (; val >= 0x80; val >>= 7)
+		buff[nBytes++] = static_cast<unsigned char>((val & 0x7f) | 0x80);
+	buff[nBytes++] = static_cast<unsigned char>(val);
+	if (!stm.write(buff, nBytes))
+		throw schema_exception(std::string(pszOp));
+}
+
+inline unsigned __int64 read_varint(binstream& stm, const char* pszOp)
+{
+	unsigned __int64 val = 0;
+	for (unsigned int nShift = 0; nShift < 64; nShift += 7)
+	{
+		unsigned char by;
+		if (!stm.read(&by, 1) || (nShift == 63 && by > 1))
+			break;
+		val |= static_cast<unsigned __int64>(by & 0x7f) << nShift;
+		if ((by & 0x80) == 0)
+			return val;
+	}
+	throw schema_exception(std::string(pszOp));
+}
+
+// Integer values of nBytes in the stream's (non-native) format.
+inline void write_uint(binstream& stm, unsigned __int64 val, unsigned int nBytes, const char* pszOp)
+{
+	if (stm.format() == binstream::compactfmt)
+		write_varint(stm, val, pszOp);
+	else
+		write_le(stm, val, nBytes, pszOp);
+}
+
+inline void write_int(binstream& stm, __int64 val, unsigned int nBytes, const char* pszOp)
+{
+	if (stm.format() == binstream::compactfmt)
+		write_varint(stm, (static_cast<unsigned __int64>(val) << 1) ^ static_cast<unsigned __int64>(val >> 63), pszOp);
+	else
+		write_le(stm, static_cast<unsigned __int64>(val), nBytes, pszOp);
+}
+
+inline unsigned __int64 read_uint(binstream& stm, unsigned int nBytes, const char* pszOp)
+{
+	if (stm.format() != binstream::compactfmt)
+		return read_le(stm, nBytes, false, pszOp);
+	unsigned __int64 val = read_varint(stm, pszOp);
+	if (nBytes < 8 && (val >> (nBytes * 8)) != 0)
+		throw schema_exception(std::string(pszOp));
+	return val;
+}
+
+inline __int64 read_int(binstream& stm, unsigned int nBytes, const char* pszOp)
+{
+	if (stm.format() != binstream::compactfmt)
+		return static_cast<__int64>(read_le(stm, nBytes, true, pszOp));
+	unsigned __int64 zz = read_varint(stm, pszOp);
+	__int64 val = static_cast<__int64>(zz >> 1) ^ -static_cast<__int64>(zz & 1);
+	if (nBytes < 8)
+	{
+		__int64 nLimit = static_cast<__int64>(1) << (nBytes * 8 - 1);
+		if (val < -nLimit || val >= nLimit)
+			throw schema_exception(std::string(pszOp));
+	}
+	return val;
+}
+
+// Writes the bit count and the bits, eight to a byte.  The compact format
+// adds a mode byte and uses alternating run lengths (starting with a run 
+// of false, which may be empty) instead when that is smaller.
+template <typename _Bits>
+void write_bits(binstream& stm, const _Bits& bits, size_t nCount, const char* pszOp)
+{
+	write_uint(stm, nCount, 4, pszOp);
+
+	bool fRuns = false;
+	if (stm.format() == binstream::compactfmt)
+	{
+		size_t nRunBytes = 0, nRun = 0;
+		bool fVal = false;
+		for (size_t i = 0; i <= nCount; ++i, ++nRun)
+		{
+			if (i == nCount || bits[i] != fVal)
+			{
+				for (nRunBytes++; nRun >= 0x80; nRun >>= 7) nRunBytes++;
+				nRun = 0; fVal = !fVal;
+			}
+		}
+		fRuns = (nRunBytes < (nCount + 7) / 8);
+		unsigned char mode = static_cast<unsigned char>(fRuns ? 1 : 0);
+		if (!stm.write(&mode, 1))
+			throw schema_exception(std::string(pszOp));
+	}
+
+	if (fRuns)
+	{
+		size_t nRun = 0;
+		bool fVal = false;
+		for (size_t i = 0; i <= nCount; ++i, ++nRun)
+		{
+			if (i == nCount || bits[i] != fVal)
+			{
+				write_varint(stm, nRun, pszOp);
+				nRun = 0; fVal = !fVal;
+			}
+		}
+		return;
+	}
+
+	unsigned char buff[256];
+	for (size_t i = 0; i < nCount; )
+	{
+		size_t nBytes = 0;
+		for (; nBytes < sizeof(buff) && i < nCount; ++nBytes)
+		{
+			unsigned char by = 0;
+			for (int nBit = 0; nBit < 8 && i < nCount; ++nBit, ++i)
+			{
+				if (bits[i])
+					by |= static_cast<unsigned char>(1 << nBit);
+			}
+			buff[nBytes] = by;
+		}
+		if (!stm.write(buff, static_cast<unsigned int>(nBytes)))
+			throw schema_exception(std::string(pszOp));
+	}
+}
+
+// Makes room for the first nCount bits; a vector grows as the bits are read
+// so a damaged count cannot allocate a huge block, and a bitset has room.
+template <size_t _Bits>
+inline void grow_bits(std::bitset<_Bits>&, size_t) {/* */}
+inline void grow_bits(std::vector<bool>& bits, size_t nCount)
+{
+	if (bits.size() < nCount)
+		bits.resize(nCount);
+}
+
+// Reads bits written by write_bits, after the count, into a container 
+// which grow_bits can size.
+template <typename _Bits>
+void read_bits(binstream& stm, _Bits& bits, size_t nCount, const char* pszOp)
+{
+	unsigned char mode = 0;
+	if (stm.format() == binstream::compactfmt && !stm.read(&mode, 1))
+		throw_damaged(stm, pszOp);
+
+	if (mode == 1)
+	{
+		bool fVal = false;
+		for (size_t i = 0; i < nCount; fVal = !fVal)
+		{
+			// Only the first run (of false) may be empty.
+			unsigned __int64 nRun = read_varint(stm, pszOp);
+			if (nRun > nCount - i || (nRun == 0 && i > 0))
+				throw_damaged(stm, pszOp);
+			size_t nEnd = i + static_cast<size_t>(nRun);
+			grow_bits(bits, nEnd);
+			for (; i < nEnd; ++i)
+				bits[i] = fVal;
+		}
+		return;
+	}
+	if (mode != 0)
+		throw_damaged(stm, pszOp);
+
+	unsigned char buff[256];
+	for (size_t i = 0; i < nCount; )
+	{
+		size_t nBytes = (nCount - i + 7) / 8;
+		if (nBytes > sizeof(buff))
+			nBytes = sizeof(buff);
+		if (!stm.read(buff, static_cast<unsigned int>(nBytes)))
+			throw_damaged(stm, pszOp);
+		grow_bits(bits, (nCount - i > nBytes * 8) ? i + nBytes * 8 : nCount);
+		for (size_t b = 0; b < nBytes; ++b)
+		{
+			for (int nBit = 0; nBit < 8 && i < nCount; ++nBit, ++i)
+				bits[i] = ((buff[b] >> nBit) & 1) != 0;
+		}
+	}
+}
+
+// Describes how a type is stored by its insertion operator: native is the 
+// size written in the native format, wire the size in the portable format, 
+// and varint whether the compact format uses a varint instead.  Elements 
+// whose size in memory matches can be copied as a block.  Types without a
+// specialization are always written one at a time.
+template <typename _Ty> struct pod_traits { enum { native = 0, wire = 0, varint = 0 }; };
+template <typename _Ty> struct pod_traits<const _Ty> : pod_traits<_Ty> {/* */};
+#define JTI_POD_TRAITS(_Ty, _Native, _Wire, _Varint) \
+	template <> struct pod_traits<_Ty> { enum { native = _Native, wire = _Wire, varint = _Varint }; }
+JTI_POD_TRAITS(char, 1, 1, 0);
+JTI_POD_TRAITS(unsigned char, 1, 1, 0);
+JTI_POD_TRAITS(short, sizeof(short), 2, 1);
+JTI_POD_TRAITS(unsigned short, sizeof(unsigned short), 2, 1);
+JTI_POD_TRAITS(int, sizeof(long), 4, 1);
+JTI_POD_TRAITS(unsigned int, sizeof(unsigned long), 4, 1);
+JTI_POD_TRAITS(long, sizeof(long), 4, 1);
+JTI_POD_TRAITS(unsigned long, sizeof(unsigned long), 4, 1);
+JTI_POD_TRAITS(__int64, 8, 8, 1);
+JTI_POD_TRAITS(unsigned __int64, 8, 8, 1);
+JTI_POD_TRAITS(float, sizeof(float), 4, 0);
+JTI_POD_TRAITS(double, sizeof(double), 8, 0);
+#undef JTI_POD_TRAITS
+
+// Returns true if an array of the type may be copied to or from the stream
+// as one block (byte-swapped on a big-endian host in the portable formats).
+template <typename _Ty>
+inline bool is_block_copy(const binstream& stm)
+{
+	typedef pod_traits<_Ty> traits;
+	if (stm.format() == binstream::nativefmt)
+		return traits::native == sizeof(_Ty);
+	return traits::wire == sizeof(_Ty) && !(traits::varint && stm.format() == binstream::compactfmt);
+}
+
+inline bool is_little_endian()
+{
+	const unsigned short n = 1;
+	return *reinterpret_cast<const unsigned char*>(&n) == 1;
+}
+
+// Reverses the bytes of each nSize-byte element in place.
+inline void swap_elements(unsigned char* pData, size_t nCount, size_t nSize)
+{
+	for (; nCount > 0; --nCount, pData += nSize)
+	{
+		for (size_t i = 0, j = nSize - 1; i < j; ++i, --j)
+		{
+			unsigned char by = pData[i]; pData[i] = pData[j]; pData[j] = by;
+		}
+	}
+}
+
+// Largest block passed to one stream call.
+const size_t BLOCK_LIMIT = 0x40000000;
+
+template <typename _Ty>
+void write_array(binstream& stm, const _Ty* pData, size_t nCount, const char* pszOp)
+{
+	if (nCount == 0)
+		return;
+	if (!is_block_copy<_Ty>(stm))
+	{
+		for (size_t i = 0; i < nCount; ++i)
+			stm << pData[i];
+		return;
+	}
+
+	const unsigned char* pIn = reinterpret_cast<const unsigned char*>(pData);
+	size_t nBytes = nCount * sizeof(_Ty);
+	if (stm.format() == binstream::nativefmt || sizeof(_Ty) == 1 || is_little_endian())
+	{
+		for (size_t nPart; nBytes > 0; pIn += nPart, nBytes -= nPart)
+		{
+			nPart = (nBytes > BLOCK_LIMIT) ? BLOCK_LIMIT : nBytes;
+			if (!stm.write(pIn, static_cast<unsigned int>(nPart)))
+				throw schema_exception(std::string(pszOp));
+		}
+		return;
+	}
+
+	// Swap a buffer at a time into little-endian order.
+	unsigned char buff[4096];
+	for (size_t nPart; nBytes > 0; pIn += nPart, nBytes -= nPart)
+	{
+		nPart = (nBytes > sizeof(buff)) ? sizeof(buff) : nBytes;
+		memcpy(buff, pIn, nPart);
+		swap_elements(buff, nPart / sizeof(_Ty), sizeof(_Ty));
+		if (!stm.write(buff, static_cast<unsigned int>(nPart)))
+			throw schema_exception(std::string(pszOp));
+	}
+}
+
+template <typename _Ty>
+void read_array(binstream& stm, _Ty* pData, size_t nCount, const char* pszOp)
+{
+	if (nCount == 0)
+		return;
+	if (!is_block_copy<_Ty>(stm))
+	{
+		for (size_t i = 0; i < nCount; ++i)
+			stm >> pData[i];
+		return;
+	}
+
+	unsigned char* pOut = reinterpret_cast<unsigned char*>(pData);
+	for (size_t nPart, nBytes = nCount * sizeof(_Ty); nBytes > 0; pOut += nPart, nBytes -= nPart)
+	{
+		nPart = (nBytes > BLOCK_LIMIT) ? BLOCK_LIMIT : nBytes;
+		if (!stm.read(pOut, static_cast<unsigned int>(nPart)))
+			throw schema_exception(std::string(pszOp));
+	}
+	if (stm.format() != binstream::nativefmt && sizeof(_Ty) > 1 && !is_little_endian())
+		swap_elements(reinterpret_cast<unsigned char*>(pData), nCount, sizeof(_Ty));
+}
+
+// Writes a 32-bit length followed by the bytes.
+inline void write_utf8(binstream& stm, const char* pData, unsigned long len, const char* pszOp)
+{
+	write_uint(stm, len, 4, pszOp);
+	if (len > 0 && !stm.write(pData, len))
+		throw schema_exception(std::string(pszOp));
+}
+
+// Reads a 32-bit length and the bytes which follow it into the string.
+inline void read_utf8(binstream& stm, std::string& string, const char* pszOp)
+{
+	unsigned long len = static_cast<unsigned long>(read_uint(stm, 4, pszOp));
+	if (len == 0)
+		string.erase();
+	else if (const void* pData = stm.view(len))
+		string.assign(static_cast<const char*>(pData), len);
+	else
+	{
+		// Grow as the data arrives so a damaged length cannot allocate a huge block.
+		const unsigned long nStep = 0x10000;
+		string.erase();
+		while (string.length() < len)
+		{
+			unsigned long nPos = static_cast<unsigned long>(string.length());
+			unsigned long nPart = (len - nPos > nStep) ? nStep : len - nPos;
+			string.resize(nPos + nPart);
+			if (!stm.read(&string[nPos], nPart))
+				throw_damaged(stm, pszOp);
+		}
+	}
+}
+} // namespace JTI_Internal
+
 // insertion operations
 inline binstream& operator<<(binstream& stm, long l) {
-	if(!stm.write(&l, sizeof(long)))
+	if (stm.format() != binstream::nativefmt)
+		JTI_Internal::write_int(stm, l, 4, "operator<<(long)");
+	else if(!stm.write(&l, sizeof(long)))
 		throw schema_exception(std::string("operator<<(long)"));
 	return stm;
 }
 
 inline binstream& operator<<(binstream& stm, float f) {
-	if(!stm.write(&f, sizeof(float)))
+	if (stm.format() != binstream::nativefmt) {
+		unsigned int bits; memcpy(&bits, &f, sizeof(bits));
+		JTI_Internal::write_le(stm, bits, 4, "operator<<(float)");
+	}
+	else if(!stm.write(&f, sizeof(float)))
 		throw schema_exception(std::string("operator<<(float)"));
 	return stm;
 }
 
 inline binstream& operator<<(binstream& stm, double d) {
-	if(!stm.write(&d, sizeof(double)))
+	if (stm.format() != binstream::nativefmt) {
+		unsigned __int64 bits; memcpy(&bits, &d, sizeof(bits));
+		JTI_Internal::write_le(stm, bits, 8, "operator<<(double)");
+	}
+	else if(!stm.write(&d, sizeof(double)))
 		throw schema_exception(std::string("operator<<(double)"));
 	return stm;
 }
 
 inline binstream& operator<<(binstream& stm, __int64 d) {
-	if(!stm.write(&d, sizeof(__int64)))
+	if (stm.format() != binstream::nativefmt)
+		JTI_Internal::write_int(stm, d, 8, "operator<<(__int64)");
+	else if(!stm.write(&d, sizeof(__int64)))
 		throw schema_exception(std::string("operator<<(__int64)"));
 	return stm;
 }
@@ -134,13 +575,17 @@ inline binstream& operator<<(binstream& stm, bool f) {
 
 inline binstream& operator<<(binstream& stm, int i) {
 	long l = static_cast<long>(i);
-	if(!stm.write(&l, sizeof(long)))
+	if (stm.format() != binstream::nativefmt)
+		JTI_Internal::write_int(stm, i, 4, "operator<<(int)");
+	else if(!stm.write(&l, sizeof(long)))
 		throw schema_exception(std::string("operator<<(int)"));
 	return stm;
 }
 
 inline binstream& operator<<(binstream& stm, short w) {
-	if(!stm.write(&w, sizeof(short)))
+	if (stm.format() != binstream::nativefmt)
+		JTI_Internal::write_int(stm, w, 2, "operator<<(short)");
+	else if(!stm.write(&w, sizeof(short)))
 		throw schema_exception(std::string("operator<<(short)"));
 	return stm;
 }
@@ -158,32 +603,45 @@ inline binstream& operator<<(binstream& stm, unsigned char by) {
 }
 
 inline binstream& operator<<(binstream& stm, unsigned short w) {
-	if(!stm.write(&w, sizeof(unsigned short)))
+	if (stm.format() != binstream::nativefmt)
+		JTI_Internal::write_uint(stm, w, 2, "operator<<(unsigned short)");
+	else if(!stm.write(&w, sizeof(unsigned short)))
 		throw schema_exception(std::string("operator<<(unsigned short)"));
 	return stm;
 }
 
 inline binstream& operator<<(binstream& stm, unsigned int w) {
 	unsigned long l = static_cast<unsigned long>(w);
-	if(!stm.write(&l, sizeof(unsigned long)))
+	if (stm.format() != binstream::nativefmt)
+		JTI_Internal::write_uint(stm, w, 4, "operator<<(unsigned int)");
+	else if(!stm.write(&l, sizeof(unsigned long)))
 		throw schema_exception(std::string("operator<<(unsigned int)"));
 	return stm;
 }
 
 inline binstream& operator<<(binstream& stm, unsigned long dw) {
-	if(!stm.write(&dw, sizeof(unsigned long)))
+	if (stm.format() != binstream::nativefmt)
+		JTI_Internal::write_uint(stm, dw, 4, "operator<<(unsigned long)");
+	else if(!stm.write(&dw, sizeof(unsigned long)))
 		throw schema_exception(std::string("operator<<(unsigned long)"));
 	return stm;
 }
 
 inline binstream& operator<<(binstream& stm, unsigned __int64 d) {
-	if(!stm.write(&d, sizeof(unsigned __int64)))
+	if (stm.format() != binstream::nativefmt)
+		JTI_Internal::write_uint(stm, d, 8, "operator<<(unsigned __int64)");
+	else if(!stm.write(&d, sizeof(unsigned __int64)))
 		throw schema_exception(std::string("operator<<(unsigned __int64)"));
 	return stm;
 }
 
 #ifdef __AFX_H__
 inline binstream& operator<<(binstream& stm, const CString& string) {
+	if (stm.format() != binstream::nativefmt) {
+		CW2A utf8(CT2W(string), CP_UTF8);
+		JTI_Internal::write_utf8(stm, utf8, static_cast<unsigned long>(strlen(utf8)), "operator<<(CString)");
+		return stm;
+	}
 	unsigned long len = string.GetLength() * sizeof(wchar_t);
 	wchar_t* pwstrBuff = reinterpret_cast<wchar_t*>(_alloca(len));
 	MultiByteToWideChar(CP_ACP,0,string,string.GetLength(),pwstrBuff,len);
@@ -196,6 +654,11 @@ inline binstream& operator<<(binstream& stm, const CString& string) {
 #endif
 
 inline binstream& operator<<(binstream& stm, const std::string& string) {
+	// The portable format writes the bytes as they are; they should be UTF-8.
+	if (stm.format() != binstream::nativefmt) {
+		JTI_Internal::write_utf8(stm, string.data(), static_cast<unsigned long>(string.length()), "operator<<(std::string)");
+		return stm;
+	}
 	unsigned long len = static_cast<unsigned long>(string.length()) * sizeof(wchar_t);
 	wchar_t* pwstrBuff = reinterpret_cast<wchar_t*>(_alloca(len));
 	MultiByteToWideChar(CP_ACP,0,string.c_str(),static_cast<int>(string.length()),pwstrBuff,len);
@@ -205,6 +668,17 @@ inline binstream& operator<<(binstream& stm, const std::string& string) {
 }
 
 inline binstream& operator<<(binstream& stm, const std::wstring& string) {
+	if (stm.format() != binstream::nativefmt) {
+		std::string utf8;
+		int nLen = static_cast<int>(string.length());
+		int nChars = (nLen > 0) ? WideCharToMultiByte(CP_UTF8, 0, string.data(), nLen, NULL, 0, NULL, NULL) : 0;
+		if (nChars > 0) {
+			utf8.resize(nChars);
+			WideCharToMultiByte(CP_UTF8, 0, string.data(), nLen, &utf8[0], nChars, NULL, NULL);
+		}
+		JTI_Internal::write_utf8(stm, utf8.data(), static_cast<unsigned long>(utf8.length()), "operator<<(wstring)");
+		return stm;
+	}
 	unsigned long len = static_cast<unsigned long>(string.length()+1) * sizeof(wchar_t);
 	if (!stm.write(&len, sizeof(unsigned long)) ||
 		!stm.write(string.c_str(), len))
@@ -212,6 +686,38 @@ inline binstream& operator<<(binstream& stm, const std::wstring& string) {
 	return stm;
 }
 
+inline binstream& operator<<(binstream& stm, const string_ref& string) {
+	JTI_Internal::write_utf8(stm, string.data, string.length, "operator<<(string_ref)");
+	return stm;
+}
+
+inline binstream& operator<<(binstream& stm, const std::vector<bool>& bits) {
+	JTI_Internal::write_bits(stm, bits, bits.size(), "operator<<(vector<bool>)");
+	return stm;
+}
+
+template <size_t _Bits>
+inline binstream& operator<<(binstream& stm, const std::bitset<_Bits>& bits) {
+	JTI_Internal::write_bits(stm, bits, _Bits, "operator<<(bitset)");
+	return stm;
+}
+
+template <typename _Ty>
+inline binstream& operator<<(binstream& stm, const array_ref<_Ty>& arr) {
+	JTI_Internal::write_array(stm, arr.data, arr.count, "operator<<(array_ref)");
+	return stm;
+}
+
+// Vectors store their size then the elements; numeric elements are written
+// as one block where the format allows it.
+template <typename _Ty, typename _Alloc>
+inline binstream& operator<<(binstream& stm, const std::vector<_Ty, _Alloc>& vec) {
+	JTI_Internal::write_uint(stm, vec.size(), 4, "operator<<(vector)");
+	if (!vec.empty())
+		JTI_Internal::write_array(stm, &vec[0], vec.size(), "operator<<(vector)");
+	return stm;
+}
+
 inline binstream& operator<<(binstream& stm, const GUID& guid) {
 	if (!stm.write(&guid, sizeof(GUID)))
 		throw schema_exception(std::string("operator<<(GUID)"));
@@ -220,22 +726,34 @@ inline binstream& operator<<(binstream& stm, const GUID& guid) {
 
 // extraction operations
 inline binstream& operator>>(binstream& stm, long& l) {
-	if(!stm.read(&l, sizeof(long)))
+	if (stm.format() != binstream::nativefmt)
+		l = static_cast<long>(JTI_Internal::read_int(stm, 4, "operator>>(long)"));
+	else if(!stm.read(&l, sizeof(long)))
 		throw schema_exception(std::string("operator>>(long)"));
 	return stm;
 }
 inline binstream& operator>>(binstream& stm, float& f) {
-	if(!stm.read(&f, sizeof(float)))
+	if (stm.format() != binstream::nativefmt) {
+		unsigned int bits = static_cast<unsigned int>(JTI_Internal::read_le(stm, 4, false, "operator>>(float)"));
+		memcpy(&f, &bits, sizeof(f));
+	}
+	else if(!stm.read(&f, sizeof(float)))
 		throw schema_exception(std::string("operator>>(float)"));
 	return stm;
 }
 inline binstream& operator>>(binstream& stm, double& d) {
-	if(!stm.read(&d, sizeof(double)))
+	if (stm.format() != binstream::nativefmt) {
+		unsigned __int64 bits = JTI_Internal::read_le(stm, 8, false, "operator>>(double)");
+		memcpy(&d, &bits, sizeof(d));
+	}
+	else if(!stm.read(&d, sizeof(double)))
 		throw schema_exception(std::string("operator>>(double)"));
 	return stm;
 }
 inline binstream& operator>>(binstream& stm, __int64& d) {
-	if(!stm.read(&d, sizeof(__int64)))
+	if (stm.format() != binstream::nativefmt)
+		d = JTI_Internal::read_int(stm, 8, "operator>>(__int64)");
+	else if(!stm.read(&d, sizeof(__int64)))
 		throw schema_exception(std::string("operator>>(__int64)"));
 	return stm;
 }
@@ -248,13 +766,17 @@ inline binstream& operator>>(binstream& stm, bool& f) {
 }
 inline binstream& operator>>(binstream& stm, int& i) {
 	long l;
-	if(!stm.read(&l, sizeof(long)))
+	if (stm.format() != binstream::nativefmt)
+		l = static_cast<long>(JTI_Internal::read_int(stm, 4, "operator>>(int)"));
+	else if(!stm.read(&l, sizeof(long)))
 		throw schema_exception(std::string("operator>>(int)"));
 	i = static_cast<int>(l);
 	return stm;
 }
 inline binstream& operator>>(binstream& stm, short& w) {
-	if(!stm.read(&w, sizeof(short)))
+	if (stm.format() != binstream::nativefmt)
+		w = static_cast<short>(JTI_Internal::read_int(stm, 2, "operator>>(short)"));
+	else if(!stm.read(&w, sizeof(short)))
 		throw schema_exception(std::string("operator>>(short)"));
 	return stm;
 }
@@ -269,30 +791,44 @@ inline binstream& operator>>(binstream& stm, unsigned char& by) {
 	return stm;
 }
 inline binstream& operator>>(binstream& stm, unsigned short& w) {
-	if(!stm.read(&w, sizeof(unsigned short)))
+	if (stm.format() != binstream::nativefmt)
+		w = static_cast<unsigned short>(JTI_Internal::read_uint(stm, 2, "operator>>(unsigned short)"));
+	else if(!stm.read(&w, sizeof(unsigned short)))
 		throw schema_exception(std::string("operator>>(unsigned short)"));
 	return stm;
 }
 inline binstream& operator>>(binstream& stm, unsigned int& w) {
 	unsigned long l;
-	if(!stm.read(&l, sizeof(unsigned long)))
+	if (stm.format() != binstream::nativefmt)
+		l = static_cast<unsigned long>(JTI_Internal::read_uint(stm, 4, "operator>>(unsigned int)"));
+	else if(!stm.read(&l, sizeof(unsigned long)))
 		throw schema_exception(std::string("operator>>(unsigned int)"));
 	w = static_cast<unsigned int>(l);
 	return stm;
 }
 inline binstream& operator>>(binstream& stm, unsigned long& dw) {
-	if(!stm.read(&dw, sizeof(unsigned long)))
+	if (stm.format() != binstream::nativefmt)
+		dw = static_cast<unsigned long>(JTI_Internal::read_uint(stm, 4, "operator>>(unsigned long)"));
+	else if(!stm.read(&dw, sizeof(unsigned long)))
 		throw schema_exception(std::string("operator>>(unsigned long)"));
 	return stm;
 }
 inline binstream& operator>>(binstream& stm, unsigned __int64& d) {
-	if(!stm.read(&d, sizeof(unsigned __int64)))
+	if (stm.format() != binstream::nativefmt)
+		d = JTI_Internal::read_uint(stm, 8, "operator>>(unsigned __int64)");
+	else if(!stm.read(&d, sizeof(unsigned __int64)))
 		throw schema_exception(std::string("operator>>(unsigned __int64)"));
 	return stm;
 }
 
 #ifdef __AFX_H__
 inline binstream& operator>>(binstream& stm, CString& string) {
+	if (stm.format() != binstream::nativefmt) {
+		std::string utf8;
+		JTI_Internal::read_utf8(stm, utf8, "operator>>(CString)");
+		string = CW2T(CA2W(utf8.c_str(), CP_UTF8));
+		return stm;
+	}
 	unsigned long len=0;
 	if (!stm.read(&len, sizeof(unsigned long)))
 		throw schema_exception(std::string("operator>>(CString)"));
@@ -310,6 +846,10 @@ inline binstream& operator>>(binstream& stm, CString& string) {
 #endif
 
 inline binstream& operator>>(binstream& stm, std::string& string) {
+	if (stm.format() != binstream::nativefmt) {
+		JTI_Internal::read_utf8(stm, string, "operator>>(string)");
+		return stm;
+	}
 	unsigned long len=0;
 	if (!stm.read(&len, sizeof(unsigned long)))
 		throw schema_exception(std::string("operator>>(string)"));
@@ -330,6 +870,16 @@ inline binstream& operator>>(binstream& stm, std::string& string) {
 }
 
 inline binstream& operator>>(binstream& stm, std::wstring& string) {
+	if (stm.format() != binstream::nativefmt) {
+		std::string utf8;
+		JTI_Internal::read_utf8(stm, utf8, "operator>>(wstring)");
+		int nLen = static_cast<int>(utf8.length());
+		int nChars = (nLen > 0) ? MultiByteToWideChar(CP_UTF8, 0, utf8.data(), nLen, NULL, 0) : 0;
+		string.resize(nChars);
+		if (nChars > 0)
+			MultiByteToWideChar(CP_UTF8, 0, utf8.data(), nLen, &string[0], nChars);
+		return stm;
+	}
 	unsigned long len=0;
 	if (!stm.read(&len, sizeof(unsigned long)))
 		throw schema_exception(std::string("operator>>(string)"));
@@ -345,6 +895,55 @@ inline binstream& operator>>(binstream& stm, std::wstring& string) {
 	return stm;
 }
 
+// Points the reference at the stream's storage; the stream must support 
+// view().  If it cannot, the length has been read, so the stream is marked
+// failed rather than left part way through the record.
+inline binstream& operator>>(binstream& stm, string_ref& string) {
+	string.length = static_cast<unsigned long>(JTI_Internal::read_uint(stm, 4, "operator>>(string_ref)"));
+	string.data = static_cast<const char*>(stm.view(string.length));
+	if (string.data == 0 && string.length > 0)
+		JTI_Internal::throw_damaged(stm, "operator>>(string_ref)");
+	return stm;
+}
+
+inline binstream& operator>>(binstream& stm, std::vector<bool>& bits) {
+	size_t nCount = static_cast<size_t>(JTI_Internal::read_uint(stm, 4, "operator>>(vector<bool>)"));
+	bits.clear();
+	JTI_Internal::read_bits(stm, bits, nCount, "operator>>(vector<bool>)");
+	return stm;
+}
+
+template <size_t _Bits>
+inline binstream& operator>>(binstream& stm, std::bitset<_Bits>& bits) {
+	if (JTI_Internal::read_uint(stm, 4, "operator>>(bitset)") != _Bits)
+		throw schema_exception(std::string("operator>>(bitset)"));
+	JTI_Internal::read_bits(stm, bits, _Bits, "operator>>(bitset)");
+	return stm;
+}
+
+template <typename _Ty>
+inline binstream& operator>>(binstream& stm, const array_ref<_Ty>& arr) {
+	JTI_Internal::read_array(stm, arr.data, arr.count, "operator>>(array_ref)");
+	return stm;
+}
+
+template <typename _Ty, typename _Alloc>
+inline binstream& operator>>(binstream& stm, std::vector<_Ty, _Alloc>& vec) {
+	size_t nCount = static_cast<size_t>(JTI_Internal::read_uint(stm, 4, "operator>>(vector)"));
+	vec.clear();
+
+	// Grow as the data arrives so a damaged count cannot allocate a huge block.
+	const size_t nStep = (0x10000 / sizeof(_Ty)) + 1;
+	while (vec.size() < nCount)
+	{
+		size_t nPos = vec.size();
+		size_t nPart = (nCount - nPos > nStep) ? nStep : nCount - nPos;
+		vec.resize(nPos + nPart);
+		JTI_Internal::read_array(stm, &vec[nPos], nPart, "operator>>(vector)");
+	}
+	return stm;
+}
+
 inline binstream& operator>>(binstream& stm, GUID& guid) {
 	if (!stm.read(&guid, sizeof(GUID)))
 		throw schema_exception(std::string("operator>>(GUID)"));
@@ -454,7 +1053,11 @@ public:
 /******************************************************************************/
 // VersionInfo
 //
-// Stores and manages schema versions within a object stream source
+// Stores and manages schema versions within a object stream source.  A
+// marker written with a wire format switches the reading stream to that
+// format; streams with the original marker (or none) keep their format.
+// A marker naming an unknown format throws schema_exception.  The marker 
+// itself is always in the native layout.
 //
 // INTERNAL DATA STRUCTURE
 //
@@ -464,40 +1067,67 @@ class VersionInfo
 // Class data
 private:
 	static const DWORD VER_MARK = 0x52455600;
+	static const DWORD FMT_MARK = 0x52460000;	// 'RF', format, version
 	int m_nVerRead;
+	int m_nFormat;
 
 // Constructor
 public:
-	VersionInfo(binstream& ar) : m_nVerRead(1) {
+	VersionInfo(binstream& ar) : m_nVerRead(1), m_nFormat(ar.format()) {
 		// If the stream doesn't support backups then exit.
 		if (ar.skip(0))
 		{
 			// Read the version marker and backup if it doesn't exist.
-			DWORD dwID; ar >> dwID;
+			DWORD dwID;
+			if (!ar.read(&dwID, sizeof(DWORD)))
+				throw schema_exception(std::string("operator>>(unsigned long)"));
 			if ((dwID & 0xffffff00) == VER_MARK)
 				m_nVerRead = (int) (dwID & 0x000000ff);
+			else if ((dwID & 0xffff0000) == FMT_MARK)
+			{
+				m_nVerRead = (int) (dwID & 0x000000ff);
+				m_nFormat = (int) ((dwID >> 8) & 0x000000ff);
+				if (m_nFormat != binstream::nativefmt && m_nFormat != binstream::portablefmt && m_nFormat != binstream::compactfmt)
+					JTI_Internal::throw_damaged(ar, "VersionInfo(binstream&)");
+				ar.setformat(m_nFormat);
+			}
 			else
 				ar.skip(-1 * static_cast<int>(sizeof(DWORD)));
 		}
 	}
 
-	VersionInfo(binstream& ar, int nVer) : m_nVerRead(1) {
+	VersionInfo(binstream& ar, int nVer) : m_nVerRead(1), m_nFormat(ar.format()) {
 		// If the stream doesn't support backups then exit.
 		if (ar.skip(0))
 		{
 			// Otherwise, store the version marker
 			DWORD dwID = (VER_MARK | (DWORD)nVer);	
-			ar << dwID;
+			if (!ar.write(&dwID, sizeof(DWORD)))
+				throw schema_exception(std::string("operator<<(unsigned long)"));
+		}
+	}
+
+	// Stores the version and switches the stream to the given wire format.
+	VersionInfo(binstream& ar, int nVer, int nFormat) : m_nVerRead(1), m_nFormat(ar.format()) {
+		if (ar.skip(0))
+		{
+			DWORD dwID = (FMT_MARK | ((DWORD)(nFormat & 0xff) << 8) | ((DWORD)nVer & 0xff));
+			if (!ar.write(&dwID, sizeof(DWORD)))
+				throw schema_exception(std::string("operator<<(unsigned long)"));
+			m_nFormat = nFormat;
+			ar.setformat(nFormat);
 		}
 	}
 
 // Properties
 public:
 	__declspec(property(get=get_Version)) int Version;
+	__declspec(property(get=get_Format)) int Format;
 
 // Accessors
 public:
 	int get_Version() const { return m_nVerRead; }
+	int get_Format() const { return m_nFormat; }
 };
 
 } // namespace JTI_Util
@@ -0,0 +1,309 @@
+/******************************************************************************/
+//
+// chainstream.h
+//
+// This header implements a binary stream which stores its data in a chain
+// of fixed-size segments rather than one contiguous buffer.
+//
+// Copyright (C) 1994-2003 JulMar Technology, Inc.   All rights reserved
+// This is private property of JulMar Technology, Inc.  It may not be
+// distributed or released without express written permission of
+// JulMar Technology, Inc.
+//
+// You must not remove this notice, or any other, from this software.
+//
+/******************************************************************************/
+
+#ifndef _CHAINSTREAM_INC_
+#define _CHAINSTREAM_INC_
+
+/*----------------------------------------------------------------------------
+    INCLUDE FILES
+-----------------------------------------------------------------------------*/
+#include <memstream.h>
+
+namespace JTI_Util
+{
+/******************************************************************************/
+// chainstream
+//
+// Binary stream made of a chain of segments.  Writes append to the last
+// segment and add a new one when it fills, so existing data is never
+// copied.  Whole chains may be moved between streams with splice(), and
+// the unread data exported with gather() for scatter/gather I/O (e.g.
+// WSASend or WriteFileGather) without flattening it.  Segments come from
+// an optional memstream_pool.  Reads release segments as they pass them,
+// keeping the previous one so the reader can back up across a boundary.
+//
+/******************************************************************************/
+class chainstream : public binstream
+{
+// Class data
+public:
+	enum { DEFAULT_SEGMENT_SIZE = 8192 };
+private:
+	struct Segment
+	{
+		BYTE* Data;
+		unsigned int Begin, End, Capacity;
+		memstream_pool* Pool;
+		Segment* Next;
+	};
+	Segment *head_, *tail_, *readSeg_;
+	unsigned int readPos_;
+	unsigned long size_;
+	unsigned int segmentSize_;
+	memstream_pool* pool_;
+	std::vector<BYTE> scratch_;		// viewed data which straddles segments
+
+// Constructor/Destructor
+public:
+	explicit chainstream(unsigned int nSegmentSize = DEFAULT_SEGMENT_SIZE, memstream_pool* pPool = 0) :
+		head_(0), tail_(0), readSeg_(0), readPos_(0), size_(0), segmentSize_(nSegmentSize), pool_(pPool) {
+		setbit(binstream::eofbit);
+	}
+	virtual ~chainstream() { clear(); }
+
+// Overridable operations required in the derived classes
+public:
+	// Skips forward through the data, or back over data read from the
+	// current and previous segments.
+	virtual bool skip(int sz) {
+		if (sz < 0)
+		{
+			if (readSeg_ == 0)
+				return false;
+			unsigned int nBack = static_cast<unsigned int>(-sz);
+			unsigned int nHere = readPos_ - readSeg_->Begin;
+			if (nBack <= nHere)
+				readPos_ -= nBack;
+			else
+			{
+				// Step back into the retained segment before this one.
+				unsigned int nPrev = nBack - nHere;
+				if (head_ == readSeg_ || nPrev > head_->End - head_->Begin)
+					return false;
+				readSeg_ = head_;
+				readPos_ = head_->End - nPrev;
+			}
+			size_ += nBack;
+			clrbit(binstream::eofbit);
+			return true;
+		}
+		if (static_cast<unsigned long>(sz) > size_)
+			return false;
+		advance(static_cast<unsigned int>(sz));
+		return true;
+	}
+
+	virtual bool peek(void* pBuff, unsigned int sz) const {
+		if (sz > size_)
+			return false;
+		BYTE* pOut = static_cast<BYTE*>(pBuff);
+		unsigned int nPos = readPos_;
+		for (Segment* pSeg = readSeg_; sz > 0; pSeg = pSeg->Next, nPos = (pSeg != 0) ? pSeg->Begin : 0)
+		{
+			unsigned int nCount = pSeg->End - nPos;
+			if (nCount > sz)
+				nCount = sz;
+			memcpy(pOut, pSeg->Data + nPos, nCount);
+			pOut += nCount;
+			sz -= nCount;
+		}
+		return true;
+	}
+
+	virtual bool read(void* pBuff, unsigned int sz) {
+		if (!peek(pBuff, sz))
+			return false;
+		advance(sz);
+		return true;
+	}
+
+	virtual bool write(const void* pBuff, unsigned int size) {
+		const BYTE* pIn = static_cast<const BYTE*>(pBuff);
+		while (size > 0)
+		{
+			if (tail_ == 0 || tail_->End == tail_->Capacity)
+			{
+				Segment* pSeg = alloc_segment();
+				if (pSeg == 0)
+					return false;
+				link(pSeg, pSeg);
+			}
+			unsigned int nCount = tail_->Capacity - tail_->End;
+			if (nCount > size)
+				nCount = size;
+			memcpy(tail_->Data + tail_->End, pIn, nCount);
+			tail_->End += nCount;
+			size_ += nCount;
+			pIn += nCount;
+			size -= nCount;
+		}
+		clrbit(binstream::eofbit);
+		return true;
+	}
+
+	// Data within the current segment is viewed in place; data which 
+	// straddles segments is copied into a scratch buffer first.  Either 
+	// way the pointer is valid until the next read.
+	virtual const void* view(unsigned int sz) {
+		if (readSeg_ == 0 || sz > size_)
+			return 0;
+		const void* pData = readSeg_->Data + readPos_;
+		if (sz > readSeg_->End - readPos_)
+		{
+			scratch_.resize(sz);
+			if (!peek(&scratch_[0], sz))
+				return 0;
+			pData = &scratch_[0];
+		}
+		advance(sz);
+		return pData;
+	}
+
+// Access methods
+public:
+	// Returns the number of bytes not yet read.
+	unsigned long size() const { return size_; }
+
+	// Fills pBuffers, an array of WSABUF or any structure with buf/len
+	// members, with the unread data; returns the number of entries the data
+	// needs, which may be more than nMax.
+	template <class _Buffer>
+	size_t gather(_Buffer* pBuffers, size_t nMax) const {
+		size_t nCount = 0;
+		unsigned int nPos = readPos_;
+		for (Segment* pSeg = readSeg_; pSeg != 0; pSeg = pSeg->Next, nPos = (pSeg != 0) ? pSeg->Begin : 0)
+		{
+			if (pSeg->End == nPos)
+				continue;
+			if (nCount < nMax)
+			{
+				pBuffers[nCount].buf = reinterpret_cast<char*>(pSeg->Data + nPos);
+				pBuffers[nCount].len = pSeg->End - nPos;
+			}
+			++nCount;
+		}
+		return nCount;
+	}
+
+	// Moves the unread data of another stream onto the end of this one
+	// without copying; the other stream is left empty.
+	void splice(chainstream& other) {
+		if (&other == this || other.readSeg_ == 0)
+			return;
+
+		// Unlink the unread segments from the other stream.
+		Segment* pFirst = other.readSeg_;
+		pFirst->Begin = other.readPos_;
+		if (other.head_ != pFirst)
+			other.release(other.head_);
+		Segment* pLast = other.tail_;
+		unsigned long nSize = other.size_;
+		other.head_ = other.tail_ = other.readSeg_ = 0;
+		other.readPos_ = 0;
+		other.size_ = 0;
+		other.setbit(binstream::eofbit);
+
+		link(pFirst, pLast);
+		size_ += nSize;
+		if (size_ > 0)
+			clrbit(binstream::eofbit);
+	}
+
+	// Releases all the data.
+	void clear() {
+		while (head_ != 0)
+		{
+			Segment* pNext = head_->Next;
+			release(head_);
+			head_ = pNext;
+		}
+		tail_ = readSeg_ = 0;
+		readPos_ = 0;
+		size_ = 0;
+		setbit(binstream::eofbit);
+	}
+
+// Internal methods
+private:
+	Segment* alloc_segment() {
+		Segment* pSeg = new Segment;
+		unsigned int nSize = segmentSize_;
+		pSeg->Data = reinterpret_cast<BYTE*>((pool_ != 0) ? pool_->acquire(segmentSize_, nSize) : malloc(segmentSize_));
+		if (pSeg->Data == 0)
+		{
+			delete pSeg;
+			return 0;
+		}
+		pSeg->Begin = pSeg->End = 0;
+		pSeg->Capacity = nSize;
+		pSeg->Pool = pool_;
+		pSeg->Next = 0;
+		return pSeg;
+	}
+
+	void release(Segment* pSeg) {
+		if (pSeg->Pool != 0)
+			pSeg->Pool->release(pSeg->Data, pSeg->Capacity);
+		else
+			free(pSeg->Data);
+		delete pSeg;
+	}
+
+	// Appends the segments pFirst..pLast to the chain.
+	void link(Segment* pFirst, Segment* pLast) {
+		pLast->Next = 0;
+		if (tail_ == 0)
+		{
+			head_ = readSeg_ = pFirst;
+			readPos_ = pFirst->Begin;
+		}
+		else
+			tail_->Next = pFirst;
+		tail_ = pLast;
+
+		// A reader waiting at the end of a full segment moves on.
+		if (readPos_ == readSeg_->End && readSeg_->Next != 0)
+			next_segment();
+	}
+
+	// Moves the read position forward over data known to be present.
+	void advance(unsigned int sz) {
+		size_ -= sz;
+		while (sz > 0)
+		{
+			unsigned int nCount = readSeg_->End - readPos_;
+			if (nCount > sz)
+				nCount = sz;
+			readPos_ += nCount;
+			sz -= nCount;
+			if (readPos_ == readSeg_->End && readSeg_->Next != 0)
+				next_segment();
+		}
+		if (size_ == 0)
+			setbit(binstream::eofbit);
+	}
+
+	// Steps into the next segment, releasing all but the one being left.
+	void next_segment() {
+		while (head_ != readSeg_)
+		{
+			Segment* pNext = head_->Next;
+			release(head_);
+			head_ = pNext;
+		}
+		readSeg_ = readSeg_->Next;
+		readPos_ = readSeg_->Begin;
+	}
+
+// Unavailable methods
+private:
+	chainstream(const chainstream&);
+	chainstream& operator=(const chainstream&);
+};
+
+} // namespace JTI_Util
+
+#endif // _CHAINSTREAM_INC_
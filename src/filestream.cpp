@@ -0,0 +1,544 @@
+/****************************************************************************/
+//
+// filestream.cpp
+//
+// This file implements the file-backed binary stream.  Two aligned buffers
+// are used with overlapped I/O: sequential reads are served from one while
+// the next block is read ahead into the other, and writes fill one while
+// the previous block is written behind.
+//
+// Copyright (C) 1994-2004 JulMar Technology, Inc.   All rights reserved
+// This is private property of JulMar Technology, Inc.  It may not be
+// distributed or released without express written permission of
+// JulMar Technology, Inc.
+//
+// You must not remove this notice, or any other, from this software.
+//
+/****************************************************************************/
+
+/*----------------------------------------------------------------------------
+    INCLUDE FILES
+-----------------------------------------------------------------------------*/
+#include "stdafx.h"
+#include "filestream.h"
+
+using namespace JTI_Util;
+
+/*----------------------------------------------------------------------------
+	LINT OPTIONS
+-----------------------------------------------------------------------------*/
+//lint -esym(534, CloseHandle, VirtualFree, SetEndOfFile, SetFilePointerEx)
+//lint -esym(1740, filestream::curr_, filestream::next_)
+
+/*****************************************************************************
+** Procedure:  filestream::filestream
+**
+** Arguments:  pszFilename - File to open
+**             nMode - in or out, optionally with unbuffered
+**             nBufferSize - Size of each of the two buffers
+**
+** Returns: void
+**
+** Description: Constructor for the file stream; the file is opened
+**              immediately and the fail bit set if that fails.
+**
+/****************************************************************************/
+filestream::filestream(const TCHAR* pszFilename, int nMode, unsigned int nBufferSize) :
+	fileName_(pszFilename), mode_(nMode), hFile_(INVALID_HANDLE_VALUE),
+	bufferSize_((nBufferSize + ALIGNMENT - 1) & ~static_cast<unsigned int>(ALIGNMENT - 1)),
+	curr_(0), next_(0), currPos_(0), fileSize_(0)
+{
+	if (bufferSize_ == 0)
+		bufferSize_ = ALIGNMENT;
+	ZeroMemory(buffers_, sizeof(buffers_));
+	if (!open())
+		setbit(binstream::failbit);
+
+}// filestream::filestream
+
+/*****************************************************************************
+** Procedure:  filestream::~filestream
+**
+** Arguments:  void
+**
+** Returns: void
+**
+** Description: Destructor for the file stream; flushes any written data.
+**
+/****************************************************************************/
+filestream::~filestream()
+{
+	close();
+
+}// filestream::~filestream
+
+/*****************************************************************************
+** Procedure:  filestream::open
+**
+** Arguments:  void
+**
+** Returns: true/false success code
+**
+** Description: Opens the file and allocates the buffers.  Reading starts
+**              the first two blocks immediately.
+**
+/****************************************************************************/
+bool filestream::open()
+{
+	if (is_open())
+		return true;
+
+	DWORD dwFlags = FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN;
+	if (mode_ & unbuffered)
+		dwFlags |= FILE_FLAG_NO_BUFFERING;
+
+	if (mode_ & out)
+		hFile_ = CreateFile(fileName_.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, dwFlags, NULL);
+	else
+		hFile_ = CreateFile(fileName_.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, dwFlags, NULL);
+	if (hFile_ == INVALID_HANDLE_VALUE)
+		return false;
+
+	// VirtualAlloc returns page-aligned memory, as unbuffered I/O requires.
+	for (int i = 0; i < 2; ++i)
+	{
+		buffers_[i].Data = reinterpret_cast<BYTE*>(VirtualAlloc(NULL, bufferSize_, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+		buffers_[i].Overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		if (buffers_[i].Data == NULL || buffers_[i].Overlapped.hEvent == NULL)
+		{
+			close();
+			return false;
+		}
+	}
+	curr_ = &buffers_[0];
+	next_ = &buffers_[1];
+	currPos_ = 0;
+	clrbit();
+
+	if (mode_ & out)
+		return true;
+
+	LARGE_INTEGER liSize;
+	if (!GetFileSizeEx(hFile_, &liSize))
+	{
+		close();
+		return false;
+	}
+	fileSize_ = static_cast<unsigned __int64>(liSize.QuadPart);
+	if (!Seek(0))
+	{
+		close();
+		return false;
+	}
+	return true;
+
+}// filestream::open
+
+/*****************************************************************************
+** Procedure:  filestream::close
+**
+** Arguments:  void
+**
+** Returns: void
+**
+** Description: Waits for outstanding I/O, writes any buffered data and
+**              closes the file.
+**
+/****************************************************************************/
+void filestream::close()
+{
+	if (!is_open())
+		return;
+
+	if (mode_ & out)
+	{
+		unsigned __int64 nFinalSize = tell();
+		if (!CompleteIo(next_) || !FlushBuffer() || !CompleteIo(curr_))
+			setbit(binstream::failbit);
+
+		// Unbuffered writes were padded to a whole block; trim the padding.
+		else if ((mode_ & unbuffered) && (nFinalSize % ALIGNMENT) != 0)
+		{
+			LARGE_INTEGER liSize; liSize.QuadPart = static_cast<LONGLONG>(nFinalSize);
+			if (!SetFilePointerEx(hFile_, liSize, NULL, FILE_BEGIN) || !SetEndOfFile(hFile_))
+				setbit(binstream::failbit);
+		}
+	}
+	else
+	{
+		CompleteIo(curr_);
+		CompleteIo(next_);
+	}
+
+	CloseHandle(hFile_);
+	hFile_ = INVALID_HANDLE_VALUE;
+
+	for (int i = 0; i < 2; ++i)
+	{
+		if (buffers_[i].Data != NULL)
+			VirtualFree(buffers_[i].Data, 0, MEM_RELEASE);
+		if (buffers_[i].Overlapped.hEvent != NULL)
+			CloseHandle(buffers_[i].Overlapped.hEvent);
+	}
+	ZeroMemory(buffers_, sizeof(buffers_));
+	curr_ = next_ = 0;
+	setbit(binstream::eofbit);
+
+}// filestream::close
+
+/*****************************************************************************
+** Procedure:  filestream::skip
+**
+** Arguments:  sz - Number of bytes to move the read position
+**
+** Returns: true/false success code
+**
+** Description: Moves the read position forward or back.  Like memstream
+**              the position is clamped to the file; a stream opened for
+**              writing only accepts a zero skip (used by VersionInfo).
+**
+/****************************************************************************/
+bool filestream::skip(int sz)
+{
+	if (!is_open() || (mode_ & out))
+		return (sz == 0 && is_open());
+
+	__int64 nTarget = static_cast<__int64>(tell()) + sz;
+	if (nTarget < 0)
+		nTarget = 0;
+	if (static_cast<unsigned __int64>(nTarget) > fileSize_)
+		nTarget = static_cast<__int64>(fileSize_);
+
+	// Within the current buffer the position just moves.
+	unsigned __int64 nPos = static_cast<unsigned __int64>(nTarget);
+	if (nPos >= curr_->Offset && nPos <= curr_->Offset + curr_->Length)
+		currPos_ = static_cast<unsigned int>(nPos - curr_->Offset);
+	else if (!Seek(nPos))
+		return false;
+
+	UpdateEof();
+	return true;
+
+}// filestream::skip
+
+/*****************************************************************************
+** Procedure:  filestream::peek
+**
+** Arguments:  pBuff - Returned data
+**             sz - Number of bytes
+**
+** Returns: true/false success code
+**
+** Description: Copies data from the read position without consuming it.
+**              The data must lie within the current and readahead buffers.
+**
+/****************************************************************************/
+bool filestream::peek(void* pBuff, unsigned int sz) const
+{
+	if (!is_open() || (mode_ & out) || tell() + sz > fileSize_)
+		return false;
+
+	unsigned int nAvail = curr_->Length - currPos_;
+	if (sz <= nAvail)
+	{
+		memcpy(pBuff, curr_->Data + currPos_, sz);
+		return true;
+	}
+
+	// The rest must come from the readahead buffer.
+	filestream* pThis = const_cast<filestream*>(this);
+	if (!pThis->CompleteIo(next_) || next_->Offset != curr_->Offset + curr_->Length || sz - nAvail > next_->Length)
+		return false;
+	memcpy(pBuff, curr_->Data + currPos_, nAvail);
+	memcpy(static_cast<BYTE*>(pBuff) + nAvail, next_->Data, sz - nAvail);
+	return true;
+
+}// filestream::peek
+
+/*****************************************************************************
+** Procedure:  filestream::read
+**
+** Arguments:  pBuff - Returned data
+**             sz - Number of bytes
+**
+** Returns: true/false success code
+**
+** Description: Reads data from the file; nothing is consumed if the file
+**              does not hold sz more bytes.
+**
+/****************************************************************************/
+bool filestream::read(void* pBuff, unsigned int sz)
+{
+	if (!is_open() || (mode_ & out) || fail() || tell() + sz > fileSize_)
+		return false;
+
+	BYTE* pOut = static_cast<BYTE*>(pBuff);
+	while (sz > 0)
+	{
+		if (currPos_ == curr_->Length && !NextBuffer())
+			return false;
+		unsigned int nCount = curr_->Length - currPos_;
+		if (nCount > sz)
+			nCount = sz;
+		memcpy(pOut, curr_->Data + currPos_, nCount);
+		currPos_ += nCount;
+		pOut += nCount;
+		sz -= nCount;
+	}
+	UpdateEof();
+	return true;
+
+}// filestream::read
+
+/*****************************************************************************
+** Procedure:  filestream::view
+**
+** Arguments:  sz - Number of bytes
+**
+** Returns: Pointer to the data in the read buffer, or NULL
+**
+** Description: Returns the next sz bytes in place if they lie within one
+**              buffer, or copied into a scratch buffer if they straddle
+**              two; the pointer is valid until the next read.
+**
+/****************************************************************************/
+const void* filestream::view(unsigned int sz)
+{
+	if (!is_open() || (mode_ & out) || fail() || tell() + sz > fileSize_)
+		return NULL;
+	if (currPos_ == curr_->Length && sz > 0 && !NextBuffer())
+		return NULL;
+	if (sz > curr_->Length - currPos_)
+	{
+		scratch_.resize(sz);
+		return (read(&scratch_[0], sz)) ? &scratch_[0] : NULL;
+	}
+
+	const void* pData = curr_->Data + currPos_;
+	currPos_ += sz;
+	UpdateEof();
+	return pData;
+
+}// filestream::view
+
+/*****************************************************************************
+** Procedure:  filestream::write
+**
+** Arguments:  pBuff - Data to write
+**             sz - Number of bytes
+**
+** Returns: true/false success code
+**
+** Description: Copies the data into the current buffer, handing each full
+**              buffer to the system to write while the other is filled.
+**
+/****************************************************************************/
+bool filestream::write(const void* pBuff, unsigned int sz)
+{
+	if (!is_open() || !(mode_ & out) || fail())
+		return false;
+
+	const BYTE* pIn = static_cast<const BYTE*>(pBuff);
+	while (sz > 0)
+	{
+		unsigned int nCount = bufferSize_ - curr_->Length;
+		if (nCount > sz)
+			nCount = sz;
+		memcpy(curr_->Data + curr_->Length, pIn, nCount);
+		curr_->Length += nCount;
+		pIn += nCount;
+		sz -= nCount;
+
+		if (curr_->Length == bufferSize_)
+		{
+			// Wait for the previous block, start this one and switch buffers.
+			unsigned __int64 nNextOffset = curr_->Offset + bufferSize_;
+			if (!CompleteIo(next_) || !FlushBuffer())
+				return false;
+			std::swap(curr_, next_);
+			curr_->Offset = nNextOffset;
+			curr_->Length = 0;
+		}
+	}
+	return true;
+
+}// filestream::write
+
+/*****************************************************************************
+** Procedure:  filestream::StartIo
+**
+** Arguments:  pBuff - Buffer to read into or write from
+**             nBytes - Number of bytes
+**
+** Returns: true/false success code
+**
+** Description: Starts an overlapped read or write at the buffer's offset.
+**
+/****************************************************************************/
+bool filestream::StartIo(Buffer* pBuff, unsigned int nBytes)
+{
+	pBuff->Overlapped.Offset = static_cast<DWORD>(pBuff->Offset & 0xffffffff);
+	pBuff->Overlapped.OffsetHigh = static_cast<DWORD>(pBuff->Offset >> 32);
+	pBuff->Overlapped.Internal = pBuff->Overlapped.InternalHigh = 0;
+
+	BOOL fStarted = (mode_ & out) ?
+		WriteFile(hFile_, pBuff->Data, nBytes, NULL, &pBuff->Overlapped) :
+		ReadFile(hFile_, pBuff->Data, nBytes, NULL, &pBuff->Overlapped);
+	if (!fStarted && GetLastError() != ERROR_IO_PENDING)
+	{
+		if ((mode_ & out) || GetLastError() != ERROR_HANDLE_EOF)
+		{
+			setbit(binstream::failbit);
+			return false;
+		}
+		pBuff->Length = 0;
+		return true;
+	}
+	pBuff->fPending = true;
+	return true;
+
+}// filestream::StartIo
+
+/*****************************************************************************
+** Procedure:  filestream::CompleteIo
+**
+** Arguments:  pBuff - Buffer with I/O outstanding
+**
+** Returns: true/false success code
+**
+** Description: Waits for the buffer's I/O.  A completed read sets the
+**              buffer length to the data returned.
+**
+/****************************************************************************/
+bool filestream::CompleteIo(Buffer* pBuff)
+{
+	if (!pBuff->fPending)
+		return true;
+	pBuff->fPending = false;
+
+	DWORD dwCount = 0;
+	if (!GetOverlappedResult(hFile_, &pBuff->Overlapped, &dwCount, TRUE) &&
+		((mode_ & out) || GetLastError() != ERROR_HANDLE_EOF))
+	{
+		setbit(binstream::failbit);
+		return false;
+	}
+
+	if ((mode_ & out) == 0)
+	{
+		// Unbuffered reads can return the padding of the final block.
+		unsigned __int64 nRemain = (pBuff->Offset < fileSize_) ? fileSize_ - pBuff->Offset : 0;
+		pBuff->Length = (dwCount < nRemain) ? dwCount : static_cast<unsigned int>(nRemain);
+	}
+	else if (dwCount < pBuff->Length)
+	{
+		setbit(binstream::failbit);
+		return false;
+	}
+	return true;
+
+}// filestream::CompleteIo
+
+/*****************************************************************************
+** Procedure:  filestream::StartRead
+**
+** Arguments:  pBuff - Buffer to read into
+**             nOffset - Aligned file offset
+**
+** Returns: true/false success code
+**
+** Description: Starts reading a block into the buffer; a block at or past
+**              the end of the file is left empty.
+**
+/****************************************************************************/
+bool filestream::StartRead(Buffer* pBuff, unsigned __int64 nOffset)
+{
+	pBuff->Offset = nOffset;
+	pBuff->Length = 0;
+	if (nOffset >= fileSize_)
+		return true;
+	return StartIo(pBuff, bufferSize_);
+
+}// filestream::StartRead
+
+/*****************************************************************************
+** Procedure:  filestream::NextBuffer
+**
+** Arguments:  void
+**
+** Returns: true/false success code
+**
+** Description: Moves reading to the readahead buffer and starts reading
+**              the block after it into the buffer just finished.
+**
+/****************************************************************************/
+bool filestream::NextBuffer()
+{
+	if (!CompleteIo(next_))
+		return false;
+	if (next_->Offset != curr_->Offset + curr_->Length || next_->Length == 0)
+		return Seek(curr_->Offset + curr_->Length) && curr_->Length > currPos_;
+
+	std::swap(curr_, next_);
+	currPos_ = 0;
+	return StartRead(next_, curr_->Offset + curr_->Length);
+
+}// filestream::NextBuffer
+
+/*****************************************************************************
+** Procedure:  filestream::Seek
+**
+** Arguments:  nPos - New read position
+**
+** Returns: true/false success code
+**
+** Description: Repositions reading, reusing the readahead buffer if it
+**              holds the position and otherwise reading the aligned block
+**              containing it.  Readahead of the following block is started.
+**
+/****************************************************************************/
+bool filestream::Seek(unsigned __int64 nPos)
+{
+	if (!CompleteIo(curr_) || !CompleteIo(next_))
+		return false;
+
+	if (nPos >= next_->Offset && nPos < next_->Offset + next_->Length)
+		std::swap(curr_, next_);
+	else
+	{
+		if (!StartRead(curr_, nPos - (nPos % bufferSize_)) || !CompleteIo(curr_))
+			return false;
+	}
+	currPos_ = static_cast<unsigned int>(nPos - curr_->Offset);
+	if (currPos_ > curr_->Length)
+		currPos_ = curr_->Length;
+	return StartRead(next_, curr_->Offset + curr_->Length);
+
+}// filestream::Seek
+
+/*****************************************************************************
+** Procedure:  filestream::FlushBuffer
+**
+** Arguments:  void
+**
+** Returns: true/false success code
+**
+** Description: Starts writing the current buffer.  Unbuffered writes are
+**              padded with zeros to a whole number of blocks.
+**
+/****************************************************************************/
+bool filestream::FlushBuffer()
+{
+	if (curr_->Length == 0)
+		return true;
+
+	unsigned int nBytes = curr_->Length;
+	if (mode_ & unbuffered)
+	{
+		unsigned int nPadded = (nBytes + ALIGNMENT - 1) & ~static_cast<unsigned int>(ALIGNMENT - 1);
+		ZeroMemory(curr_->Data + nBytes, nPadded - nBytes);
+		nBytes = nPadded;
+	}
+	return StartIo(curr_, nBytes);
+
+}// filestream::FlushBuffer
@@ -0,0 +1,116 @@
+/******************************************************************************/
+//
+// filestream.h
+//
+// This header implements a binary stream over a file.  Reads are double
+// buffered with asynchronous readahead and writes are double buffered with
+// write-behind, both using overlapped I/O.
+//
+// Copyright (C) 1994-2004 JulMar Technology, Inc.   All rights reserved
+// This is private property of JulMar Technology, Inc.  It may not be
+// distributed or released without express written permission of
+// JulMar Technology, Inc.
+//
+// You must not remove this notice, or any other, from this software.
+//
+/******************************************************************************/
+
+#ifndef _FILESTREAM_INC_
+#define _FILESTREAM_INC_
+
+/*----------------------------------------------------------------------------
+    INCLUDE FILES
+-----------------------------------------------------------------------------*/
+#include <vector>
+#include <binstream.h>
+#include <tchar.h>
+
+namespace JTI_Util
+{
+/******************************************************************************/
+// filestream
+//
+// Binary stream which reads an existing file or creates a new one.  Data is
+// moved through two page-aligned buffers; while one is being consumed (or
+// filled) the other is being read (or written) in the background.  The
+// unbuffered mode opens the file with FILE_FLAG_NO_BUFFERING so very large
+// snapshots do not pass through the system cache; the final partial block
+// is padded on write and the file trimmed back to its true size on close.
+// skip() and peek() keep their memstream semantics so VersionInfo works; a
+// peek may span at most the current and readahead buffers.
+//
+/******************************************************************************/
+class filestream : public binstream
+{
+// Class data
+public:
+	enum {
+		in			= 0x1,	// open an existing file for reading
+		out			= 0x2,	// create (or truncate) a file for writing
+		unbuffered	= 0x4	// bypass the system cache
+	};
+	// Buffers are a multiple of ALIGNMENT, which covers the sector size
+	// FILE_FLAG_NO_BUFFERING requires.
+	enum { DEFAULT_BUFFER_SIZE = 0x40000, ALIGNMENT = 4096 };
+private:
+	struct Buffer
+	{
+		BYTE* Data;
+		unsigned int Length;		// bytes valid (reading) or filled (writing)
+		unsigned __int64 Offset;	// file offset of Data[0]
+		OVERLAPPED Overlapped;
+		bool fPending;
+	};
+	std::basic_string<TCHAR> fileName_;
+	int mode_;
+	HANDLE hFile_;
+	unsigned int bufferSize_;
+	Buffer buffers_[2];
+	Buffer* curr_;					// buffer being consumed or filled
+	Buffer* next_;					// readahead or write-behind buffer
+	unsigned int currPos_;			// read position within curr_
+	unsigned __int64 fileSize_;		// size when opened for reading
+	std::vector<BYTE> scratch_;		// viewed data which straddles buffers
+
+// Constructor/Destructor
+public:
+	filestream(const TCHAR* pszFilename, int nMode, unsigned int nBufferSize = DEFAULT_BUFFER_SIZE);
+	virtual ~filestream();
+
+// Overridable operations required in the derived classes
+public:
+	virtual bool open();
+	virtual void close();
+	virtual bool skip(int sz);
+	virtual bool peek(void* pBuff, unsigned int sz) const;
+	virtual bool read(void* pBuff, unsigned int sz);
+	virtual bool write(const void* pBuff, unsigned int sz);
+	virtual const void* view(unsigned int sz);
+
+// Access methods
+public:
+	bool is_open() const { return hFile_ != INVALID_HANDLE_VALUE; }
+	// Returns the current read or write position.
+	unsigned __int64 tell() const { return (curr_ != 0) ? curr_->Offset + ((mode_ & out) ? curr_->Length : currPos_) : 0; }
+	// Returns the size of the file being read, or the data written so far.
+	unsigned __int64 size() const { return (mode_ & out) ? tell() : fileSize_; }
+
+// Internal methods
+private:
+	bool StartIo(Buffer* pBuff, unsigned int nBytes);
+	bool CompleteIo(Buffer* pBuff);
+	bool StartRead(Buffer* pBuff, unsigned __int64 nOffset);
+	bool NextBuffer();
+	bool Seek(unsigned __int64 nPos);
+	bool FlushBuffer();
+	void UpdateEof() { if (tell() >= fileSize_) setbit(binstream::eofbit); else clrbit(binstream::eofbit); }
+
+// Unavailable methods
+private:
+	filestream(const filestream&);
+	filestream& operator=(const filestream&);
+};
+
+} // namespace JTI_Util
+
+#endif // _FILESTREAM_INC_
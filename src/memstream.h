@@ -20,14 +20,102 @@
 /*----------------------------------------------------------------------------
     INCLUDE FILES
 -----------------------------------------------------------------------------*/
+#include <vector>
+#include <climits>
 #include <binstream.h>
+#include <Lock.h>
 
 namespace JTI_Util
 {
+/******************************************************************************/
+// memstream_pool
+//
+// Recycles the buffers of memstream objects constructed against it so 
+// short-lived streams do not go to the allocator each time.  At most 
+// nMaxCount buffers of nMaxSize bytes or less are kept.  The pool must 
+// outlive the streams which use it.
+//
+/******************************************************************************/
+class memstream_pool : public LockableObject<MultiThreadModel>
+{
+// Class data
+private:
+	struct Buffer
+	{
+		void* Data;
+		unsigned int Size;
+	};
+	std::vector<Buffer> buffers_;
+	unsigned int maxCount_;
+	unsigned int maxSize_;
+
+// Constructor/Destructor
+public:
+	memstream_pool(unsigned int nMaxCount = 16, unsigned int nMaxSize = 0x100000) : maxCount_(nMaxCount), maxSize_(nMaxSize) {/* */}
+	virtual ~memstream_pool() {
+		for (std::vector<Buffer>::iterator it = buffers_.begin(); it != buffers_.end(); ++it)
+			free(it->Data);
+	}
+
+// Methods
+public:
+	// Returns a buffer of at least nMinSize bytes; nSize receives its size.
+	void* acquire(unsigned int nMinSize, unsigned int& nSize) {
+		{
+			CCSLock<memstream_pool> lock(this);
+			if (!buffers_.empty())
+			{
+				Buffer buff = buffers_.back();
+				buffers_.pop_back();
+				if (buff.Size < nMinSize)
+				{
+					void* pData = realloc(buff.Data, nMinSize);
+					if (pData == 0)
+					{
+						free(buff.Data);
+						return 0;
+					}
+					buff.Data = pData;
+					buff.Size = nMinSize;
+				}
+				nSize = buff.Size;
+				return buff.Data;
+			}
+		}
+		nSize = nMinSize;
+		return malloc(nMinSize);
+	}
+
+	// Returns a buffer to the pool, or frees it if the pool is full.
+	void release(void* pData, unsigned int nSize) {
+		if (pData == 0)
+			return;
+		if (nSize <= maxSize_)
+		{
+			CCSLock<memstream_pool> lock(this);
+			if (buffers_.size() < maxCount_)
+			{
+				Buffer buff = { pData, nSize };
+				buffers_.push_back(buff);
+				return;
+			}
+		}
+		free(pData);
+	}
+
+// Unavailable methods
+private:
+	memstream_pool(const memstream_pool&);
+	memstream_pool& operator=(const memstream_pool&);
+};
+
 /******************************************************************************/
 // memstream
 //
-// Implementation class for the binary stream.
+// Implementation class for the binary stream.  Data is written at the end
+// and read from the current read position.  The buffer grows geometrically.
+// A stream constructed without copying refers to the caller's memory until 
+// it is first written, when the data is copied into a buffer of its own.
 //
 /******************************************************************************/
 class memstream : public binstream
@@ -37,18 +125,45 @@ private:
 	static const unsigned int SIZE_INC = 4096;
 	BYTE *dataBuff_, *currRead_, *currWrite_;
 	unsigned int buffSize_;
+	bool fOwned_;
+	memstream_pool* pool_;
 
 // Constructor/Destructor
 public:
-	memstream(const void* pData, unsigned int nSize) : buffSize_(nSize), dataBuff_(0), currRead_(0), currWrite_(0) {
-		currRead_ = currWrite_ = dataBuff_ = reinterpret_cast<BYTE*>(realloc(dataBuff_,nSize));
-		memcpy(dataBuff_, pData, nSize);
+	memstream(const void* pData, unsigned int nSize, bool fCopy = true) : 
+		dataBuff_(0), currRead_(0), currWrite_(0), buffSize_(0), fOwned_(fCopy), pool_(0) {
+		if (fCopy)
+		{
+			if (nSize > 0 && !reserve(nSize))
+				throw std::bad_alloc();
+			if (nSize > 0)
+				memcpy(dataBuff_, pData, nSize);
+		}
+		else
+		{
+			dataBuff_ = reinterpret_cast<BYTE*>(const_cast<void*>(pData));
+			buffSize_ = nSize;
+		}
+		currRead_ = dataBuff_;
+		currWrite_ = dataBuff_ + nSize;
+		if (nSize == 0)
+			setbit(binstream::eofbit);
+	}
+	memstream() : dataBuff_(0), currRead_(0), currWrite_(0), buffSize_(0), fOwned_(true), pool_(0) { 
+		setbit(binstream::eofbit);
 	}
-	memstream() : buffSize_(SIZE_INC), currRead_(0), currWrite_(0), dataBuff_(0) { 
-		currRead_ = currWrite_ = dataBuff_ = reinterpret_cast<BYTE*>(realloc(dataBuff_,buffSize_));
+	explicit memstream(memstream_pool& pool) : dataBuff_(0), currRead_(0), currWrite_(0), buffSize_(0), fOwned_(true), pool_(&pool) { 
 		setbit(binstream::eofbit);
 	}
-	virtual ~memstream() { realloc(dataBuff_,0); }
+	virtual ~memstream() { 
+		if (fOwned_)
+		{
+			if (pool_ != 0)
+				pool_->release(dataBuff_, buffSize_);
+			else
+				free(dataBuff_);
+		}
+	}
 
 // Overridable operations required in the derived classes
 public:
@@ -85,14 +200,11 @@ public:
 	}
 
 	virtual bool write(const void* pBuff, unsigned int size) {
-		if ( (currWrite_ + size) > (dataBuff_ + buffSize_) )
+		if (!fOwned_ || (currWrite_ + size) > (dataBuff_ + buffSize_))
 		{
-			unsigned int nDiffR = static_cast<unsigned int>(currRead_ - dataBuff_);
-			unsigned int nDiffW = static_cast<unsigned int>(currWrite_ - dataBuff_);
-			dataBuff_ = reinterpret_cast<BYTE*>(realloc(dataBuff_, buffSize_+SIZE_INC));
-			buffSize_ += SIZE_INC;
-			currWrite_ = dataBuff_ + nDiffW;
-			currRead_ = dataBuff_ + nDiffR;
+			unsigned int nUsed = static_cast<unsigned int>(currWrite_ - dataBuff_);
+			if (size > UINT_MAX - nUsed || !grow(nUsed + size))
+				return false;
 		}
 		memcpy(currWrite_, pBuff, size);
 		currWrite_ += size;
@@ -100,13 +212,62 @@ public:
 		return true;
 	}
 
+	// The pointer is valid until the next write.
+	virtual const void* view(unsigned int sz) {
+		if (!currRead_ || (currRead_ + sz) > (dataBuff_ + size()))
+			return 0;
+		const void* pData = currRead_;
+		currRead_ += sz;
+		if (currRead_ >= (dataBuff_+size()))
+			setbit(binstream::eofbit);
+		return pData;
+	}
+
 // Access methods
 public:
 	void* get() const { return dataBuff_; }
-	unsigned long size() const { 
-		if (currWrite_ > dataBuff_)
-			return static_cast<unsigned long>(currWrite_ - dataBuff_);
-		return buffSize_;
+	unsigned long size() const { return static_cast<unsigned long>(currWrite_ - dataBuff_); }
+	unsigned long capacity() const { return buffSize_; }
+
+	// Ensures the stream can hold nSize bytes without reallocating.
+	bool reserve(unsigned int nSize) {
+		return (fOwned_ && nSize <= buffSize_) || grow(nSize);
+	}
+
+// Internal methods
+private:
+	// Moves the data into an owned buffer of at least nSize bytes, at least
+	// doubling the current size.
+	bool grow(unsigned int nSize) {
+		unsigned int nNewSize = (buffSize_ > UINT_MAX / 2) ? UINT_MAX : buffSize_ * 2;
+		if (nNewSize < SIZE_INC)
+			nNewSize = SIZE_INC;
+		if (nNewSize < nSize)
+			nNewSize = nSize;
+
+		unsigned int nUsed = static_cast<unsigned int>(currWrite_ - dataBuff_);
+		unsigned int nDiffR = static_cast<unsigned int>(currRead_ - dataBuff_);
+		BYTE* pNewBuff = 0;
+		if (fOwned_ && dataBuff_ != 0)
+			pNewBuff = reinterpret_cast<BYTE*>(realloc(dataBuff_, nNewSize));
+		else
+		{
+			if (pool_ != 0)
+				pNewBuff = reinterpret_cast<BYTE*>(pool_->acquire(nNewSize, nNewSize));
+			else
+				pNewBuff = reinterpret_cast<BYTE*>(malloc(nNewSize));
+			if (pNewBuff != 0 && nUsed > 0)
+				memcpy(pNewBuff, dataBuff_, nUsed);
+		}
+		if (pNewBuff == 0)
+			return false;
+
+		dataBuff_ = pNewBuff;
+		buffSize_ = nNewSize;
+		fOwned_ = true;
+		currWrite_ = dataBuff_ + nUsed;
+		currRead_ = dataBuff_ + nDiffR;
+		return true;
 	}
 };
 
@@ -17,7 +17,9 @@
 #include "comutls.h"
 #include "adoconn.h"
 #include "Base64.h"
+#include "base64stream.h"
 #include "binstream.h"
+#include "chainstream.h"
 #include "CommandLineParser.h"
 #include "DateTime.h"
 #include "Delegates.h"
@@ -25,6 +27,7 @@
 #include "EventLog.h"
 #include "FileEventLogger.h"
 #include "FileSystemWatcher.h"
+#include "filestream.h"
 #include "Lock.h"
 #include "Longevity.h"
 #include "ManagementObject.h"
@@ -0,0 +1,138 @@
+/****************************************************************************/
+//
+// Base64Bench.cpp
+//
+// Measures Base64 encode and decode throughput for each variant at
+// several buffer sizes, through the buffer API, the incremental decoder
+// and the string API.  Decode() takes no whitespace, so MIME text is
+// decoded by it without its line breaks.  Building with JTI_BASE64_NO_SIMD
+// defined measures the table driven kernels alone.
+//
+// Usage: Base64Bench [megabytes per measurement]
+//
+/****************************************************************************/
+
+#include <JTIUtils.h>
+#include <Base64.h>
+#include <StatTimer.h>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+using namespace JTI_Util;
+
+namespace {
+// Returns MB/s for nBytes processed in dElapsed milliseconds
+double Rate(double dBytes, double dElapsed)
+{
+	return (dElapsed > 0) ? dBytes / (1024.0 * 1024.0) / (dElapsed / 1000.0) : 0;
+}
+
+// Times one variant at one size; returns false if a decode did not give
+// back the input
+bool TimeVariant(Base64Variant::Types variant, const char* pszName, size_t nSize, size_t nTotal)
+{
+	std::vector<unsigned char> arrInput(nSize);
+	for (size_t i = 0; i < nSize; ++i)
+		arrInput[i] = static_cast<unsigned char>((i * 7919) >> 3);
+	int nRepeat = static_cast<int>((nTotal + nSize - 1) / nSize);
+	double dBytes = static_cast<double>(nSize) * nRepeat;
+
+	std::vector<char> arrEncoded(Base64::EncodedLength(nSize, variant) + 1);
+	std::vector<unsigned char> arrDecoded(Base64::MaxDecodedLength(arrEncoded.size()) + 1);
+
+	size_t nEncoded = 0;
+	StatTimer timer(true);
+	for (int i = 0; i < nRepeat; ++i)
+		nEncoded = Base64::Encode(&arrInput[0], nSize, &arrEncoded[0], variant);
+	double dEncode = timer.ElapsedTime();
+
+	std::string strPlain;
+	for (size_t i = 0; i < nEncoded; ++i)
+	{
+		if (arrEncoded[i] != '\r' && arrEncoded[i] != '\n')
+			strPlain += arrEncoded[i];
+	}
+
+	size_t nDecoded = 0;
+	bool fDecoded = true;
+	timer.Start();
+	for (int i = 0; i < nRepeat; ++i)
+		fDecoded &= Base64::Decode(strPlain.data(), strPlain.length(), &arrDecoded[0], nDecoded, variant);
+	double dDecode = timer.ElapsedTime();
+	if (!fDecoded || nDecoded != nSize || memcmp(&arrDecoded[0], &arrInput[0], nSize) != 0)
+		return false;
+
+	timer.Start();
+	for (int i = 0; i < nRepeat; ++i)
+	{
+		Base64Decoder decoder(variant);
+		size_t nPushed = 0, nFinished = 0;
+		fDecoded &= decoder.Push(&arrEncoded[0], nEncoded, &arrDecoded[0], nPushed);
+		fDecoded &= decoder.Finish(&arrDecoded[nPushed], nFinished);
+		nDecoded = nPushed + nFinished;
+	}
+	double dPush = timer.ElapsedTime();
+	if (!fDecoded || nDecoded != nSize || memcmp(&arrDecoded[0], &arrInput[0], nSize) != 0)
+		return false;
+
+	size_t nChars = 0;
+	timer.Start();
+	for (int i = 0; i < nRepeat; ++i)
+		nChars += Base64::EncodeBuffer(&arrInput[0], nSize, variant).length();
+	double dEncodeString = timer.ElapsedTime();
+
+	size_t nBytes = 0;
+	timer.Start();
+	for (int i = 0; i < nRepeat; ++i)
+		nBytes += Base64::DecodeBuffer(&arrEncoded[0], nEncoded, variant).size();
+	double dDecodeString = timer.ElapsedTime();
+	if (nBytes != nSize * nRepeat)
+		return false;
+
+	std::cout << std::setw(8) << pszName << std::setw(10) << nSize << std::fixed << std::setprecision(1)
+			  << std::setw(10) << Rate(dBytes, dEncode) << std::setw(10) << Rate(dBytes, dDecode) << std::setw(10) << Rate(dBytes, dPush)
+			  << std::setw(10) << Rate(dBytes, dEncodeString) << std::setw(10) << Rate(dBytes, dDecodeString)
+			  << std::endl;
+	return true;
+}
+}// namespace
+
+int main(int argc, char* argv[])
+{
+	int nMegabytes = (argc > 1) ? atoi(argv[1]) : 64;
+	if (nMegabytes <= 0)
+	{
+		std::cout << "Usage: Base64Bench [megabytes per measurement]" << std::endl;
+		return 1;
+	}
+
+#ifdef JTI_BASE64_SSSE3
+	std::cout << "SSSE3 kernels " << (JTI_Internal::Base64Kernels::HasSsse3() ? "in use" : "not supported by this processor") << std::endl;
+#else
+	std::cout << "Table driven kernels only" << std::endl;
+#endif
+	std::cout << "MB/s of unencoded data; push decodes with Base64Decoder, and string results" << std::endl;
+	std::cout << "are built with EncodeBuffer and DecodeBuffer" << std::endl;
+	std::cout << " variant      size    encode    decode      push  enc.str.  dec.str." << std::endl;
+
+	const size_t arrSizes[] = { 64, 4096, 1024 * 1024, 16 * 1024 * 1024 };
+	const struct { Base64Variant::Types variant; const char* pszName; } arrVariants[] = {
+		{ Base64Variant::Standard, "standard" },
+		{ Base64Variant::UrlSafe, "url" },
+		{ Base64Variant::Mime, "mime" }
+	};
+	size_t nTotal = static_cast<size_t>(nMegabytes) * 1024 * 1024;
+	for (size_t i = 0; i < sizeofarray(arrVariants); ++i)
+	{
+		for (size_t j = 0; j < sizeofarray(arrSizes); ++j)
+		{
+			if (!TimeVariant(arrVariants[i].variant, arrVariants[i].pszName, arrSizes[j], nTotal))
+			{
+				std::cout << "Decoding did not give back the input." << std::endl;
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
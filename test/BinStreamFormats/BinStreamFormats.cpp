@@ -0,0 +1,366 @@
+/****************************************************************************/
+//
+// BinStreamFormats.cpp
+//
+// Checks that every binstream insertion operator reads back through its
+// extraction operator in the native, portable and compact wire formats,
+// that the portable and compact formats have the same layout on every
+// host, that arrays, vectors and bit sets read back whole, and that
+// VersionInfo switches a reader to the format written.
+//
+/****************************************************************************/
+
+#include <JTIUtils.h>
+#include <memstream.h>
+#include <iostream>
+#include <sstream>
+
+using namespace JTI_Util;
+
+namespace {
+int g_nFailures = 0;
+
+void Check(bool fTest, const char* pszTest)
+{
+	if (!fTest) {
+		std::cout << "FAILED: " << pszTest << std::endl;
+		++g_nFailures;
+	}
+}
+
+const int g_arrFormats[] = { binstream::nativefmt, binstream::portablefmt, binstream::compactfmt };
+const char* const g_arrFormatNames[] = { "native", "portable", "compact" };
+
+template <typename _Ty>
+bool Same(const _Ty& lhs, const _Ty& rhs) { return lhs == rhs; }
+bool Same(const GUID& lhs, const GUID& rhs) { return IsEqualGUID(lhs, rhs) != 0; }
+
+// Writes a value followed by a marker byte, reads it back and checks that
+// the marker follows it, so a value read with the wrong size is caught
+template <typename _Ty>
+void CheckRoundTrip(int nFormat, const _Ty& val, const char* pszType)
+{
+	std::string strTest = std::string(g_arrFormatNames[nFormat]) + " " + pszType;
+	memstream stm;
+	stm.setformat(nFormat);
+	stm << val << static_cast<unsigned char>(0x5a);
+	_Ty result = _Ty();
+	unsigned char byMarker = 0;
+	try {
+		stm >> result >> byMarker;
+	}
+	catch (const schema_exception&) {
+		Check(false, (strTest + " reads without an exception").c_str());
+		return;
+	}
+	Check(Same(result, val), (strTest + " reads back").c_str());
+	Check(byMarker == 0x5a, (strTest + " reads its own size").c_str());
+}
+
+// Returns the bytes a value is written as
+template <typename _Ty>
+std::string Encode(int nFormat, const _Ty& val)
+{
+	memstream stm;
+	stm.setformat(nFormat);
+	stm << val;
+	return std::string(static_cast<const char*>(stm.get()), stm.size());
+}
+
+// Round trips every scalar and string operator
+void CheckOperators(int nFormat)
+{
+	CheckRoundTrip(nFormat, true, "bool");
+	CheckRoundTrip(nFormat, false, "bool false");
+	CheckRoundTrip(nFormat, 'x', "char");
+	CheckRoundTrip(nFormat, static_cast<unsigned char>(0xfe), "unsigned char");
+	CheckRoundTrip(nFormat, static_cast<short>(-12345), "short");
+	CheckRoundTrip(nFormat, static_cast<unsigned short>(0xfedc), "unsigned short");
+	CheckRoundTrip(nFormat, -123456789, "int");
+	CheckRoundTrip(nFormat, 0x7fffffff, "int maximum");
+	CheckRoundTrip(nFormat, static_cast<unsigned int>(0xfedcba98), "unsigned int");
+	CheckRoundTrip(nFormat, -2147483647L - 1, "long minimum");
+	CheckRoundTrip(nFormat, 0xfedcba98UL, "unsigned long");
+	CheckRoundTrip(nFormat, static_cast<__int64>(-1234567890123456789LL), "__int64");
+	CheckRoundTrip(nFormat, static_cast<unsigned __int64>(0xfedcba9876543210ULL), "unsigned __int64");
+	CheckRoundTrip(nFormat, 3.25f, "float");
+	CheckRoundTrip(nFormat, -1.0e300, "double");
+	CheckRoundTrip(nFormat, std::string("text"), "string");
+	CheckRoundTrip(nFormat, std::string(), "empty string");
+	CheckRoundTrip(nFormat, std::string(100000, 'z'), "long string");
+	GUID guid = { 0x12345678, 0x9abc, 0xdef0, { 1, 2, 3, 4, 5, 6, 7, 8 } };
+	CheckRoundTrip(nFormat, guid, "GUID");
+
+	// The native layout keeps the terminator the original writer stores.
+	const wchar_t* arrWide[] = { L"wide text", L"" };
+	for (size_t i = 0; i < sizeofarray(arrWide); ++i) {
+		std::wstring strWide(arrWide[i]);
+		if (nFormat == binstream::nativefmt)
+			strWide += L'\0';
+		memstream stm;
+		stm.setformat(nFormat);
+		stm << std::wstring(arrWide[i]) << static_cast<unsigned char>(0x5a);
+		std::wstring strResult;
+		unsigned char byMarker = 0;
+		stm >> strResult >> byMarker;
+		Check(strResult == strWide && byMarker == 0x5a, (std::string(g_arrFormatNames[nFormat]) + " wstring reads back").c_str());
+	}
+}
+
+// Round trips arrays, vectors and bit sets, which are copied as a block
+// where the element layout allows and one element at a time otherwise
+void CheckBulkOperators(int nFormat)
+{
+	std::vector<double> vecDouble(100000);
+	std::vector<int> vecInt(70000);
+	std::vector<unsigned short> vecWord(5000);
+	std::vector<__int64> vecLong(3000);
+	std::vector<float> vecFloat(1001);
+	std::vector<char> vecChar(65537);
+	for (size_t i = 0; i < vecDouble.size(); ++i)
+		vecDouble[i] = static_cast<double>(i) * -1.5;
+	for (size_t i = 0; i < vecInt.size(); ++i)
+		vecInt[i] = static_cast<int>(i * 7919) - 100000;
+	for (size_t i = 0; i < vecWord.size(); ++i)
+		vecWord[i] = static_cast<unsigned short>(i * 31);
+	for (size_t i = 0; i < vecLong.size(); ++i)
+		vecLong[i] = static_cast<__int64>(i) << 40;
+	for (size_t i = 0; i < vecFloat.size(); ++i)
+		vecFloat[i] = static_cast<float>(i) / 8;
+	for (size_t i = 0; i < vecChar.size(); ++i)
+		vecChar[i] = static_cast<char>(i);
+
+	CheckRoundTrip(nFormat, vecDouble, "vector<double>");
+	CheckRoundTrip(nFormat, vecInt, "vector<int>");
+	CheckRoundTrip(nFormat, vecWord, "vector<unsigned short>");
+	CheckRoundTrip(nFormat, vecLong, "vector<__int64>");
+	CheckRoundTrip(nFormat, vecFloat, "vector<float>");
+	CheckRoundTrip(nFormat, vecChar, "vector<char>");
+	CheckRoundTrip(nFormat, std::vector<double>(), "empty vector");
+
+	std::vector<std::string> vecString;
+	vecString.push_back("one");
+	vecString.push_back("");
+	vecString.push_back(std::string(300, 's'));
+	CheckRoundTrip(nFormat, vecString, "vector<string>");
+
+	const size_t arrBitCounts[] = { 0, 1, 9, 100003 };
+	for (size_t i = 0; i < sizeofarray(arrBitCounts); ++i)
+	{
+		std::vector<bool> bits(arrBitCounts[i]);
+		for (size_t nBit = 0; nBit < bits.size(); ++nBit)
+			bits[nBit] = ((nBit * 7919) % 13) < 3;
+		CheckRoundTrip(nFormat, bits, "vector<bool>");
+	}
+	std::bitset<1> bits1;
+	bits1.set();
+	std::bitset<77> bits77;
+	bits77.set(0).set(40).set(76);
+	std::bitset<1000> bits1000;
+	bits1000.set().reset(999);
+	CheckRoundTrip(nFormat, bits1, "bitset<1>");
+	CheckRoundTrip(nFormat, bits77, "bitset<77>");
+	CheckRoundTrip(nFormat, bits1000, "bitset<1000>");
+
+	// An array is written without a count and read into a caller's array.
+	std::string strTest = g_arrFormatNames[nFormat];
+	short arrWritten[5] = { -1, 2, -300, 4000, -32768 };
+	short arrRead[5] = { 0 };
+	memstream stm;
+	stm.setformat(nFormat);
+	stm << make_array_ref(arrWritten, 5) << static_cast<unsigned char>(0x5a);
+	unsigned char byMarker = 0;
+	stm >> make_array_ref(arrRead, 5) >> byMarker;
+	Check(memcmp(arrWritten, arrRead, sizeof(arrRead)) == 0 && byMarker == 0x5a, (strTest + " array_ref reads back").c_str());
+
+	// A bit set read at another size is refused.
+	memstream bits;
+	bits.setformat(nFormat);
+	bits << std::bitset<10>();
+	std::bitset<11> bitsOther;
+	bool fRefused = false;
+	try {
+		bits >> bitsOther;
+	}
+	catch (const schema_exception&) {
+		fRefused = true;
+	}
+	Check(fRefused, (strTest + " bitset of another size refused").c_str());
+
+	// A damaged count is refused without allocating for it.
+	memstream damaged;
+	damaged.setformat(nFormat);
+	damaged << 0x7ffffff0UL;
+	damaged.write("abcdefgh", 8);
+	std::vector<double> vecResult;
+	fRefused = false;
+	try {
+		damaged >> vecResult;
+	}
+	catch (const schema_exception&) {
+		fRefused = true;
+	}
+	Check(fRefused, (strTest + " damaged vector count refused").c_str());
+	Check(vecResult.capacity() < 0x100000, (strTest + " damaged vector count not allocated").c_str());
+}
+
+// Checks the portable layout: little-endian fixed-width integers and
+// UTF-8 strings with a 32 bit length
+void CheckPortableLayout()
+{
+	const int nFormat = binstream::portablefmt;
+	Check(Encode(nFormat, static_cast<short>(-2)) == std::string("\xfe\xff", 2), "portable short layout");
+	Check(Encode(nFormat, 0x01020304L) == std::string("\x04\x03\x02\x01", 4), "portable long layout");
+	Check(Encode(nFormat, 0x01020304UL) == std::string("\x04\x03\x02\x01", 4), "portable unsigned long layout");
+	Check(Encode(nFormat, 5) == std::string("\x05\0\0\0", 4), "portable int layout");
+	Check(Encode(nFormat, static_cast<__int64>(-2)) == std::string("\xfe\xff\xff\xff\xff\xff\xff\xff", 8), "portable __int64 layout");
+	Check(Encode(nFormat, 1.0) == std::string("\0\0\0\0\0\0\xf0\x3f", 8), "portable double layout");
+	Check(Encode(nFormat, 1.0f) == std::string("\0\0\x80\x3f", 4), "portable float layout");
+	Check(Encode(nFormat, true) == std::string("\x01", 1), "portable bool layout");
+	Check(Encode(nFormat, std::string("ab")) == std::string("\x02\0\0\0ab", 6), "portable string layout");
+
+	std::vector<unsigned short> vecWord;
+	vecWord.push_back(1);
+	vecWord.push_back(0x0203);
+	Check(Encode(nFormat, vecWord) == std::string("\x02\0\0\0\x01\0\x03\x02", 8), "portable vector layout");
+	std::bitset<10> bits;
+	bits.set(0).set(9);
+	Check(Encode(nFormat, bits) == std::string("\x0a\0\0\0\x01\x02", 6), "portable bitset layout");
+
+	// Strings are UTF-8 on the wire whatever their type in memory.
+	const std::string strUtf8("\xc3\xa9\xe2\x82\xac");
+	Check(Encode(nFormat, std::wstring(L"\x00e9\x20ac")) == std::string("\x05\0\0\0", 4) + strUtf8, "portable wstring is UTF-8");
+	CheckRoundTrip(nFormat, strUtf8, "UTF-8 string");
+	CheckRoundTrip(nFormat, std::wstring(L"\x00e9\x20ac"), "non-ASCII wstring");
+
+	// A string_ref reads the bytes in place and writes them as a string.
+	memstream stm;
+	stm.setformat(nFormat);
+	stm << std::string("in place") << string_ref("ref", 3);
+	string_ref ref1, ref2;
+	stm >> ref1 >> ref2;
+	Check(std::string(ref2.data, ref2.length) == "ref", "string_ref reads back");
+	Check(stm.good(), "string_ref leaves the stream good");
+
+	// A length larger than the data left is refused.
+	memstream damaged;
+	damaged.setformat(nFormat);
+	damaged << 0x7ffffff0UL;
+	damaged.write("abc", 3);
+	std::string strResult;
+	bool fRefused = false;
+	try {
+		damaged >> strResult;
+	}
+	catch (const schema_exception&) {
+		fRefused = true;
+	}
+	Check(fRefused && damaged.fail(), "damaged string length refused");
+}
+
+// Checks the compact layout: varint integers and lengths, zigzag signed
+// values and run length packed bits
+void CheckCompactLayout()
+{
+	const int nFormat = binstream::compactfmt;
+	Check(Encode(nFormat, 5UL) == "\x05", "compact small unsigned is one byte");
+	Check(Encode(nFormat, 300UL) == "\xac\x02", "compact unsigned varint layout");
+	Check(Encode(nFormat, 0xffffffffUL) == "\xff\xff\xff\xff\x0f", "compact largest unsigned long");
+	Check(Encode(nFormat, 5) == "\x0a", "compact positive int is zigzag encoded");
+	Check(Encode(nFormat, -1) == "\x01", "compact negative int is zigzag encoded");
+	Check(Encode(nFormat, static_cast<short>(-64)) == "\x7f", "compact short layout");
+	Check(Encode(nFormat, static_cast<__int64>(0)) == std::string("\0", 1), "compact zero __int64");
+	Check(Encode(nFormat, 1.0) == std::string("\0\0\0\0\0\0\xf0\x3f", 8), "compact double is fixed width");
+	Check(Encode(nFormat, std::string("ab")) == "\x02" "ab", "compact string length is a varint");
+
+	// Mostly equal bits are written as runs when that is smaller.
+	std::vector<bool> bits(100000, true);
+	bits[50000] = false;
+	Check(Encode(nFormat, bits).length() < 16, "compact bit runs are packed");
+	CheckRoundTrip(nFormat, bits, "vector<bool> runs");
+
+	// A varint too large for the type read is refused.
+	memstream stm;
+	stm.setformat(nFormat);
+	stm << 70000UL;
+	unsigned short w = 0;
+	bool fRefused = false;
+	try {
+		stm >> w;
+	}
+	catch (const schema_exception&) {
+		fRefused = true;
+	}
+	Check(fRefused, "compact value too large for its type refused");
+}
+
+// Writes version markers and reads them back with a reader in the native
+// format, which switches to the format the marker names
+void CheckVersionInfo()
+{
+	for (size_t i = 0; i < sizeofarray(g_arrFormats); ++i)
+	{
+		std::string strTest = std::string(g_arrFormatNames[g_arrFormats[i]]) + " version marker";
+		memstream stm;
+		{
+			VersionInfo written(stm, 3, g_arrFormats[i]);
+		}
+		stm << -5 << std::string("after");
+		stm.setformat(binstream::nativefmt);
+
+		VersionInfo read(stm);
+		int nValue = 0;
+		std::string strValue;
+		stm >> nValue >> strValue;
+		Check(read.Version == 3 && read.Format == g_arrFormats[i], (strTest + " is read").c_str());
+		Check(stm.format() == g_arrFormats[i], (strTest + " switches the reader").c_str());
+		Check(nValue == -5 && strValue == "after", (strTest + " values read").c_str());
+	}
+
+	// The original marker, or none, leaves the reader's format alone.
+	memstream original;
+	{
+		VersionInfo written(original, 2);
+	}
+	original << 7L;
+	original.setformat(binstream::portablefmt);
+	VersionInfo read(original);
+	Check(read.Version == 2 && original.format() == binstream::portablefmt, "original marker keeps the format");
+
+	memstream unmarked;
+	unmarked << 7L;
+	long lValue = 0;
+	VersionInfo none(unmarked);
+	unmarked >> lValue;
+	Check(none.Version == 1 && lValue == 7, "stream without a marker reads from the start");
+
+	// A marker naming an unknown format is refused.
+	memstream unknown;
+	DWORD dwMarker = 0x52460000 | (0x07 << 8) | 0x01;
+	unknown.write(&dwMarker, sizeof(dwMarker));
+	unknown << 7L;
+	bool fRefused = false;
+	try {
+		VersionInfo bad(unknown);
+	}
+	catch (const schema_exception&) {
+		fRefused = true;
+	}
+	Check(fRefused && unknown.fail(), "unknown format marker refused");
+}
+}// namespace
+
+int main()
+{
+	for (size_t i = 0; i < sizeofarray(g_arrFormats); ++i) {
+		CheckOperators(g_arrFormats[i]);
+		CheckBulkOperators(g_arrFormats[i]);
+	}
+	CheckPortableLayout();
+	CheckCompactLayout();
+	CheckVersionInfo();
+
+	if (g_nFailures == 0)
+		std::cout << "BinStreamFormats passed" << std::endl;
+	return g_nFailures;
+}
@@ -0,0 +1,110 @@
+/****************************************************************************/
+//
+// FileLoggerBench.cpp
+//
+// Measures how fast FileEventLogger takes lines from one or more threads
+// and writes them to its file, for several buffer sizes.  Each run lasts
+// until Stop() has written every line.
+//
+// Usage: FileLoggerBench [lines]
+//
+/****************************************************************************/
+
+#include <JTIUtils.h>
+#include <FileEventLogger.h>
+#include <StatTimer.h>
+#include <process.h>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+using namespace JTI_Util;
+
+namespace {
+// Work given to each logging thread
+struct LogWork
+{
+	FileEventLogger* pLogger;
+	int nLines;
+};
+
+const char g_szLine[] = "2024-01-01 12:00:00.000 [0042] INFO  Request completed for client 10.0.0.17 in 12 ms";
+
+UINT __stdcall LogThread(void* pParam)
+{
+	LogWork* pWork = reinterpret_cast<LogWork*>(pParam);
+	for (int i = 0; i < pWork->nLines; ++i)
+		pWork->pLogger->Log(g_szLine);
+	return 0;
+}
+
+// Logs nLines lines split between nThreads threads and returns the time
+// taken until the logger has stopped, in milliseconds
+double TimeRun(int nLines, int nThreads, DWORD dwBufferSize)
+{
+	FileEventLogger logger;
+	logger.BufferSize = dwBufferSize;
+	logger.TruncateExistingData = true;
+
+	// Start returns true if the logger could not be started.
+	if (logger.Start(".", "FileLoggerBench.log"))
+		return -1;
+
+	std::vector<LogWork> arrWork(nThreads);
+	std::vector<HANDLE> arrThreads;
+	StatTimer timer(true);
+	for (int i = 0; i < nThreads; ++i)
+	{
+		arrWork[i].pLogger = &logger;
+		arrWork[i].nLines = nLines / nThreads;
+		UINT nThreadId = 0;
+		HANDLE hThread = reinterpret_cast<HANDLE>(_beginthreadex(NULL, 0, LogThread, &arrWork[i], 0, &nThreadId));
+		if (hThread != 0)
+			arrThreads.push_back(hThread);
+	}
+	if (!arrThreads.empty())
+		WaitForMultipleObjects(static_cast<DWORD>(arrThreads.size()), &arrThreads[0], TRUE, INFINITE);
+	logger.Stop();
+	double dElapsed = timer.ElapsedTime();
+
+	for (size_t i = 0; i < arrThreads.size(); ++i)
+		CloseHandle(arrThreads[i]);
+	DeleteFileA(logger.CurrentFilename);
+	return (static_cast<int>(arrThreads.size()) == nThreads) ? dElapsed : -1;
+}
+}// namespace
+
+int main(int argc, char* argv[])
+{
+	int nLines = (argc > 1) ? atoi(argv[1]) : 1000000;
+	if (nLines <= 0)
+	{
+		std::cout << "Usage: FileLoggerBench [lines]" << std::endl;
+		return 1;
+	}
+
+	const int arrThreads[] = { 1, 2, 4 };
+	const DWORD arrBufferSizes[] = { 4096, 65536, 1048576 };
+	const double dBytes = static_cast<double>(nLines) * (sizeof(g_szLine) - 1 + 2);
+
+	std::cout << nLines << " lines of " << sizeof(g_szLine) - 1 << " characters" << std::endl;
+	std::cout << "threads   buffer     ms   lines/s      MB/s" << std::endl;
+	for (size_t i = 0; i < sizeofarray(arrThreads); ++i)
+	{
+		for (size_t j = 0; j < sizeofarray(arrBufferSizes); ++j)
+		{
+			double dElapsed = TimeRun(nLines, arrThreads[i], arrBufferSizes[j]);
+			if (dElapsed < 0)
+			{
+				std::cout << "The logger could not be started in this directory." << std::endl;
+				return 1;
+			}
+			std::cout << std::setw(7) << arrThreads[i] << std::setw(9) << arrBufferSizes[j]
+					  << std::setw(7) << static_cast<long>(dElapsed)
+					  << std::setw(10) << static_cast<long>(nLines / (dElapsed / 1000.0))
+					  << std::fixed << std::setprecision(1) << std::setw(10) << dBytes / (1024.0 * 1024.0) / (dElapsed / 1000.0)
+					  << std::endl;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,149 @@
+/****************************************************************************/
+//
+// MemStreamBench.cpp
+//
+// Measures memstream: building a large stream with sequential writes of
+// several sizes, with and without reserve(); creating many short-lived
+// streams with and without a memstream_pool; and reading caller data
+// through a copying and a borrowing stream.
+//
+// Usage: MemStreamBench [megabytes]
+//
+/****************************************************************************/
+
+#include <JTIUtils.h>
+#include <memstream.h>
+#include <StatTimer.h>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+using namespace JTI_Util;
+
+namespace {
+// Returns MB/s for nBytes processed in dElapsed milliseconds
+double Rate(double dBytes, double dElapsed)
+{
+	return (dElapsed > 0) ? dBytes / (1024.0 * 1024.0) / (dElapsed / 1000.0) : 0;
+}
+
+// Writes nTotal bytes in chunks of nChunk, reserving the space first if
+// asked, and returns the time taken in milliseconds
+double TimeWrites(unsigned int nTotal, unsigned int nChunk, bool fReserve)
+{
+	std::vector<char> arrChunk(nChunk, 'x');
+	StatTimer timer(true);
+	memstream stm;
+	if (fReserve)
+		stm.reserve(nTotal);
+	for (unsigned int nWritten = 0; nWritten < nTotal; nWritten += nChunk)
+		stm.write(&arrChunk[0], nChunk);
+	double dElapsed = timer.ElapsedTime();
+	return (stm.size() >= nTotal) ? dElapsed : -1;
+}
+
+// Builds nStreams streams of nSize bytes each, written in 256 byte
+// pieces, and returns the time taken in milliseconds
+double TimeShortStreams(int nStreams, unsigned int nSize, memstream_pool* pPool)
+{
+	char szPiece[256];
+	memset(szPiece, 'p', sizeof(szPiece));
+	StatTimer timer(true);
+	for (int i = 0; i < nStreams; ++i)
+	{
+		if (pPool != NULL)
+		{
+			memstream stm(*pPool);
+			for (unsigned int nWritten = 0; nWritten < nSize; nWritten += sizeof(szPiece))
+				stm.write(szPiece, sizeof(szPiece));
+		}
+		else
+		{
+			memstream stm;
+			for (unsigned int nWritten = 0; nWritten < nSize; nWritten += sizeof(szPiece))
+				stm.write(szPiece, sizeof(szPiece));
+		}
+	}
+	return timer.ElapsedTime();
+}
+
+// Reads a buffer through a stream in pieces of up to 4K and returns the
+// time taken in milliseconds, including constructing the stream; dRead
+// receives the number of bytes read
+double TimeReads(const std::vector<char>& arrData, bool fCopy, int nRepeat, double& dRead)
+{
+	char szPiece[4096];
+	unsigned int nSize = static_cast<unsigned int>(arrData.size());
+	unsigned int nPiece = (nSize < sizeof(szPiece)) ? nSize : sizeof(szPiece);
+	dRead = 0;
+	StatTimer timer(true);
+	for (int i = 0; i < nRepeat; ++i)
+	{
+		memstream stm(&arrData[0], nSize, fCopy);
+		while (stm.read(szPiece, nPiece))
+			dRead += szPiece[nPiece - 1] == 'd' ? nPiece : 0;
+	}
+	return timer.ElapsedTime();
+}
+}// namespace
+
+int main(int argc, char* argv[])
+{
+	int nMegabytes = (argc > 1) ? atoi(argv[1]) : 100;
+	if (nMegabytes <= 0 || nMegabytes > 1024)
+	{
+		std::cout << "Usage: MemStreamBench [megabytes, up to 1024]" << std::endl;
+		return 1;
+	}
+	unsigned int nTotal = static_cast<unsigned int>(nMegabytes) * 1024 * 1024;
+	double dTotal = static_cast<double>(nTotal);
+
+	std::cout << "Sequential writes building a " << nMegabytes << "MB stream" << std::endl;
+	std::cout << "  chunk     grown ms      MB/s  reserved ms      MB/s" << std::endl;
+	const unsigned int arrChunks[] = { 16, 256, 4096, 65536 };
+	for (size_t i = 0; i < sizeofarray(arrChunks); ++i)
+	{
+		double dGrown = TimeWrites(nTotal, arrChunks[i], false);
+		double dReserved = TimeWrites(nTotal, arrChunks[i], true);
+		if (dGrown < 0 || dReserved < 0)
+		{
+			std::cout << "The stream could not be allocated." << std::endl;
+			return 1;
+		}
+		std::cout << std::setw(7) << arrChunks[i] << std::fixed << std::setprecision(1)
+				  << std::setw(13) << dGrown << std::setw(10) << Rate(dTotal, dGrown)
+				  << std::setw(13) << dReserved << std::setw(10) << Rate(dTotal, dReserved) << std::endl;
+	}
+
+	const int nStreams = 100000;
+	std::cout << std::endl << nStreams << " short-lived streams written in 256 byte pieces" << std::endl;
+	std::cout << "   size   unpooled ms   pooled ms" << std::endl;
+	const unsigned int arrSizes[] = { 1024, 16384, 262144 };
+	for (size_t i = 0; i < sizeofarray(arrSizes); ++i)
+	{
+		memstream_pool pool;
+		double dUnpooled = TimeShortStreams(nStreams, arrSizes[i], NULL);
+		double dPooled = TimeShortStreams(nStreams, arrSizes[i], &pool);
+		std::cout << std::setw(7) << arrSizes[i] << std::fixed << std::setprecision(1)
+				  << std::setw(14) << dUnpooled << std::setw(12) << dPooled << std::endl;
+	}
+
+	std::cout << std::endl << "Reading " << nMegabytes << "MB of caller data in pieces of up to 4K" << std::endl;
+	std::cout << "   size   copied ms   borrowed ms" << std::endl;
+	for (size_t i = 0; i < sizeofarray(arrSizes); ++i)
+	{
+		std::vector<char> arrData(arrSizes[i], 'd');
+		int nRepeat = static_cast<int>(nTotal / arrSizes[i]);
+		double dCopiedRead, dBorrowedRead;
+		double dCopied = TimeReads(arrData, true, nRepeat, dCopiedRead);
+		double dBorrowed = TimeReads(arrData, false, nRepeat, dBorrowedRead);
+		if (dCopiedRead != dBorrowedRead || dCopiedRead != static_cast<double>(nRepeat) * arrSizes[i])
+		{
+			std::cout << "The streams did not read back the data." << std::endl;
+			return 1;
+		}
+		std::cout << std::setw(7) << arrSizes[i] << std::fixed << std::setprecision(1)
+				  << std::setw(12) << dCopied << std::setw(14) << dBorrowed << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,95 @@
+/****************************************************************************/
+//
+// TraceBatch.cpp
+//
+// Checks that traces delivered to a handler as one batch are joined into
+// a single buffer with no embedded NUL characters.
+//
+/****************************************************************************/
+
+#define RELEASE_TRACE
+#include <JTIUtils.h>
+#include <TraceLogger.h>
+#include <iostream>
+
+using namespace JTI_Util;
+
+/****************************************************************************/
+// BatchCapture
+//
+// Log handler which keeps the joined text of every batch it is given
+//
+/****************************************************************************/
+class BatchCapture : public LogHandler
+{
+public:
+	std::string Joined;
+	size_t Batches;
+
+	BatchCapture() : Batches(0) { LogLevel = 0xffffffff; }
+	virtual void OnLog(const LogElement& le) { OnBatch(&le, 1); }
+	virtual void OnAssert(const AssertElement& ae) { OnBatch(&ae, 1); }
+	virtual void OnLogBatch(const InternalLogElement* const* ppElements, size_t nCount) {
+		++Batches;
+		JoinBatch(ppElements, nCount, "\r\n", Joined);
+	}
+private:
+	void OnBatch(const InternalLogElement* pElement, size_t nCount) {
+		const InternalLogElement* const* ppElements = &pElement;
+		OnLogBatch(ppElements, nCount);
+	}
+};
+
+namespace {
+int g_nFailures = 0;
+
+void Check(bool fTest, const char* pszTest)
+{
+	if (!fTest) {
+		std::cout << "FAILED: " << pszTest << std::endl;
+		++g_nFailures;
+	}
+}
+
+// Counts the CRLF-terminated lines in a joined batch
+size_t CountLines(const std::string& strJoined)
+{
+	size_t nLines = 0;
+	for (std::string::size_type nPos = strJoined.find("\r\n"); nPos != std::string::npos; 
+		 nPos = strJoined.find("\r\n", nPos + 2))
+		++nLines;
+	return nLines;
+}
+}// namespace
+
+int main()
+{
+	// Elements built by older callers still carry the std::ends terminator.
+	BatchCapture direct;
+	LogElement le1(0, std::string("first") + '\0');
+	LogElement le2(0, "second");
+	LogElement le3(0, std::string("third") + '\0');
+	const InternalLogElement* arrElements[] = { &le1, &le2, &le3 };
+	direct.OnLogBatch(arrElements, 3);
+
+	Check(direct.Joined.find('\0') == std::string::npos, "direct batch has no NUL");
+	Check(CountLines(direct.Joined) == 3, "direct batch has three lines");
+	Check(direct.Joined.find("first\r\n") != std::string::npos, "first element ends its line");
+	Check(direct.Joined.find("third\r\n") != std::string::npos, "last element ends its line");
+
+	// Traces raised through the macros and delivered by the logger thread.
+	BatchCapture logged;
+	TraceLogger::Instance().addTraceHandler(&logged);
+	for (int i = 0; i < 10; ++i)
+		JTI_TRACE("trace " << i);
+	TraceLogger::Instance().Stop();
+	TraceLogger::Instance().removeTraceHandler(&logged);
+
+	Check(logged.Joined.find('\0') == std::string::npos, "logged batches have no NUL");
+	Check(CountLines(logged.Joined) >= 10, "logged batches have every trace");
+	Check(logged.Joined.find("trace 9\r\n") != std::string::npos, "last trace ends its line");
+
+	if (g_nFailures == 0)
+		std::cout << "TraceBatch passed" << std::endl;
+	return g_nFailures;
+}
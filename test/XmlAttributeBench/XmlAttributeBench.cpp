@@ -0,0 +1,162 @@
+/****************************************************************************/
+//
+// XmlAttributeBench.cpp
+//
+// Measures attribute storage for elements holding 2 to 8 attributes:
+// parsing, the heap used when the attributes are first expanded, lookup
+// of present and missing names, iteration, and adding attributes to new
+// nodes.  The heap figures come from the debug CRT and are only reported
+// by a Debug build.
+//
+// Usage: XmlAttributeBench [elements]
+//
+/****************************************************************************/
+
+#include <JTIUtils.h>
+#include <XmlParser.h>
+#include <StatTimer.h>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#if defined(DEBUG) || defined(_DEBUG)
+#include <crtdbg.h>
+#endif
+
+using namespace JTI_Util;
+
+namespace {
+const char* const arrNames[] = { "id", "name", "kind", "state", "owner", "created", "size", "checksum" };
+
+// Builds a document of nElements empty elements each holding nAttributes
+// attributes with short values
+std::string BuildDocument(int nElements, int nAttributes)
+{
+	std::ostringstream stm;
+	stm << "<?xml version=\"1.0\"?>\r\n<export>\r\n";
+	for (int i = 0; i < nElements; ++i)
+	{
+		stm << "\t<e";
+		for (int nAttr = 0; nAttr < nAttributes; ++nAttr)
+			stm << ' ' << arrNames[nAttr] << "=\"v" << nAttr << '-' << i << '"';
+		stm << "/>\r\n";
+	}
+	stm << "</export>\r\n";
+	return stm.str();
+}
+
+// Returns the bytes in use on the debug heap, or zero in a release build
+size_t HeapInUse()
+{
+#if defined(DEBUG) || defined(_DEBUG)
+	_CrtMemState state;
+	_CrtMemCheckpoint(&state);
+	return state.lSizes[_NORMAL_BLOCK];
+#else
+	return 0;
+#endif
+}
+
+// Returns nanoseconds per operation
+double PerOp(double dElapsed, double dOps)
+{
+	return (dOps > 0) ? dElapsed * 1000000.0 / dOps : 0;
+}
+}// namespace
+
+int main(int argc, char* argv[])
+{
+	int nElements = (argc > 1) ? atoi(argv[1]) : 100000;
+	if (nElements <= 0)
+	{
+		std::cout << "Usage: XmlAttributeBench [elements]" << std::endl;
+		return 1;
+	}
+
+	std::cout << nElements << " elements per document; times are ns per attribute" << std::endl;
+	std::cout << "attrs  parse ms  bytes/elem    lookup   missing   iterate       add" << std::endl;
+	const int arrCounts[] = { 2, 4, 6, 8 };
+	for (size_t i = 0; i < sizeofarray(arrCounts); ++i)
+	{
+		int nAttributes = arrCounts[i];
+		double dAttributes = static_cast<double>(nElements) * nAttributes;
+		std::string strXml = BuildDocument(nElements, nAttributes);
+
+		XmlDocument doc;
+		StatTimer timer(true);
+		doc.parse(strXml);
+		double dParse = timer.ElapsedTime();
+
+		// The first access to the attributes of an element expands them.
+		// Expanding the last element frees the node store, so the heap is
+		// measured over the others.
+		XmlNodeArrayIterator elements = doc.RootNode.Children.Iterator;
+		std::vector<XmlAttributeMap> arrMaps;
+		arrMaps.reserve(elements.size());
+		size_t nBefore = HeapInUse();
+		for (int nElement = 0; nElement < nElements - 1; ++nElement)
+			arrMaps.push_back(elements[nElement].Attributes);
+		size_t nAfter = HeapInUse();
+		arrMaps.push_back(elements[nElements - 1].Attributes);
+
+		size_t nChars = 0;
+		timer.Start();
+		for (size_t nElement = 0; nElement < arrMaps.size(); ++nElement)
+		{
+			for (int nAttr = 0; nAttr < nAttributes; ++nAttr)
+				nChars += arrMaps[nElement].find(arrNames[nAttr]).length();
+		}
+		double dLookup = timer.ElapsedTime();
+		if (nChars < dAttributes * 4)
+		{
+			std::cout << "Lookups did not find every attribute." << std::endl;
+			return 1;
+		}
+
+		size_t nMissing = 0;
+		timer.Start();
+		for (size_t nElement = 0; nElement < arrMaps.size(); ++nElement)
+		{
+			for (int nAttr = 0; nAttr < nAttributes; ++nAttr)
+				nMissing += arrMaps[nElement].find("missing").empty() ? 1 : 0;
+		}
+		double dMissing = timer.ElapsedTime();
+
+		size_t nIterated = 0;
+		timer.Start();
+		for (size_t nElement = 0; nElement < arrMaps.size(); ++nElement)
+		{
+			XmlAttributeMapIterator attrs = arrMaps[nElement].Iterator;
+			for (XmlAttributeMapIterator::const_iterator it = attrs.begin(); it != attrs.end(); ++it)
+				nIterated += it->second.length();
+		}
+		double dIterate = timer.ElapsedTime();
+		if (nIterated != nChars || nMissing != dAttributes)
+		{
+			std::cout << "Iteration did not match the lookups." << std::endl;
+			return 1;
+		}
+		arrMaps.clear();
+
+		std::vector<XmlNode> arrNodes;
+		arrNodes.reserve(nElements);
+		timer.Start();
+		for (int nElement = 0; nElement < nElements; ++nElement)
+		{
+			arrNodes.push_back(XmlNode("e"));
+			XmlAttributeMap attrs = arrNodes.back().Attributes;
+			for (int nAttr = 0; nAttr < nAttributes; ++nAttr)
+				attrs.add(arrNames[nAttr], nElement);
+		}
+		double dAdd = timer.ElapsedTime();
+
+		std::cout << std::setw(5) << nAttributes << std::fixed << std::setprecision(1) << std::setw(10) << dParse;
+		if (nAfter > nBefore && nElements > 1)
+			std::cout << std::setw(12) << static_cast<double>(nAfter - nBefore) / (nElements - 1);
+		else
+			std::cout << std::setw(12) << "n/a";
+		std::cout << std::setw(10) << PerOp(dLookup, dAttributes) << std::setw(10) << PerOp(dMissing, dAttributes)
+				  << std::setw(10) << PerOp(dIterate, dAttributes) << std::setw(10) << PerOp(dAdd, dAttributes) << std::endl;
+	}
+	return 0;
+}
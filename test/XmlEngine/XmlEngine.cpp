@@ -0,0 +1,481 @@
+/****************************************************************************/
+//
+// XmlEngine.cpp
+//
+// Checks the XML parser engine: documents parsed and rendered again keep
+// their names, values, attributes and comments, the node store reads the
+// same tree the document does, files load in each encoding, paths a
+// document remembers are found again after the tree changes, large
+// documents parse the same on several threads as on one, and snapshots
+// load as the parse they were made from and are refused when damaged.
+//
+/****************************************************************************/
+
+#include <JTIUtils.h>
+#include <XmlParser.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+
+using namespace JTI_Util;
+
+namespace {
+int g_nFailures = 0;
+
+void Check(bool fTest, const char* pszTest)
+{
+	if (!fTest) {
+		std::cout << "FAILED: " << pszTest << std::endl;
+		++g_nFailures;
+	}
+}
+
+// Returns true if the text does not parse
+bool Refused(const char* pszXml)
+{
+	try {
+		XmlDocument doc;
+		doc.parse(pszXml);
+	}
+	catch (const std::runtime_error&) {
+		return true;
+	}
+	return false;
+}
+
+// Parses a document, renders it and parses the rendered text again
+void CheckRoundTrips()
+{
+	const char* pszXml =
+		"<?xml version=\"1.0\"?>\r\n"
+		"<!DOCTYPE cfg>\r\n"
+		"<!--before-->\r\n"
+		"<cfg version=\"2\" quote='say \"hi\"' apos=\"it&apos;s\">\r\n"
+		"\t<item key=\"a&amp;b\">one &lt; two &amp;&amp; three &gt; two</item>\r\n"
+		"\t<!--inside-->\r\n"
+		"\t<refs>&#65;&#x42;&#x20AC; &unknown; &</refs>\r\n"
+		"\t<code><![CDATA[if (a < b && c > d) { <tag/> }]]></code>\r\n"
+		"\t<empty/>\r\n"
+		"\t<nested><inner level=\"2\"><leaf>deep</leaf></inner></nested>\r\n"
+		"</cfg>\r\n";
+
+	XmlDocument doc;
+	doc.parse(pszXml);
+	XmlNode root = doc.RootNode;
+	Check(root.Name == "cfg", "root is named");
+	Check(root.Attributes.Count == 3, "root has three attributes");
+	Check(root.Attributes.find("version") == "2", "attribute in double quotes");
+	Check(root.Attributes.find("quote") == "say \"hi\"", "attribute in single quotes");
+	Check(root.Attributes.find("apos") == "it's", "entity in an attribute");
+	Check(root.Comments.Count == 2, "comments before and inside the root");
+	Check(root.Comments[0] == "before" && root.Comments[1] == "inside", "comment text");
+	Check(root.Children.Count == 5, "root has five children");
+
+	XmlNode item = doc.find("cfg/item");
+	Check(item.Value == "one < two && three > two", "entities in text");
+	Check(item.Attributes.find("key") == "a&b", "entity in an attribute value");
+	Check(doc.find("cfg/refs").Value == "AB\xe2\x82\xac &unknown; &", "character references and unknown entities");
+	Check(doc.find("cfg/code").Value == "if (a < b && c > d) { <tag/> }", "CDATA is kept as text");
+	Check(doc.find("cfg/empty").IsValid && !doc.find("cfg/empty").HasValue, "empty element");
+	Check(doc.find("cfg/nested/inner/leaf").Value == "deep", "nested element");
+	Check(doc.find("cfg/nested/inner").Attributes.find("level") == "2", "nested attribute");
+	Check(!doc.find("cfg/missing").IsValid, "missing element");
+
+	// The rendered text parses back to the same tree and renders the same.
+	std::string strXml = doc.XmlText;
+	XmlDocument again;
+	again.parse(strXml);
+	Check(again.XmlText == strXml, "rendered text renders the same");
+	Check(again.find("cfg/item").Value == item.Value, "text survives a round trip");
+	Check(again.find("cfg/item").Attributes.find("key") == "a&b", "attribute survives a round trip");
+	Check(again.RootNode.Attributes.find("quote") == "say \"hi\"", "quotes survive a round trip");
+	Check(again.find("cfg/code").Value == "if (a < b && c > d) { <tag/> }", "CDATA text survives a round trip");
+	Check(again.find("cfg/refs").Value == "AB\xe2\x82\xac &unknown; &", "references survive a round trip");
+	Check(again.RootNode.Comments.Count == 2, "comments survive a round trip");
+
+	// Nodes changed after the parse are rendered with their changes.
+	XmlNode added("added", "x < y");
+	added.Attributes.add("name", "\"q\" & 'a'");
+	doc.RootNode.Children.add(added);
+	doc.find("cfg/item").Value = "changed";
+	XmlDocument changed;
+	changed.parse(doc.XmlText);
+	Check(changed.find("cfg/item").Value == "changed", "changed value is rendered");
+	Check(changed.find("cfg/added").Value == "x < y", "added node is rendered");
+	Check(changed.find("cfg/added").Attributes.find("name") == "\"q\" & 'a'", "added attribute is rendered");
+
+	// Badly formed documents are refused.
+	Check(Refused("<a><b></a>"), "mismatched end tag");
+	Check(Refused("<a><!-- open"), "comment never closed");
+	Check(Refused("<a><![CDATA[ open"), "CDATA never closed");
+	Check(Refused("<a b=\"1></a>"), "attribute never closed");
+	Check(Refused("<>"), "element without a name");
+}
+
+// Reads a parsed document through the node store and through XmlDocument
+void CheckStore()
+{
+	const char* pszXml =
+		"<!--top--><cfg v=\"1\"><a k=\"x\" k2=\"y&amp;z\">hello</a><!--c1-->"
+		"<b><c>deep &amp; more</c><c>two</c></b><a>second</a></cfg>";
+
+	XmlNodeStore* pStore = XmlNodeStore::Create(pszXml, strlen(pszXml));
+	Check(pStore->Count == 6, "store holds every element");
+
+	XmlNodeStore::Index root = pStore->Root();
+	Check(strcmp(pStore->GetName(root), "cfg") == 0, "store root name");
+	Check(pStore->AttributeCount(root) == 1, "store root attributes");
+
+	XmlNodeStore::Index a = pStore->FindChild(root, "a");
+	size_t nLength = 0;
+	const char* pValue = pStore->GetValue(a, nLength);
+	Check(a != XmlNodeStore::NIL && std::string(pValue, nLength) == "hello", "value kept in the source");
+	pValue = pStore->FindAttribute(a, "k2", nLength);
+	Check(pValue != NULL && std::string(pValue, nLength) == "y&z", "attribute with an entity");
+	Check(pStore->FindAttribute(a, "zz", nLength) == NULL, "missing attribute");
+	Check(strcmp(pStore->GetName(pStore->NextSibling(pStore->NextSibling(a))), "a") == 0, "siblings in document order");
+
+	XmlNodeStore::Index c = pStore->FindPath(XmlPath("cfg/b/c"));
+	pValue = pStore->GetValue(c, nLength);
+	Check(c != XmlNodeStore::NIL && std::string(pValue, nLength) == "deep & more", "path into the store");
+	Check(pStore->FindPath(XmlPath("cfg/b/zz")) == XmlNodeStore::NIL, "missing path in the store");
+	Check(pStore->FindChild(root, "zz") == XmlNodeStore::NIL, "missing child in the store");
+	Check(pStore->NameId(a) == pStore->NameId(pStore->NextSibling(pStore->NextSibling(a))), "names are interned");
+
+	size_t nComments = 0;
+	for (XmlNodeStore::Index comment = pStore->FirstComment(root); comment != XmlNodeStore::NIL; 
+		 comment = pStore->NextComment(comment))
+		++nComments;
+	Check(nComments == 2, "store comments");
+
+	// A document over the store takes a reference and expands nodes as
+	// they are reached.
+	pStore->AddRef();
+	XmlDocument doc(pStore);
+	XmlDocument parsed;
+	parsed.parse(pszXml);
+	Check(doc.XmlText == parsed.XmlText, "store document renders as a parse");
+	Check(doc.find("cfg/b").Children.Count == 2, "store children");
+	Check(doc.find("cfg/b").Children[1].Value == "two", "store child value");
+	Check(doc.find("cfg/a").Attributes.find("k2") == "y&z", "store attribute");
+
+	// Nodes handed out stay usable after their document is gone.
+	XmlNode keep;
+	{
+		pStore->AddRef();
+		XmlDocument gone(pStore);
+		keep = gone.find("cfg/b");
+	}
+	pStore->Release();
+	Check(keep.Children.Count == 2 && keep.Children[0].Value == "deep & more", "node outlives its document");
+}
+
+// Writes the bytes of a file
+void WriteFile(const char* pszFile, const std::string& strData)
+{
+	std::ofstream stm(pszFile, std::ios::out | std::ios::binary | std::ios::trunc);
+	stm.write(strData.data(), static_cast<std::streamsize>(strData.length()));
+}
+
+// Reads the bytes of a file
+std::string ReadFile(const char* pszFile)
+{
+	std::ifstream stm(pszFile, std::ios::in | std::ios::binary);
+	std::ostringstream stmData;
+	stmData << stm.rdbuf();
+	return stmData.str();
+}
+
+// Encodes UTF-16 code units with a byte order mark
+std::string Utf16(const wchar_t* pszText, bool fBigEndian)
+{
+	std::string strData(fBigEndian ? "\xfe\xff" : "\xff\xfe");
+	for (; *pszText != L'\0'; ++pszText) {
+		char chHigh = static_cast<char>((*pszText >> 8) & 0xff);
+		char chLow = static_cast<char>(*pszText & 0xff);
+		strData += fBigEndian ? chHigh : chLow;
+		strData += fBigEndian ? chLow : chHigh;
+	}
+	return strData;
+}
+
+// Loads a file written in each encoding the loader detects
+void CheckFileLoad()
+{
+	const char* pszFile = "XmlEngine.xml";
+	const char* pszUtf8 = "<cfg a=\"\xc3\xa9\"><v>\xe2\x82\xac \xf0\x9f\x98\x80</v><!--note--></cfg>";
+	const wchar_t* pszWide = L"<cfg a=\"\x00e9\"><v>\x20ac \xd83d\xde00</v><!--note--></cfg>";
+	struct { const char* pszName; std::string strData; } arrFiles[] = {
+		{ "plain", pszUtf8 },
+		{ "UTF-8 BOM", std::string("\xef\xbb\xbf") + pszUtf8 },
+		{ "UTF-16 little endian BOM", Utf16(pszWide, false) },
+		{ "UTF-16 big endian BOM", Utf16(pszWide, true) },
+	};
+
+	for (size_t i = 0; i < sizeofarray(arrFiles); ++i) {
+		std::string strTest = std::string(arrFiles[i].pszName) + " file";
+		WriteFile(pszFile, arrFiles[i].strData);
+		XmlDocument doc;
+		Check(doc.load(pszFile), (strTest + " loads").c_str());
+		Check(doc.RootNode.Attributes.find("a") == "\xc3\xa9", (strTest + " attribute is UTF-8").c_str());
+		Check(doc.find("cfg/v").Value == "\xe2\x82\xac \xf0\x9f\x98\x80", (strTest + " text is UTF-8").c_str());
+		Check(doc.RootNode.Comments.Count == 1 && doc.RootNode.Comments[0] == "note", (strTest + " comment").c_str());
+
+		// The file is not held open, so it can be replaced while the
+		// loaded document is still read.
+		WriteFile(pszFile, "<cfg><v>replaced</v></cfg>");
+		Check(doc.find("cfg/v").Value == "\xe2\x82\xac \xf0\x9f\x98\x80", (strTest + " is read after it is replaced").c_str());
+	}
+
+	// A saved document loads back the same.
+	WriteFile(pszFile, pszUtf8);
+	XmlDocument doc;
+	doc.load(pszFile);
+	doc.find("cfg/v").Value = "saved & loaded";
+	Check(doc.save(pszFile), "document saves");
+	XmlDocument saved;
+	Check(saved.load(pszFile) && saved.XmlText == doc.XmlText, "saved document loads the same");
+	Check(saved.find("cfg/v").Value == "saved & loaded", "saved change loads back");
+
+	WriteFile(pszFile, "");
+	XmlDocument empty;
+	Check(empty.load(pszFile) && !empty.RootNode.IsValid, "empty file loads with no root");
+	remove(pszFile);
+	Check(!empty.load(pszFile), "missing file does not load");
+}
+
+// Changes a document between lookups of the paths it remembers
+void CheckPathCache()
+{
+	XmlDocument doc;
+	doc.parse("<cfg><a><b>1</b></a><c>2</c></cfg>");
+	XmlPath pathNew("cfg/a/new");
+	XmlPath pathC("cfg/c");
+
+	// A path which was not found is found once its node is added, even
+	// through a node handed out before the lookup.
+	XmlNode a = doc.find("cfg/a");
+	Check(!doc.find(pathNew).IsValid && !doc.find("cfg/a/new").IsValid, "path missing before add");
+	a.Children.add(XmlNode("new", "added"));
+	Check(doc.find(pathNew).Value == "added", "compiled path found after add");
+	Check(doc.find("cfg/a/new").Value == "added", "path found after add");
+
+	// A node added with its own children is found below its new parent.
+	XmlNode sub("sub");
+	sub.Children.add(XmlNode("leaf", "x"));
+	Check(!doc.find("cfg/sub/leaf").IsValid, "subtree path missing before add");
+	doc.RootNode.Children.add(sub);
+	Check(doc.find("cfg/sub/leaf").Value == "x", "subtree path found after add");
+	sub.Children.add(XmlNode("later", "y"));
+	Check(doc.find("cfg/sub/later").Value == "y", "path found after add to an added node");
+
+	// A path which was found is not found once its node is removed.
+	XmlNode c = doc.find(pathC);
+	Check(c.Value == "2", "path found before remove");
+	Check(doc.RootNode.Children.remove(c), "node removed");
+	Check(!doc.find(pathC).IsValid && !doc.find("cfg/c").IsValid, "path missing after remove");
+	Check(doc.find("cfg/a/b").Value == "1", "other path found after remove");
+
+	// A renamed node is found by its new name only.
+	XmlNode b = doc.find("cfg/a/b");
+	Check(!doc.find("cfg/a/renamed").IsValid, "new name missing before rename");
+	b.Name = "renamed";
+	Check(!doc.find("cfg/a/b").IsValid, "old name missing after rename");
+	Check(doc.find("cfg/a/renamed").Value == "1", "new name found after rename");
+
+	// Nodes made by create are found afterwards.
+	bool fCreated = false;
+	XmlNode made = doc.create("cfg/made/deeper", &fCreated);
+	Check(fCreated && made.IsValid, "path created");
+	Check(doc.find("cfg/made/deeper") == made, "created path found");
+	fCreated = true;
+	Check(doc.create("cfg/made/deeper", &fCreated) == made && !fCreated, "existing path not created again");
+
+	// A change to another document does not affect this one's paths.
+	XmlDocument other;
+	other.parse("<cfg><a/></cfg>");
+	Check(other.find("cfg/a").IsValid, "other document path found");
+	other.find("cfg").Children.remove(other.find("cfg/a"));
+	Check(!other.find("cfg/a").IsValid, "other document path missing after remove");
+	Check(doc.find("cfg/a/new").Value == "added", "first document path still found");
+
+	// A document parsed again forgets the paths of its old tree.
+	doc.parse("<cfg><c>3</c></cfg>");
+	Check(doc.find(pathC).Value == "3" && !doc.find(pathNew).IsValid, "paths follow a new parse");
+}
+
+// Builds a document large enough to be split between threads, with
+// markup in comments and CDATA that looks like element boundaries
+std::string BuildLargeDocument(int nItems)
+{
+	std::ostringstream stm;
+	stm << "<?xml version=\"1.0\"?>\r\n<!--head <export>-->\r\n<export count=\"" << nItems << "\">\r\n";
+	for (int i = 0; i < nItems; ++i)
+	{
+		stm << "\t<item id=\"" << i << "\" name='n&amp;" << i << "'>";
+		switch (i % 4)
+		{
+			case 0: stm << "<value>" << i * 3 << "</value><flag/>"; break;
+			case 1: stm << "<!-- </item><item> --><value>a &lt; b</value>"; break;
+			case 2: stm << "<code><![CDATA[</item>\r\n<item id=\"x\">]]></code>"; break;
+			default: stm << "<deep><deeper><deepest level=\"3\">" << i << "</deepest></deeper></deep>"; break;
+		}
+		stm << "</item>\r\n";
+		if (i % 1000 == 0)
+			stm << "\t<!-- block " << i << " -->\r\n";
+	}
+	stm << "</export>\r\n";
+	return stm.str();
+}
+
+// Parses a large document on one thread and on several
+void CheckThreadedParse()
+{
+	const int nItems = 60000;
+	std::string strXml = BuildLargeDocument(nItems);
+
+	XmlDocument serial;
+	serial.parse(strXml, 1);
+	std::string strSerial = serial.XmlText;
+	Check(serial.RootNode.Children.Count == nItems, "serial parse reads every item");
+	Check(serial.RootNode.Comments.Count == nItems / 1000 + 1, "serial parse reads every comment");
+
+	const int arrThreads[] = { 2, 3, 4, 8 };
+	for (size_t i = 0; i < sizeofarray(arrThreads); ++i)
+	{
+		std::ostringstream stmTest;
+		stmTest << arrThreads[i] << " thread parse";
+		std::string strTest = stmTest.str();
+
+		XmlDocument threaded;
+		threaded.parse(strXml, arrThreads[i]);
+		Check(threaded.RootNode.Children.Count == nItems, (strTest + " reads every item").c_str());
+		Check(threaded.XmlText == strSerial, (strTest + " renders as the serial parse").c_str());
+
+		XmlNodeStore* pSerial = XmlNodeStore::Create(strXml.data(), strXml.length(), 1);
+		XmlNodeStore* pThreaded = XmlNodeStore::Create(strXml.data(), strXml.length(), arrThreads[i]);
+		Check(pSerial->Count == pThreaded->Count, (strTest + " stores every element").c_str());
+		XmlNodeStore::Index last = pThreaded->FindPath(XmlPath("export/item"));
+		for (int nItem = 1; nItem < nItems && last != XmlNodeStore::NIL; ++nItem)
+			last = pThreaded->NextSibling(last);
+		size_t nLength = 0;
+		const char* pszId = (last != XmlNodeStore::NIL) ? pThreaded->FindAttribute(last, "id", nLength) : NULL;
+		std::ostringstream stmLast;
+		stmLast << nItems - 1;
+		Check(pszId != NULL && std::string(pszId, nLength) == stmLast.str(), (strTest + " links the parts in order").c_str());
+		pSerial->Release();
+		pThreaded->Release();
+	}
+
+	// An error in any part is reported however many threads are used.
+	std::string strBroken = strXml;
+	strBroken.replace(strBroken.find("<item id=\"45000\""), 5, "<itam");
+	for (int nThreads = 1; nThreads <= 4; ++nThreads)
+	{
+		bool fRefused = false;
+		try {
+			XmlDocument broken;
+			broken.parse(strBroken, nThreads);
+		}
+		catch (const std::runtime_error&) {
+			fRefused = true;
+		}
+		Check(fRefused, "mismatched element refused in any part");
+	}
+}
+
+// Returns true if the snapshot is usable for the source
+bool SnapshotLoads(const char* pszSnapshot, const char* pszSource)
+{
+	XmlNodeStore* pStore = XmlNodeStore::LoadSnapshot(pszSnapshot, pszSource);
+	if (pStore == NULL)
+		return false;
+	pStore->Release();
+	return true;
+}
+
+// Loads documents from snapshots and damages the snapshots
+void CheckSnapshots()
+{
+	const char* pszFile = "XmlEngine.xml";
+	const char* pszSnapshot = "XmlEngine.snap";
+	remove(pszSnapshot);
+	std::string strXml = BuildLargeDocument(200);
+	WriteFile(pszFile, strXml);
+
+	// The first load parses the file and writes the snapshot.
+	XmlDocument parsed;
+	parsed.parse(strXml);
+	XmlDocument first;
+	Check(first.load(pszFile, pszSnapshot), "file loads and writes its snapshot");
+	Check(first.XmlText == parsed.XmlText, "first load reads as a parse");
+	Check(SnapshotLoads(pszSnapshot, pszFile), "snapshot written");
+
+	// Later loads read the snapshot.
+	XmlNodeStore* pStore = XmlNodeStore::LoadSnapshot(pszSnapshot, pszFile);
+	Check(pStore != NULL, "snapshot loads");
+	if (pStore != NULL)
+	{
+		XmlNodeStore* pParsed = XmlNodeStore::Create(strXml.data(), strXml.length());
+		Check(pStore->Count == pParsed->Count, "snapshot stores every element");
+		XmlNodeStore::Index value = pStore->FindPath(XmlPath("export/item/value"));
+		size_t nLength = 0;
+		const char* pValue = (value != XmlNodeStore::NIL) ? pStore->GetValue(value, nLength) : NULL;
+		Check(pValue != NULL && std::string(pValue, nLength) == "0", "snapshot path and value");
+		Check(pStore->FindName("deepest", 7) != XmlNodeStore::NIL, "snapshot names are found");
+		Check(pStore->FindName("missing", 7) == XmlNodeStore::NIL, "snapshot missing name");
+		pParsed->Release();
+		XmlDocument snapped(pStore);
+		Check(snapped.XmlText == parsed.XmlText, "snapshot reads as a parse");
+		Check(snapped.RootNode.Children[2].find("code").Value == "</item>\r\n<item id=\"x\">", "snapshot CDATA text");
+	}
+
+	// The source written again with the same text keeps the snapshot; a
+	// change of the same size does not.
+	WriteFile(pszFile, strXml);
+	Check(SnapshotLoads(pszSnapshot, pszFile), "snapshot kept when the source text is unchanged");
+	std::string strChanged = strXml;
+	strChanged.replace(strChanged.find("a &lt; b"), 8, "c &lt; d");
+	WriteFile(pszFile, strChanged);
+	Check(!SnapshotLoads(pszSnapshot, pszFile), "snapshot refused when the source changes");
+	XmlDocument reloaded;
+	Check(reloaded.load(pszFile, pszSnapshot) && reloaded.find("export/item/value").Value == "0", "changed source loads");
+	Check(SnapshotLoads(pszSnapshot, pszFile), "snapshot written again for the changed source");
+
+	// Damaged snapshots are refused and the file is parsed instead.
+	std::string strSnapshot = ReadFile(pszSnapshot);
+	std::string strDamaged = strSnapshot;
+	strDamaged[0] = static_cast<char>(strDamaged[0] ^ 0xff);
+	WriteFile(pszSnapshot, strDamaged);
+	Check(!SnapshotLoads(pszSnapshot, pszFile), "snapshot with a bad header refused");
+
+	WriteFile(pszSnapshot, strSnapshot.substr(0, strSnapshot.length() / 2));
+	Check(!SnapshotLoads(pszSnapshot, pszFile), "truncated snapshot refused");
+
+	strDamaged = strSnapshot;
+	strDamaged.replace(128, 1024, 1024, '\xff');
+	WriteFile(pszSnapshot, strDamaged);
+	Check(!SnapshotLoads(pszSnapshot, pszFile), "snapshot with damaged records refused");
+	XmlDocument recovered;
+	Check(recovered.load(pszFile, pszSnapshot) && recovered.find("export/item/value").Value == "0", "damaged snapshot is parsed instead");
+	Check(SnapshotLoads(pszSnapshot, pszFile), "damaged snapshot written again");
+
+	remove(pszFile);
+	remove(pszSnapshot);
+}
+}// namespace
+
+int main()
+{
+	CheckRoundTrips();
+	CheckStore();
+	CheckFileLoad();
+	CheckPathCache();
+	CheckThreadedParse();
+	CheckSnapshots();
+
+	if (g_nFailures == 0)
+		std::cout << "XmlEngine passed" << std::endl;
+	return g_nFailures;
+}
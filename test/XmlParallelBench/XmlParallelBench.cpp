@@ -0,0 +1,142 @@
+/****************************************************************************/
+//
+// XmlParallelBench.cpp
+//
+// Measures how parsing a large generated document scales with the number
+// of threads, from one up to the number of processors, for both the node
+// store and a parse into a document.  Speedups are against one thread.
+//
+// Usage: XmlParallelBench [megabytes] [max threads]
+//
+/****************************************************************************/
+
+#include <JTIUtils.h>
+#include <XmlParser.h>
+#include <StatTimer.h>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+using namespace JTI_Util;
+
+namespace {
+const int nRuns = 3;
+
+// Builds a document of roughly nBytes holding a flat list of items under
+// the root, the shape of our exports
+std::string BuildDocument(size_t nBytes, int& nItems)
+{
+	std::ostringstream stm;
+	stm << "<?xml version=\"1.0\"?>\r\n<export>\r\n";
+	for (nItems = 0; static_cast<size_t>(stm.tellp()) < nBytes; ++nItems)
+	{
+		stm << "\t<item id=\"" << nItems << "\" name='n&amp;" << nItems << "' kind=\"k" << nItems % 7 << "\">";
+		switch (nItems % 4)
+		{
+			case 0: stm << "<value>" << nItems * 3 << "</value><flag/>"; break;
+			case 1: stm << "<!-- </item><item> --><value>a &lt; b</value>"; break;
+			case 2: stm << "<code><![CDATA[</item>\r\n<item id=\"x\">]]></code>"; break;
+			default: stm << "<deep><deeper><deepest level=\"3\">" << nItems << "</deepest></deeper></deep>"; break;
+		}
+		stm << "</item>\r\n";
+	}
+	stm << "</export>\r\n";
+	return stm.str();
+}
+
+// Returns the best time of nRuns node store builds in milliseconds, and
+// the number of elements stored
+double TimeStore(const std::string& strXml, int nThreads, size_t& nCount)
+{
+	double dBest = 0;
+	for (int nRun = 0; nRun < nRuns; ++nRun)
+	{
+		StatTimer timer(true);
+		XmlNodeStore* pStore = XmlNodeStore::Create(strXml.data(), strXml.length(), nThreads);
+		double dElapsed = timer.ElapsedTime();
+		nCount = pStore->Count;
+		pStore->Release();
+		dBest = (nRun == 0 || dElapsed < dBest) ? dElapsed : dBest;
+	}
+	return dBest;
+}
+
+// Returns the best time of nRuns document parses in milliseconds, and the
+// number of items under the root
+double TimeParse(const std::string& strXml, int nThreads, int& nItems)
+{
+	double dBest = 0;
+	for (int nRun = 0; nRun < nRuns; ++nRun)
+	{
+		XmlDocument doc;
+		StatTimer timer(true);
+		doc.parse(strXml, nThreads);
+		double dElapsed = timer.ElapsedTime();
+		nItems = doc.RootNode.Children.Count;
+		dBest = (nRun == 0 || dElapsed < dBest) ? dElapsed : dBest;
+	}
+	return dBest;
+}
+}// namespace
+
+int main(int argc, char* argv[])
+{
+	SYSTEM_INFO sysInfo;
+	GetSystemInfo(&sysInfo);
+	int nProcessors = static_cast<int>(sysInfo.dwNumberOfProcessors);
+
+	int nMegabytes = (argc > 1) ? atoi(argv[1]) : 128;
+	int nMaxThreads = (argc > 2) ? atoi(argv[2]) : nProcessors;
+	if (nMegabytes <= 0 || nMaxThreads <= 0)
+	{
+		std::cout << "Usage: XmlParallelBench [megabytes] [max threads]" << std::endl;
+		return 1;
+	}
+
+	// Powers of two up to the limit, and the limit itself.
+	std::vector<int> arrThreads;
+	for (int nThreads = 1; nThreads < nMaxThreads; nThreads *= 2)
+		arrThreads.push_back(nThreads);
+	arrThreads.push_back(nMaxThreads);
+
+	int nItems = 0;
+	std::string strXml = BuildDocument(static_cast<size_t>(nMegabytes) * 1024 * 1024, nItems);
+	double dMegabytes = strXml.length() / (1024.0 * 1024.0);
+	std::cout << "Document of " << strXml.length() << " bytes holding " << nItems << " items, "
+			  << nProcessors << " processors, best of " << nRuns << " runs" << std::endl;
+	std::cout << "threads  store ms    MB/s speedup  parse ms    MB/s speedup" << std::endl;
+
+	double dStoreOne = 0, dParseOne = 0;
+	size_t nCountOne = 0;
+	try {
+		for (size_t i = 0; i < arrThreads.size(); ++i)
+		{
+			size_t nCount = 0;
+			int nParsed = 0;
+			double dStore = TimeStore(strXml, arrThreads[i], nCount);
+			double dParse = TimeParse(strXml, arrThreads[i], nParsed);
+			if (i == 0)
+			{
+				dStoreOne = dStore;
+				dParseOne = dParse;
+				nCountOne = nCount;
+			}
+			if (nCount != nCountOne || nParsed != nItems)
+			{
+				std::cout << "The " << arrThreads[i] << " thread parse did not read every element." << std::endl;
+				return 1;
+			}
+			std::cout << std::setw(7) << arrThreads[i] << std::fixed
+					  << std::setprecision(1) << std::setw(10) << dStore << std::setw(8) << dMegabytes / (dStore / 1000.0)
+					  << std::setprecision(2) << std::setw(8) << dStoreOne / dStore
+					  << std::setprecision(1) << std::setw(10) << dParse << std::setw(8) << dMegabytes / (dParse / 1000.0)
+					  << std::setprecision(2) << std::setw(8) << dParseOne / dParse << std::endl;
+		}
+	}
+	catch (const std::exception& e) {
+		std::cout << "Parse failed: " << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,161 @@
+/****************************************************************************/
+//
+// XmlParseBench.cpp
+//
+// Measures XmlDocument parsing on a generated multi-megabyte document:
+// building the node store, parsing into a document, loading the document
+// from a file, visiting every element and its attributes the first time,
+// and rendering the document back to text.
+//
+// Usage: XmlParseBench [megabytes]
+//
+/****************************************************************************/
+
+#include <JTIUtils.h>
+#include <XmlParser.h>
+#include <StatTimer.h>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+
+using namespace JTI_Util;
+
+namespace {
+const int nRuns = 3;
+const char* const pszFile = "XmlParseBench.xml";
+
+// Builds a document of roughly nBytes with the mix of markup found in
+// our exports: attributes, entities, comments, CDATA and nesting
+std::string BuildDocument(size_t nBytes, int& nItems)
+{
+	std::ostringstream stm;
+	stm << "<?xml version=\"1.0\"?>\r\n<export>\r\n";
+	for (nItems = 0; static_cast<size_t>(stm.tellp()) < nBytes; ++nItems)
+	{
+		stm << "\t<item id=\"" << nItems << "\" name='n&amp;" << nItems << "' kind=\"k" << nItems % 7 << "\">";
+		switch (nItems % 4)
+		{
+			case 0: stm << "<value>" << nItems * 3 << "</value><flag/>"; break;
+			case 1: stm << "<!-- note " << nItems << " --><value>a &lt; b &#x41;</value>"; break;
+			case 2: stm << "<code><![CDATA[if (a < b && c > d) return;]]></code>"; break;
+			default: stm << "<deep><deeper><deepest level=\"3\">" << nItems << "</deepest></deeper></deep>"; break;
+		}
+		stm << "</item>\r\n";
+	}
+	stm << "</export>\r\n";
+	return stm.str();
+}
+
+// Returns MB/s for nBytes processed in dElapsed milliseconds
+double Rate(size_t nBytes, double dElapsed)
+{
+	return (dElapsed > 0) ? nBytes / (1024.0 * 1024.0) / (dElapsed / 1000.0) : 0;
+}
+
+// Prints one row of the results table
+void Report(const char* pszName, size_t nBytes, double dElapsed)
+{
+	std::cout << std::left << std::setw(16) << pszName << std::right << std::fixed << std::setprecision(1)
+			  << std::setw(10) << dElapsed << std::setw(10) << Rate(nBytes, dElapsed) << std::endl;
+}
+
+// Visits every item, reading its attributes and the text of its first
+// child, and returns the number of attribute characters read
+size_t VisitItems(XmlDocument& doc)
+{
+	size_t nChars = 0;
+	XmlNodeArrayIterator items = doc.RootNode.Children.Iterator;
+	for (XmlNodeArrayIterator::iterator it = items.begin(); it != items.end(); ++it)
+	{
+		XmlNode& item = *it;
+		nChars += item.Attributes.find("id").length();
+		nChars += item.Attributes.find("name").length();
+		if (item.HasChildren)
+			nChars += item.Children[0].Value.length();
+	}
+	return nChars;
+}
+}// namespace
+
+int main(int argc, char* argv[])
+{
+	int nMegabytes = (argc > 1) ? atoi(argv[1]) : 32;
+	if (nMegabytes <= 0)
+	{
+		std::cout << "Usage: XmlParseBench [megabytes]" << std::endl;
+		return 1;
+	}
+
+	int nItems = 0;
+	std::string strXml = BuildDocument(static_cast<size_t>(nMegabytes) * 1024 * 1024, nItems);
+	size_t nBytes = strXml.length();
+	std::cout << "Document of " << nBytes << " bytes holding " << nItems << " items, best of " << nRuns << " runs" << std::endl;
+	std::cout << "operation             ms      MB/s" << std::endl;
+
+	double dStore = 0, dParse = 0, dLoad = 0, dVisit = 0, dRender = 0;
+	size_t nRendered = 0;
+	{
+		std::ofstream stmFile(pszFile, std::ios::binary);
+		stmFile.write(strXml.data(), static_cast<std::streamsize>(nBytes));
+	}
+	try {
+		for (int nRun = 0; nRun < nRuns; ++nRun)
+		{
+			StatTimer timer(true);
+			XmlNodeStore* pStore = XmlNodeStore::Create(strXml.data(), nBytes);
+			double dElapsed = timer.ElapsedTime();
+			dStore = (nRun == 0 || dElapsed < dStore) ? dElapsed : dStore;
+			pStore->Release();
+
+			XmlDocument doc;
+			timer.Start();
+			doc.parse(strXml);
+			dElapsed = timer.ElapsedTime();
+			dParse = (nRun == 0 || dElapsed < dParse) ? dElapsed : dParse;
+			if (doc.RootNode.Children.Count != nItems)
+			{
+				std::cout << "The parse did not read every item." << std::endl;
+				return 1;
+			}
+
+			timer.Start();
+			size_t nChars = VisitItems(doc);
+			dElapsed = timer.ElapsedTime();
+			dVisit = (nRun == 0 || dElapsed < dVisit) ? dElapsed : dVisit;
+			if (nChars == 0)
+				return 1;
+
+			timer.Start();
+			std::string strRendered = doc.XmlText;
+			dElapsed = timer.ElapsedTime();
+			dRender = (nRun == 0 || dElapsed < dRender) ? dElapsed : dRender;
+			nRendered = strRendered.length();
+
+			XmlDocument loaded;
+			timer.Start();
+			bool fLoaded = loaded.load(pszFile);
+			dElapsed = timer.ElapsedTime();
+			dLoad = (nRun == 0 || dElapsed < dLoad) ? dElapsed : dLoad;
+			if (!fLoaded || loaded.XmlText != strRendered)
+			{
+				std::cout << "The file did not load as the parse." << std::endl;
+				return 1;
+			}
+		}
+	}
+	catch (const std::exception& e) {
+		std::cout << "Parse failed: " << e.what() << std::endl;
+		remove(pszFile);
+		return 1;
+	}
+	remove(pszFile);
+
+	Report("store create", nBytes, dStore);
+	Report("document parse", nBytes, dParse);
+	Report("file load", nBytes, dLoad);
+	Report("first visit", nBytes, dVisit);
+	Report("render", nRendered, dRender);
+	return 0;
+}